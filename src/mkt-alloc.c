@@ -0,0 +1,163 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-alloc.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-alloc"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "mkt-alloc.h"
+
+/**
+ * SECTION: mkt-alloc
+ * @title: mkt-alloc
+ * @short_description: Heap allocation accounting
+ * @include: "mkt-alloc.h"
+ *
+ * Built only with the alloc_accounting build option, this
+ * replaces malloc(), calloc() and realloc() of the process
+ * with ones that count each allocation before passing it to
+ * glibc.  Allocations are accounted to the scope the thread
+ * is in, set with MKT_ALLOC_SCOPE(), or to
+ * %MKT_ALLOC_SCOPE_NONE outside of any, so that tests can
+ * check that hot paths like the key path don't allocate.
+ * Aligned allocations are not counted.
+ */
+
+/* Exported by glibc, and safe to call from malloc() itself, unlike dlsym() */
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t n_members,
+                             size_t size);
+extern void *__libc_realloc (void  *ptr,
+                             size_t size);
+
+static MktAllocCounter alloc_counters[MKT_ALLOC_N_SCOPES];
+/* The default TLS model may allocate on first access from a shared library */
+static __thread MktAllocScope current_scope __attribute__ ((tls_model ("initial-exec")));
+/* Allocations of this thread outside of any scope */
+static __thread MktAllocCounter thread_counter __attribute__ ((tls_model ("initial-exec")));
+
+static inline void
+alloc_count (size_t size)
+{
+  MktAllocCounter *counter = &alloc_counters[current_scope];
+
+  __atomic_fetch_add (&counter->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&counter->bytes, size, __ATOMIC_RELAXED);
+
+  if (current_scope == MKT_ALLOC_SCOPE_NONE)
+    {
+      thread_counter.allocs++;
+      thread_counter.bytes += size;
+    }
+}
+
+void *
+malloc (size_t size)
+{
+  alloc_count (size);
+
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  alloc_count (n_members * size);
+
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  /* A realloc() to 0 is a free() */
+  if (size)
+    alloc_count (size);
+
+  return __libc_realloc (ptr, size);
+}
+
+/**
+ * mkt_alloc_push_scope:
+ * @scope: A #MktAllocScope
+ *
+ * Account the allocations of the calling thread to @scope,
+ * until mkt_alloc_pop_scope() is called with the returned
+ * scope.  Use MKT_ALLOC_SCOPE() instead, which does both.
+ *
+ * Returns: The scope the thread was in
+ */
+MktAllocScope
+mkt_alloc_push_scope (MktAllocScope scope)
+{
+  MktAllocScope old_scope = current_scope;
+
+  current_scope = scope;
+
+  return old_scope;
+}
+
+void
+mkt_alloc_pop_scope (MktAllocScope *old_scope)
+{
+  current_scope = *old_scope;
+}
+
+/**
+ * mkt_alloc_get_counters:
+ * @counters: (out caller-allocates): The counters of each scope
+ *
+ * Get the number of allocations and the bytes allocated in
+ * each scope from all threads, since the process started.
+ */
+void
+mkt_alloc_get_counters (MktAllocCounter counters[MKT_ALLOC_N_SCOPES])
+{
+  for (guint i = 0; i < MKT_ALLOC_N_SCOPES; i++)
+    {
+      counters[i].allocs = __atomic_load_n (&alloc_counters[i].allocs, __ATOMIC_RELAXED);
+      counters[i].bytes = __atomic_load_n (&alloc_counters[i].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * mkt_alloc_get_thread_counter:
+ * @counter: (out caller-allocates): The counter of the thread
+ *
+ * Get the number of allocations and the bytes allocated by
+ * the calling thread outside of any scope, since it started.
+ * Unlike %MKT_ALLOC_SCOPE_NONE of mkt_alloc_get_counters(),
+ * this excludes other threads.
+ */
+void
+mkt_alloc_get_thread_counter (MktAllocCounter *counter)
+{
+  *counter = thread_counter;
+}
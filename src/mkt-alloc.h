@@ -0,0 +1,61 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-alloc.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MKT_ALLOC_SCOPE_NONE,
+  MKT_ALLOC_SCOPE_CONTROLLER,
+  MKT_ALLOC_SCOPE_KEYBOARD,
+  MKT_ALLOC_SCOPE_TERMINAL,
+  MKT_ALLOC_N_SCOPES
+} MktAllocScope;
+
+typedef struct
+{
+  guint64 allocs;
+  guint64 bytes;
+} MktAllocCounter;
+
+#ifdef MKT_ENABLE_ALLOC_ACCOUNTING
+
+MktAllocScope mkt_alloc_push_scope   (MktAllocScope    scope);
+void          mkt_alloc_pop_scope    (MktAllocScope   *old_scope);
+void          mkt_alloc_get_counters (MktAllocCounter  counters[MKT_ALLOC_N_SCOPES]);
+void          mkt_alloc_get_thread_counter (MktAllocCounter *counter);
+
+/* Account the allocations of this thread to @scope till the end of the block */
+# define MKT_ALLOC_SCOPE(scope)                                          \
+  G_GNUC_UNUSED MktAllocScope mkt_alloc_old_scope_                      \
+    __attribute__ ((cleanup (mkt_alloc_pop_scope))) = mkt_alloc_push_scope (scope)
+#else
+# define MKT_ALLOC_SCOPE(scope) G_STMT_START { } G_STMT_END
+#endif
+
+G_END_DECLS
@@ -30,7 +30,17 @@
 #endif
 
 #include <glib/gi18n.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <unistd.h>
 
+#include "mkt-cgroup.h"
+#include "mkt-controller.h"
+#include "mkt-dbus-service.h"
+#include "mkt-keyboard.h"
+#include "mkt-metrics.h"
+#include "mkt-router.h"
+#include "mkt-terminal.h"
 #include "mkt-window.h"
 #include "mkt-application.h"
 #include "mkt-log.h"
@@ -40,13 +50,59 @@
  * @title: MktApplication
  * @short_description: Base Application class
  * @include: "mkt-application.h"
+ *
+ * The application owns the #MktController, which is shared
+ * by every window.  If "use-all-monitors" setting is set, a
+ * fullscreen window is kept on each monitor, and terminals
+ * are spread across them.  A keyboard stays on the window
+ * it's assigned to, unless the window is gone.
+ *
+ * Input devices are set up in the background while the
+ * window is built.  With --profile-startup, the time taken
+ * to reach each phase of startup is printed once the first
+ * frame is drawn and the devices are ready.
+ *
+ * With --headless, no window is created and GTK is not
+ * even initialized.  A #MktRouter sends the input of each
+ * keyboard to the target set in “headless-routes” instead.
  */
 
+typedef struct
+{
+  const char *phase;
+  gint64      time;
+} StartupMark;
+
+typedef struct
+{
+  GtkWidget  *window;
+  GdkMonitor *monitor;
+  /* The keyboards shown in the window */
+  GListStore *keyboards;
+} AppWindow;
+
 struct _MktApplication
 {
   AdwApplication  parent_instance;
 
   MktSettings    *settings;
+  MktController  *controller;
+  MktDbusService *dbus_service;
+  /* Set if the “metrics-file” setting is set */
+  MktMetrics     *metrics;
+  /* Socket of the input broker, if devices are owned by it */
+  char           *input_broker;
+
+  /* Array of AppWindow */
+  GPtrArray      *windows;
+  /* MktKeyboard to AppWindow map */
+  GHashTable     *keyboard_windows;
+
+  /* Array of StartupMark, set with --profile-startup */
+  GArray         *startup_marks;
+  gint64          start_time;
+  /* The first frame and the devices */
+  guint           startup_pending;
 };
 
 G_DEFINE_TYPE (MktApplication, mkt_application, ADW_TYPE_APPLICATION)
@@ -67,6 +123,23 @@ static GOptionEntry cmd_options[] = {
     "version", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
     N_("Show release version"), NULL
   },
+  {
+    "async-log", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+    N_("Write logs from a background thread, dropping them if the output is slow"), NULL
+  },
+  {
+    "input-broker", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, NULL,
+    N_("Get input from multi-keyterm-input-broker listening on SOCKET, instead of opening devices"),
+    "SOCKET"
+  },
+  {
+    "headless", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+    N_("Route keyboards to the TTYs or sockets set in settings, without any window"), NULL
+  },
+  {
+    "profile-startup", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+    N_("Print the time taken by each phase of startup"), NULL
+  },
   { NULL }
 };
 
@@ -81,6 +154,170 @@ cmd_verbose_cb (const char  *option_name,
   return TRUE;
 }
 
+static void application_export_dbus (MktApplication *self);
+
+static void
+application_mark_startup (MktApplication *self,
+                          const char     *phase)
+{
+  StartupMark mark;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  if (!self->startup_marks)
+    return;
+
+  mark.phase = phase;
+  mark.time = g_get_monotonic_time ();
+  g_array_append_val (self->startup_marks, mark);
+}
+
+static void
+application_startup_done (MktApplication *self,
+                          const char     *phase)
+{
+  gint64 last_time;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  if (!self->startup_marks || !self->startup_pending)
+    return;
+
+  application_mark_startup (self, phase);
+
+  if (--self->startup_pending)
+    return;
+
+  g_printerr ("Startup profile (ms since start, and since the previous phase):\n");
+  last_time = self->start_time;
+
+  for (guint i = 0; i < self->startup_marks->len; i++)
+    {
+      StartupMark *mark = &g_array_index (self->startup_marks, StartupMark, i);
+
+      g_printerr ("  %-12s %9.2f %9.2f\n", mark->phase,
+                  (mark->time - self->start_time) / 1000.0,
+                  (mark->time - last_time) / 1000.0);
+      last_time = mark->time;
+    }
+
+  g_clear_pointer (&self->startup_marks, g_array_unref);
+}
+
+static void
+application_devices_ready_cb (MktApplication *self)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+
+  if (mkt_controller_get_ready (self->controller))
+    application_startup_done (self, "devices");
+}
+
+static void
+application_first_frame_cb (MktApplication *self,
+                            GdkFrameClock  *frame_clock)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+
+  g_signal_handlers_disconnect_by_func (frame_clock, application_first_frame_cb, self);
+  application_startup_done (self, "first-frame");
+}
+
+static MktController *
+application_create_controller (MktApplication *self)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (MKT_IS_SETTINGS (self->settings));
+
+  if (self->input_broker)
+    return mkt_controller_new_for_broker (self->settings, self->input_broker);
+
+  return mkt_controller_new (self->settings);
+}
+
+static void
+application_start_metrics (MktApplication *self)
+{
+  g_autofree char *path = NULL;
+
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (MKT_IS_CONTROLLER (self->controller));
+
+  path = mkt_settings_get_metrics_file (self->settings);
+
+  if (path)
+    self->metrics = mkt_metrics_new (self->controller, path,
+                                     mkt_settings_get_metrics_interval (self->settings));
+}
+
+static gboolean
+application_quit_headless_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+application_headless_failed_cb (GMainLoop     *main_loop,
+                                GParamSpec    *pspec,
+                                MktController *controller)
+{
+  /* Seats are set up in a thread, so errors may arrive late */
+  if (!mkt_controller_get_error (controller))
+    return;
+
+  g_printerr ("%s\n", mkt_controller_get_error (controller));
+  g_main_loop_quit (main_loop);
+}
+
+static int
+application_run_headless (MktApplication *self)
+{
+  g_autoptr(MktRouter) router = NULL;
+  g_autoptr(GMainLoop) main_loop = NULL;
+  guint sigint_id, sigterm_id;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  g_info ("%s %s, git version: %s, running headless", PACKAGE_NAME,
+          PACKAGE_VERSION, PACKAGE_VCS_VERSION);
+
+  self->settings = mkt_settings_new ();
+
+  /* Before any shell is spawned, as the application may move to a child cgroup */
+  if (mkt_settings_get_isolate_terminals (self->settings))
+    mkt_cgroup_protect_self (mkt_cgroup_get_default (),
+                             mkt_settings_get_ui_cpu_weight (self->settings));
+
+  self->controller = application_create_controller (self);
+  application_start_metrics (self);
+
+  if (mkt_controller_get_error (self->controller))
+    {
+      g_printerr ("%s\n", mkt_controller_get_error (self->controller));
+      return 1;
+    }
+
+  router = mkt_router_new (self->controller, self->settings);
+  application_export_dbus (self);
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect_swapped (self->controller, "notify::failed",
+                            G_CALLBACK (application_headless_failed_cb), main_loop);
+  sigint_id = g_unix_signal_add (SIGINT, application_quit_headless_cb, main_loop);
+  sigterm_id = g_unix_signal_add (SIGTERM, application_quit_headless_cb, main_loop);
+  g_main_loop_run (main_loop);
+
+  g_clear_handle_id (&sigint_id, g_source_remove);
+  g_clear_handle_id (&sigterm_id, g_source_remove);
+  g_signal_handlers_disconnect_by_data (self->controller, main_loop);
+  g_clear_pointer (&self->metrics, mkt_metrics_free);
+  g_clear_object (&self->dbus_service);
+
+  return mkt_controller_get_error (self->controller) ? 1 : 0;
+}
+
 static int
 mkt_application_handle_local_options (GApplication *application,
                                       GVariantDict *options)
@@ -91,9 +328,364 @@ mkt_application_handle_local_options (GApplication *application,
       return 0;
     }
 
+  if (g_variant_dict_contains (options, "async-log"))
+    mkt_log_enable_async ();
+
+  if (g_variant_dict_contains (options, "profile-startup"))
+    {
+      MktApplication *self = MKT_APPLICATION (application);
+
+      self->startup_marks = g_array_new (FALSE, FALSE, sizeof (StartupMark));
+      self->startup_pending = 2;
+      application_mark_startup (self, "options");
+    }
+
+  g_variant_dict_lookup (options, "input-broker", "^ay",
+                         &MKT_APPLICATION (application)->input_broker);
+
+  if (g_variant_dict_contains (options, "headless"))
+    return application_run_headless (MKT_APPLICATION (application));
+
   return -1;
 }
 
+static void
+app_window_free (gpointer data)
+{
+  AppWindow *app_window = data;
+
+  g_clear_object (&app_window->keyboards);
+  g_clear_object (&app_window->monitor);
+  g_free (app_window);
+}
+
+static AppWindow *
+application_find_window (MktApplication *self,
+                         GdkMonitor     *monitor)
+{
+  for (guint i = 0; i < self->windows->len; i++)
+    {
+      AppWindow *app_window = self->windows->pdata[i];
+
+      if (app_window->monitor == monitor)
+        return app_window;
+    }
+
+  return NULL;
+}
+
+/* @terminal, if set, is the terminal of @keyboard from a window that was removed */
+static void
+application_assign_keyboard (MktApplication *self,
+                             MktKeyboard    *keyboard,
+                             GtkWidget      *terminal)
+{
+  AppWindow *target = NULL;
+  guint min_items = G_MAXUINT;
+
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+  g_assert (!terminal || MKT_IS_TERMINAL (terminal));
+
+  if (g_hash_table_contains (self->keyboard_windows, keyboard))
+    return;
+
+  /* Assign to the window with the least number of terminals */
+  for (guint i = 0; i < self->windows->len; i++)
+    {
+      AppWindow *app_window = self->windows->pdata[i];
+      guint n_items;
+
+      n_items = g_list_model_get_n_items (G_LIST_MODEL (app_window->keyboards));
+
+      if (n_items < min_items)
+        {
+          min_items = n_items;
+          target = app_window;
+        }
+    }
+
+  if (!target)
+    return;
+
+  if (terminal)
+    mkt_window_reuse_terminal (MKT_WINDOW (target->window), terminal);
+
+  g_hash_table_insert (self->keyboard_windows, g_object_ref (keyboard), target);
+  g_list_store_append (target->keyboards, keyboard);
+}
+
+/* Assign the keyboards without a window, reusing their terminal from @terminals */
+static void
+application_assign_keyboards (MktApplication *self,
+                              GHashTable     *terminals)
+{
+  GListModel *keyboard_list;
+  guint n_items;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
+  n_items = g_list_model_get_n_items (keyboard_list);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+      application_assign_keyboard (self, keyboard,
+                                   g_hash_table_lookup (terminals, keyboard));
+    }
+}
+
+static void
+application_keyboards_changed_cb (MktApplication *self,
+                                  guint           position,
+                                  guint           removed,
+                                  guint           added,
+                                  GListModel     *keyboard_list)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (G_IS_LIST_MODEL (keyboard_list));
+
+  if (removed)
+    {
+      GHashTableIter iter;
+      MktKeyboard *keyboard;
+      AppWindow *app_window;
+
+      g_hash_table_iter_init (&iter, self->keyboard_windows);
+
+      while (g_hash_table_iter_next (&iter, (gpointer *)&keyboard, (gpointer *)&app_window))
+        {
+          guint index;
+
+          if (g_list_store_find (G_LIST_STORE (keyboard_list), keyboard, NULL))
+            continue;
+
+          if (g_list_store_find (app_window->keyboards, keyboard, &index))
+            g_list_store_remove (app_window->keyboards, index);
+
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  for (guint i = position; i < position + added; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+      application_assign_keyboard (self, keyboard, NULL);
+    }
+}
+
+static void
+application_add_window (MktApplication *self,
+                        GdkMonitor     *monitor)
+{
+  AppWindow *app_window;
+
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (!monitor || GDK_IS_MONITOR (monitor));
+
+  app_window = g_new0 (AppWindow, 1);
+  g_set_object (&app_window->monitor, monitor);
+  app_window->keyboards = g_list_store_new (MKT_TYPE_KEYBOARD);
+  app_window->window = mkt_window_new (GTK_APPLICATION (self), self->settings,
+                                       self->controller,
+                                       G_LIST_MODEL (app_window->keyboards));
+  g_ptr_array_add (self->windows, app_window);
+
+  if (monitor)
+    gtk_window_fullscreen_on_monitor (GTK_WINDOW (app_window->window), monitor);
+  else
+    gtk_window_maximize (GTK_WINDOW (app_window->window));
+
+  gtk_window_present (GTK_WINDOW (app_window->window));
+}
+
+/*
+ * Remove @app_window without destroying it.  The terminals
+ * shown in it are added to @terminals, keyed by keyboard,
+ * so that they can be moved to the remaining windows.
+ */
+static void
+application_remove_window (MktApplication *self,
+                           AppWindow      *app_window,
+                           GHashTable     *terminals)
+{
+  GListModel *keyboards;
+  GHashTableIter iter;
+  gpointer value;
+  guint n_items;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  keyboards = G_LIST_MODEL (app_window->keyboards);
+  n_items = g_list_model_get_n_items (keyboards);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+      GtkWidget *terminal;
+
+      keyboard = g_list_model_get_item (keyboards, i);
+      terminal = mkt_window_get_terminal (MKT_WINDOW (app_window->window), keyboard);
+
+      if (terminal)
+        g_hash_table_insert (terminals, g_object_ref (keyboard), g_object_ref (terminal));
+    }
+
+  /* This unparents the terminals, @terminals keeps them alive */
+  g_list_store_remove_all (app_window->keyboards);
+
+  g_hash_table_iter_init (&iter, self->keyboard_windows);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    if (value == app_window)
+      g_hash_table_iter_remove (&iter);
+
+  MKT_DEBUG_MSG ("Removing window %p", app_window->window);
+  g_ptr_array_remove (self->windows, app_window);
+}
+
+static void
+application_update_windows (MktApplication *self)
+{
+  g_autoptr(GHashTable) terminals = NULL;
+  g_autoptr(GPtrArray) monitors = NULL;
+  GdkDisplay *display;
+  guint n_items;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  display = gdk_display_get_default ();
+  monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  terminals = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                     g_object_unref, g_object_unref);
+
+  if (display && mkt_settings_get_use_all_monitors (self->settings))
+    {
+      GListModel *monitor_list;
+
+      monitor_list = gdk_display_get_monitors (display);
+      n_items = g_list_model_get_n_items (monitor_list);
+
+      for (guint i = 0; i < n_items; i++)
+        g_ptr_array_add (monitors, g_list_model_get_item (monitor_list, i));
+    }
+
+  /* Without monitors, a single maximized window is used */
+  if (monitors->len == 0)
+    g_ptr_array_add (monitors, NULL);
+
+  /* Add the new windows first, so that there is always one to move terminals to */
+  for (guint i = 0; i < monitors->len; i++)
+    if (!application_find_window (self, monitors->pdata[i]))
+      application_add_window (self, monitors->pdata[i]);
+
+  /* Close windows of monitors that are gone, their terminals are moved below */
+  for (guint i = self->windows->len; i > 0; i--)
+    {
+      AppWindow *app_window = self->windows->pdata[i - 1];
+      GtkWidget *window;
+
+      if (g_ptr_array_find (monitors, app_window->monitor, NULL))
+        continue;
+
+      window = app_window->window;
+      application_remove_window (self, app_window, terminals);
+      gtk_window_destroy (GTK_WINDOW (window));
+    }
+
+  application_assign_keyboards (self, terminals);
+}
+
+static void
+application_monitors_changed_cb (MktApplication *self)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+
+  /* Update only if windows are shown already */
+  if (self->windows->len)
+    application_update_windows (self);
+}
+
+static gboolean
+application_window_close_request_cb (MktApplication *self,
+                                     GtkWindow      *window)
+{
+  g_autoptr(GHashTable) terminals = NULL;
+
+  g_assert (MKT_IS_APPLICATION (self));
+  g_assert (GTK_IS_WINDOW (window));
+
+  /* Closing the last window quits */
+  if (self->windows->len <= 1)
+    {
+      g_application_quit (G_APPLICATION (self));
+      return FALSE;
+    }
+
+  /* Otherwise, its terminals are moved to the remaining windows */
+  terminals = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                     g_object_unref, g_object_unref);
+
+  for (guint i = 0; i < self->windows->len; i++)
+    {
+      AppWindow *app_window = self->windows->pdata[i];
+
+      if (app_window->window == GTK_WIDGET (window))
+        {
+          application_remove_window (self, app_window, terminals);
+          break;
+        }
+    }
+
+  application_assign_keyboards (self, terminals);
+
+  return FALSE;
+}
+
+static void
+application_window_added_cb (MktApplication *self,
+                             GtkWindow      *window)
+{
+  g_assert (MKT_IS_APPLICATION (self));
+
+  if (!MKT_IS_WINDOW (window))
+    return;
+
+  g_signal_connect_object (window, "close-request",
+                           G_CALLBACK (application_window_close_request_cb),
+                           self, G_CONNECT_SWAPPED);
+}
+
+static void
+application_export_dbus (MktApplication *self)
+{
+  g_autoptr(GError) error = NULL;
+  GDBusConnection *connection;
+
+  g_assert (MKT_IS_APPLICATION (self));
+
+  self->dbus_service = mkt_dbus_service_new (self->controller);
+  connection = g_application_get_dbus_connection (G_APPLICATION (self));
+
+  if (connection &&
+      !mkt_dbus_service_export (self->dbus_service, connection,
+                                g_application_get_dbus_object_path (G_APPLICATION (self)),
+                                &error))
+    g_warning ("Failed to export D-Bus interface: %s", error->message);
+
+  g_clear_error (&error);
+
+  /* There is usually no session bus for root, so listen on a socket of our own */
+  if (geteuid () == 0 &&
+      !mkt_dbus_service_listen (self->dbus_service, &error))
+    g_warning ("Failed to listen for D-Bus peers: %s", error->message);
+}
+
 static void
 mkt_application_startup (GApplication *application)
 {
@@ -103,10 +695,45 @@ mkt_application_startup (GApplication *application)
           PACKAGE_VERSION, PACKAGE_VCS_VERSION);
 
   G_APPLICATION_CLASS (mkt_application_parent_class)->startup (application);
+  application_mark_startup (self, "gtk");
 
   g_set_application_name (_("Multi Key Term"));
   gtk_window_set_default_icon_name (PACKAGE_ID);
+  adw_style_manager_set_color_scheme (adw_style_manager_get_default (),
+                                      ADW_COLOR_SCHEME_FORCE_DARK);
   self->settings = mkt_settings_new ();
+  application_mark_startup (self, "settings");
+
+  /* Before any shell is spawned, as the application may move to a child cgroup */
+  if (mkt_settings_get_isolate_terminals (self->settings))
+    mkt_cgroup_protect_self (mkt_cgroup_get_default (),
+                             mkt_settings_get_ui_cpu_weight (self->settings));
+
+  /* Input devices are set up in a thread, see mkt_controller_get_ready() */
+  self->controller = application_create_controller (self);
+  application_start_metrics (self);
+  application_mark_startup (self, "controller");
+
+  g_signal_connect_object (self->controller, "notify::ready",
+                           G_CALLBACK (application_devices_ready_cb),
+                           self, G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (mkt_controller_get_keyboard_list (self->controller),
+                           "items-changed",
+                           G_CALLBACK (application_keyboards_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::use-all-monitors",
+                           G_CALLBACK (application_monitors_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+
+  if (gdk_display_get_default ())
+    g_signal_connect_object (gdk_display_get_monitors (gdk_display_get_default ()),
+                             "items-changed",
+                             G_CALLBACK (application_monitors_changed_cb),
+                             self, G_CONNECT_SWAPPED);
+
+  application_export_dbus (self);
+  application_mark_startup (self, "dbus");
 }
 
 static void
@@ -117,10 +744,42 @@ mkt_application_activate (GApplication *application)
 
   window = gtk_application_get_active_window (GTK_APPLICATION (self));
 
-  if (window == NULL)
-    window = GTK_WINDOW (mkt_window_new (GTK_APPLICATION (self), self->settings));
+  if (window)
+    {
+      gtk_window_present (window);
+      return;
+    }
 
-  gtk_window_present (window);
+  application_update_windows (self);
+  application_mark_startup (self, "window");
+
+  if (self->startup_marks && self->windows->len)
+    {
+      AppWindow *app_window = self->windows->pdata[0];
+      GdkFrameClock *frame_clock;
+
+      frame_clock = gtk_widget_get_frame_clock (app_window->window);
+
+      if (frame_clock)
+        g_signal_connect_object (frame_clock, "after-paint",
+                                 G_CALLBACK (application_first_frame_cb),
+                                 self, G_CONNECT_SWAPPED);
+    }
+
+  /* The devices may have been ready before the window */
+  application_devices_ready_cb (self);
+}
+
+static void
+mkt_application_shutdown (GApplication *application)
+{
+  MktApplication *self = (MktApplication *)application;
+
+  /* Unexport before the application bus connection is closed */
+  g_clear_object (&self->dbus_service);
+  g_clear_pointer (&self->metrics, mkt_metrics_free);
+
+  G_APPLICATION_CLASS (mkt_application_parent_class)->shutdown (application);
 }
 
 static void
@@ -129,7 +788,13 @@ mkt_application_finalize (GObject *object)
   MktApplication *self = (MktApplication *)object;
 
   MKT_TRACE_MSG ("disposing application");
+  g_clear_pointer (&self->keyboard_windows, g_hash_table_unref);
+  g_clear_pointer (&self->startup_marks, g_array_unref);
+  g_clear_pointer (&self->metrics, mkt_metrics_free);
+  g_clear_pointer (&self->windows, g_ptr_array_unref);
+  g_clear_object (&self->controller);
   g_clear_object (&self->settings);
+  g_free (self->input_broker);
 
   G_OBJECT_CLASS (mkt_application_parent_class)->finalize (object);
 }
@@ -145,12 +810,21 @@ mkt_application_class_init (MktApplicationClass *klass)
   application_class->handle_local_options = mkt_application_handle_local_options;
   application_class->startup = mkt_application_startup;
   application_class->activate = mkt_application_activate;
+  application_class->shutdown = mkt_application_shutdown;
 }
 
 static void
 mkt_application_init (MktApplication *self)
 {
   g_application_add_main_option_entries (G_APPLICATION (self), cmd_options);
+
+  self->windows = g_ptr_array_new_with_free_func (app_window_free);
+  self->keyboard_windows = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                  g_object_unref, NULL);
+
+  g_signal_connect (self, "window-added",
+                    G_CALLBACK (application_window_added_cb), NULL);
+  self->start_time = g_get_monotonic_time ();
 }
 
 MktApplication *
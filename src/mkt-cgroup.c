@@ -0,0 +1,575 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-cgroup.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-cgroup"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <gio/gio.h>
+
+#include "mkt-cgroup.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-cgroup
+ * @title: MktCgroup
+ * @short_description: Isolate the processes of each terminal
+ * @include: "mkt-cgroup.h"
+ *
+ * Without isolation, every shell runs in the cgroup of the
+ * application, so a `make -j` in one terminal slows down the
+ * others and the application that draws them all.  Each
+ * terminal gets a cgroup v2 leaf of its own instead, with the
+ * CPU weight, memory.high and pids.max set for its slot.
+ *
+ * If systemd is running, each shell is moved to a transient
+ * scope with the limits, and the unit of the application gets
+ * the higher CPU weight.  Processes started by the shell before
+ * it's moved stay behind, which only happens on startup.
+ *
+ * Otherwise, if the cgroup of the application can be written
+ * to, like when run as root without systemd, the application
+ * moves itself to a “ui” child cgroup, as processes can't be
+ * in a cgroup whose children have controllers, and shells join
+ * a child cgroup of their own before they are run.
+ */
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_CONTROLLERS "+cpu +memory +pids"
+
+typedef enum
+{
+  CGROUP_MODE_NONE,
+  CGROUP_MODE_SYSTEMD,
+  CGROUP_MODE_DIRECT,
+} CgroupMode;
+
+struct _MktCgroupLeaf
+{
+  MktCgroup     *cgroup;
+  MktSlotLimits  limits;
+  guint          slot;
+  /* The cgroup directory and its cgroup.procs, if not systemd */
+  char          *path;
+  int            procs_fd;
+};
+
+struct _MktCgroup
+{
+  GObject          parent_instance;
+
+  GDBusConnection *bus;
+  /* The cgroup of the application, if written directly */
+  char            *base;
+  CgroupMode       mode;
+  guint            ui_cpu_weight;
+  guint            n_leaves;
+};
+
+G_DEFINE_TYPE (MktCgroup, mkt_cgroup, G_TYPE_OBJECT)
+
+static gboolean
+cgroup_write (const char *dir,
+              const char *file,
+              const char *value)
+{
+  g_autofree char *path = NULL;
+  gssize len;
+  int fd;
+
+  path = g_build_filename (dir, file, NULL);
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+
+  /* cgroup files can't be replaced, so g_file_set_contents() won't do */
+  if (fd >= 0)
+    {
+      len = write (fd, value, strlen (value));
+      close (fd);
+
+      if (len == (gssize)strlen (value))
+        return TRUE;
+    }
+
+  g_debug ("Failed to write ‘%s’ to %s: %s", value, path, g_strerror (errno));
+
+  return FALSE;
+}
+
+static char *
+cgroup_get_own_path (void)
+{
+  g_autofree char *content = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  if (!g_file_get_contents ("/proc/self/cgroup", &content, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (content, "\n", -1);
+
+  /* The unified hierarchy has the id 0 and no controllers listed */
+  for (guint i = 0; lines[i]; i++)
+    if (g_str_has_prefix (lines[i], "0::"))
+      return g_build_filename (CGROUP_ROOT, lines[i] + strlen ("0::"), NULL);
+
+  return NULL;
+}
+
+static gboolean
+cgroup_setup_systemd (MktCgroup *self)
+{
+  g_autoptr(GError) error = NULL;
+  GBusType bus_type;
+
+  g_assert (MKT_IS_CGROUP (self));
+
+  /* Same as sd_booted() */
+  if (access ("/run/systemd/system", F_OK) != 0)
+    return FALSE;
+
+  /* root talks to the system manager, others to their user manager */
+  bus_type = geteuid () == 0 ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION;
+  self->bus = g_bus_get_sync (bus_type, NULL, &error);
+
+  if (!self->bus)
+    g_debug ("Failed to get bus for systemd: %s", error->message);
+
+  return self->bus != NULL;
+}
+
+static gboolean
+cgroup_setup_direct (MktCgroup *self)
+{
+  g_autofree char *subtree_control = NULL;
+  g_autofree char *procs_path = NULL;
+  g_autofree char *procs = NULL;
+  g_autofree char *base = NULL;
+  g_autofree char *ui = NULL;
+  g_autofree char *pid = NULL;
+
+  g_assert (MKT_IS_CGROUP (self));
+
+  base = cgroup_get_own_path ();
+
+  if (!base || access (CGROUP_ROOT "/cgroup.controllers", F_OK) != 0)
+    return FALSE;
+
+  subtree_control = g_build_filename (base, "cgroup.subtree_control", NULL);
+  procs_path = g_build_filename (base, "cgroup.procs", NULL);
+
+  if (access (subtree_control, W_OK) != 0 ||
+      !g_file_get_contents (procs_path, &procs, NULL, NULL))
+    return FALSE;
+
+  /* We can't move other processes out, so we should be alone */
+  pid = g_strdup_printf ("%d", getpid ());
+
+  if (g_strcmp0 (g_strstrip (procs), pid) != 0)
+    return FALSE;
+
+  ui = g_build_filename (base, "ui", NULL);
+
+  if ((mkdir (ui, 0755) != 0 && errno != EEXIST) ||
+      !cgroup_write (ui, "cgroup.procs", pid))
+    return FALSE;
+
+  if (!cgroup_write (base, "cgroup.subtree_control", CGROUP_CONTROLLERS))
+    {
+      cgroup_write (base, "cgroup.procs", pid);
+      rmdir (ui);
+
+      return FALSE;
+    }
+
+  self->base = g_steal_pointer (&base);
+
+  return TRUE;
+}
+
+static void
+cgroup_set_properties_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+
+  if (!reply)
+    g_warning ("Failed to set CPU weight of the application: %s", error->message);
+}
+
+static void
+cgroup_get_unit_id_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  g_autoptr(MktCgroup) self = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GVariant) id = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantBuilder properties;
+
+  g_assert (MKT_IS_CGROUP (self));
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+
+  if (!reply)
+    {
+      g_warning ("Failed to get unit of the application: %s", error->message);
+      return;
+    }
+
+  g_variant_get (reply, "(v)", &id);
+  MKT_DEBUG_MSG ("Setting CPU weight of %s to %u",
+                 g_variant_get_string (id, NULL), self->ui_cpu_weight);
+
+  g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+  g_variant_builder_add (&properties, "(sv)", "CPUWeight",
+                         g_variant_new_uint64 (self->ui_cpu_weight));
+  g_dbus_connection_call (self->bus,
+                          "org.freedesktop.systemd1",
+                          "/org/freedesktop/systemd1",
+                          "org.freedesktop.systemd1.Manager",
+                          "SetUnitProperties",
+                          g_variant_new ("(sba(sv))", g_variant_get_string (id, NULL),
+                                         TRUE, &properties),
+                          NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          cgroup_set_properties_cb, NULL);
+}
+
+static void
+cgroup_get_unit_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  g_autoptr(MktCgroup) self = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+  const char *path;
+
+  g_assert (MKT_IS_CGROUP (self));
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+
+  if (!reply)
+    {
+      g_warning ("Failed to get unit of the application: %s", error->message);
+      return;
+    }
+
+  g_variant_get (reply, "(&o)", &path);
+  g_dbus_connection_call (self->bus,
+                          "org.freedesktop.systemd1", path,
+                          "org.freedesktop.DBus.Properties", "Get",
+                          g_variant_new ("(ss)", "org.freedesktop.systemd1.Unit", "Id"),
+                          G_VARIANT_TYPE ("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          cgroup_get_unit_id_cb, g_object_ref (self));
+}
+
+static void
+cgroup_scope_started_cb (GObject      *object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  g_autofree char *name = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+
+  if (reply)
+    MKT_DEBUG_MSG ("Started scope %s", name);
+  else
+    g_warning ("Failed to start scope %s: %s", name, error->message);
+}
+
+static void
+mkt_cgroup_finalize (GObject *object)
+{
+  MktCgroup *self = (MktCgroup *)object;
+
+  g_clear_object (&self->bus);
+  g_clear_pointer (&self->base, g_free);
+
+  G_OBJECT_CLASS (mkt_cgroup_parent_class)->finalize (object);
+}
+
+static void
+mkt_cgroup_class_init (MktCgroupClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = mkt_cgroup_finalize;
+}
+
+static void
+mkt_cgroup_init (MktCgroup *self)
+{
+  if (cgroup_setup_systemd (self))
+    self->mode = CGROUP_MODE_SYSTEMD;
+  else if (cgroup_setup_direct (self))
+    self->mode = CGROUP_MODE_DIRECT;
+  else
+    g_info ("No cgroup can be created, terminals won't be isolated");
+
+  MKT_DEBUG_MSG ("cgroup mode: %s",
+                 self->mode == CGROUP_MODE_SYSTEMD ? "systemd" :
+                 self->mode == CGROUP_MODE_DIRECT ? "direct" : "none");
+}
+
+/**
+ * mkt_cgroup_get_default:
+ *
+ * Get the default #MktCgroup.  The first call decides how
+ * cgroups are created, and may move the application to a
+ * child cgroup.
+ *
+ * Returns: (transfer none): A #MktCgroup
+ */
+MktCgroup *
+mkt_cgroup_get_default (void)
+{
+  static MktCgroup *self;
+
+  if (!self)
+    self = g_object_new (MKT_TYPE_CGROUP, NULL);
+
+  return self;
+}
+
+gboolean
+mkt_cgroup_is_available (MktCgroup *self)
+{
+  g_return_val_if_fail (MKT_IS_CGROUP (self), FALSE);
+
+  return self->mode != CGROUP_MODE_NONE;
+}
+
+/**
+ * mkt_cgroup_protect_self:
+ * @self: A #MktCgroup
+ * @cpu_weight: The CPU weight, from 1 to 10000
+ *
+ * Set the CPU weight of the application, so that busy
+ * terminals, which get 100 by default, can't starve it.
+ */
+void
+mkt_cgroup_protect_self (MktCgroup *self,
+                         guint      cpu_weight)
+{
+  char weight[16];
+
+  g_return_if_fail (MKT_IS_CGROUP (self));
+  g_return_if_fail (cpu_weight >= 1 && cpu_weight <= 10000);
+
+  self->ui_cpu_weight = cpu_weight;
+
+  if (self->mode == CGROUP_MODE_DIRECT)
+    {
+      g_autofree char *ui = NULL;
+
+      ui = g_build_filename (self->base, "ui", NULL);
+      g_snprintf (weight, sizeof weight, "%u", cpu_weight);
+      cgroup_write (ui, "cpu.weight", weight);
+    }
+  else if (self->mode == CGROUP_MODE_SYSTEMD)
+    {
+      g_dbus_connection_call (self->bus,
+                              "org.freedesktop.systemd1",
+                              "/org/freedesktop/systemd1",
+                              "org.freedesktop.systemd1.Manager",
+                              "GetUnitByPID",
+                              g_variant_new ("(u)", (guint32)getpid ()),
+                              G_VARIANT_TYPE ("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                              cgroup_get_unit_cb, g_object_ref (self));
+    }
+}
+
+/**
+ * mkt_cgroup_leaf_new:
+ * @self: A #MktCgroup
+ * @slot: The slot of the terminal
+ * @limits: The limits of the terminal
+ *
+ * Create a cgroup for the processes of a terminal.  The
+ * shell shall be spawned with mkt_cgroup_leaf_child_setup()
+ * as the child setup function, and mkt_cgroup_leaf_attach()
+ * called once it's running.
+ *
+ * Returns: (transfer full): A #MktCgroupLeaf
+ */
+MktCgroupLeaf *
+mkt_cgroup_leaf_new (MktCgroup           *self,
+                     guint                slot,
+                     const MktSlotLimits *limits)
+{
+  g_autofree char *procs = NULL;
+  g_autofree char *name = NULL;
+  MktCgroupLeaf *leaf;
+  char value[32];
+
+  g_return_val_if_fail (MKT_IS_CGROUP (self), NULL);
+  g_return_val_if_fail (limits, NULL);
+
+  leaf = g_new0 (MktCgroupLeaf, 1);
+  leaf->cgroup = g_object_ref (self);
+  leaf->limits = *limits;
+  leaf->slot = slot;
+  leaf->procs_fd = -1;
+
+  if (self->mode != CGROUP_MODE_DIRECT)
+    return leaf;
+
+  name = g_strdup_printf ("terminal%u-%u", slot, ++self->n_leaves);
+  leaf->path = g_build_filename (self->base, name, NULL);
+
+  if (mkdir (leaf->path, 0755) != 0)
+    {
+      g_warning ("Failed to create cgroup %s: %s", leaf->path, g_strerror (errno));
+      g_clear_pointer (&leaf->path, g_free);
+
+      return leaf;
+    }
+
+  g_snprintf (value, sizeof value, "%u", limits->cpu_weight);
+  cgroup_write (leaf->path, "cpu.weight", value);
+
+  if (limits->memory_high)
+    g_snprintf (value, sizeof value, "%" G_GUINT64_FORMAT, limits->memory_high);
+  else
+    g_strlcpy (value, "max", sizeof value);
+  cgroup_write (leaf->path, "memory.high", value);
+
+  if (limits->pids_max)
+    g_snprintf (value, sizeof value, "%u", limits->pids_max);
+  else
+    g_strlcpy (value, "max", sizeof value);
+  cgroup_write (leaf->path, "pids.max", value);
+
+  /* Opened here, as only async-signal-safe calls can be done in the child */
+  procs = g_build_filename (leaf->path, "cgroup.procs", NULL);
+  leaf->procs_fd = open (procs, O_WRONLY | O_CLOEXEC);
+
+  return leaf;
+}
+
+/**
+ * mkt_cgroup_leaf_child_setup:
+ * @leaf: A #MktCgroupLeaf
+ *
+ * A #GSpawnChildSetupFunc that moves the child to @leaf,
+ * before the shell is run.
+ */
+void
+mkt_cgroup_leaf_child_setup (gpointer leaf)
+{
+  MktCgroupLeaf *self = leaf;
+  G_GNUC_UNUSED gssize len;
+
+  /* Writing 0 moves the writer.  If it fails, stay where we are */
+  if (self->procs_fd >= 0)
+    len = write (self->procs_fd, "0", 1);
+}
+
+/**
+ * mkt_cgroup_leaf_attach:
+ * @leaf: A #MktCgroupLeaf
+ * @pid: The pid of the shell
+ *
+ * Move the shell with @pid to @leaf, if it couldn't be
+ * done before it was run.
+ */
+void
+mkt_cgroup_leaf_attach (MktCgroupLeaf *leaf,
+                        GPid           pid)
+{
+  GVariantBuilder properties;
+  guint32 pids[1];
+  char *name;
+
+  g_return_if_fail (leaf);
+
+  if (leaf->cgroup->mode != CGROUP_MODE_SYSTEMD || pid <= 0)
+    return;
+
+  pids[0] = pid;
+  name = g_strdup_printf ("multi-keyterm-terminal%u-%d.scope", leaf->slot, pid);
+
+  g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+  g_variant_builder_add (&properties, "(sv)", "Description",
+                         g_variant_new_take_string (g_strdup_printf ("Multi Key Term terminal %u",
+                                                                     leaf->slot)));
+  g_variant_builder_add (&properties, "(sv)", "PIDs",
+                         g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, pids,
+                                                    G_N_ELEMENTS (pids), sizeof (guint32)));
+  /* Don't keep the scope around once the shell and its jobs exit */
+  g_variant_builder_add (&properties, "(sv)", "CollectMode",
+                         g_variant_new_string ("inactive-or-failed"));
+  g_variant_builder_add (&properties, "(sv)", "CPUWeight",
+                         g_variant_new_uint64 (leaf->limits.cpu_weight));
+
+  if (leaf->limits.memory_high)
+    g_variant_builder_add (&properties, "(sv)", "MemoryHigh",
+                           g_variant_new_uint64 (leaf->limits.memory_high));
+
+  if (leaf->limits.pids_max)
+    g_variant_builder_add (&properties, "(sv)", "TasksMax",
+                           g_variant_new_uint64 (leaf->limits.pids_max));
+
+  g_dbus_connection_call (leaf->cgroup->bus,
+                          "org.freedesktop.systemd1",
+                          "/org/freedesktop/systemd1",
+                          "org.freedesktop.systemd1.Manager",
+                          "StartTransientUnit",
+                          g_variant_new ("(ssa(sv)@a(sa(sv)))", name, "fail", &properties,
+                                         g_variant_new_array (G_VARIANT_TYPE ("(sa(sv))"), NULL, 0)),
+                          G_VARIANT_TYPE ("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          cgroup_scope_started_cb, name);
+}
+
+void
+mkt_cgroup_leaf_free (MktCgroupLeaf *leaf)
+{
+  if (!leaf)
+    return;
+
+  if (leaf->procs_fd >= 0)
+    close (leaf->procs_fd);
+
+  /* Fails if some process of the terminal is still running */
+  if (leaf->path && rmdir (leaf->path) != 0)
+    g_debug ("Failed to remove cgroup %s: %s", leaf->path, g_strerror (errno));
+
+  g_clear_object (&leaf->cgroup);
+  g_free (leaf->path);
+  g_free (leaf);
+}
@@ -0,0 +1,54 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-cgroup.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "mkt-settings.h"
+
+G_BEGIN_DECLS
+
+typedef struct _MktCgroupLeaf MktCgroupLeaf;
+
+#define MKT_TYPE_CGROUP (mkt_cgroup_get_type ())
+
+G_DECLARE_FINAL_TYPE (MktCgroup, mkt_cgroup, MKT, CGROUP, GObject)
+
+MktCgroup     *mkt_cgroup_get_default      (void);
+gboolean       mkt_cgroup_is_available     (MktCgroup           *self);
+void           mkt_cgroup_protect_self     (MktCgroup           *self,
+                                            guint                cpu_weight);
+
+MktCgroupLeaf *mkt_cgroup_leaf_new         (MktCgroup           *self,
+                                            guint                slot,
+                                            const MktSlotLimits *limits);
+void           mkt_cgroup_leaf_child_setup (gpointer             leaf);
+void           mkt_cgroup_leaf_attach      (MktCgroupLeaf       *leaf,
+                                            GPid                 pid);
+void           mkt_cgroup_leaf_free        (MktCgroupLeaf       *leaf);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktCgroupLeaf, mkt_cgroup_leaf_free)
+
+G_END_DECLS
@@ -37,12 +37,60 @@
 #include <sys/ioctl.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "mkt-alloc.h"
 #include "mkt-utils.h"
 #include "mkt-controller.h"
+#include "mkt-input-client.h"
 #include "mkt-log.h"
 
 #define INITIAL_REPEAT_TIMEOUT 250 /* ms */
 #define REPEAT_TIMEOUT         33  /* ms */
+/* Lost keyboards expiring this close are removed together */
+#define LOST_BATCH_SLACK       250 /* ms */
+/* The most libinput events handled before the main loop gets a turn */
+#define DISPATCH_BUDGET        64
+#define DISPATCH_BUDGET_TIME   2000 /* µs */
+/* Backlogs are handled below GDK_PRIORITY_REDRAW, so frames aren't held up */
+#define DISPATCH_PRIORITY      (G_PRIORITY_HIGH_IDLE + 30)
+
+/*
+ * libinput events of a device waiting to be handled.  Events
+ * are handled one device at a time in turn, so that a burst
+ * from one device doesn't delay the keys of the others.
+ */
+typedef struct
+{
+  struct libinput_device *device;
+  GPtrArray              *events;
+  /* The next event to handle in events */
+  guint                   head;
+  /* Set once the device removed event is handled */
+  gboolean                removed;
+} DeviceQueue;
+
+/* A removed keyboard waiting for its device to return */
+typedef struct
+{
+  MktKeyboard *keyboard;
+  gint64       deadline;
+} LostKeyboard;
+
+/* The user data of the libinput context of a seat */
+typedef struct
+{
+  /* Unset while the seat is set up in a thread, and when we are gone */
+  MktController *controller;
+  gboolean       open_failed;
+} Seat;
+
+typedef enum
+{
+  CONTROLLER_STATE_NEW,
+  /* Seats are set up in threads, see controller_add_seat() */
+  CONTROLLER_STATE_STARTING,
+  /* The devices present on start are set up */
+  CONTROLLER_STATE_READY,
+} ControllerState;
 
 struct _MktController
 {
@@ -51,10 +99,34 @@ struct _MktController
   MktSettings     *settings;
   GListStore      *keyboard_list;
   GListStore      *full_keyboard_list;
-  struct libinput *li;
+  /* One libinput context per seat */
+  GPtrArray       *contexts;
+  GPtrArray       *seats;
+  GArray          *watch_ids;
   char            *error;
+  /* Seats still being set up */
+  guint            pending_seats;
+
+  /* Set if devices are owned by the input broker */
+  MktInputClient  *input_client;
+  /* Broker device number to MktKeyboard */
+  GHashTable      *remote_keyboards;
+  /* Keyboards with keys held back while a libinput batch is handled */
+  GPtrArray       *frozen_keyboards;
+  /* Array of DeviceQueue */
+  GPtrArray       *device_queues;
+  /* The DeviceQueue to handle an event from first */
+  guint            next_queue;
+  guint            n_pending_events;
+  guint            dispatch_id;
+  /* Device id to LostKeyboard */
+  GHashTable      *lost_keyboards;
+  guint            lost_timeout_id;
+  /* Device added and removed events */
+  guint64          hotplug_events;
 
   gboolean         ignore_keypress;
+  ControllerState  state;
 };
 
 G_DEFINE_TYPE (MktController, mkt_controller, G_TYPE_OBJECT)
@@ -62,29 +134,44 @@ G_DEFINE_TYPE (MktController, mkt_controller, G_TYPE_OBJECT)
 enum {
   PROP_0,
   PROP_FAILED,
+  PROP_READY,
   N_PROPS
 };
 
 static GParamSpec *properties[N_PROPS];
 
+static void
+controller_set_error (MktController *self,
+                      const char    *error)
+{
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  /* Keep the first error, that's likely the cause of others */
+  if (self->error)
+    return;
+
+  self->error = g_strdup (error);
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FAILED]);
+}
+
 /* Adapted from libinput gui debug example */
 static int
 open_restricted (const char *path,
                  int         flags,
                  void       *user_data)
 {
-  MktController *self = user_data;
+  Seat *seat = user_data;
   int fd = open (path, flags);
 
   if (fd < 0)
     {
       g_warning ("Failed to open %s (%s)", path, strerror (errno));
 
-      if (!self->error)
-        {
-          self->error = g_strdup ("libinput error: Failed to open input event");
-          g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FAILED]);
-        }
+      /* The error is set once the seat is handed to the main thread */
+      if (seat->controller)
+        controller_set_error (seat->controller, "libinput error: Failed to open input event");
+      else
+        seat->open_failed = TRUE;
     }
 
   return fd < 0 ? -errno : fd;
@@ -102,13 +189,408 @@ static const struct libinput_interface interface = {
   .close_restricted = close_restricted,
 };
 
+static void
+controller_update_keyboard_layout (MktController *self,
+                                   MktKeyboard   *keyboard)
+{
+  g_autoptr(MktKeyboardProfile) profile = NULL;
+  const char *layout;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  profile = mkt_settings_get_keyboard_profile (self->settings,
+                                               mkt_keyboard_get_id (keyboard));
+
+  if (profile && profile->layout)
+    layout = profile->layout;
+  else
+    layout = mkt_settings_get_kbd_layout (self->settings);
+
+  mkt_keyboard_set_layout (keyboard, layout);
+}
+
+static gboolean update_keyboard_leds (gpointer user_data);
+
+static void
+controller_update_keyboard_limits (MktController *self,
+                                   MktKeyboard   *keyboard)
+{
+  guint rate, burst;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  rate = mkt_settings_get_key_rate_limit (self->settings, &burst);
+  mkt_keyboard_set_rate_limit (keyboard, rate, burst);
+  mkt_keyboard_set_stuck_timeout (keyboard, mkt_settings_get_stuck_key_timeout (self->settings));
+}
+
+static void
+controller_setup_keyboard (MktController *self,
+                           MktKeyboard   *keyboard)
+{
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  controller_update_keyboard_layout (self, keyboard);
+  controller_update_keyboard_limits (self, keyboard);
+  g_list_store_append (self->full_keyboard_list, keyboard);
+  /* Update LED status as we sets Num Lock when keyboard is added */
+  g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
+}
+
+static MktKeyboard *
+controller_create_keyboard (MktController          *self,
+                            struct libinput_device *dev)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (dev);
+
+  keyboard = mkt_keyboard_new (dev);
+  controller_setup_keyboard (self, keyboard);
+
+  /* full_keyboard_list holds the reference from now */
+  return keyboard;
+}
+
+/* Keep the keyboards sorted by their index, so that terminals are in slot order */
+static void
+controller_insert_keyboard (MktController *self,
+                            MktKeyboard   *keyboard)
+{
+  GListModel *keyboard_list;
+  guint32 index;
+  guint n_items, position;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  keyboard_list = G_LIST_MODEL (self->keyboard_list);
+  n_items = g_list_model_get_n_items (keyboard_list);
+  index = mkt_keyboard_get_index (keyboard);
+
+  for (position = 0; position < n_items; position++)
+    {
+      g_autoptr(MktKeyboard) item = NULL;
+
+      item = g_list_model_get_item (keyboard_list, position);
+
+      if (mkt_keyboard_get_index (item) > index)
+        break;
+    }
+
+  g_list_store_insert (self->keyboard_list, position, keyboard);
+}
+
+/* Returns the smallest slot index not used by any terminal, or 0 if all are used */
+static guint32
+controller_get_free_index (MktController *self)
+{
+  GListModel *keyboard_list;
+  guint n_items;
+  guint used = 0;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  keyboard_list = G_LIST_MODEL (self->keyboard_list);
+  n_items = g_list_model_get_n_items (keyboard_list);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+      used |= 1 << (mkt_keyboard_get_index (keyboard) - XKB_KEY_0);
+    }
+
+  for (guint32 index = XKB_KEY_1; index <= XKB_KEY_9; index++)
+    if (!(used & 1 << (index - XKB_KEY_0)))
+      return index;
+
+  return 0;
+}
+
+static void
+controller_save_profile (MktController *self,
+                         MktKeyboard   *keyboard)
+{
+  g_autoptr(MktKeyboardProfile) profile = NULL;
+  const char *id;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  id = mkt_keyboard_get_id (keyboard);
+
+  if (!id)
+    return;
+
+  profile = mkt_settings_get_keyboard_profile (self->settings, id);
+
+  if (!profile)
+    {
+      profile = g_new0 (MktKeyboardProfile, 1);
+      profile->zoom = 1.0;
+    }
+
+  profile->slot = mkt_keyboard_get_index (keyboard) - XKB_KEY_0;
+
+  if (mkt_settings_set_keyboard_profile (self->settings, id, profile))
+    mkt_settings_save (self->settings);
+}
+
+static void
+controller_restore_keyboard (MktController *self,
+                             MktKeyboard   *keyboard)
+{
+  g_autoptr(MktKeyboardProfile) profile = NULL;
+  guint used_index;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  profile = mkt_settings_get_keyboard_profile (self->settings,
+                                               mkt_keyboard_get_id (keyboard));
+
+  /* Keyboards without a profile are claimed on key press */
+  if (!profile)
+    return;
+
+  used_index = XKB_KEY_0 + profile->slot;
+
+  for (guint i = 0; i < g_list_model_get_n_items (G_LIST_MODEL (self->keyboard_list)); i++)
+    {
+      g_autoptr(MktKeyboard) item = NULL;
+
+      item = g_list_model_get_item (G_LIST_MODEL (self->keyboard_list), i);
+
+      if (mkt_keyboard_get_index (item) == used_index)
+        {
+          used_index = controller_get_free_index (self);
+          break;
+        }
+    }
+
+  if (!used_index)
+    {
+      g_debug ("Slot %u of keyboard '%s' is in use and no slot is free, not restoring",
+               profile->slot, mkt_keyboard_get_id (keyboard));
+      return;
+    }
+
+  MKT_DEBUG_MSG ("Restoring keyboard %p (%s) to slot %u", keyboard,
+                 mkt_keyboard_get_id (keyboard), used_index - XKB_KEY_0);
+  mkt_keyboard_set_index (keyboard, used_index);
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  controller_insert_keyboard (self, keyboard);
+
+  /* The saved slot was taken, remember the one the keyboard got instead */
+  if (used_index != XKB_KEY_0 + profile->slot)
+    controller_save_profile (self, keyboard);
+}
+
+static void
+controller_forget_keyboard (MktController *self,
+                            MktKeyboard   *keyboard)
+{
+  guint position;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  if (g_list_store_find (self->keyboard_list, keyboard, &position))
+    g_list_store_remove (self->keyboard_list, position);
+
+  if (g_list_store_find (self->full_keyboard_list, keyboard, &position))
+    g_list_store_remove (self->full_keyboard_list, position);
+}
+
+static void
+lost_keyboard_free (gpointer data)
+{
+  LostKeyboard *lost = data;
+
+  g_object_unref (lost->keyboard);
+  g_free (lost);
+}
+
+static void controller_schedule_lost (MktController *self);
+
+static gboolean
+controller_lost_timeout_cb (gpointer user_data)
+{
+  MktController *self = user_data;
+  g_autoptr(GPtrArray) expired = NULL;
+  GHashTableIter iter;
+  LostKeyboard *lost;
+  gint64 now;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  self->lost_timeout_id = 0;
+  now = g_get_monotonic_time ();
+  expired = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_hash_table_iter_init (&iter, self->lost_keyboards);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&lost))
+    if (lost->deadline <= now + LOST_BATCH_SLACK * 1000)
+      {
+        g_ptr_array_add (expired, g_object_ref (lost->keyboard));
+        g_hash_table_iter_remove (&iter);
+      }
+
+  /* Keyboards dropped together by a hub reset go away together */
+  for (guint i = 0; i < expired->len; i++)
+    {
+      MktKeyboard *keyboard = g_ptr_array_index (expired, i);
+
+      MKT_DEBUG_MSG ("Keyboard %p (%s) didn't return, removing", keyboard,
+                     mkt_keyboard_get_id (keyboard));
+      controller_forget_keyboard (self, keyboard);
+    }
+
+  controller_schedule_lost (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+controller_schedule_lost (MktController *self)
+{
+  GHashTableIter iter;
+  LostKeyboard *lost;
+  gint64 deadline = G_MAXINT64;
+  gint64 timeout;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  g_clear_handle_id (&self->lost_timeout_id, g_source_remove);
+
+  g_hash_table_iter_init (&iter, self->lost_keyboards);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&lost))
+    deadline = MIN (deadline, lost->deadline);
+
+  if (deadline == G_MAXINT64)
+    return;
+
+  timeout = MAX (deadline - g_get_monotonic_time (), 0) / 1000 + 1;
+  self->lost_timeout_id = g_timeout_add (timeout, controller_lost_timeout_cb, self);
+}
+
+/*
+ * Keep a removed keyboard, and so its terminal and shell, for
+ * the grace period, in case the device returns.  Flaky hubs and
+ * KVM switches drop devices for a moment.
+ */
+static void
+controller_lose_keyboard (MktController *self,
+                          MktKeyboard   *keyboard)
+{
+  LostKeyboard *lost;
+  const char *id;
+  guint grace_period;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  grace_period = mkt_settings_get_reconnect_grace_period (self->settings);
+  id = mkt_keyboard_get_id (keyboard);
+
+  /* A device without an id can't be matched when it returns */
+  if (!grace_period || !id ||
+      !g_list_store_find (self->keyboard_list, keyboard, NULL))
+    {
+      controller_forget_keyboard (self, keyboard);
+      return;
+    }
+
+  /* Two devices may share a serial, keep the latest */
+  lost = g_hash_table_lookup (self->lost_keyboards, id);
+
+  if (lost)
+    controller_forget_keyboard (self, lost->keyboard);
+
+  MKT_DEBUG_MSG ("Keyboard %p (%s) removed, waiting %u ms for it to return",
+                 keyboard, id, grace_period);
+  mkt_keyboard_set_connected (keyboard, FALSE);
+
+  lost = g_new0 (LostKeyboard, 1);
+  lost->keyboard = g_object_ref (keyboard);
+  lost->deadline = g_get_monotonic_time () + (gint64)grace_period * 1000;
+  g_hash_table_replace (self->lost_keyboards, g_strdup (id), lost);
+  controller_schedule_lost (self);
+}
+
+/* Returns: (transfer full) (nullable): The keyboard lost with @id */
+static MktKeyboard *
+controller_find_lost_keyboard (MktController *self,
+                               const char    *id)
+{
+  MktKeyboard *keyboard;
+  LostKeyboard *lost;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  if (!id)
+    return NULL;
+
+  lost = g_hash_table_lookup (self->lost_keyboards, id);
+
+  if (!lost)
+    return NULL;
+
+  keyboard = g_object_ref (lost->keyboard);
+  g_hash_table_remove (self->lost_keyboards, id);
+  controller_schedule_lost (self);
+
+  MKT_DEBUG_MSG ("Keyboard %p (%s) returned", keyboard, id);
+  mkt_keyboard_set_connected (keyboard, TRUE);
+
+  return keyboard;
+}
+
+static void
+handle_device_added_event (MktController         *self,
+                           struct libinput_event *ev)
+{
+  g_autoptr(MktKeyboard) lost_keyboard = NULL;
+  g_autofree char *id = NULL;
+  struct libinput_device *dev;
+  MktKeyboard *keyboard;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (ev);
+
+  dev = libinput_event_get_device (ev);
+
+  if (!libinput_device_has_capability (dev, LIBINPUT_DEVICE_CAP_KEYBOARD) ||
+      libinput_device_get_user_data (dev))
+    return;
+
+  /* Rebind a returning device to its terminal */
+  id = mkt_utils_get_device_id (dev);
+  lost_keyboard = controller_find_lost_keyboard (self, id);
+
+  if (lost_keyboard)
+    {
+      mkt_keyboard_set_device (lost_keyboard, dev);
+      g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
+      return;
+    }
+
+  keyboard = controller_create_keyboard (self, dev);
+  controller_restore_keyboard (self, keyboard);
+}
+
 static void
 handle_device_removed_event (MktController         *self,
                              struct libinput_event *ev)
 {
   MktKeyboard *keyboard;
   struct libinput_device *dev;
-  guint position;
 
   g_assert (MKT_IS_CONTROLLER (self));
   g_assert (ev);
@@ -121,13 +603,8 @@ handle_device_removed_event (MktController         *self,
   if (!keyboard)
     return;
 
-  libinput_device_set_user_data (dev, NULL);
-
-  if (g_list_store_find (self->keyboard_list, keyboard, &position))
-    g_list_store_remove (self->keyboard_list, position);
-
-  if (g_list_store_find (self->full_keyboard_list, keyboard, &position))
-    g_list_store_remove (self->full_keyboard_list, position);
+  mkt_keyboard_set_device (keyboard, NULL);
+  controller_lose_keyboard (self, keyboard);
 }
 
 /* We update LEDs from all keyboards.  The system
@@ -157,71 +634,273 @@ update_keyboard_leds (gpointer user_data)
   return G_SOURCE_REMOVE;
 }
 
+static void
+controller_handle_key (MktController          *self,
+                       MktKeyboard            *keyboard,
+                       enum xkb_key_direction  direction,
+                       guint32                 key,
+                       guint64                 time)
+{
+  gboolean was_enabled;
+  guint32 sym;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  was_enabled = mkt_keyboard_get_enabled (keyboard);
+
+  /* Keyboards in the list keep their slot, even if the terminal has exited */
+  if (!was_enabled && direction == XKB_KEY_DOWN &&
+      !g_list_store_find (self->keyboard_list, keyboard, NULL))
+    {
+      guint32 index;
+
+      index = controller_get_free_index (self);
+
+      if (index)
+        mkt_keyboard_set_index (keyboard, index);
+    }
+
+  mkt_keyboard_set_event_time (keyboard, time);
+  sym = mkt_keyboard_feed_key (keyboard, direction, key);
+
+  /*
+   * When lock keys are pressed, the system may set LEDs for all keyboards.  We delay
+   * a bit updating LEDs so that they are re-updated after systems sets them
+   */
+  if (sym == XKB_KEY_Caps_Lock ||
+      sym == XKB_KEY_Num_Lock ||
+      sym == XKB_KEY_Scroll_Lock)
+    g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
+
+  if (!was_enabled &&
+      mkt_keyboard_get_enabled (keyboard) &&
+      !g_list_store_find (self->keyboard_list, keyboard, NULL))
+    {
+      MKT_DEBUG_MSG ("Added new keyboard %p (%s)", keyboard,
+                     mkt_keyboard_get_id (keyboard));
+      controller_insert_keyboard (self, keyboard);
+      controller_save_profile (self, keyboard);
+    }
+}
+
 static void
 handle_keyboard_event (MktController         *self,
                        struct libinput_event *ev)
 {
   struct libinput_event_keyboard *key_event;
   struct libinput_device *dev;
-  MktKeyboard *keyboard;
   enum xkb_key_direction direction = XKB_KEY_DOWN;
-  gboolean was_enabled;
-  uint32_t key, sym;
+  MktKeyboard *keyboard;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (ev);
+
+  dev = libinput_event_get_device (ev);
+  key_event = libinput_event_get_keyboard_event (ev);
+
+  if (libinput_event_keyboard_get_key_state (key_event) == LIBINPUT_KEY_STATE_RELEASED)
+    direction = XKB_KEY_UP;
+
+  if (!libinput_device_get_user_data (dev))
+    controller_create_keyboard (self, dev);
+
+  keyboard = libinput_device_get_user_data (dev);
+
+  /* Pass the keys of a keyboard in this dispatch at once */
+  if (!g_ptr_array_find (self->frozen_keyboards, keyboard, NULL))
+    {
+      mkt_keyboard_freeze_keys (keyboard);
+      g_ptr_array_add (self->frozen_keyboards, g_object_ref (keyboard));
+    }
+
+  controller_handle_key (self, keyboard, direction,
+                         libinput_event_keyboard_get_key (key_event),
+                         libinput_event_keyboard_get_time_usec (key_event));
+}
+
+static void
+handle_ignored_keyboard_event (MktController         *self,
+                               struct libinput_event *ev)
+{
+  MktKeyboard *keyboard;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (ev);
+
+  keyboard = libinput_device_get_user_data (libinput_event_get_device (ev));
+
+  if (keyboard)
+    mkt_keyboard_count_dropped (keyboard);
+}
+
+static void
+device_queue_free (gpointer data)
+{
+  DeviceQueue *queue = data;
+
+  for (guint i = queue->head; i < queue->events->len; i++)
+    libinput_event_destroy (queue->events->pdata[i]);
+
+  g_ptr_array_unref (queue->events);
+  libinput_device_unref (queue->device);
+  g_free (queue);
+}
+
+static void
+controller_queue_event (MktController         *self,
+                        struct libinput_event *ev)
+{
+  struct libinput_device *device;
+  DeviceQueue *queue = NULL;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  device = libinput_event_get_device (ev);
+
+  /* There are only a few devices, and the last one is likely the same */
+  for (guint i = self->device_queues->len; i > 0; i--)
+    {
+      DeviceQueue *item = self->device_queues->pdata[i - 1];
+
+      if (item->device == device)
+        {
+          queue = item;
+          break;
+        }
+    }
+
+  if (!queue)
+    {
+      queue = g_new0 (DeviceQueue, 1);
+      queue->device = libinput_device_ref (device);
+      queue->events = g_ptr_array_sized_new (DISPATCH_BUDGET);
+      g_ptr_array_add (self->device_queues, queue);
+    }
+
+  g_ptr_array_add (queue->events, ev);
+  self->n_pending_events++;
+}
+
+static void
+controller_handle_event (MktController         *self,
+                         DeviceQueue           *queue,
+                         struct libinput_event *ev)
+{
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_CONTROLLER);
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  switch ((int)libinput_event_get_type (ev))
+    {
+    case LIBINPUT_EVENT_DEVICE_ADDED:
+      self->hotplug_events++;
+      handle_device_added_event (self, ev);
+      break;
+
+    case LIBINPUT_EVENT_DEVICE_REMOVED:
+      self->hotplug_events++;
+      handle_device_removed_event (self, ev);
+      queue->removed = TRUE;
+      break;
+
+    case LIBINPUT_EVENT_KEYBOARD_KEY:
+      if (!self->ignore_keypress)
+        handle_keyboard_event (self, ev);
+      else
+        handle_ignored_keyboard_event (self, ev);
+      break;
+
+    default:
+      break;
+    }
+
+  libinput_event_destroy (ev);
+}
+
+static gboolean controller_dispatch_cb (gpointer user_data);
+
+/*
+ * Handle the queued events one device at a time in turn,
+ * until the budget is used up.  The rest is handled on
+ * the next idle, after GTK had a chance to draw.
+ */
+static void
+controller_dispatch_events (MktController *self)
+{
+  gint64 deadline;
+  guint n_events = 0;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  deadline = g_get_monotonic_time () + DISPATCH_BUDGET_TIME;
+
+  while (self->n_pending_events &&
+         n_events < DISPATCH_BUDGET &&
+         g_get_monotonic_time () < deadline)
+    {
+      DeviceQueue *queue;
+      struct libinput_event *ev;
 
-  g_assert (MKT_IS_CONTROLLER (self));
-  g_assert (ev);
+      if (self->next_queue >= self->device_queues->len)
+        self->next_queue = 0;
 
-  dev = libinput_event_get_device (ev);
-  key_event = libinput_event_get_keyboard_event (ev);
-  key = libinput_event_keyboard_get_key (key_event);
+      queue = self->device_queues->pdata[self->next_queue];
 
-  if (libinput_event_keyboard_get_key_state (key_event) == LIBINPUT_KEY_STATE_RELEASED)
-    direction = XKB_KEY_UP;
+      if (queue->head == queue->events->len)
+        {
+          /* Drop the queues of removed devices once drained */
+          if (queue->removed)
+            g_ptr_array_remove_index (self->device_queues, self->next_queue);
+          else
+            self->next_queue++;
 
-  if (!libinput_device_get_user_data (dev))
-    {
-      keyboard = mkt_keyboard_new (dev);
-      mkt_keyboard_set_layout (keyboard, mkt_settings_get_kbd_layout (self->settings));
-      g_list_store_append (self->full_keyboard_list, keyboard);
-      /* Update LED status as we sets Num Lock when keyboard is added */
-      g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
-      g_object_unref (keyboard);
+          continue;
+        }
+
+      ev = queue->events->pdata[queue->head++];
+      self->n_pending_events--;
+      n_events++;
+
+      /* Keep the capacity, so that queueing doesn't allocate */
+      if (queue->head == queue->events->len)
+        {
+          g_ptr_array_set_size (queue->events, 0);
+          queue->head = 0;
+        }
+
+      controller_handle_event (self, queue, ev);
+      self->next_queue++;
     }
 
-  keyboard = libinput_device_get_user_data (dev);
+  for (guint i = 0; i < self->frozen_keyboards->len; i++)
+    mkt_keyboard_thaw_keys (g_ptr_array_index (self->frozen_keyboards, i));
+  g_ptr_array_set_size (self->frozen_keyboards, 0);
 
-  was_enabled = mkt_keyboard_get_enabled (keyboard);
-  if (!was_enabled && direction == XKB_KEY_DOWN)
+  if (!self->n_pending_events)
     {
-      guint index = 0;
-
-      if (g_list_store_find (self->keyboard_list, keyboard, &index))
-        index = index + XKB_KEY_1;
-      else
-        index = XKB_KEY_1 + g_list_model_get_n_items (G_LIST_MODEL (self->keyboard_list));
+      for (guint i = self->device_queues->len; i > 0; i--)
+        if (((DeviceQueue *)self->device_queues->pdata[i - 1])->removed)
+          g_ptr_array_remove_index (self->device_queues, i - 1);
 
-      mkt_keyboard_set_index (keyboard, index);
+      g_clear_handle_id (&self->dispatch_id, g_source_remove);
     }
+  else if (!self->dispatch_id)
+    self->dispatch_id = g_idle_add_full (DISPATCH_PRIORITY, controller_dispatch_cb,
+                                         self, NULL);
+}
 
-  sym = mkt_keyboard_feed_key (keyboard, direction, key);
+static gboolean
+controller_dispatch_cb (gpointer user_data)
+{
+  MktController *self = user_data;
 
-  /*
-   * When lock keys are pressed, the system may set LEDs for all keyboards.  We delay
-   * a bit updating LEDs so that they are re-updated after systems sets them
-   */
-  if (sym == XKB_KEY_Caps_Lock ||
-      sym == XKB_KEY_Num_Lock ||
-      sym == XKB_KEY_Scroll_Lock)
-    g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
+  g_assert (MKT_IS_CONTROLLER (self));
 
-  if (!was_enabled &&
-      mkt_keyboard_get_enabled (keyboard) &&
-      !g_list_store_find (self->keyboard_list, keyboard, NULL))
-    {
-      MKT_DEBUG_MSG ("Added new keyboard %p for libinput keyboard %p (%s)", keyboard, dev,
-                     libinput_device_get_name (dev));
-      g_list_store_append (self->keyboard_list, keyboard);
-    }
+  controller_dispatch_events (self);
+
+  /* The source is removed once there's nothing left */
+  return G_SOURCE_CONTINUE;
 }
 
 static gboolean
@@ -230,31 +909,127 @@ handle_event_libinput (GIOChannel   *source,
                        gpointer      user_data)
 {
   struct libinput *li = user_data;
-  MktController *self = libinput_get_user_data (li);
+  Seat *seat = libinput_get_user_data (li);
+  MktController *self = seat->controller;
   struct libinput_event *ev;
+  gboolean backlog;
 
   g_assert (MKT_IS_MAIN_THREAD ());
 
   libinput_dispatch (li);
+  backlog = self->n_pending_events > 0;
 
+  /* Queueing is cheap, the events are handled within a budget */
   while ((ev = libinput_get_event (li)))
+    controller_queue_event (self, ev);
+
+  /* Handle new events right away, unless there's a backlog already */
+  if (!backlog)
+    controller_dispatch_events (self);
+
+  return TRUE;
+}
+
+static void
+controller_remote_led_cb (MktKeyboard *keyboard,
+                          guint        leds,
+                          gpointer     user_data)
+{
+  MktController *self = user_data;
+  GHashTableIter iter;
+  gpointer device, value;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  if (!self->input_client)
+    return;
+
+  g_hash_table_iter_init (&iter, self->remote_keyboards);
+
+  while (g_hash_table_iter_next (&iter, &device, &value))
+    if (value == keyboard)
+      {
+        mkt_input_client_set_leds (self->input_client, GPOINTER_TO_UINT (device), leds);
+        break;
+      }
+}
+
+static void
+handle_input_broker_event (const MktInputEvent *event,
+                           gpointer             user_data)
+{
+  MktController *self = user_data;
+  MktKeyboard *keyboard;
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_CONTROLLER);
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (MKT_IS_MAIN_THREAD ());
+
+  if (!event)
+    {
+      controller_set_error (self, "Input broker disconnected");
+      return;
+    }
+
+  keyboard = g_hash_table_lookup (self->remote_keyboards, GUINT_TO_POINTER (event->device));
+
+  switch ((int)event->type)
     {
-      switch ((int)libinput_event_get_type (ev))
+    case MKT_INPUT_EVENT_DEVICE_ADDED:
+      self->hotplug_events++;
+
+      if (!keyboard)
         {
-        case LIBINPUT_EVENT_DEVICE_REMOVED:
-          handle_device_removed_event (self, ev);
-          break;
+          g_autofree char *id = NULL;
+
+          id = g_strndup (event->id, sizeof event->id);
+          keyboard = controller_find_lost_keyboard (self, *id ? id : NULL);
+
+          if (keyboard)
+            {
+              mkt_keyboard_set_led_func (keyboard, controller_remote_led_cb, self);
+              g_hash_table_insert (self->remote_keyboards,
+                                   GUINT_TO_POINTER (event->device), keyboard);
+              g_timeout_add (1, update_keyboard_leds, g_object_ref (self));
+              break;
+            }
+
+          keyboard = mkt_keyboard_new_remote (*id ? id : NULL);
+          mkt_keyboard_set_led_func (keyboard, controller_remote_led_cb, self);
+          g_hash_table_insert (self->remote_keyboards,
+                               GUINT_TO_POINTER (event->device), keyboard);
+          controller_setup_keyboard (self, keyboard);
+          controller_restore_keyboard (self, keyboard);
+        }
+      break;
 
-        case LIBINPUT_EVENT_KEYBOARD_KEY:
-          if (!self->ignore_keypress)
-            handle_keyboard_event (self, ev);
-          break;
-    }
+    case MKT_INPUT_EVENT_DEVICE_REMOVED:
+      self->hotplug_events++;
+      MKT_DEBUG_MSG ("Removed keyboard: %p, broker device: %u", keyboard, event->device);
+
+      if (keyboard)
+        {
+          mkt_keyboard_set_led_func (keyboard, NULL, NULL);
+          controller_lose_keyboard (self, keyboard);
+          g_hash_table_remove (self->remote_keyboards, GUINT_TO_POINTER (event->device));
+        }
+      break;
 
-    libinput_event_destroy (ev);
-  }
+    case MKT_INPUT_EVENT_KEY:
+      if (!keyboard)
+        break;
 
-  return TRUE;
+      if (self->ignore_keypress)
+        mkt_keyboard_count_dropped (keyboard);
+      else
+        controller_handle_key (self, keyboard,
+                               event->pressed ? XKB_KEY_DOWN : XKB_KEY_UP,
+                               event->key, event->time);
+      break;
+
+    default:
+      break;
+    }
 }
 
 static void
@@ -271,6 +1046,10 @@ mkt_controller_get_property (GObject    *object,
       g_value_set_boolean (value, !!self->error);
       break;
 
+    case PROP_READY:
+      g_value_set_boolean (value, self->state == CONTROLLER_STATE_READY);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -289,24 +1068,15 @@ mkt_controller_finalize (GObject *object)
   keyboard_list = G_LIST_MODEL (self->full_keyboard_list);
   n_items = g_list_model_get_n_items (keyboard_list);
 
-  if (n_items)
+  /* Restore the lock state of the system keyboard, if there is a display */
+  if (n_items && gdk_display_get_default ())
     {
       struct xkb_keymap *xkb_keymap;
-      struct xkb_context *context;
-      struct xkb_rule_names names;
       GdkDisplay *display;
       GdkDevice *device;
       GdkSeat *seat;
 
-      names.rules = "evdev";
-      names.model = "pc105";
-      names.layout = "us";
-      names.variant = "";
-      names.options = "";
-
-      context = xkb_context_new (0);
-      xkb_keymap = xkb_keymap_new_from_names (context, &names, 0);
-      xkb_context_unref (context);
+      xkb_keymap = mkt_keyboard_get_us_keymap ();
       display = gdk_display_get_default ();
       seat = gdk_display_get_default_seat (display);
       device = gdk_seat_get_keyboard (seat);
@@ -334,11 +1104,40 @@ mkt_controller_finalize (GObject *object)
       mkt_keyboard_update_leds (keyboard);
     }
 
+  for (guint i = 0; i < self->watch_ids->len; i++)
+    g_source_remove (g_array_index (self->watch_ids, guint, i));
+  g_clear_handle_id (&self->dispatch_id, g_source_remove);
+
+  for (guint i = 0; i < self->seats->len; i++)
+    ((Seat *)self->seats->pdata[i])->controller = NULL;
+
+  /* The keyboards may outlive us, as terminals hold them */
+  if (self->remote_keyboards)
+    {
+      GHashTableIter iter;
+      gpointer keyboard;
+
+      g_hash_table_iter_init (&iter, self->remote_keyboards);
+      while (g_hash_table_iter_next (&iter, NULL, &keyboard))
+        mkt_keyboard_set_led_func (keyboard, NULL, NULL);
+    }
+
+  g_clear_pointer (&self->input_client, mkt_input_client_free);
+  g_clear_pointer (&self->remote_keyboards, g_hash_table_unref);
+  g_clear_pointer (&self->frozen_keyboards, g_ptr_array_unref);
+  g_clear_handle_id (&self->lost_timeout_id, g_source_remove);
+  g_clear_pointer (&self->lost_keyboards, g_hash_table_unref);
+
   g_free (self->error);
   g_clear_object (&self->keyboard_list);
   g_clear_object (&self->full_keyboard_list);
-  libinput_set_user_data (self->li, NULL);
-  g_clear_pointer (&self->li, libinput_unref);
+  g_clear_pointer (&self->watch_ids, g_array_unref);
+  /* Before the contexts, as the events hold their devices */
+  g_clear_pointer (&self->device_queues, g_ptr_array_unref);
+  g_clear_pointer (&self->contexts, g_ptr_array_unref);
+  /* After the contexts, which may still open devices */
+  g_clear_pointer (&self->seats, g_ptr_array_unref);
+  g_clear_object (&self->settings);
 
   G_OBJECT_CLASS (mkt_controller_parent_class)->finalize (object);
 }
@@ -358,49 +1157,178 @@ mkt_controller_class_init (MktControllerClass *klass)
                           FALSE,
                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_READY] =
+    g_param_spec_boolean ("ready",
+                          "Ready",
+                          "Whether the input devices present on start are set up",
+                          FALSE,
+                          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
 static void
-mkt_controller_init (MktController *self)
+controller_set_ready (MktController *self)
+{
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  if (self->state == CONTROLLER_STATE_READY)
+    return;
+
+  MKT_DEBUG_MSG ("Input devices are set up");
+  self->state = CONTROLLER_STATE_READY;
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_READY]);
+}
+
+/*
+ * Creating the context opens every input device of the seat,
+ * which is slow with many devices, so it's done in a thread,
+ * while the window is built.  The US keymap every keyboard
+ * needs is compiled there too.
+ */
+static void
+controller_setup_seat_thread (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
 {
-  GIOChannel *c = NULL;
-  struct udev *udev = NULL;
+  const char *seat_name = task_data;
+  struct udev *udev;
+  struct libinput *li;
+  Seat *seat;
 
+  mkt_keyboard_get_us_keymap ();
+
+  /* udev isn't thread safe, so use one of our own */
   udev = udev_new ();
 
   if (!udev)
-    g_error ("Failed to initialize udev");
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "udev error: Failed to initialize udev");
+      return;
+    }
+
+  seat = g_new0 (Seat, 1);
+  li = libinput_udev_create_context (&interface, seat, udev);
+  udev_unref (udev);
+
+  if (!li)
+    {
+      g_free (seat);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "libinput error: Failed to initialize libinput");
+      return;
+    }
+
+  if (libinput_udev_assign_seat (li, seat_name))
+    {
+      libinput_unref (li);
+      g_free (seat);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "libinput error: Failed to assign seat");
+      return;
+    }
+
+  /* The events are handled in the main thread */
+  libinput_dispatch (li);
+  g_task_return_pointer (task, li, NULL);
+}
+
+static void
+controller_seat_ready_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  MktController *self = (MktController *)object;
+  g_autoptr(GError) error = NULL;
+  struct libinput *li;
+  GIOChannel *channel;
+  Seat *seat;
+  guint watch_id;
 
-  self->li = libinput_udev_create_context (&interface, self, udev);
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (G_IS_TASK (result));
+
+  li = g_task_propagate_pointer (G_TASK (result), &error);
+  self->pending_seats--;
+
+  if (!li)
+    {
+      /* Don't abort on failures, so that virtual keyboards can still be used */
+      g_warning ("Failed to set up seat '%s': %s",
+                 (char *)g_task_get_task_data (G_TASK (result)), error->message);
+      controller_set_error (self, error->message);
+    }
+  else
+    {
+      MKT_DEBUG_MSG ("Handling keyboards from seat '%s'",
+                     (char *)g_task_get_task_data (G_TASK (result)));
+
+      seat = libinput_get_user_data (li);
+      seat->controller = self;
+      g_ptr_array_add (self->seats, seat);
+
+      if (seat->open_failed)
+        controller_set_error (self, "libinput error: Failed to open input event");
 
-  if (!self->li)
-    g_error ("Failed to initialize libinput path context");
+      g_ptr_array_add (self->contexts, li);
 
-  if (libinput_udev_assign_seat (self->li, "seat0"))
-    g_error ("failed to set seat");
+      channel = g_io_channel_unix_new (libinput_get_fd (li));
+      g_io_channel_set_encoding (channel, NULL, NULL);
+      watch_id = g_io_add_watch (channel, G_IO_IN, handle_event_libinput, li);
+      g_array_append_val (self->watch_ids, watch_id);
+      g_io_channel_unref (channel);
 
-  libinput_set_user_data (self->li, self);
+      handle_event_libinput (NULL, 0, li);
+    }
+
+  if (!self->pending_seats)
+    controller_set_ready (self);
+}
+
+static void
+controller_add_seat (MktController *self,
+                     const char    *seat)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (MKT_IS_CONTROLLER (self));
+  g_assert (seat && *seat);
+
+  task = g_task_new (self, NULL, controller_seat_ready_cb, NULL);
+  g_task_set_source_tag (task, controller_add_seat);
+  g_task_set_task_data (task, g_strdup (seat), g_free);
+  self->pending_seats++;
+  self->state = CONTROLLER_STATE_STARTING;
+  g_task_run_in_thread (task, controller_setup_seat_thread);
+}
 
+static void
+mkt_controller_init (MktController *self)
+{
   self->keyboard_list = g_list_store_new (MKT_TYPE_KEYBOARD);
   self->full_keyboard_list = g_list_store_new (MKT_TYPE_KEYBOARD);
-
-  c = g_io_channel_unix_new (libinput_get_fd (self->li));
-  g_io_channel_set_encoding (c, NULL, NULL);
-  g_io_add_watch (c, G_IO_IN, handle_event_libinput, self->li);
-  handle_event_libinput (NULL, 0, self->li);
+  self->contexts = g_ptr_array_new_with_free_func ((GDestroyNotify)libinput_unref);
+  self->seats = g_ptr_array_new_with_free_func (g_free);
+  self->watch_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->remote_keyboards = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                  NULL, g_object_unref);
+  self->frozen_keyboards = g_ptr_array_new_with_free_func (g_object_unref);
+  self->device_queues = g_ptr_array_new_with_free_func (device_queue_free);
+  self->lost_keyboards = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, lost_keyboard_free);
+  self->state = CONTROLLER_STATE_NEW;
 }
 
 static void
 controller_kbd_layout_changed_cb (MktController *self)
 {
   GListModel *keyboards;
-  const char *layout;
   guint n_items;
 
   g_assert (MKT_IS_CONTROLLER (self));
 
-  layout = mkt_settings_get_kbd_layout (self->settings);
   keyboards = G_LIST_MODEL (self->full_keyboard_list);
   n_items = g_list_model_get_n_items (keyboards);
 
@@ -409,16 +1337,34 @@ controller_kbd_layout_changed_cb (MktController *self)
       g_autoptr(MktKeyboard) keyboard = NULL;
 
       keyboard = g_list_model_get_item (keyboards, i);
-      mkt_keyboard_set_layout (keyboard, layout);
+      controller_update_keyboard_layout (self, keyboard);
     }
 }
 
-MktController *
-mkt_controller_new (MktSettings *settings)
+static void
+controller_key_limits_changed_cb (MktController *self)
 {
-  MktController *self;
+  GListModel *keyboards;
+  guint n_items;
 
-  g_return_val_if_fail (MKT_IS_SETTINGS (settings), NULL);
+  g_assert (MKT_IS_CONTROLLER (self));
+
+  keyboards = G_LIST_MODEL (self->full_keyboard_list);
+  n_items = g_list_model_get_n_items (keyboards);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (keyboards, i);
+      controller_update_keyboard_limits (self, keyboard);
+    }
+}
+
+static MktController *
+controller_new (MktSettings *settings)
+{
+  MktController *self;
 
   self = g_object_new (MKT_TYPE_CONTROLLER, NULL);
   g_set_object (&self->settings, settings);
@@ -427,6 +1373,76 @@ mkt_controller_new (MktSettings *settings)
                            "kbd-layout-changed",
                            G_CALLBACK (controller_kbd_layout_changed_cb),
                            self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::key-rate-limit",
+                           G_CALLBACK (controller_key_limits_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::key-burst",
+                           G_CALLBACK (controller_key_limits_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::stuck-key-timeout",
+                           G_CALLBACK (controller_key_limits_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+
+  return self;
+}
+
+MktController *
+mkt_controller_new (MktSettings *settings)
+{
+  const char * const *seats;
+  MktController *self;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (settings), NULL);
+
+  self = controller_new (settings);
+  seats = mkt_settings_get_seats (self->settings);
+
+  /* Each seat thread reports its own udev and libinput errors */
+  for (guint i = 0; seats[i]; i++)
+    controller_add_seat (self, seats[i]);
+
+  if (self->state == CONTROLLER_STATE_NEW)
+    controller_set_ready (self);
+
+  return self;
+}
+
+/**
+ * mkt_controller_new_for_broker:
+ * @settings: A #MktSettings
+ * @socket_path: The socket of the input broker
+ *
+ * Create a new controller that gets the input events
+ * from multi-keyterm-input-broker listening on
+ * @socket_path, instead of opening the input devices,
+ * so that no privileges are required.
+ *
+ * Returns: (transfer full): A #MktController
+ */
+MktController *
+mkt_controller_new_for_broker (MktSettings *settings,
+                               const char  *socket_path)
+{
+  g_autoptr(GError) error = NULL;
+  MktController *self;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (settings), NULL);
+  g_return_val_if_fail (socket_path && *socket_path, NULL);
+
+  self = controller_new (settings);
+  self->input_client = mkt_input_client_new (socket_path,
+                                             handle_input_broker_event,
+                                             self, &error);
+
+  if (!self->input_client)
+    {
+      g_warning ("Failed to connect to input broker at %s: %s",
+                 socket_path, error->message);
+      controller_set_error (self, "Failed to connect to input broker");
+    }
+
+  /* The broker sends the devices it has as they are added */
+  controller_set_ready (self);
 
   return self;
 }
@@ -439,6 +1455,77 @@ mkt_controller_get_keyboard_list (MktController *self)
   return G_LIST_MODEL (self->keyboard_list);
 }
 
+/**
+ * mkt_controller_add_keyboard:
+ * @self: A #MktController
+ * @keyboard: A #MktKeyboard
+ *
+ * Add @keyboard to the list of keyboards, as if a key
+ * was pressed from it.  This is useful to add virtual
+ * keyboards not backed by libinput.  If @keyboard has
+ * no slot yet, the first free slot is assigned.
+ */
+void
+mkt_controller_add_keyboard (MktController *self,
+                             MktKeyboard   *keyboard)
+{
+  g_return_if_fail (MKT_IS_CONTROLLER (self));
+  g_return_if_fail (MKT_IS_KEYBOARD (keyboard));
+
+  if (!g_list_store_find (self->full_keyboard_list, keyboard, NULL))
+    g_list_store_append (self->full_keyboard_list, keyboard);
+
+  if (g_list_store_find (self->keyboard_list, keyboard, NULL))
+    return;
+
+  if (mkt_keyboard_get_index (keyboard) == XKB_KEY_0 &&
+      !mkt_keyboard_get_enabled (keyboard))
+    {
+      guint32 index;
+
+      index = controller_get_free_index (self);
+
+      if (index)
+        mkt_keyboard_set_index (keyboard, index);
+    }
+
+  controller_insert_keyboard (self, keyboard);
+}
+
+/**
+ * mkt_controller_get_keyboard_for_slot:
+ * @self: A #MktController
+ * @slot: The slot number, from 1 to 9
+ *
+ * Get the keyboard claimed for the terminal in @slot.
+ *
+ * Returns: (transfer none) (nullable): The keyboard
+ */
+MktKeyboard *
+mkt_controller_get_keyboard_for_slot (MktController *self,
+                                      guint          slot)
+{
+  GListModel *keyboard_list;
+  guint n_items;
+
+  g_return_val_if_fail (MKT_IS_CONTROLLER (self), NULL);
+
+  keyboard_list = G_LIST_MODEL (self->keyboard_list);
+  n_items = g_list_model_get_n_items (keyboard_list);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+
+      if (mkt_keyboard_get_index (keyboard) == XKB_KEY_0 + slot)
+        return keyboard;
+    }
+
+  return NULL;
+}
+
 void
 mkt_controller_remove_keyboard (MktController *self,
                                 MktKeyboard   *keyboard)
@@ -477,6 +1564,41 @@ mkt_controller_ignore_keypress (MktController *self,
     }
 }
 
+/**
+ * mkt_controller_get_ready:
+ * @self: A #MktController
+ *
+ * Get if the input devices present when @self was created
+ * are set up.  This is done in the background, and the
+ * "ready" property is notified when done.
+ *
+ * Returns: %TRUE if the devices are set up
+ */
+gboolean
+mkt_controller_get_ready (MktController *self)
+{
+  g_return_val_if_fail (MKT_IS_CONTROLLER (self), FALSE);
+
+  return self->state == CONTROLLER_STATE_READY;
+}
+
+/**
+ * mkt_controller_get_hotplug_events:
+ * @self: A #MktController
+ *
+ * Get the number of input devices added and removed,
+ * including those found when seats are set up.
+ *
+ * Returns: The number of device events
+ */
+guint64
+mkt_controller_get_hotplug_events (MktController *self)
+{
+  g_return_val_if_fail (MKT_IS_CONTROLLER (self), 0);
+
+  return self->hotplug_events;
+}
+
 const char *
 mkt_controller_get_error (MktController *self)
 {
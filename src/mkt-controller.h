@@ -34,11 +34,19 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (MktController, mkt_controller, MKT, CONTROLLER, GObject)
 
 MktController *mkt_controller_new               (MktSettings   *settings);
+MktController *mkt_controller_new_for_broker    (MktSettings   *settings,
+                                                 const char    *socket_path);
 GListModel    *mkt_controller_get_keyboard_list (MktController *self);
+void           mkt_controller_add_keyboard      (MktController *self,
+                                                 MktKeyboard   *keyboard);
 void           mkt_controller_remove_keyboard   (MktController *self,
                                                  MktKeyboard   *keyboard);
+MktKeyboard   *mkt_controller_get_keyboard_for_slot (MktController *self,
+                                                     guint          slot);
 void           mkt_controller_ignore_keypress   (MktController *self,
                                                  gboolean       ignore);
+gboolean       mkt_controller_get_ready         (MktController *self);
+guint64        mkt_controller_get_hotplug_events (MktController *self);
 const char    *mkt_controller_get_error         (MktController *self);
 
 G_END_DECLS
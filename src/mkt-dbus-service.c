@@ -0,0 +1,485 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-dbus-service.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#define G_LOG_DOMAIN "mkt-dbus-service"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-dbus-service.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-dbus-service
+ * @title: MktDbusService
+ * @short_description: D-Bus interface to inspect and control the controller
+ * @include: "mkt-dbus-service.h"
+ *
+ * Exports org.sadiqpk.MultiKeyterm.Controller interface, which
+ * lists the keyboards claimed for terminals along with their
+ * statistics, and allows injecting keys to them.
+ *
+ * The interface is exported on the application bus connection.
+ * When running as root, there usually is no session bus, so a
+ * peer-to-peer socket can be listened on, that only the same
+ * user can connect to, eg:
+ *
+ * |[
+ * gdbus call -a unix:path=/run/user/0/multi-keyterm/bus \
+ *   -o /org/sadiqpk/multi_keyterm \
+ *   -m org.sadiqpk.MultiKeyterm.Controller.ListKeyboards
+ * ]|
+ */
+
+#define OBJECT_PATH "/org/sadiqpk/multi_keyterm"
+
+typedef struct
+{
+  GDBusConnection *connection;
+  guint            id;
+} Registration;
+
+struct _MktDbusService
+{
+  GObject          parent_instance;
+
+  MktController   *controller;
+  GDBusServer     *server;
+  char            *socket_path;
+  /* GDBusConnection to Registration */
+  GHashTable      *registrations;
+};
+
+G_DEFINE_TYPE (MktDbusService, mkt_dbus_service, G_TYPE_OBJECT)
+
+static const char introspection_xml[] =
+  "<node>"
+  "  <interface name='org.sadiqpk.MultiKeyterm.Controller'>"
+  "    <method name='ListKeyboards'>"
+  "      <arg type='a(usb)' name='keyboards' direction='out'/>"
+  "    </method>"
+  "    <method name='GetStats'>"
+  "      <arg type='u' name='slot' direction='in'/>"
+  "      <arg type='a{sv}' name='stats' direction='out'/>"
+  "    </method>"
+  "    <method name='AddVirtualKeyboard'>"
+  "      <arg type='u' name='slot' direction='out'/>"
+  "    </method>"
+  "    <method name='InjectKey'>"
+  "      <arg type='u' name='slot' direction='in'/>"
+  "      <arg type='u' name='keycode' direction='in'/>"
+  "      <arg type='b' name='pressed' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static GDBusNodeInfo *introspection_data;
+
+static GVariant *
+dbus_service_list_keyboards (MktDbusService *self)
+{
+  GVariantBuilder builder;
+  GListModel *keyboard_list;
+  guint n_items;
+
+  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
+  n_items = g_list_model_get_n_items (keyboard_list);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(usb)"));
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+      const char *id;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+      id = mkt_keyboard_get_id (keyboard);
+      g_variant_builder_add (&builder, "(usb)",
+                             mkt_keyboard_get_index (keyboard) - XKB_KEY_0,
+                             id ?: "",
+                             mkt_keyboard_get_enabled (keyboard));
+    }
+
+  return g_variant_new ("(a(usb))", &builder);
+}
+
+static GVariant *
+dbus_service_get_stats (MktDbusService *self,
+                        MktKeyboard    *keyboard)
+{
+  const MktKeyboardStats *stats;
+  GVariantBuilder builder;
+
+  stats = mkt_keyboard_get_stats (keyboard);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_variant_builder_add (&builder, "{sv}", "events", g_variant_new_uint64 (stats->events));
+  g_variant_builder_add (&builder, "{sv}", "repeats", g_variant_new_uint64 (stats->repeats));
+  g_variant_builder_add (&builder, "{sv}", "dropped", g_variant_new_uint64 (stats->dropped));
+  g_variant_builder_add (&builder, "{sv}", "bytes-written",
+                         g_variant_new_uint64 (stats->bytes_written));
+  g_variant_builder_add (&builder, "{sv}", "latency-p50-us",
+                         g_variant_new_uint64 (mkt_keyboard_stats_get_latency_percentile (stats, 0.5)));
+  g_variant_builder_add (&builder, "{sv}", "latency-p90-us",
+                         g_variant_new_uint64 (mkt_keyboard_stats_get_latency_percentile (stats, 0.9)));
+  g_variant_builder_add (&builder, "{sv}", "latency-p99-us",
+                         g_variant_new_uint64 (mkt_keyboard_stats_get_latency_percentile (stats, 0.99)));
+  g_variant_builder_add (&builder, "{sv}", "latency-histogram",
+                         g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                    stats->latency,
+                                                    MKT_KEYBOARD_LATENCY_BUCKETS,
+                                                    sizeof (guint64)));
+
+  return g_variant_new ("(a{sv})", &builder);
+}
+
+static void
+dbus_service_method_call (GDBusConnection       *connection,
+                          const char            *sender,
+                          const char            *object_path,
+                          const char            *interface_name,
+                          const char            *method_name,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation,
+                          gpointer               user_data)
+{
+  MktDbusService *self = user_data;
+  MktKeyboard *keyboard = NULL;
+  guint slot = 0;
+
+  g_assert (MKT_IS_DBUS_SERVICE (self));
+
+  MKT_TRACE_MSG ("D-Bus method '%s' called by '%s'", method_name, sender ?: "peer");
+
+  if (g_str_equal (method_name, "ListKeyboards"))
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             dbus_service_list_keyboards (self));
+      return;
+    }
+
+  if (g_str_equal (method_name, "AddVirtualKeyboard"))
+    {
+      g_autoptr(MktKeyboard) virtual = NULL;
+
+      virtual = mkt_keyboard_new_virtual ();
+      mkt_controller_add_keyboard (self->controller, virtual);
+
+      if (mkt_keyboard_get_index (virtual) == XKB_KEY_0)
+        {
+          mkt_controller_remove_keyboard (self->controller, virtual);
+          g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                         G_DBUS_ERROR_LIMITS_EXCEEDED,
+                                                         "No free slot left");
+          return;
+        }
+
+      mkt_keyboard_set_enabled (virtual, TRUE);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(u)",
+                                                            mkt_keyboard_get_index (virtual) - XKB_KEY_0));
+      return;
+    }
+
+  /* Rest of the methods take the slot as the first argument */
+  g_variant_get_child (parameters, 0, "u", &slot);
+  keyboard = mkt_controller_get_keyboard_for_slot (self->controller, slot);
+
+  if (!keyboard)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_INVALID_ARGS,
+                                             "No keyboard in slot %u", slot);
+      return;
+    }
+
+  if (g_str_equal (method_name, "GetStats"))
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             dbus_service_get_stats (self, keyboard));
+    }
+  else if (g_str_equal (method_name, "InjectKey"))
+    {
+      gboolean pressed;
+      guint keycode;
+
+      g_variant_get (parameters, "(uub)", NULL, &keycode, &pressed);
+      mkt_keyboard_feed_key (keyboard, pressed ? XKB_KEY_DOWN : XKB_KEY_UP, keycode);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_UNKNOWN_METHOD,
+                                             "Unknown method '%s'", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+  dbus_service_method_call,
+  NULL,
+  NULL,
+};
+
+static void
+dbus_service_connection_closed_cb (MktDbusService  *self,
+                                   gboolean         remote_peer_vanished,
+                                   GError          *error,
+                                   GDBusConnection *connection)
+{
+  g_assert (MKT_IS_DBUS_SERVICE (self));
+
+  MKT_DEBUG_MSG ("D-Bus peer connection %p closed", connection);
+  g_hash_table_remove (self->registrations, connection);
+}
+
+static gboolean
+dbus_service_new_connection_cb (MktDbusService  *self,
+                                GDBusConnection *connection)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MKT_IS_DBUS_SERVICE (self));
+
+  MKT_DEBUG_MSG ("New D-Bus peer connection %p", connection);
+
+  if (!mkt_dbus_service_export (self, connection, OBJECT_PATH, &error))
+    {
+      g_warning ("Failed to export D-Bus interface on peer: %s", error->message);
+      return FALSE;
+    }
+
+  g_signal_connect_object (connection, "closed",
+                           G_CALLBACK (dbus_service_connection_closed_cb),
+                           self, G_CONNECT_SWAPPED);
+
+  return TRUE;
+}
+
+static gboolean
+dbus_service_authorize_peer_cb (GDBusAuthObserver *observer,
+                                GIOStream         *stream,
+                                GCredentials      *credentials)
+{
+  /* Only the same user can connect */
+  if (!credentials)
+    return FALSE;
+
+  return g_credentials_get_unix_user (credentials, NULL) == geteuid ();
+}
+
+static void
+mkt_dbus_service_finalize (GObject *object)
+{
+  MktDbusService *self = (MktDbusService *)object;
+
+  if (self->server)
+    g_dbus_server_stop (self->server);
+
+  if (self->socket_path)
+    g_unlink (self->socket_path);
+
+  g_clear_pointer (&self->registrations, g_hash_table_unref);
+  g_clear_object (&self->server);
+  g_clear_object (&self->controller);
+  g_free (self->socket_path);
+
+  G_OBJECT_CLASS (mkt_dbus_service_parent_class)->finalize (object);
+}
+
+static void
+mkt_dbus_service_class_init (MktDbusServiceClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = mkt_dbus_service_finalize;
+
+  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (introspection_data);
+}
+
+static void
+registration_free (gpointer data)
+{
+  Registration *registration = data;
+
+  g_dbus_connection_unregister_object (registration->connection, registration->id);
+  g_object_unref (registration->connection);
+  g_free (registration);
+}
+
+static void
+mkt_dbus_service_init (MktDbusService *self)
+{
+  self->registrations = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                               NULL, registration_free);
+}
+
+MktDbusService *
+mkt_dbus_service_new (MktController *controller)
+{
+  MktDbusService *self;
+
+  g_return_val_if_fail (MKT_IS_CONTROLLER (controller), NULL);
+
+  self = g_object_new (MKT_TYPE_DBUS_SERVICE, NULL);
+  self->controller = g_object_ref (controller);
+
+  return self;
+}
+
+/**
+ * mkt_dbus_service_export:
+ * @self: A #MktDbusService
+ * @connection: A #GDBusConnection
+ * @object_path: (nullable): The object path
+ * @error: A location for #GError
+ *
+ * Export the interface on @connection at @object_path.  The
+ * interface is unexported when @self is finalized.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ */
+gboolean
+mkt_dbus_service_export (MktDbusService   *self,
+                         GDBusConnection  *connection,
+                         const char       *object_path,
+                         GError          **error)
+{
+  Registration *registration;
+  guint id;
+
+  g_return_val_if_fail (MKT_IS_DBUS_SERVICE (self), FALSE);
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), FALSE);
+
+  if (g_hash_table_contains (self->registrations, connection))
+    return TRUE;
+
+  id = g_dbus_connection_register_object (connection,
+                                          object_path ?: OBJECT_PATH,
+                                          introspection_data->interfaces[0],
+                                          &interface_vtable,
+                                          self, NULL, error);
+
+  if (!id)
+    return FALSE;
+
+  /* Keep the connection alive until unregistered */
+  registration = g_new0 (Registration, 1);
+  registration->connection = g_object_ref (connection);
+  registration->id = id;
+  g_hash_table_insert (self->registrations, connection, registration);
+
+  return TRUE;
+}
+
+/**
+ * mkt_dbus_service_listen:
+ * @self: A #MktDbusService
+ * @error: A location for #GError
+ *
+ * Listen for peer-to-peer connections on a unix socket in
+ * the user runtime directory, see mkt_dbus_service_get_address().
+ * The interface is exported on each connection.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ */
+gboolean
+mkt_dbus_service_listen (MktDbusService  *self,
+                         GError         **error)
+{
+  g_autoptr(GDBusAuthObserver) observer = NULL;
+  g_autofree char *address = NULL;
+  g_autofree char *guid = NULL;
+  g_autofree char *dir = NULL;
+
+  g_return_val_if_fail (MKT_IS_DBUS_SERVICE (self), FALSE);
+
+  if (self->server)
+    return TRUE;
+
+  dir = g_build_filename (g_get_user_runtime_dir (), PACKAGE_NAME, NULL);
+
+  if (g_mkdir_with_parents (dir, 0700) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to create %s: %s", dir, g_strerror (errsv));
+      return FALSE;
+    }
+
+  self->socket_path = g_build_filename (dir, "bus", NULL);
+  /* Remove stale socket from a previous run, if any */
+  g_unlink (self->socket_path);
+
+  address = g_strdup_printf ("unix:path=%s", self->socket_path);
+  guid = g_dbus_generate_guid ();
+  observer = g_dbus_auth_observer_new ();
+  g_signal_connect (observer, "authorize-authenticated-peer",
+                    G_CALLBACK (dbus_service_authorize_peer_cb), NULL);
+
+  self->server = g_dbus_server_new_sync (address, G_DBUS_SERVER_FLAGS_NONE,
+                                         guid, observer, NULL, error);
+
+  if (!self->server)
+    {
+      g_clear_pointer (&self->socket_path, g_free);
+      return FALSE;
+    }
+
+  g_signal_connect_object (self->server, "new-connection",
+                           G_CALLBACK (dbus_service_new_connection_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_dbus_server_start (self->server);
+  g_info ("Listening for D-Bus peers on %s", address);
+
+  return TRUE;
+}
+
+/**
+ * mkt_dbus_service_get_address:
+ * @self: A #MktDbusService
+ *
+ * Get the address to connect to for peer-to-peer
+ * D-Bus connections, see mkt_dbus_service_listen()
+ *
+ * Returns: (nullable): The address, or %NULL if not listening
+ */
+const char *
+mkt_dbus_service_get_address (MktDbusService *self)
+{
+  g_return_val_if_fail (MKT_IS_DBUS_SERVICE (self), NULL);
+
+  if (!self->server)
+    return NULL;
+
+  return g_dbus_server_get_client_address (self->server);
+}
@@ -0,0 +1,47 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-dbus-service.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "mkt-controller.h"
+
+G_BEGIN_DECLS
+
+#define MKT_TYPE_DBUS_SERVICE (mkt_dbus_service_get_type ())
+
+G_DECLARE_FINAL_TYPE (MktDbusService, mkt_dbus_service, MKT, DBUS_SERVICE, GObject)
+
+MktDbusService *mkt_dbus_service_new      (MktController   *controller);
+gboolean        mkt_dbus_service_export   (MktDbusService  *self,
+                                           GDBusConnection *connection,
+                                           const char      *object_path,
+                                           GError         **error);
+gboolean        mkt_dbus_service_listen   (MktDbusService  *self,
+                                           GError         **error);
+const char     *mkt_dbus_service_get_address (MktDbusService *self);
+
+G_END_DECLS
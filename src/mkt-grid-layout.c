@@ -0,0 +1,418 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-grid-layout.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-grid-layout"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "mkt-grid-layout.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-grid-layout
+ * @title: MktGridLayout
+ * @short_description: Tiling layout manager for terminals
+ * @include: "mkt-grid-layout.h"
+ *
+ * A layout manager that tiles its children into a grid of
+ * equally sized cells.  The number of rows and columns is
+ * chosen so that each cell is as close as possible to the
+ * shape of a standard terminal in the font of the terminals,
+ * see mkt_grid_layout_set_char_size().  The result is cached
+ * until the number of children or the allocated size change.
+ *
+ * Setters only queue a relayout, so any number of changes
+ * within a frame results in a single allocation.
+ */
+
+/* Cells are preferred in the shape of a 80×24 terminal */
+#define CELL_COLUMNS     80
+#define CELL_ROWS        24
+/* And not smaller than this, if possible */
+#define MIN_CELL_COLUMNS 30
+#define MIN_CELL_ROWS    8
+
+/* A typical monospace font, until the real one is set */
+#define DEFAULT_CHAR_WIDTH  8
+#define DEFAULT_CHAR_HEIGHT 16
+
+struct _MktGridLayout
+{
+  GtkLayoutManager parent_instance;
+
+  int        char_width;
+  int        char_height;
+  int        single_column_height;
+  gboolean   expand_last_row;
+
+  /* Grid size cache of the last allocation */
+  guint      n_items;
+  int        width;
+  int        height;
+  guint      rows;
+  guint      columns;
+  gboolean   cache_valid;
+};
+
+G_DEFINE_TYPE (MktGridLayout, mkt_grid_layout, GTK_TYPE_LAYOUT_MANAGER)
+
+static void
+grid_layout_invalidate (MktGridLayout *self)
+{
+  g_assert (MKT_IS_GRID_LAYOUT (self));
+
+  self->cache_valid = FALSE;
+  gtk_layout_manager_layout_changed (GTK_LAYOUT_MANAGER (self));
+}
+
+static void
+grid_layout_update_grid_size (MktGridLayout *self,
+                              guint          n_items,
+                              int            width,
+                              int            height)
+{
+  g_assert (MKT_IS_GRID_LAYOUT (self));
+
+  if (self->cache_valid &&
+      self->n_items == n_items &&
+      self->width == width &&
+      self->height == height)
+    return;
+
+  mkt_grid_layout_compute (n_items, width, height,
+                           MIN_CELL_COLUMNS * self->char_width,
+                           MIN_CELL_ROWS * self->char_height,
+                           (double)(CELL_COLUMNS * self->char_width) /
+                           (CELL_ROWS * self->char_height),
+                           self->single_column_height,
+                           &self->rows, &self->columns);
+
+  if (self->n_items != n_items || !self->cache_valid)
+    MKT_TRACE_MSG ("%u items, grid size: %u×%u", n_items, self->rows, self->columns);
+
+  self->n_items = n_items;
+  self->width = width;
+  self->height = height;
+  self->cache_valid = TRUE;
+}
+
+static GtkSizeRequestMode
+mkt_grid_layout_get_request_mode (GtkLayoutManager *manager,
+                                  GtkWidget        *widget)
+{
+  return GTK_SIZE_REQUEST_CONSTANT_SIZE;
+}
+
+static void
+mkt_grid_layout_measure (GtkLayoutManager *manager,
+                         GtkWidget        *widget,
+                         GtkOrientation    orientation,
+                         int               for_size,
+                         int              *minimum,
+                         int              *natural,
+                         int              *minimum_baseline,
+                         int              *natural_baseline)
+{
+  int min = 0, nat = 0;
+
+  /*
+   * We always fill the space given, so just ask for enough
+   * space to fit a single child.  The children have to
+   * shrink to the cell size as the number of items grow.
+   */
+  for (GtkWidget *child = gtk_widget_get_first_child (widget);
+       child != NULL;
+       child = gtk_widget_get_next_sibling (child))
+    {
+      int child_min, child_nat;
+
+      if (!gtk_widget_should_layout (child))
+        continue;
+
+      gtk_widget_measure (child, orientation, -1,
+                          &child_min, &child_nat, NULL, NULL);
+      min = MAX (min, child_min);
+      nat = MAX (nat, child_nat);
+    }
+
+  *minimum = min;
+  *natural = nat;
+}
+
+static void
+mkt_grid_layout_allocate (GtkLayoutManager *manager,
+                          GtkWidget        *widget,
+                          int               width,
+                          int               height,
+                          int               baseline)
+{
+  MktGridLayout *self = (MktGridLayout *)manager;
+  guint n_items = 0, index = 0;
+
+  for (GtkWidget *child = gtk_widget_get_first_child (widget);
+       child != NULL;
+       child = gtk_widget_get_next_sibling (child))
+    if (gtk_widget_should_layout (child))
+      n_items++;
+
+  if (!n_items)
+    return;
+
+  grid_layout_update_grid_size (self, n_items, width, height);
+
+  for (GtkWidget *child = gtk_widget_get_first_child (widget);
+       child != NULL;
+       child = gtk_widget_get_next_sibling (child))
+    {
+      GtkAllocation allocation;
+      guint row, column, row_items;
+      int min_width, min_height;
+
+      if (!gtk_widget_should_layout (child))
+        continue;
+
+      row = index / self->columns;
+      column = index % self->columns;
+      row_items = self->columns;
+      index++;
+
+      /* Let the items in the last row share the free space */
+      if (self->expand_last_row && row == self->rows - 1)
+        row_items = n_items - row * self->columns;
+
+      allocation.x = column * width / row_items;
+      allocation.y = row * height / self->rows;
+      allocation.width = (column + 1) * width / row_items - allocation.x;
+      allocation.height = (row + 1) * height / self->rows - allocation.y;
+
+      gtk_widget_measure (child, GTK_ORIENTATION_HORIZONTAL, -1,
+                          &min_width, NULL, NULL, NULL);
+      gtk_widget_measure (child, GTK_ORIENTATION_VERTICAL, -1,
+                          &min_height, NULL, NULL, NULL);
+
+      /* The overflow is clipped by the parent */
+      allocation.width = MAX (allocation.width, min_width);
+      allocation.height = MAX (allocation.height, min_height);
+
+      gtk_widget_size_allocate (child, &allocation, -1);
+    }
+}
+
+static void
+mkt_grid_layout_class_init (MktGridLayoutClass *klass)
+{
+  GtkLayoutManagerClass *layout_class = GTK_LAYOUT_MANAGER_CLASS (klass);
+
+  layout_class->get_request_mode = mkt_grid_layout_get_request_mode;
+  layout_class->measure = mkt_grid_layout_measure;
+  layout_class->allocate = mkt_grid_layout_allocate;
+}
+
+static void
+mkt_grid_layout_init (MktGridLayout *self)
+{
+  self->char_width = DEFAULT_CHAR_WIDTH;
+  self->char_height = DEFAULT_CHAR_HEIGHT;
+}
+
+GtkLayoutManager *
+mkt_grid_layout_new (void)
+{
+  return g_object_new (MKT_TYPE_GRID_LAYOUT, NULL);
+}
+
+/**
+ * mkt_grid_layout_set_char_size:
+ * @self: A #MktGridLayout
+ * @width: The character width of the terminal font
+ * @height: The character height of the terminal font
+ *
+ * Set the character size of the terminals.  Cells are
+ * preferred in the shape of a 80×24 terminal, and grid
+ * sizes that keep cells larger than 30×8 characters are
+ * preferred over those that don't, regardless of shape.
+ */
+void
+mkt_grid_layout_set_char_size (MktGridLayout *self,
+                               int            width,
+                               int            height)
+{
+  g_return_if_fail (MKT_IS_GRID_LAYOUT (self));
+  g_return_if_fail (width > 0 && height > 0);
+
+  if (self->char_width == width &&
+      self->char_height == height)
+    return;
+
+  self->char_width = width;
+  self->char_height = height;
+  grid_layout_invalidate (self);
+}
+
+/**
+ * mkt_grid_layout_set_single_column_height:
+ * @self: A #MktGridLayout
+ * @height: The minimum height of a row, or 0
+ *
+ * If @height is non-zero, stack all items in a single
+ * column as long as each item can get at least @height
+ * pixels height.
+ */
+void
+mkt_grid_layout_set_single_column_height (MktGridLayout *self,
+                                          int            height)
+{
+  g_return_if_fail (MKT_IS_GRID_LAYOUT (self));
+  g_return_if_fail (height >= 0);
+
+  if (self->single_column_height == height)
+    return;
+
+  self->single_column_height = height;
+  grid_layout_invalidate (self);
+}
+
+/**
+ * mkt_grid_layout_set_expand_last_row:
+ * @self: A #MktGridLayout
+ * @expand: Whether to expand the last row
+ *
+ * Set whether the items in the last row, if the row is
+ * not full, should expand to fill the whole row.
+ */
+void
+mkt_grid_layout_set_expand_last_row (MktGridLayout *self,
+                                     gboolean       expand)
+{
+  g_return_if_fail (MKT_IS_GRID_LAYOUT (self));
+
+  expand = !!expand;
+
+  if (self->expand_last_row == expand)
+    return;
+
+  self->expand_last_row = expand;
+  gtk_layout_manager_layout_changed (GTK_LAYOUT_MANAGER (self));
+}
+
+/**
+ * mkt_grid_layout_get_grid_size:
+ * @self: A #MktGridLayout
+ * @rows: (out) (optional): return location for rows
+ * @columns: (out) (optional): return location for columns
+ *
+ * Get the grid size used in the last allocation.
+ */
+void
+mkt_grid_layout_get_grid_size (MktGridLayout *self,
+                               guint         *rows,
+                               guint         *columns)
+{
+  g_return_if_fail (MKT_IS_GRID_LAYOUT (self));
+
+  if (rows)
+    *rows = self->cache_valid ? self->rows : 0;
+  if (columns)
+    *columns = self->cache_valid ? self->columns : 0;
+}
+
+/**
+ * mkt_grid_layout_compute:
+ * @n_items: The number of items to tile
+ * @width: The available width
+ * @height: The available height
+ * @min_cell_width: The minimum preferred cell width
+ * @min_cell_height: The minimum preferred cell height
+ * @cell_aspect_ratio: The preferred width/height ratio of a cell
+ * @single_column_height: The minimum row height for a single
+ *   column layout, or 0 to disable
+ * @rows: (out): return location for rows
+ * @columns: (out): return location for columns
+ *
+ * Compute the grid size to tile @n_items in the given
+ * area.  Column counts that would leave a full row empty
+ * are skipped, and among the remaining ones, the one that
+ * fits the largest terminal shaped box in a cell is chosen.
+ */
+void
+mkt_grid_layout_compute (guint  n_items,
+                         int    width,
+                         int    height,
+                         int    min_cell_width,
+                         int    min_cell_height,
+                         double cell_aspect_ratio,
+                         int    single_column_height,
+                         guint *rows,
+                         guint *columns)
+{
+  double best_score = -1.0;
+  gboolean best_fits = FALSE;
+  guint best_columns = 1;
+
+  g_return_if_fail (rows && columns);
+  g_return_if_fail (cell_aspect_ratio > 0.0);
+
+  if (n_items == 0)
+    {
+      *rows = *columns = 0;
+      return;
+    }
+
+  if (single_column_height > 0 &&
+      (gint64)n_items * single_column_height <= height)
+    {
+      *rows = n_items;
+      *columns = 1;
+      return;
+    }
+
+  for (guint n_columns = 1; n_columns <= n_items; n_columns++)
+    {
+      guint n_rows = (n_items + n_columns - 1) / n_columns;
+      double cell_width, cell_height, score;
+      gboolean fits;
+
+      /* Same rows with fewer columns, which is always better */
+      if (n_columns > 1 && n_rows * (n_columns - 1) >= n_items)
+        continue;
+
+      cell_width = (double)width / n_columns;
+      cell_height = (double)height / n_rows;
+      fits = cell_width >= min_cell_width && cell_height >= min_cell_height;
+      score = MIN (cell_width / cell_aspect_ratio, cell_height);
+
+      if ((fits && !best_fits) ||
+          (fits == best_fits && score > best_score))
+        {
+          best_fits = fits;
+          best_score = score;
+          best_columns = n_columns;
+        }
+    }
+
+  *columns = best_columns;
+  *rows = (n_items + best_columns - 1) / best_columns;
+}
@@ -0,0 +1,56 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-grid-layout.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define MKT_TYPE_GRID_LAYOUT (mkt_grid_layout_get_type ())
+
+G_DECLARE_FINAL_TYPE (MktGridLayout, mkt_grid_layout, MKT, GRID_LAYOUT, GtkLayoutManager)
+
+GtkLayoutManager *mkt_grid_layout_new                      (void);
+void              mkt_grid_layout_set_char_size            (MktGridLayout *self,
+                                                            int            width,
+                                                            int            height);
+void              mkt_grid_layout_set_single_column_height (MktGridLayout *self,
+                                                            int            height);
+void              mkt_grid_layout_set_expand_last_row      (MktGridLayout *self,
+                                                            gboolean       expand);
+void              mkt_grid_layout_get_grid_size            (MktGridLayout *self,
+                                                            guint         *rows,
+                                                            guint         *columns);
+void              mkt_grid_layout_compute                  (guint          n_items,
+                                                            int            width,
+                                                            int            height,
+                                                            int            min_cell_width,
+                                                            int            min_cell_height,
+                                                            double         cell_aspect_ratio,
+                                                            int            single_column_height,
+                                                            guint         *rows,
+                                                            guint         *columns);
+
+G_END_DECLS
@@ -0,0 +1,495 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-input-broker.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * multi-keyterm-input-broker owns the input devices, so that the
+ * UI doesn't have to run as root or in the input group.  It opens
+ * the keyboards with libinput and streams the key events to the
+ * one UI process connected to its socket, over a #MktInputRing
+ * in shared memory.  The UI does the keymap translation, as the
+ * layout is a per user, per keyboard setting.  Run it as root,
+ * and let the UI user connect, eg:
+ *
+ *   multi-keyterm-input-broker --user kiosk &
+ *   multi-keyterm --input-broker /run/multi-keyterm/input
+ */
+
+#define G_LOG_DOMAIN "mkt-input-broker"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <libinput.h>
+#include <libudev.h>
+#include <pwd.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "mkt-input-ring.h"
+#include "mkt-utils.h"
+#include "mkt-log.h"
+
+#define DEFAULT_SOCKET "/run/multi-keyterm/input"
+#define RING_SIZE      1024 /* events */
+/* Keep some slots for device events, so that they are never lost */
+#define RING_RESERVED  64
+
+typedef struct
+{
+  GMainLoop         *main_loop;
+  struct udev       *udev;
+  GPtrArray         *contexts;
+  /* Device number to struct libinput_device */
+  GHashTable        *devices;
+  guint32            last_device;
+  uid_t              uid;
+
+  /* The UI process connected, if any */
+  GSocketConnection *connection;
+  MktInputRing      *ring;
+  guint              connection_id;
+} Broker;
+
+static char *socket_path;
+static char *user_name;
+static char **seats;
+
+static gboolean
+cmd_verbose_cb (const char  *option_name,
+                const char  *value,
+                gpointer     data,
+                GError     **error)
+{
+  mkt_log_increase_verbosity ();
+
+  return TRUE;
+}
+
+static GOptionEntry cmd_options[] = {
+  { "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path,
+    "Socket to listen on (default: " DEFAULT_SOCKET ")", "PATH" },
+  { "user", 'u', 0, G_OPTION_ARG_STRING, &user_name,
+    "User allowed to connect, in addition to root", "USER" },
+  { "seat", 0, 0, G_OPTION_ARG_STRING_ARRAY, &seats,
+    "The udev seat to handle keyboards from, can be repeated (default: seat0)", "SEAT" },
+  { "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, cmd_verbose_cb,
+    "Show verbose logs", NULL },
+  { NULL }
+};
+
+/* Adapted from libinput gui debug example */
+static int
+open_restricted (const char *path,
+                 int         flags,
+                 void       *user_data)
+{
+  int fd = open (path, flags | O_CLOEXEC);
+
+  if (fd < 0)
+    g_warning ("Failed to open %s (%s)", path, g_strerror (errno));
+
+  return fd < 0 ? -errno : fd;
+}
+
+static void
+close_restricted (int   fd,
+                  void *user_data)
+{
+  close (fd);
+}
+
+static const struct libinput_interface interface = {
+  .open_restricted = open_restricted,
+  .close_restricted = close_restricted,
+};
+
+static void
+broker_push (Broker              *broker,
+             const MktInputEvent *event)
+{
+  if (!broker->ring)
+    return;
+
+  if ((event->type == MKT_INPUT_EVENT_KEY &&
+       mkt_input_ring_get_n_free (broker->ring) <= RING_RESERVED) ||
+      !mkt_input_ring_push (broker->ring, event))
+    {
+      mkt_input_ring_add_dropped (broker->ring);
+      MKT_DEBUG_MSG ("Input ring full, dropped event of device %u", event->device);
+    }
+}
+
+static void
+broker_push_device_added (Broker                 *broker,
+                          guint32                 number,
+                          struct libinput_device *device)
+{
+  g_autofree char *id = NULL;
+  MktInputEvent event = { 0 };
+
+  event.type = MKT_INPUT_EVENT_DEVICE_ADDED;
+  event.device = number;
+  id = mkt_utils_get_device_id (device);
+
+  if (id)
+    g_strlcpy (event.id, id, sizeof event.id);
+
+  broker_push (broker, &event);
+}
+
+static void
+broker_drop_client (Broker *broker)
+{
+  if (broker->connection)
+    {
+      MKT_DEBUG_MSG ("Client disconnected, %u events dropped",
+                     mkt_input_ring_get_dropped (broker->ring));
+      g_io_stream_close (G_IO_STREAM (broker->connection), NULL, NULL);
+    }
+
+  g_clear_handle_id (&broker->connection_id, g_source_remove);
+  g_clear_object (&broker->connection);
+  g_clear_pointer (&broker->ring, mkt_input_ring_free);
+}
+
+static gboolean
+broker_client_cb (GSocket      *socket,
+                  GIOCondition  condition,
+                  gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  Broker *broker = user_data;
+  MktInputLedMessage message;
+  gssize size;
+
+  /* The client only sends LED updates */
+  while ((size = g_socket_receive_with_blocking (socket, (char *)&message, sizeof message,
+                                                 FALSE, NULL, &error)) == sizeof message)
+    {
+      struct libinput_device *device;
+
+      device = g_hash_table_lookup (broker->devices, GUINT_TO_POINTER (message.device));
+
+      if (device)
+        libinput_device_led_update (device, message.leds);
+    }
+
+  /* EOF, error or garbage */
+  if (size != -1 ||
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    {
+      broker->connection_id = 0;
+      broker_drop_client (broker);
+
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+broker_incoming_cb (GSocketService    *service,
+                    GSocketConnection *connection,
+                    GObject           *source_object,
+                    gpointer           user_data)
+{
+  g_autoptr(GCredentials) credentials = NULL;
+  g_autoptr(GSource) source = NULL;
+  g_autoptr(GError) error = NULL;
+  Broker *broker = user_data;
+  GHashTableIter iter;
+  gpointer number, device;
+  GSocket *socket;
+  uid_t uid;
+
+  socket = g_socket_connection_get_socket (connection);
+  credentials = g_socket_get_credentials (socket, &error);
+  uid = credentials ? g_credentials_get_unix_user (credentials, NULL) : (uid_t)-1;
+
+  if (uid != 0 && uid != broker->uid)
+    {
+      g_warning ("Rejecting client of uid %d", (int)uid);
+      return TRUE;
+    }
+
+  /* There is only one UI, a new one replaces the old */
+  broker_drop_client (broker);
+  broker->ring = mkt_input_ring_new (RING_SIZE, &error);
+
+  if (!broker->ring ||
+      !g_unix_connection_send_fd (G_UNIX_CONNECTION (connection),
+                                  mkt_input_ring_get_memfd (broker->ring),
+                                  NULL, &error) ||
+      !g_unix_connection_send_fd (G_UNIX_CONNECTION (connection),
+                                  mkt_input_ring_get_eventfd (broker->ring),
+                                  NULL, &error))
+    {
+      g_warning ("Failed to set up client: %s", error->message);
+      g_clear_pointer (&broker->ring, mkt_input_ring_free);
+      return TRUE;
+    }
+
+  MKT_DEBUG_MSG ("Client of uid %d connected", (int)uid);
+  broker->connection = g_object_ref (connection);
+  source = g_socket_create_source (socket, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+  g_source_set_callback (source, (GSourceFunc)broker_client_cb, broker, NULL);
+  broker->connection_id = g_source_attach (source, NULL);
+
+  g_hash_table_iter_init (&iter, broker->devices);
+  while (g_hash_table_iter_next (&iter, &number, &device))
+    broker_push_device_added (broker, GPOINTER_TO_UINT (number), device);
+
+  return TRUE;
+}
+
+static gboolean
+handle_event_libinput (GIOChannel   *source,
+                       GIOCondition  condition,
+                       gpointer      user_data)
+{
+  struct libinput *li = user_data;
+  Broker *broker = libinput_get_user_data (li);
+  struct libinput_event *ev;
+
+  libinput_dispatch (li);
+
+  while ((ev = libinput_get_event (li)))
+    {
+      struct libinput_device *device;
+      MktInputEvent event = { 0 };
+      guint32 number;
+
+      device = libinput_event_get_device (ev);
+      number = GPOINTER_TO_UINT (libinput_device_get_user_data (device));
+
+      switch ((int)libinput_event_get_type (ev))
+        {
+        case LIBINPUT_EVENT_DEVICE_ADDED:
+          if (!libinput_device_has_capability (device, LIBINPUT_DEVICE_CAP_KEYBOARD))
+            break;
+
+          number = ++broker->last_device;
+          libinput_device_set_user_data (device, GUINT_TO_POINTER (number));
+          g_hash_table_insert (broker->devices, GUINT_TO_POINTER (number),
+                               libinput_device_ref (device));
+          MKT_DEBUG_MSG ("Added device %u (%s)", number, libinput_device_get_name (device));
+          broker_push_device_added (broker, number, device);
+          break;
+
+        case LIBINPUT_EVENT_DEVICE_REMOVED:
+          if (!number)
+            break;
+
+          MKT_DEBUG_MSG ("Removed device %u", number);
+          event.type = MKT_INPUT_EVENT_DEVICE_REMOVED;
+          event.device = number;
+          broker_push (broker, &event);
+          libinput_device_set_user_data (device, NULL);
+          g_hash_table_remove (broker->devices, GUINT_TO_POINTER (number));
+          break;
+
+        case LIBINPUT_EVENT_KEYBOARD_KEY:
+          {
+            struct libinput_event_keyboard *key_event;
+
+            if (!number)
+              break;
+
+            key_event = libinput_event_get_keyboard_event (ev);
+            event.type = MKT_INPUT_EVENT_KEY;
+            event.device = number;
+            event.key = libinput_event_keyboard_get_key (key_event);
+            event.pressed = libinput_event_keyboard_get_key_state (key_event) == LIBINPUT_KEY_STATE_PRESSED;
+            event.time = libinput_event_keyboard_get_time_usec (key_event);
+            broker_push (broker, &event);
+          }
+          break;
+
+        default:
+          break;
+        }
+
+      libinput_event_destroy (ev);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+broker_add_seat (Broker     *broker,
+                 const char *seat)
+{
+  struct libinput *li;
+  GIOChannel *channel;
+
+  li = libinput_udev_create_context (&interface, broker, broker->udev);
+
+  if (!li)
+    {
+      g_printerr ("Failed to initialize libinput udev context\n");
+      return FALSE;
+    }
+
+  if (libinput_udev_assign_seat (li, seat))
+    {
+      g_printerr ("Failed to assign seat '%s' to libinput\n", seat);
+      libinput_unref (li);
+      return FALSE;
+    }
+
+  libinput_set_user_data (li, broker);
+  g_ptr_array_add (broker->contexts, li);
+
+  channel = g_io_channel_unix_new (libinput_get_fd (li));
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_add_watch (channel, G_IO_IN, handle_event_libinput, li);
+  g_io_channel_unref (channel);
+
+  handle_event_libinput (NULL, 0, li);
+
+  return TRUE;
+}
+
+static gboolean
+broker_quit_cb (gpointer user_data)
+{
+  Broker *broker = user_data;
+
+  g_main_loop_quit (broker->main_loop);
+
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GSocketService) service = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *socket_dir = NULL;
+  const char *default_seats[] = { "seat0", NULL };
+  const char * const *seat_list;
+  Broker broker = { 0 };
+
+  context = g_option_context_new ("- share keyboards with multi-keyterm");
+  g_option_context_add_main_entries (context, cmd_options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  mkt_log_init ();
+
+  if (!socket_path)
+    socket_path = g_strdup (DEFAULT_SOCKET);
+
+  broker.uid = 0;
+
+  if (user_name)
+    {
+      struct passwd *pw;
+
+      pw = getpwnam (user_name);
+
+      if (!pw)
+        {
+          g_printerr ("Unknown user '%s'\n", user_name);
+          return 1;
+        }
+
+      broker.uid = pw->pw_uid;
+    }
+
+  broker.udev = udev_new ();
+
+  if (!broker.udev)
+    {
+      g_printerr ("Failed to initialize udev\n");
+      return 1;
+    }
+
+  broker.contexts = g_ptr_array_new_with_free_func ((GDestroyNotify)libinput_unref);
+  broker.devices = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                          NULL, (GDestroyNotify)libinput_device_unref);
+  seat_list = seats ? (const char * const *)seats : default_seats;
+
+  for (guint i = 0; seat_list[i]; i++)
+    if (!broker_add_seat (&broker, seat_list[i]))
+      return 1;
+
+  socket_dir = g_path_get_dirname (socket_path);
+  g_mkdir_with_parents (socket_dir, 0755);
+  /* Remove the socket of a previous run, if any */
+  g_unlink (socket_path);
+
+  service = g_socket_service_new ();
+  address = g_unix_socket_address_new (socket_path);
+
+  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error))
+    {
+      g_printerr ("Failed to listen on %s: %s\n", socket_path, error->message);
+      return 1;
+    }
+
+  /* Peers are checked on connection too, this is to not even let others connect */
+  if (chown (socket_path, broker.uid, (gid_t)-1) == -1 ||
+      g_chmod (socket_path, 0600) == -1)
+    {
+      g_printerr ("Failed to set permissions of %s: %s\n", socket_path, g_strerror (errno));
+      return 1;
+    }
+
+  g_signal_connect (service, "incoming", G_CALLBACK (broker_incoming_cb), &broker);
+  g_socket_service_start (service);
+  g_info ("Listening on %s", socket_path);
+
+  broker.main_loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGINT, broker_quit_cb, &broker);
+  g_unix_signal_add (SIGTERM, broker_quit_cb, &broker);
+  g_main_loop_run (broker.main_loop);
+
+  g_socket_service_stop (service);
+  g_unlink (socket_path);
+  broker_drop_client (&broker);
+  g_hash_table_unref (broker.devices);
+  g_ptr_array_unref (broker.contexts);
+  udev_unref (broker.udev);
+  g_main_loop_unref (broker.main_loop);
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-input-client.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-input-client"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <gio/gio.h>
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
+#include <unistd.h>
+
+#include "mkt-input-client.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-input-client
+ * @title: MktInputClient
+ * @short_description: Receive input events from the input broker
+ * @include: "mkt-input-client.h"
+ *
+ * Connects to the socket of multi-keyterm-input-broker, which
+ * sends the memfd and eventfd of a #MktInputRing.  Events are
+ * then read from the shared ring, and the socket is only used
+ * to send LED updates back to the broker.
+ */
+
+struct _MktInputClient
+{
+  GSocketConnection *connection;
+  MktInputRing      *ring;
+  MktInputEventFunc  func;
+  gpointer           user_data;
+  guint              ring_id;
+  guint              socket_id;
+};
+
+static void
+input_client_disconnect (MktInputClient *self)
+{
+  g_clear_handle_id (&self->ring_id, g_source_remove);
+  g_clear_handle_id (&self->socket_id, g_source_remove);
+
+  if (self->connection)
+    g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
+  g_clear_object (&self->connection);
+}
+
+static gboolean
+input_client_ring_ready_cb (int          fd,
+                            GIOCondition condition,
+                            gpointer     user_data)
+{
+  MktInputClient *self = user_data;
+  MktInputEvent event;
+
+  do
+    {
+      while (mkt_input_ring_pop (self->ring, &event))
+        self->func (&event, self->user_data);
+    }
+  while (!mkt_input_ring_prepare_wait (self->ring));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+input_client_socket_cb (GSocket      *socket,
+                        GIOCondition  condition,
+                        gpointer      user_data)
+{
+  MktInputClient *self = user_data;
+
+  /* The broker never writes after sending the ring, so this is EOF */
+  g_warning ("Input broker disconnected");
+
+  /* Drain what's left so that removed devices are handled */
+  input_client_ring_ready_cb (-1, G_IO_IN, self);
+
+  self->socket_id = 0;
+  input_client_disconnect (self);
+  self->func (NULL, self->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * mkt_input_client_new:
+ * @socket_path: The path of the broker socket
+ * @func: The function to call for each event
+ * @user_data: The data passed to @func
+ * @error: A location for a #GError
+ *
+ * Connect to the input broker listening on @socket_path.
+ * @func is called from the main context for each input
+ * event received, and once with %NULL event if the broker
+ * disconnects.
+ *
+ * Returns: (transfer full) (nullable): A #MktInputClient
+ */
+MktInputClient *
+mkt_input_client_new (const char         *socket_path,
+                      MktInputEventFunc   func,
+                      gpointer            user_data,
+                      GError            **error)
+{
+  g_autoptr(MktInputClient) self = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GSocketClient) client = NULL;
+  g_autoptr(GSource) source = NULL;
+  GUnixConnection *connection;
+  int memfd, eventfd;
+
+  g_return_val_if_fail (socket_path && *socket_path, NULL);
+  g_return_val_if_fail (func, NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  self = g_new0 (MktInputClient, 1);
+  self->func = func;
+  self->user_data = user_data;
+
+  address = g_unix_socket_address_new (socket_path);
+  client = g_socket_client_new ();
+  self->connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+                                              NULL, error);
+
+  if (!self->connection)
+    return NULL;
+
+  if (!G_IS_UNIX_CONNECTION (self->connection))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Input broker socket is not a UNIX socket");
+      return NULL;
+    }
+
+  connection = G_UNIX_CONNECTION (self->connection);
+  memfd = g_unix_connection_receive_fd (connection, NULL, error);
+
+  if (memfd == -1)
+    return NULL;
+
+  eventfd = g_unix_connection_receive_fd (connection, NULL, error);
+
+  if (eventfd == -1)
+    {
+      close (memfd);
+      return NULL;
+    }
+
+  self->ring = mkt_input_ring_new_from_fds (memfd, eventfd, error);
+
+  if (!self->ring)
+    return NULL;
+
+  /* Keys are latency sensitive, handle them before redraws */
+  self->ring_id = g_unix_fd_add_full (G_PRIORITY_HIGH, eventfd, G_IO_IN,
+                                      input_client_ring_ready_cb, self, NULL);
+
+  source = g_socket_create_source (g_socket_connection_get_socket (self->connection),
+                                   G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+  g_source_set_callback (source, (GSourceFunc)input_client_socket_cb, self, NULL);
+  self->socket_id = g_source_attach (source, NULL);
+
+  MKT_DEBUG_MSG ("Connected to input broker at %s", socket_path);
+
+  /* Handle the devices sent on connection */
+  input_client_ring_ready_cb (eventfd, G_IO_IN, self);
+
+  return g_steal_pointer (&self);
+}
+
+void
+mkt_input_client_free (MktInputClient *self)
+{
+  if (!self)
+    return;
+
+  input_client_disconnect (self);
+  g_clear_pointer (&self->ring, mkt_input_ring_free);
+  g_free (self);
+}
+
+/**
+ * mkt_input_client_set_leds:
+ * @self: A #MktInputClient
+ * @device: The device number from the broker
+ * @leds: A mask of enum libinput_led
+ *
+ * Ask the broker to set the LEDs of @device.
+ */
+void
+mkt_input_client_set_leds (MktInputClient *self,
+                           guint32         device,
+                           guint32         leds)
+{
+  g_autoptr(GError) error = NULL;
+  MktInputLedMessage message;
+  GSocket *socket;
+
+  g_return_if_fail (self);
+
+  if (!self->connection)
+    return;
+
+  message.device = device;
+  message.leds = leds;
+  socket = g_socket_connection_get_socket (self->connection);
+
+  /* The message is tiny, it fits in the socket buffer unless the broker is stuck */
+  if (g_socket_send_with_blocking (socket, (const char *)&message, sizeof message,
+                                   FALSE, NULL, &error) != sizeof message)
+    g_debug ("Failed to send LED update to input broker: %s",
+             error ? error->message : "Short write");
+}
@@ -0,0 +1,50 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-input-client.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "mkt-input-ring.h"
+
+G_BEGIN_DECLS
+
+/* @event is %NULL when the broker has disconnected */
+typedef void (*MktInputEventFunc) (const MktInputEvent *event,
+                                   gpointer             user_data);
+
+typedef struct _MktInputClient MktInputClient;
+
+MktInputClient *mkt_input_client_new      (const char         *socket_path,
+                                           MktInputEventFunc   func,
+                                           gpointer            user_data,
+                                           GError            **error);
+void            mkt_input_client_free     (MktInputClient     *self);
+void            mkt_input_client_set_leds (MktInputClient     *self,
+                                           guint32             device,
+                                           guint32             leds);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktInputClient, mkt_input_client_free)
+
+G_END_DECLS
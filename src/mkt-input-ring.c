@@ -0,0 +1,420 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-input-ring.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-input-ring"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mkt-input-ring.h"
+
+/**
+ * SECTION: mkt-input-ring
+ * @title: MktInputRing
+ * @short_description: Shared memory ring buffer of input events
+ * @include: "mkt-input-ring.h"
+ *
+ * A single producer, single consumer ring buffer in a sealed
+ * memfd, used to pass input events from the privileged input
+ * broker to the UI process.  Pushing and popping events
+ * doesn't need any syscall.  The consumer sets a flag before
+ * it goes to sleep on the eventfd, and the producer writes to
+ * the eventfd only if the flag is set, so that a busy consumer
+ * isn't woken up for each event.
+ */
+
+#define RING_MAGIC      0x4d4b5452 /* "MKTR" */
+#define CACHE_LINE_SIZE 64
+
+typedef struct
+{
+  guint32       magic;
+  guint32       n_slots;
+  gint          dropped;
+  char          pad0[CACHE_LINE_SIZE - 3 * sizeof (gint)];
+
+  /* Written only by the producer */
+  gint          head;
+  char          pad1[CACHE_LINE_SIZE - sizeof (gint)];
+
+  /* Written only by the consumer, except @waiting which is cleared on wake up */
+  gint          tail;
+  gint          waiting;
+  char          pad2[CACHE_LINE_SIZE - 2 * sizeof (gint)];
+
+  MktInputEvent slots[];
+} RingShared;
+
+struct _MktInputRing
+{
+  RingShared *shared;
+  gsize       size;
+  guint       mask;
+  int         memfd;
+  int         eventfd;
+};
+
+static gsize
+ring_get_size (guint n_slots)
+{
+  return sizeof (RingShared) + (gsize)n_slots * sizeof (MktInputEvent);
+}
+
+static gboolean
+ring_map (MktInputRing  *self,
+          GError       **error)
+{
+  self->shared = mmap (NULL, self->size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, self->memfd, 0);
+
+  if (self->shared == MAP_FAILED)
+    {
+      int saved_errno = errno;
+
+      self->shared = NULL;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to map input ring: %s", g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * mkt_input_ring_new:
+ * @n_slots: The number of events, a power of 2
+ * @error: A location for a #GError
+ *
+ * Create a new ring to produce events to.  Pass the
+ * fds from mkt_input_ring_get_memfd() and
+ * mkt_input_ring_get_eventfd() to the consumer.
+ *
+ * Returns: (transfer full) (nullable): A #MktInputRing
+ */
+MktInputRing *
+mkt_input_ring_new (guint    n_slots,
+                    GError **error)
+{
+  g_autoptr(MktInputRing) self = NULL;
+
+  g_return_val_if_fail (n_slots && (n_slots & (n_slots - 1)) == 0, NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  self = g_new0 (MktInputRing, 1);
+  self->size = ring_get_size (n_slots);
+  self->mask = n_slots - 1;
+  self->eventfd = -1;
+  self->memfd = memfd_create ("multi-keyterm-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (self->memfd == -1 ||
+      ftruncate (self->memfd, self->size) == -1 ||
+      /* So that the consumer can't be made to fault by shrinking it */
+      fcntl (self->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to create input ring: %s", g_strerror (saved_errno));
+      return NULL;
+    }
+
+  if (!ring_map (self, error))
+    return NULL;
+
+  self->eventfd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (self->eventfd == -1)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to create eventfd: %s", g_strerror (saved_errno));
+      return NULL;
+    }
+
+  self->shared->magic = RING_MAGIC;
+  self->shared->n_slots = n_slots;
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * mkt_input_ring_new_from_fds:
+ * @memfd: The memfd of the ring
+ * @eventfd: The eventfd of the ring
+ * @error: A location for a #GError
+ *
+ * Map the ring created by the producer to consume events
+ * from.  The ownership of @memfd and @eventfd is taken,
+ * even on failure.
+ *
+ * Returns: (transfer full) (nullable): A #MktInputRing
+ */
+MktInputRing *
+mkt_input_ring_new_from_fds (int      memfd,
+                             int      eventfd,
+                             GError **error)
+{
+  g_autoptr(MktInputRing) self = NULL;
+  struct stat st;
+  guint n_slots;
+  int seals;
+
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  self = g_new0 (MktInputRing, 1);
+  self->memfd = memfd;
+  self->eventfd = eventfd;
+
+  if (memfd == -1 || eventfd == -1 ||
+      fstat (memfd, &st) == -1 ||
+      st.st_size < (off_t)sizeof (RingShared))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid input ring");
+      return NULL;
+    }
+
+  seals = fcntl (memfd, F_GET_SEALS);
+
+  if (seals == -1 || !(seals & F_SEAL_SHRINK))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Input ring is not sealed");
+      return NULL;
+    }
+
+  self->size = st.st_size;
+
+  if (!ring_map (self, error))
+    return NULL;
+
+  n_slots = self->shared->n_slots;
+
+  if (self->shared->magic != RING_MAGIC ||
+      !n_slots || (n_slots & (n_slots - 1)) != 0 ||
+      ring_get_size (n_slots) != self->size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid input ring");
+      return NULL;
+    }
+
+  self->mask = n_slots - 1;
+
+  return g_steal_pointer (&self);
+}
+
+void
+mkt_input_ring_free (MktInputRing *self)
+{
+  if (!self)
+    return;
+
+  if (self->shared)
+    munmap (self->shared, self->size);
+
+  if (self->memfd != -1)
+    close (self->memfd);
+
+  if (self->eventfd != -1)
+    close (self->eventfd);
+
+  g_free (self);
+}
+
+int
+mkt_input_ring_get_memfd (MktInputRing *self)
+{
+  g_return_val_if_fail (self, -1);
+
+  return self->memfd;
+}
+
+int
+mkt_input_ring_get_eventfd (MktInputRing *self)
+{
+  g_return_val_if_fail (self, -1);
+
+  return self->eventfd;
+}
+
+guint
+mkt_input_ring_get_n_free (MktInputRing *self)
+{
+  guint head, tail, used;
+
+  g_return_val_if_fail (self, 0);
+
+  head = (guint)g_atomic_int_get (&self->shared->head);
+  tail = (guint)g_atomic_int_get (&self->shared->tail);
+  used = head - tail;
+
+  if (used > self->mask)
+    return 0;
+
+  return self->mask + 1 - used;
+}
+
+guint
+mkt_input_ring_get_dropped (MktInputRing *self)
+{
+  g_return_val_if_fail (self, 0);
+
+  return (guint)g_atomic_int_get (&self->shared->dropped);
+}
+
+void
+mkt_input_ring_add_dropped (MktInputRing *self)
+{
+  g_return_if_fail (self);
+
+  g_atomic_int_inc (&self->shared->dropped);
+}
+
+/**
+ * mkt_input_ring_push:
+ * @self: A #MktInputRing
+ * @event: The event to push
+ *
+ * Push @event to the ring, waking up the consumer if
+ * it's waiting.  Only the producer shall call this.
+ *
+ * Returns: %TRUE if @event was pushed, %FALSE if
+ * the ring is full.
+ */
+gboolean
+mkt_input_ring_push (MktInputRing        *self,
+                     const MktInputEvent *event)
+{
+  RingShared *shared;
+  guint head, tail;
+
+  g_return_val_if_fail (self, FALSE);
+  g_return_val_if_fail (event, FALSE);
+
+  shared = self->shared;
+  head = (guint)g_atomic_int_get (&shared->head);
+  tail = (guint)g_atomic_int_get (&shared->tail);
+
+  if (head - tail > self->mask)
+    return FALSE;
+
+  shared->slots[head & self->mask] = *event;
+  /* Publish the event before checking if the consumer is waiting */
+  g_atomic_int_set (&shared->head, (gint)(head + 1));
+
+  if (g_atomic_int_get (&shared->waiting) &&
+      g_atomic_int_compare_and_exchange (&shared->waiting, TRUE, FALSE))
+    {
+      guint64 value = 1;
+
+      if (write (self->eventfd, &value, sizeof value) == -1 && errno != EAGAIN)
+        g_warning ("Failed to wake up input ring consumer: %s", g_strerror (errno));
+    }
+
+  return TRUE;
+}
+
+/**
+ * mkt_input_ring_pop:
+ * @self: A #MktInputRing
+ * @event: (out): A location for the event
+ *
+ * Pop the oldest event from the ring.  Only the
+ * consumer shall call this.
+ *
+ * Returns: %TRUE if an event was popped, %FALSE if
+ * the ring is empty.
+ */
+gboolean
+mkt_input_ring_pop (MktInputRing  *self,
+                    MktInputEvent *event)
+{
+  RingShared *shared;
+  guint head, tail;
+
+  g_return_val_if_fail (self, FALSE);
+  g_return_val_if_fail (event, FALSE);
+
+  shared = self->shared;
+  tail = (guint)g_atomic_int_get (&shared->tail);
+  head = (guint)g_atomic_int_get (&shared->head);
+
+  if (head == tail)
+    return FALSE;
+
+  *event = shared->slots[tail & self->mask];
+  g_atomic_int_set (&shared->tail, (gint)(tail + 1));
+
+  return TRUE;
+}
+
+/**
+ * mkt_input_ring_prepare_wait:
+ * @self: A #MktInputRing
+ *
+ * Tell the producer that the consumer is about to wait
+ * for the eventfd to be readable.  Only the consumer
+ * shall call this, after it has popped every event.
+ *
+ * Returns: %TRUE if the consumer can wait, %FALSE if
+ * more events were pushed meanwhile, which should be
+ * popped before calling this again.
+ */
+gboolean
+mkt_input_ring_prepare_wait (MktInputRing *self)
+{
+  RingShared *shared;
+  guint64 value;
+
+  g_return_val_if_fail (self, FALSE);
+
+  shared = self->shared;
+
+  /* Clear the wake ups we have already handled */
+  if (read (self->eventfd, &value, sizeof value) == -1 && errno != EAGAIN)
+    g_warning ("Failed to read input ring eventfd: %s", g_strerror (errno));
+
+  g_atomic_int_set (&shared->waiting, TRUE);
+
+  /* The producer may have pushed before it saw the flag */
+  if (g_atomic_int_get (&shared->head) != g_atomic_int_get (&shared->tail))
+    {
+      g_atomic_int_set (&shared->waiting, FALSE);
+      return FALSE;
+    }
+
+  return TRUE;
+}
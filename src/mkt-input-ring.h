@@ -0,0 +1,84 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-input-ring.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MKT_INPUT_ID_LEN 64
+
+typedef enum
+{
+  MKT_INPUT_EVENT_DEVICE_ADDED = 1,
+  MKT_INPUT_EVENT_DEVICE_REMOVED,
+  MKT_INPUT_EVENT_KEY,
+} MktInputEventType;
+
+/*
+ * @device is a number assigned by the broker, unique for the
+ * lifetime of the broker.  @time is in CLOCK_MONOTONIC µs, the
+ * same as g_get_monotonic_time().  @id is the stable id of the
+ * device, set only for MKT_INPUT_EVENT_DEVICE_ADDED.
+ */
+typedef struct
+{
+  guint32 type;
+  guint32 device;
+  guint32 key;
+  guint32 pressed;
+  gint64  time;
+  char    id[MKT_INPUT_ID_LEN];
+} MktInputEvent;
+
+/* Sent by the UI over the broker socket to set the LEDs of @device */
+typedef struct
+{
+  guint32 device;
+  guint32 leds;   /* enum libinput_led */
+} MktInputLedMessage;
+
+typedef struct _MktInputRing MktInputRing;
+
+MktInputRing *mkt_input_ring_new          (guint          n_slots,
+                                           GError       **error);
+MktInputRing *mkt_input_ring_new_from_fds (int            memfd,
+                                           int            eventfd,
+                                           GError       **error);
+void          mkt_input_ring_free         (MktInputRing  *self);
+int           mkt_input_ring_get_memfd    (MktInputRing  *self);
+int           mkt_input_ring_get_eventfd  (MktInputRing  *self);
+guint         mkt_input_ring_get_n_free   (MktInputRing  *self);
+guint         mkt_input_ring_get_dropped  (MktInputRing  *self);
+void          mkt_input_ring_add_dropped  (MktInputRing  *self);
+gboolean      mkt_input_ring_push         (MktInputRing        *self,
+                                           const MktInputEvent *event);
+gboolean      mkt_input_ring_pop          (MktInputRing  *self,
+                                           MktInputEvent *event);
+gboolean      mkt_input_ring_prepare_wait (MktInputRing  *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktInputRing, mkt_input_ring_free)
+
+G_END_DECLS
@@ -27,14 +27,28 @@
 # include "config.h"
 #endif
 
+#include <ctype.h>
+#include <string.h>
 #include <libinput.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "mkt-alloc.h"
 #include "mkt-keyboard.h"
+#include "mkt-utils.h"
 #include "mkt-log.h"
 
 #define INITIAL_REPEAT_TIMEOUT 250 /* ms */
 #define REPEAT_TIMEOUT         33  /* ms */
+/* Keys above KEY_MAX of linux/input-event-codes.h are never dropped */
+#define SWALLOW_KEYS           0x300
+/* No keyboard reports more keys held at once, more are logged and not tracked */
+#define MAX_HELD_KEYS          16
+
+typedef struct
+{
+  guint32 key;
+  gint64  time;
+} HeldKey;
 
 struct _MktKeyboard
 {
@@ -46,29 +60,65 @@ struct _MktKeyboard
   struct xkb_keymap      *xkb_keymap;
   struct xkb_state       *xkb_state;
 
+  char        *id;
   xkb_keysym_t index_sym;
 
-  guint        repeat_id;
+  /* Used to set LEDs of keyboards not owned by us */
+  MktKeyboardLedFunc led_func;
+  gpointer           led_func_data;
+
+  /* The consumer of key events, usually the terminal */
+  MktKeyboardKeyFunc key_func;
+  gpointer           key_func_data;
+  /* Keys held back while frozen, see mkt_keyboard_freeze_keys() */
+  MktKeyboardKey     key_batch[MKT_KEYBOARD_KEY_BATCH];
+  guint              n_key_batch;
+  guint              key_freeze_count;
+  /* event_time of the first key in key_batch */
+  gint64             key_batch_time;
+
+  MktKeyboardStats stats;
+  /* Monotonic time of the key event being handled, 0 if none */
+  gint64       event_time;
+  gint64       next_event_time;
+
+  /* Token bucket of key presses, see mkt_keyboard_set_rate_limit() */
+  guint        rate;
+  guint        burst;
+  double       tokens;
+  gint64       tokens_time;
+  /* Keys whose release should be dropped, as their press was */
+  guint64      swallowed_keys[SWALLOW_KEYS / 64];
+
+  /* Armed with g_source_set_ready_time(), so that no key allocates */
+  GSource     *repeat_source;
+  xkb_keysym_t repeat_sym;
+
+  /* Keys not released yet and when they were pressed, see mkt_keyboard_set_stuck_timeout() */
+  HeldKey      held_keys[MAX_HELD_KEYS];
+  guint        n_held_keys;
+  GSource     *stuck_source;
+  gint64       stuck_deadline;
+  guint        stuck_timeout;
   gboolean     enabled;
+  gboolean     connected;
 };
 
 G_DEFINE_TYPE (MktKeyboard, mkt_keyboard, G_TYPE_OBJECT)
 
-enum {
-  KEY_PRESSED,
-  KEY_RELEASED,
-  N_SIGNALS
-};
-
 enum {
   PROP_0,
   PROP_ENABLED,
+  PROP_CONNECTED,
   N_PROPS
 };
 
-static guint signals[N_SIGNALS];
 static GParamSpec *properties[N_PROPS];
 
+static guint32 keyboard_feed_key (MktKeyboard *self,
+                                  guint32      direction,
+                                  guint32      key);
+
 static GdkModifierType
 get_active_modifiers (MktKeyboard *self)
 {
@@ -101,8 +151,8 @@ mkt_keyboard_set_lock (MktKeyboard *self,
   xkb_keycode_t lock;
 
   lock = xkb_keymap_key_by_name (self->xkb_us_keymap, key);
-  mkt_keyboard_feed_key (self, XKB_KEY_DOWN, lock);
-  mkt_keyboard_feed_key (self, XKB_KEY_UP, lock);
+  keyboard_feed_key (self, XKB_KEY_DOWN, lock);
+  keyboard_feed_key (self, XKB_KEY_UP, lock);
 }
 
 static void
@@ -111,51 +161,72 @@ show_key_log (MktKeyboard            *self,
               enum xkb_key_direction  direction,
               gboolean                is_repeat)
 {
-  g_autoptr(GString) keys = NULL;
+  /* Long enough for all modifiers and any keysym name */
+  char keys[128] = {0};
   char buf[64] = {0};
 
-  keys = g_string_new ("");
-
 #define MODE_IS_ACTIVE(state, name) xkb_state_mod_name_is_active (state, name, \
                                                                   XKB_STATE_MODS_EFFECTIVE)
   if (MODE_IS_ACTIVE (self->xkb_us_state, "Super"))
-    g_string_append (keys, "Super + ");
+    g_strlcat (keys, "Super + ", sizeof keys);
   if (MODE_IS_ACTIVE (self->xkb_us_state, XKB_MOD_NAME_CTRL) &&
       (sym != XKB_KEY_Control_L &&
        sym != XKB_KEY_Control_R))
-    g_string_append (keys, "Control + ");
+    g_strlcat (keys, "Control + ", sizeof keys);
   if ((MODE_IS_ACTIVE (self->xkb_us_state, XKB_MOD_NAME_ALT) ||
        MODE_IS_ACTIVE (self->xkb_us_state, "Meta")) &&
       (sym != XKB_KEY_Alt_L &&
        sym != XKB_KEY_Alt_R))
-    g_string_append (keys, "Alt + ");
+    g_strlcat (keys, "Alt + ", sizeof keys);
   if (MODE_IS_ACTIVE (self->xkb_us_state, XKB_MOD_NAME_SHIFT) &&
       (sym == XKB_KEY_Shift_L &&
        sym == XKB_KEY_Shift_R))
-    g_string_append (keys, "Shift + ");
+    g_strlcat (keys, "Shift + ", sizeof keys);
 #undef MODE_IS_ACTIVE
 
   xkb_keysym_get_name (sym, buf, sizeof (buf));
 
   if (sym == XKB_KEY_Tab)
-    g_string_append (keys, "Tab");
+    g_strlcat (keys, "Tab", sizeof keys);
   else if (*buf)
-    g_string_append (keys, buf);
+    g_strlcat (keys, buf, sizeof keys);
 
   if (is_repeat)
-    MKT_TRACE ("Repeat effective keys: '%s', dev: %p", keys->str, self);
+    MKT_TRACE ("Repeat effective keys: '%s', dev: %p", keys, self);
   else
-    MKT_TRACE ("effective keys: '%s', %s '%s', dev: %p", keys->str,
+    MKT_TRACE ("effective keys: '%s', %s '%s', dev: %p", keys,
                direction == XKB_KEY_DOWN ? "pressed" : "released", buf, self);
 }
 
+static void
+flush_keys (MktKeyboard *self)
+{
+  MktKeyboardKey keys[MKT_KEYBOARD_KEY_BATCH];
+  guint n_keys;
+
+  n_keys = self->n_key_batch;
+
+  if (!n_keys)
+    return;
+
+  /* Copy, so that keys generated from the callback are not mixed up */
+  memcpy (keys, self->key_batch, n_keys * sizeof *keys);
+  self->n_key_batch = 0;
+
+  /* Account the latency of the batch from its oldest key */
+  self->event_time = self->key_batch_time;
+
+  if (self->key_func)
+    self->key_func (self, keys, n_keys, self->key_func_data);
+}
+
 static void
 emit_event (MktKeyboard            *self,
             enum xkb_key_direction  direction,
             xkb_keysym_t            sym)
 {
   GdkModifierType modifier;
-  MktKeyboardKey key = {0};
+  MktKeyboardKey *key;
 
   modifier = get_active_modifiers (self);
 
@@ -163,58 +234,234 @@ emit_event (MktKeyboard            *self,
   if (modifier == GDK_ALT_MASK && sym == GDK_KEY_Tab)
     return;
 
-  key.keycode = sym;
-  key.keyval = sym;
-  key.modifier = modifier;
+  if (!self->key_func)
+    return;
 
-  if (direction == XKB_KEY_DOWN)
-    g_signal_emit (self, signals[KEY_PRESSED], 0, &key);
+  if (!self->n_key_batch)
+    self->key_batch_time = self->event_time;
+
+  key = &self->key_batch[self->n_key_batch++];
+  key->keycode = sym;
+  key->keyval = sym;
+  key->modifier = modifier;
+  key->pressed = direction == XKB_KEY_DOWN;
+
+  if (!self->key_freeze_count ||
+      self->n_key_batch == MKT_KEYBOARD_KEY_BATCH)
+    flush_keys (self);
+}
+
+
+static void
+keyboard_swallow_key (MktKeyboard *self,
+                      guint32      key,
+                      gboolean     swallow)
+{
+  if (key >= SWALLOW_KEYS)
+    return;
+
+  if (swallow)
+    self->swallowed_keys[key / 64] |= G_GUINT64_CONSTANT (1) << (key % 64);
   else
-    g_signal_emit (self, signals[KEY_RELEASED], 0, &key);
+    self->swallowed_keys[key / 64] &= ~(G_GUINT64_CONSTANT (1) << (key % 64));
 }
 
+static gboolean
+keyboard_key_is_swallowed (MktKeyboard *self,
+                           guint32      key)
+{
+  if (key >= SWALLOW_KEYS)
+    return FALSE;
+
+  return !!(self->swallowed_keys[key / 64] & (G_GUINT64_CONSTANT (1) << (key % 64)));
+}
 
+/*
+ * Returns %TRUE if a key press can be handled now.  The
+ * bucket fills at @rate tokens per second up to @burst,
+ * and each press takes one.
+ */
 static gboolean
-repeat_key_cb (GTask    *task,
-               gboolean  repeat)
+keyboard_take_token (MktKeyboard *self,
+                     gint64       now)
 {
-  MktKeyboard *self;
-  xkb_keysym_t sym;
+  double tokens;
+
+  if (!self->rate)
+    return TRUE;
 
-  g_assert (G_IS_TASK (task));
+  tokens = self->tokens + (now - self->tokens_time) * self->rate / (double)G_USEC_PER_SEC;
+  self->tokens = MIN (tokens, self->burst);
+  self->tokens_time = now;
 
-  self = g_task_get_source_object (task);
-  sym = GPOINTER_TO_INT (g_task_get_task_data (task));
-  emit_event (self, XKB_KEY_DOWN, sym);
-  emit_event (self, XKB_KEY_UP, sym);
+  if (self->tokens < 1.0)
+    return FALSE;
 
-  if (mkt_log_get_verbosity () > 3)
-    show_key_log (self, sym, 0, TRUE);
+  self->tokens -= 1.0;
 
-  return repeat;
+  return TRUE;
+}
+
+static void
+keyboard_stop_repeat (MktKeyboard *self)
+{
+  if (self->repeat_source)
+    g_source_set_ready_time (self->repeat_source, -1);
+}
+
+/* Arm the stuck key timer for the key held the longest */
+static void
+keyboard_update_stuck_timer (MktKeyboard *self)
+{
+  gint64 deadline = -1;
+
+  if (!self->stuck_source)
+    return;
+
+  if (self->stuck_timeout)
+    for (guint i = 0; i < self->n_held_keys; i++)
+      {
+        gint64 key_deadline;
+
+        key_deadline = self->held_keys[i].time + self->stuck_timeout * G_USEC_PER_SEC;
+
+        if (deadline == -1 || key_deadline < deadline)
+          deadline = key_deadline;
+      }
+
+  /* Typing more keys while one is held doesn't change anything */
+  if (deadline == self->stuck_deadline)
+    return;
+
+  self->stuck_deadline = deadline;
+  g_source_set_ready_time (self->stuck_source, deadline);
+}
+
+static void
+keyboard_track_key (MktKeyboard *self,
+                    guint32      direction,
+                    guint32      key)
+{
+  guint i;
+
+  for (i = 0; i < self->n_held_keys; i++)
+    if (self->held_keys[i].key == key)
+      break;
+
+  if (direction == XKB_KEY_UP)
+    {
+      if (i == self->n_held_keys)
+        return;
+
+      self->held_keys[i] = self->held_keys[--self->n_held_keys];
+    }
+  else
+    {
+      if (i == MAX_HELD_KEYS)
+        {
+          g_debug ("Keyboard %p holds more than %u keys, key %u won't be released if stuck",
+                   self, MAX_HELD_KEYS, key);
+          return;
+        }
+
+      if (i == self->n_held_keys)
+        self->n_held_keys++;
+
+      self->held_keys[i].key = key;
+      self->held_keys[i].time = self->event_time;
+    }
+
+  keyboard_update_stuck_timer (self);
 }
 
 static gboolean
-repeat_key (gpointer user_data)
+stuck_key_cb (gpointer user_data)
 {
-  return repeat_key_cb (user_data, G_SOURCE_CONTINUE);
+  MktKeyboard *self = user_data;
+  gint64 now;
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_KEYBOARD);
+
+  g_assert (MKT_IS_KEYBOARD (self));
+
+  now = g_get_monotonic_time ();
+
+  /* Backwards, as a release moves the last key to its place */
+  for (guint i = self->n_held_keys; i > 0; i--)
+    {
+      HeldKey held = self->held_keys[i - 1];
+
+      /* The release was likely lost, eg: by a flaky device */
+      if (now - held.time < self->stuck_timeout * G_USEC_PER_SEC)
+        continue;
+
+      g_debug ("Releasing key %u of keyboard %p, held for %u seconds",
+               held.key, self, self->stuck_timeout);
+      self->stats.stuck_releases++;
+      /* This also stops the repeat, if the key was repeating */
+      keyboard_feed_key (self, XKB_KEY_UP, held.key);
+      /* Drop the real release, if it ever arrives */
+      keyboard_swallow_key (self, held.key, TRUE);
+    }
+
+  /* The ready time is kept, so it has to be set again */
+  self->stuck_deadline = 0;
+  keyboard_update_stuck_timer (self);
+
+  return G_SOURCE_CONTINUE;
 }
 
 static gboolean
-initial_repeat_key (gpointer user_data)
+repeat_key_cb (gpointer user_data)
 {
-  MktKeyboard *self;
+  MktKeyboard *self = user_data;
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_KEYBOARD);
+
+  g_assert (MKT_IS_KEYBOARD (self));
+
+  self->event_time = g_get_monotonic_time ();
+
+  g_source_set_ready_time (self->repeat_source,
+                           self->event_time + REPEAT_TIMEOUT * 1000);
+
+  self->stats.repeats++;
+  mkt_keyboard_freeze_keys (self);
+  emit_event (self, XKB_KEY_DOWN, self->repeat_sym);
+  emit_event (self, XKB_KEY_UP, self->repeat_sym);
+  mkt_keyboard_thaw_keys (self);
+
+  if (MKT_LOG_ENABLED (MKT_LOG_FLAG_TRACE))
+    show_key_log (self, self->repeat_sym, 0, TRUE);
 
-  self = g_task_get_source_object (user_data);
+  return G_SOURCE_CONTINUE;
+}
 
-  g_clear_handle_id (&self->repeat_id, g_source_remove);
+static gboolean
+timer_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  /* The ready time is kept, so the callback has to set it again */
+  return callback (user_data);
+}
 
-  self->repeat_id = g_timeout_add_full (G_PRIORITY_HIGH,
-                                        REPEAT_TIMEOUT,
-                                        repeat_key, g_object_ref (user_data),
-                                        g_object_unref);
+static GSourceFuncs timer_source_funcs = {
+  NULL, NULL, timer_source_dispatch, NULL,
+};
 
-  return repeat_key_cb (user_data, G_SOURCE_REMOVE);
+static GSource *
+keyboard_create_timer (MktKeyboard *self,
+                       GSourceFunc  func,
+                       const char  *name)
+{
+  GSource *source;
+
+  source = g_source_new (&timer_source_funcs, sizeof (GSource));
+  g_source_set_priority (source, G_PRIORITY_HIGH);
+  g_source_set_callback (source, func, self, NULL);
+  g_source_set_name (source, name);
+  g_source_attach (source, NULL);
+
+  return source;
 }
 
 static void
@@ -231,6 +478,10 @@ mkt_keyboard_get_property (GObject    *object,
       g_value_set_boolean (value, self->enabled);
       break;
 
+    case PROP_CONNECTED:
+      g_value_set_boolean (value, self->connected);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -245,8 +496,16 @@ mkt_keyboard_finalize (GObject *object)
 
   if (self->device)
     libinput_device_set_user_data (self->device, NULL);
-  g_clear_handle_id (&self->repeat_id, g_source_remove);
+  g_source_destroy (self->repeat_source);
+  g_clear_pointer (&self->repeat_source, g_source_unref);
+  g_source_destroy (self->stuck_source);
+  g_clear_pointer (&self->stuck_source, g_source_unref);
   g_clear_pointer (&self->device, libinput_device_unref);
+  g_clear_pointer (&self->xkb_state, xkb_state_unref);
+  g_clear_pointer (&self->xkb_keymap, xkb_keymap_unref);
+  g_clear_pointer (&self->xkb_us_state, xkb_state_unref);
+  g_clear_pointer (&self->xkb_us_keymap, xkb_keymap_unref);
+  g_free (self->id);
 
   G_OBJECT_CLASS (mkt_keyboard_parent_class)->finalize (object);
 }
@@ -266,26 +525,37 @@ mkt_keyboard_class_init (MktKeyboardClass *klass)
                           FALSE,
                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
-  g_object_class_install_properties (object_class, N_PROPS, properties);
+  properties[PROP_CONNECTED] =
+    g_param_spec_boolean ("connected",
+                          "Connected",
+                          "Whether the device of the keyboard is present",
+                          TRUE,
+                          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
-  signals [KEY_PRESSED] =
-    g_signal_new ("key-pressed",
-                  G_TYPE_FROM_CLASS (klass),
-                  G_SIGNAL_RUN_LAST,
-                  0, NULL, NULL, NULL,
-                  G_TYPE_NONE, 1, G_TYPE_POINTER);
-  signals [KEY_RELEASED] =
-    g_signal_new ("key-released",
-                  G_TYPE_FROM_CLASS (klass),
-                  G_SIGNAL_RUN_LAST,
-                  0, NULL, NULL, NULL,
-                  G_TYPE_NONE, 1, G_TYPE_POINTER);
+  g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
 static void
 mkt_keyboard_init (MktKeyboard *self)
+{
+  self->connected = TRUE;
+
+  self->xkb_us_keymap = xkb_keymap_ref (mkt_keyboard_get_us_keymap ());
+  self->xkb_us_state = xkb_state_new (self->xkb_us_keymap);
+  self->index_sym = XKB_KEY_0;
+
+  self->repeat_source = keyboard_create_timer (self, repeat_key_cb,
+                                               "[multi-keyterm] key repeat");
+  self->stuck_source = keyboard_create_timer (self, stuck_key_cb,
+                                              "[multi-keyterm] stuck keys");
+  self->stuck_deadline = -1;
+}
+
+static gpointer
+keyboard_create_us_keymap (gpointer user_data)
 {
   struct xkb_context *context;
+  struct xkb_keymap *keymap;
   struct xkb_rule_names names;
 
   names.rules = "evdev";
@@ -295,11 +565,32 @@ mkt_keyboard_init (MktKeyboard *self)
   names.options = "";
 
   context = xkb_context_new (0);
-  self->xkb_us_keymap = xkb_keymap_new_from_names (context, &names, 0);
-  self->xkb_us_state = xkb_state_new (self->xkb_us_keymap);
-  self->index_sym = XKB_KEY_0;
-
+  keymap = xkb_keymap_new_from_names (context, &names, 0);
   xkb_context_unref (context);
+
+  return keymap;
+}
+
+/**
+ * mkt_keyboard_get_us_keymap:
+ *
+ * Get the US keymap used to find the keys of slots and
+ * locks, which is the same for every keyboard.  It's
+ * compiled on the first call, which can be done from
+ * any thread, to have it ready before keyboards are
+ * created.  The keymap is never modified, so it's safe
+ * to share.
+ *
+ * Returns: (transfer none): A `struct xkb_keymap`
+ */
+gpointer
+mkt_keyboard_get_us_keymap (void)
+{
+  static GOnce us_keymap = G_ONCE_INIT;
+
+  g_once (&us_keymap, keyboard_create_us_keymap, NULL);
+
+  return us_keymap.retval;
 }
 
 MktKeyboard *
@@ -321,23 +612,195 @@ mkt_keyboard_new (gpointer libinput_device)
   return self;
 }
 
+/**
+ * mkt_keyboard_new_virtual:
+ *
+ * Create a keyboard not backed by any input device.
+ * Keys can be fed with mkt_keyboard_feed_key() as
+ * with any other keyboard.  This is useful to replay
+ * or synthesize input without hardware.
+ *
+ * Returns: (transfer full): A #MktKeyboard
+ */
+MktKeyboard *
+mkt_keyboard_new_virtual (void)
+{
+  MktKeyboard *self;
+
+  self = g_object_new (MKT_TYPE_KEYBOARD, NULL);
+  MKT_DEBUG_MSG ("Created new virtual keyboard %p", self);
+
+  mkt_keyboard_set_lock (self, "NMLK");
+
+  return self;
+}
+
+/**
+ * mkt_keyboard_new_remote:
+ * @id: (nullable): The stable id of the device
+ *
+ * Create a keyboard for a device owned by another
+ * process, like the input broker.  The keys should
+ * be fed with mkt_keyboard_feed_key(), and LEDs can
+ * be handled with mkt_keyboard_set_led_func().
+ *
+ * Returns: (transfer full): A #MktKeyboard
+ */
+MktKeyboard *
+mkt_keyboard_new_remote (const char *id)
+{
+  MktKeyboard *self;
+
+  self = g_object_new (MKT_TYPE_KEYBOARD, NULL);
+  self->id = g_strdup (id);
+  MKT_DEBUG_MSG ("Created new remote keyboard %p (%s)", self, id);
+
+  /* Enable Num Lock by default */
+  mkt_keyboard_set_lock (self, "NMLK");
+
+  return self;
+}
+
+/**
+ * mkt_keyboard_set_led_func:
+ * @self: A #MktKeyboard
+ * @func: (nullable): The function to set LEDs
+ * @user_data: The data passed to @func
+ *
+ * Set the function called to update the LEDs of @self,
+ * if @self isn't backed by a local libinput device.
+ */
+void
+mkt_keyboard_set_led_func (MktKeyboard        *self,
+                           MktKeyboardLedFunc  func,
+                           gpointer            user_data)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->led_func = func;
+  self->led_func_data = user_data;
+}
+
+/**
+ * mkt_keyboard_set_key_func:
+ * @self: A #MktKeyboard
+ * @func: (nullable): The function to handle keys
+ * @user_data: The data passed to @func
+ *
+ * Set the function that handles the keys of @self,
+ * replacing the one set before, if any.  Each keyboard
+ * has a single consumer, so this is called directly
+ * instead of emitting a signal per key.
+ */
+void
+mkt_keyboard_set_key_func (MktKeyboard        *self,
+                           MktKeyboardKeyFunc  func,
+                           gpointer            user_data)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->key_func = func;
+  self->key_func_data = func ? user_data : NULL;
+}
+
+/**
+ * mkt_keyboard_unset_key_func:
+ * @self: A #MktKeyboard
+ * @user_data: The data the key function was set with
+ *
+ * Unset the key function of @self, if it was set
+ * with @user_data.  This is to be used on dispose,
+ * so that a newer consumer is not unset.
+ */
+void
+mkt_keyboard_unset_key_func (MktKeyboard *self,
+                             gpointer     user_data)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  if (self->key_func && self->key_func_data == user_data)
+    mkt_keyboard_set_key_func (self, NULL, NULL);
+}
+
+/**
+ * mkt_keyboard_freeze_keys:
+ * @self: A #MktKeyboard
+ *
+ * Hold back the keys generated, so that they are passed
+ * to the key function in a batch on the matching
+ * mkt_keyboard_thaw_keys(), or once the batch is full.
+ * Calls can be nested.
+ */
+void
+mkt_keyboard_freeze_keys (MktKeyboard *self)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->key_freeze_count++;
+}
+
+void
+mkt_keyboard_thaw_keys (MktKeyboard *self)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+  g_return_if_fail (self->key_freeze_count);
+
+  self->key_freeze_count--;
+
+  if (!self->key_freeze_count)
+    flush_keys (self);
+}
+
+/**
+ * mkt_keyboard_set_device:
+ * @self: A #MktKeyboard
+ * @libinput_device: (nullable): A struct libinput_device
+ *
+ * Set the libinput device of @self.  Set %NULL when
+ * the device is removed.
+ */
 void
 mkt_keyboard_set_device (MktKeyboard *self,
                          gpointer     libinput_device)
 {
   g_return_if_fail (MKT_IS_KEYBOARD (self));
-  g_return_if_fail (libinput_device);
 
   if (self->device == libinput_device)
     return;
 
-  g_return_if_fail (!libinput_device_get_user_data (libinput_device));
+  g_return_if_fail (!libinput_device || !libinput_device_get_user_data (libinput_device));
 
   if (self->device)
-    libinput_device_unref (self->device);
+    libinput_device_set_user_data (self->device, NULL);
+  g_clear_pointer (&self->device, libinput_device_unref);
+
+  /* Keep the id, so that the device can be matched if it returns */
+  if (!libinput_device)
+    return;
 
   self->device = libinput_device_ref (libinput_device);
   libinput_device_set_user_data (libinput_device, self);
+
+  g_free (self->id);
+  self->id = mkt_utils_get_device_id (self->device);
+}
+
+/**
+ * mkt_keyboard_get_id:
+ * @self: A #MktKeyboard
+ *
+ * Get the stable id of the keyboard, which doesn't
+ * change across restarts or re-plugs to the same port.
+ *
+ * Returns: (nullable): The id of the keyboard, or %NULL
+ * for virtual keyboards and if the id is not known.
+ */
+const char *
+mkt_keyboard_get_id (MktKeyboard *self)
+{
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), NULL);
+
+  return self->id;
 }
 
 void
@@ -348,7 +811,9 @@ mkt_keyboard_reset (MktKeyboard *self,
 
   g_return_if_fail (MKT_IS_KEYBOARD (self));
 
-  g_clear_handle_id (&self->repeat_id, g_source_remove);
+  keyboard_stop_repeat (self);
+  self->n_held_keys = 0;
+  keyboard_update_stuck_timer (self);
   xkb_state = g_steal_pointer (&self->xkb_us_state);
   self->xkb_us_state = xkb_state_new (self->xkb_us_keymap);
 
@@ -384,6 +849,14 @@ mkt_keyboard_set_index (MktKeyboard *self,
   self->index_sym = index;
 }
 
+guint32
+mkt_keyboard_get_index (MktKeyboard *self)
+{
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), XKB_KEY_0);
+
+  return self->index_sym;
+}
+
 gboolean
 mkt_keyboard_get_enabled (MktKeyboard *self)
 {
@@ -407,16 +880,60 @@ mkt_keyboard_set_enabled (MktKeyboard *self,
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_ENABLED]);
 }
 
-guint32
-mkt_keyboard_feed_key (MktKeyboard *self,
-                       guint32      direction, /* enum xkb_key_direction  */
-                       guint32      key)       /* xkb_keycode_t */
+gboolean
+mkt_keyboard_get_connected (MktKeyboard *self)
+{
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), FALSE);
+
+  return self->connected;
+}
+
+/**
+ * mkt_keyboard_set_connected:
+ * @self: A #MktKeyboard
+ * @connected: Whether the device is present
+ *
+ * Mark the device of @self as gone or back.  A keyboard
+ * that is disconnected keeps its slot and terminal, so
+ * that the device can be rebound to it if it returns.
+ * The keys held down are released either way, as their
+ * release may have been lost.
+ */
+void
+mkt_keyboard_set_connected (MktKeyboard *self,
+                            gboolean     connected)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  connected = !!connected;
+
+  if (self->connected == connected)
+    return;
+
+  self->connected = connected;
+  mkt_keyboard_reset (self, TRUE);
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CONNECTED]);
+}
+
+/* Feed a key, without the rate limit */
+static guint32
+keyboard_feed_key (MktKeyboard *self,
+                   guint32      direction,
+                   guint32      key)
 {
   struct xkb_keymap *xkb_keymap;
   xkb_keysym_t sym_us, sym;
   GdkModifierType modifier;
 
-  g_return_val_if_fail (MKT_IS_KEYBOARD (self), 0);
+  g_assert (MKT_IS_KEYBOARD (self));
+
+  self->stats.events++;
+
+  if (self->next_event_time)
+    self->event_time = self->next_event_time;
+  else
+    self->event_time = g_get_monotonic_time ();
+  self->next_event_time = 0;
 
   sym_us = xkb_state_key_get_one_sym (self->xkb_us_state, key + 8);
 
@@ -449,23 +966,20 @@ mkt_keyboard_feed_key (MktKeyboard *self,
   if (modifier & GDK_CONTROL_MASK)
     sym = sym_us;
 
-  g_clear_handle_id (&self->repeat_id, g_source_remove);
+  keyboard_track_key (self, direction, key);
+  keyboard_stop_repeat (self);
 
   if (mkt_keyboard_get_enabled (self))
     {
-      GTask *task;
-
-      task = g_task_new (self, NULL, NULL, NULL);
-      g_task_set_task_data (task, GINT_TO_POINTER (sym), NULL);
-
       emit_event (self, direction, sym);
 
       if (direction == XKB_KEY_DOWN &&
           xkb_keymap_key_repeats (xkb_keymap, key + 8))
-        self->repeat_id = g_timeout_add_full (G_PRIORITY_HIGH,
-                                              INITIAL_REPEAT_TIMEOUT,
-                                              initial_repeat_key, task,
-                                              g_object_unref);
+        {
+          self->repeat_sym = sym;
+          g_source_set_ready_time (self->repeat_source,
+                                   g_get_monotonic_time () + INITIAL_REPEAT_TIMEOUT * 1000);
+        }
     }
 
   if (direction == XKB_KEY_DOWN &&
@@ -477,19 +991,52 @@ mkt_keyboard_feed_key (MktKeyboard *self,
         mkt_keyboard_set_enabled (self, TRUE);
     }
 
-  if (mkt_log_get_verbosity () > 3)
+  MKT_PROBE (key_fed, self, direction, key, sym);
+
+  if (MKT_LOG_ENABLED (MKT_LOG_FLAG_TRACE))
     show_key_log (self, sym, direction, FALSE);
 
   return sym;
 }
 
+guint32
+mkt_keyboard_feed_key (MktKeyboard *self,
+                       guint32      direction, /* enum xkb_key_direction  */
+                       guint32      key)       /* xkb_keycode_t */
+{
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_KEYBOARD);
+
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), 0);
+
+  /* A release is dropped along with its press, so keys are never left pressed */
+  if (direction == XKB_KEY_UP && keyboard_key_is_swallowed (self, key))
+    {
+      keyboard_swallow_key (self, key, FALSE);
+      self->next_event_time = 0;
+      return 0;
+    }
+
+  if (direction == XKB_KEY_DOWN &&
+      !keyboard_take_token (self, g_get_monotonic_time ()))
+    {
+      keyboard_swallow_key (self, key, TRUE);
+      self->stats.limited++;
+      self->next_event_time = 0;
+      return 0;
+    }
+
+  if (direction == XKB_KEY_DOWN)
+    keyboard_swallow_key (self, key, FALSE);
+
+  return keyboard_feed_key (self, direction, key);
+}
+
 void
 mkt_keyboard_update_leds (MktKeyboard *self)
 {
   enum libinput_led leds = 0;
 
-
-  if (!self->device)
+  if (!self->device && !self->led_func)
     return;
 
   if (xkb_state_led_name_is_active (self->xkb_us_state, XKB_LED_NAME_CAPS))
@@ -499,7 +1046,12 @@ mkt_keyboard_update_leds (MktKeyboard *self)
   if (xkb_state_led_name_is_active (self->xkb_us_state, XKB_LED_NAME_SCROLL))
     leds |= LIBINPUT_LED_SCROLL_LOCK;
 
-  libinput_device_led_update (self->device, leds);
+  if (self->device)
+    libinput_device_led_update (self->device, leds);
+  else
+    self->led_func (self, leds, self->led_func_data);
+
+  self->stats.led_writes++;
 
   MKT_TRACE_MSG ("Updated Keyboard %p LEDs. Caps: %d, Num: %d, Scroll: %d",
                  self,
@@ -526,9 +1078,285 @@ mkt_keyboard_set_layout (MktKeyboard *self,
   names.variant = strv[1] ?: "";
   names.options = "";
 
+  g_clear_pointer (&self->xkb_state, xkb_state_unref);
+  g_clear_pointer (&self->xkb_keymap, xkb_keymap_unref);
+
   context = xkb_context_new (0);
   self->xkb_keymap = xkb_keymap_new_from_names (context, &names, 0);
-  self->xkb_state = xkb_state_new (self->xkb_keymap);
+
+  if (self->xkb_keymap)
+    self->xkb_state = xkb_state_new (self->xkb_keymap);
+  else
+    g_warning ("Failed to create keymap for layout '%s'", layout);
 
   xkb_context_unref (context);
 }
+
+/**
+ * mkt_keyboard_set_rate_limit:
+ * @self: A #MktKeyboard
+ * @rate: Key presses per second, or 0 for no limit
+ * @burst: Key presses accepted at once
+ *
+ * Limit the rate of key presses fed to @self, so that a
+ * flood of keys from a single device doesn't hold up the
+ * main loop.  Presses over the limit are dropped along
+ * with their releases, and counted in the stats.
+ */
+void
+mkt_keyboard_set_rate_limit (MktKeyboard *self,
+                             guint        rate,
+                             guint        burst)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+  g_return_if_fail (!rate || burst);
+
+  if (self->rate == rate && self->burst == burst)
+    return;
+
+  self->rate = rate;
+  self->burst = burst;
+  /* Start with a full bucket */
+  self->tokens = burst;
+  self->tokens_time = g_get_monotonic_time ();
+}
+
+/**
+ * mkt_keyboard_set_stuck_timeout:
+ * @self: A #MktKeyboard
+ * @timeout: The timeout in seconds, or 0 to disable
+ *
+ * Set the time after which a key of @self that is held
+ * down is released, as its release was likely lost.  This
+ * includes modifiers, which don't repeat.  The release, if
+ * it arrives later, is dropped.
+ */
+void
+mkt_keyboard_set_stuck_timeout (MktKeyboard *self,
+                                guint        timeout)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->stuck_timeout = timeout;
+  keyboard_update_stuck_timer (self);
+}
+
+/**
+ * mkt_keyboard_set_event_time:
+ * @self: A #MktKeyboard
+ * @time: The monotonic time in µs
+ *
+ * Set the time at which the next key fed with
+ * mkt_keyboard_feed_key() was generated, which is used
+ * to measure the latency.  If not set, the time at which
+ * the key is fed is used.
+ */
+void
+mkt_keyboard_set_event_time (MktKeyboard *self,
+                             gint64       time)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->next_event_time = time;
+}
+
+/**
+ * mkt_keyboard_count_dropped:
+ * @self: A #MktKeyboard
+ *
+ * Count a key event from the keyboard that was
+ * not handled, eg: as the window had no focus.
+ */
+void
+mkt_keyboard_count_dropped (MktKeyboard *self)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->stats.dropped++;
+}
+
+/**
+ * mkt_keyboard_add_written:
+ * @self: A #MktKeyboard
+ * @n_bytes: The number of bytes written
+ *
+ * Account @n_bytes written to the terminal as a result
+ * of the key event being handled.  The latency of the
+ * event is recorded on the first write.
+ */
+void
+mkt_keyboard_add_written (MktKeyboard *self,
+                          gsize        n_bytes)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->stats.bytes_written += n_bytes;
+
+  if (self->event_time)
+    {
+      gint64 latency;
+      guint bucket;
+
+      latency = MAX (g_get_monotonic_time () - self->event_time, 1);
+      bucket = MIN (g_bit_storage (latency - 1), MKT_KEYBOARD_LATENCY_BUCKETS - 1);
+      self->stats.latency[bucket]++;
+      self->stats.latency_sum += latency;
+      self->event_time = 0;
+    }
+}
+
+/**
+ * mkt_keyboard_add_read:
+ * @self: A #MktKeyboard
+ * @n_bytes: The number of bytes read
+ *
+ * Account @n_bytes of output read from the shell
+ * of the terminal of @self.
+ */
+void
+mkt_keyboard_add_read (MktKeyboard *self,
+                       gsize        n_bytes)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->stats.bytes_read += n_bytes;
+}
+
+/**
+ * mkt_keyboard_count_shell_exit:
+ * @self: A #MktKeyboard
+ *
+ * Count an exit of the shell of the terminal of @self,
+ * after which the shell is started again on request.
+ */
+void
+mkt_keyboard_count_shell_exit (MktKeyboard *self)
+{
+  g_return_if_fail (MKT_IS_KEYBOARD (self));
+
+  self->stats.shell_exits++;
+}
+
+/**
+ * mkt_keyboard_get_modifiers:
+ * @self: A #MktKeyboard
+ *
+ * Get the modifiers currently active on @self, as
+ * seen with the US layout.
+ *
+ * Returns: The active #GdkModifierType
+ */
+GdkModifierType
+mkt_keyboard_get_modifiers (MktKeyboard *self)
+{
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), 0);
+
+  return get_active_modifiers (self);
+}
+
+/**
+ * mkt_keyboard_key_encode:
+ * @key: A #MktKeyboardKey
+ * @buffer: A buffer of at least %MKT_KEYBOARD_KEY_MAX_LEN bytes
+ *
+ * Encode @key into the bytes to be written to the
+ * terminal.  @buffer is always NUL terminated.
+ *
+ * Returns: The number of bytes written to @buffer,
+ * excluding the terminating NUL, 0 if @key has no
+ * text representation.
+ */
+gsize
+mkt_keyboard_key_encode (const MktKeyboardKey *key,
+                         char                 *buffer)
+{
+  gunichar c;
+  gsize len;
+
+  g_assert (key);
+  g_assert (buffer);
+
+  if (key->modifier == GDK_CONTROL_MASK &&
+      toupper (key->keyval) >= 'A' && toupper (key->keyval) <= 'Z')
+    {
+      buffer[0] = toupper (key->keyval) - 'A' + 1;
+      buffer[1] = '\0';
+
+      return 1;
+    }
+
+  if (key->keyval >= GDK_KEY_Left &&
+      key->keyval <= GDK_KEY_Down)
+    {
+      buffer[0] = '\033';
+      buffer[1] = '[';
+      if (key->keyval == GDK_KEY_Up)
+        buffer[2] = 'A';
+      else if (key->keyval == GDK_KEY_Down)
+        buffer[2] = 'B';
+      else if (key->keyval == GDK_KEY_Right)
+        buffer[2] = 'C';
+      else
+        buffer[2] = 'D';
+      buffer[3] = '\0';
+
+      return 3;
+    }
+
+  c = gdk_keyval_to_unicode (key->keyval);
+
+  if (!c)
+    len = 0;
+  else
+    len = g_unichar_to_utf8 (c, buffer);
+  buffer[len] = '\0';
+
+  return len;
+}
+
+const MktKeyboardStats *
+mkt_keyboard_get_stats (MktKeyboard *self)
+{
+  g_return_val_if_fail (MKT_IS_KEYBOARD (self), NULL);
+
+  return &self->stats;
+}
+
+/**
+ * mkt_keyboard_stats_get_latency_percentile:
+ * @stats: A #MktKeyboardStats
+ * @percentile: The percentile, from 0.0 to 1.0
+ *
+ * Get the upper bound of the latency of @percentile of
+ * events.  As the latency is stored in log2 buckets, this
+ * is a power of 2.
+ *
+ * Returns: The latency in µs, or 0 if no event was recorded
+ */
+guint64
+mkt_keyboard_stats_get_latency_percentile (const MktKeyboardStats *stats,
+                                           double                  percentile)
+{
+  guint64 total = 0, count = 0, target;
+
+  g_return_val_if_fail (stats, 0);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 1.0, 0);
+
+  for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS; i++)
+    total += stats->latency[i];
+
+  if (!total)
+    return 0;
+
+  target = MAX ((guint64)(total * percentile + 0.5), 1);
+
+  for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS; i++)
+    {
+      count += stats->latency[i];
+
+      if (count >= target)
+        return G_GUINT64_CONSTANT (1) << i;
+    }
+
+  return G_GUINT64_CONSTANT (1) << (MKT_KEYBOARD_LATENCY_BUCKETS - 1);
+}
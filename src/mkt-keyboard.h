@@ -31,20 +31,84 @@ typedef struct _MktKeyboardKey {
   GdkModifierType modifier;
   guint           keycode;
   guint           keyval;
+  gboolean        pressed;
 } MktKeyboardKey;
 
+/* The most keys passed at once to MktKeyboardKeyFunc */
+#define MKT_KEYBOARD_KEY_BATCH 16
+
+/* Enough for the longest sequence mkt_keyboard_key_encode() writes */
+#define MKT_KEYBOARD_KEY_MAX_LEN 8
+
+#define MKT_KEYBOARD_LATENCY_BUCKETS 24
+
+/*
+ * latency[i] is the number of key events written to the
+ * terminal within 2^i µs (and more than 2^(i-1) µs) since
+ * the event.  The last bucket counts all slower events.
+ * bytes_read is only known when the shell is run by the
+ * session server, as VTE reads the PTY itself otherwise.
+ */
+typedef struct _MktKeyboardStats {
+  guint64 events;
+  guint64 repeats;
+  guint64 dropped;
+  guint64 limited;        /* Presses over the rate limit */
+  guint64 stuck_releases;
+  guint64 bytes_written;
+  guint64 bytes_read;
+  guint64 shell_exits;
+  guint64 led_writes;
+  guint64 latency_sum; /* µs */
+  guint64 latency[MKT_KEYBOARD_LATENCY_BUCKETS];
+} MktKeyboardStats;
+
 #define MKT_TYPE_KEYBOARD (mkt_keyboard_get_type ())
 G_DECLARE_FINAL_TYPE (MktKeyboard, mkt_keyboard, MKT, KEYBOARD, GObject)
 
+/* @leds is a mask of enum libinput_led */
+typedef void (*MktKeyboardLedFunc) (MktKeyboard *keyboard,
+                                    guint        leds,
+                                    gpointer     user_data);
+
+/*
+ * Keys are passed in the order they are generated, with
+ * @n_keys at most MKT_KEYBOARD_KEY_BATCH.  @keys is valid
+ * only during the call.
+ */
+typedef void (*MktKeyboardKeyFunc) (MktKeyboard          *keyboard,
+                                    const MktKeyboardKey *keys,
+                                    guint                 n_keys,
+                                    gpointer              user_data);
+
+gpointer     mkt_keyboard_get_us_keymap (void);
+
 MktKeyboard *mkt_keyboard_new         (gpointer      libinput_device);
+MktKeyboard *mkt_keyboard_new_virtual (void);
+MktKeyboard *mkt_keyboard_new_remote  (const char   *id);
+void         mkt_keyboard_set_led_func (MktKeyboard       *self,
+                                        MktKeyboardLedFunc func,
+                                        gpointer           user_data);
+void         mkt_keyboard_set_key_func (MktKeyboard       *self,
+                                        MktKeyboardKeyFunc func,
+                                        gpointer           user_data);
+void         mkt_keyboard_unset_key_func (MktKeyboard     *self,
+                                          gpointer         user_data);
+void         mkt_keyboard_freeze_keys (MktKeyboard  *self);
+void         mkt_keyboard_thaw_keys   (MktKeyboard  *self);
 void         mkt_keyboard_set_layout  (MktKeyboard  *self,
                                        const char   *layout);
 void         mkt_keyboard_set_device  (MktKeyboard  *self,
                                        gpointer      libinput_device);
+const char  *mkt_keyboard_get_id      (MktKeyboard  *self);
 void         mkt_keyboard_reset       (MktKeyboard  *self,
                                        gboolean      keep_locks);
 void         mkt_keyboard_set_index   (MktKeyboard  *self,
                                        guint32       index);
+guint32      mkt_keyboard_get_index   (MktKeyboard  *self);
+gboolean     mkt_keyboard_get_connected (MktKeyboard *self);
+void         mkt_keyboard_set_connected (MktKeyboard *self,
+                                         gboolean     connected);
 gboolean     mkt_keyboard_get_enabled (MktKeyboard  *self);
 void         mkt_keyboard_set_enabled (MktKeyboard  *self,
                                        gboolean      enabled);
@@ -52,5 +116,25 @@ guint32      mkt_keyboard_feed_key    (MktKeyboard  *self,
                                        guint32       direction,
                                        guint32       key);
 void        mkt_keyboard_update_leds (MktKeyboard  *self);
+GdkModifierType mkt_keyboard_get_modifiers (MktKeyboard *self);
+gsize        mkt_keyboard_key_encode  (const MktKeyboardKey *key,
+                                       char                 *buffer);
+
+void         mkt_keyboard_set_rate_limit (MktKeyboard *self,
+                                          guint        rate,
+                                          guint        burst);
+void         mkt_keyboard_set_stuck_timeout (MktKeyboard *self,
+                                             guint        timeout);
+void         mkt_keyboard_set_event_time (MktKeyboard *self,
+                                          gint64       time);
+void         mkt_keyboard_count_dropped  (MktKeyboard *self);
+void         mkt_keyboard_add_written    (MktKeyboard *self,
+                                          gsize        n_bytes);
+void         mkt_keyboard_add_read       (MktKeyboard *self,
+                                          gsize        n_bytes);
+void         mkt_keyboard_count_shell_exit (MktKeyboard *self);
+const MktKeyboardStats *mkt_keyboard_get_stats (MktKeyboard *self);
+guint64      mkt_keyboard_stats_get_latency_percentile (const MktKeyboardStats *stats,
+                                                        double                  percentile);
 
 G_END_DECLS
@@ -24,6 +24,8 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 
@@ -31,9 +33,53 @@
 
 #define DEFAULT_DOMAIN "mkt"
 
+/* Should be a power of 2 */
+#define LOG_RING_SIZE         1024
+#define LOG_SLOT_DOMAIN_SIZE  32
+#define LOG_SLOT_MESSAGE_SIZE 448
+#define LOG_WRITER_TIMEOUT    (20 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * A slot in the async log ring buffer.  @seq is used to
+ * synchronize producers and the writer thread, as in a
+ * bounded MPMC queue by Dmitry Vyukov: A slot is free to
+ * write if @seq equals the enqueue position, and is ready
+ * to be read if @seq is one more than the dequeue position.
+ */
+typedef struct
+{
+  gint           seq;
+  GLogLevelFlags log_level;
+  gint64         time;
+  char           domain[LOG_SLOT_DOMAIN_SIZE];
+  char           message[LOG_SLOT_MESSAGE_SIZE];
+} LogSlot;
+
+typedef struct
+{
+  LogSlot  *slots;
+  gint      enqueue_pos;
+  guint     dequeue_pos;  /* Used only by the writer thread */
+  guint     dropped;
+
+  GThread  *thread;
+  GMutex    mutex;
+  GCond     cond;
+  gint      writer_waiting;
+  gint      stop;
+} LogRing;
+
 char *domain;
 static int verbosity;
 gboolean any_domain;
+static gboolean stdout_can_color, stderr_can_color;
+static int pid;
+static LogRing *log_ring;
+/* Threads pushing to log_ring, see mkt_log_finalize() */
+static gint log_ring_users;
+
+/* Log points check these before formatting the message, see mkt-log.h */
+int mkt_log_flags;
 
 static void
 log_str_append_log_domain (GString    *log_str,
@@ -100,6 +146,44 @@ get_log_level_prefix (GLogLevelFlags log_level,
     }
 }
 
+static FILE *
+log_get_stream (GLogLevelFlags log_level)
+{
+  if (log_level & (G_LOG_LEVEL_ERROR |
+                   G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING))
+    return stderr;
+
+  return stdout;
+}
+
+static void
+log_str_append_message (GString        *log_str,
+                        GLogLevelFlags  log_level,
+                        gint64          time,
+                        const char     *log_domain,
+                        const char     *log_message,
+                        gboolean        can_color)
+{
+  char buffer[32];
+  struct tm tm_now;
+  time_t sec_now;
+
+  /* Add local time */
+  sec_now = time / G_USEC_PER_SEC;
+  localtime_r (&sec_now, &tm_now);
+  strftime (buffer, sizeof (buffer), "%H:%M:%S", &tm_now);
+
+  g_string_append_printf (log_str, "%s.%04d ", buffer,
+                          (int)((time % G_USEC_PER_SEC) / 100));
+
+  log_str_append_log_domain (log_str, log_domain, can_color);
+  g_string_append_printf (log_str, "[%5d]:", pid);
+
+  g_string_append_printf (log_str, "%s: ", get_log_level_prefix (log_level, can_color));
+  g_string_append (log_str, log_message);
+  g_string_append_c (log_str, '\n');
+}
+
 static GLogWriterOutput
 mkt_log_write (GLogLevelFlags   log_level,
                const char      *log_domain,
@@ -109,44 +193,161 @@ mkt_log_write (GLogLevelFlags   log_level,
                gpointer         user_data)
 {
   g_autoptr(GString) log_str = NULL;
-  FILE *stream = stdout;
-  gboolean can_color;
-
-  if (log_level & (G_LOG_LEVEL_ERROR |
-                   G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING))
-    stream = stderr;
+  FILE *stream;
 
+  stream = log_get_stream (log_level);
   log_str = g_string_new (NULL);
+  log_str_append_message (log_str, log_level, g_get_real_time (),
+                          log_domain, log_message,
+                          stream == stdout ? stdout_can_color : stderr_can_color);
 
-  /* Add local time */
-  {
-    char buffer[32];
-    struct tm tm_now;
-    time_t sec_now;
-    gint64 now;
-
-    now = g_get_real_time ();
-    sec_now = now / G_USEC_PER_SEC;
-    tm_now = *localtime (&sec_now);
-    strftime (buffer, sizeof (buffer), "%H:%M:%S", &tm_now);
-
-    g_string_append_printf (log_str, "%s.%04d ", buffer,
-                            (int)((now % G_USEC_PER_SEC) / 100));
-  }
-
-  can_color = g_log_writer_supports_color (fileno (stream));
-  log_str_append_log_domain (log_str, log_domain, can_color);
-  g_string_append_printf (log_str, "[%5d]:", getpid ());
+  fwrite (log_str->str, 1, log_str->len, stream);
+  fflush (stream);
 
-  g_string_append_printf (log_str, "%s: ", get_log_level_prefix (log_level, can_color));
-  g_string_append (log_str, log_message);
+  return G_LOG_WRITER_HANDLED;
+}
 
-  fprintf (stream, "%s\n", log_str->str);
-  fflush (stream);
+/*
+ * Push the message to the ring buffer, to be written by the
+ * writer thread.  This never blocks, nor allocates.  If the
+ * ring is full, the message is dropped and counted.
+ */
+static GLogWriterOutput
+mkt_log_write_async (LogRing        *ring,
+                     GLogLevelFlags  log_level,
+                     const char     *log_domain,
+                     const char     *log_message)
+{
+  LogSlot *slot;
+  gint pos;
+
+  pos = g_atomic_int_get (&ring->enqueue_pos);
+
+  while (TRUE)
+    {
+      gint diff;
+
+      slot = &ring->slots[(guint)pos & (LOG_RING_SIZE - 1)];
+      diff = (gint)((guint)g_atomic_int_get (&slot->seq) - (guint)pos);
+
+      if (diff == 0)
+        {
+          if (g_atomic_int_compare_and_exchange (&ring->enqueue_pos,
+                                                 pos, (gint)((guint)pos + 1)))
+            break;
+
+          pos = g_atomic_int_get (&ring->enqueue_pos);
+        }
+      else if (diff < 0)
+        {
+          /* The writer thread hasn't caught up yet */
+          g_atomic_int_inc (&ring->dropped);
+          return G_LOG_WRITER_HANDLED;
+        }
+      else
+        {
+          pos = g_atomic_int_get (&ring->enqueue_pos);
+        }
+    }
+
+  slot->log_level = log_level;
+  slot->time = g_get_real_time ();
+  g_strlcpy (slot->domain, log_domain, sizeof (slot->domain));
+  g_strlcpy (slot->message, log_message, sizeof (slot->message));
+  g_atomic_int_set (&slot->seq, (gint)((guint)pos + 1));
+
+  /* The writer wakes up periodically, so a missed wake up only delays the write */
+  if (g_atomic_int_get (&ring->writer_waiting))
+    g_cond_signal (&ring->cond);
 
   return G_LOG_WRITER_HANDLED;
 }
 
+static gboolean
+log_ring_drain (LogRing *ring,
+                GString *out_str,
+                GString *err_str)
+{
+  gboolean written = FALSE;
+
+  while (TRUE)
+    {
+      LogSlot *slot;
+      GString *str;
+      FILE *stream;
+      guint pos;
+
+      pos = ring->dequeue_pos;
+      slot = &ring->slots[pos & (LOG_RING_SIZE - 1)];
+
+      if (g_atomic_int_get (&slot->seq) != (gint)(pos + 1))
+        break;
+
+      stream = log_get_stream (slot->log_level);
+      str = stream == stdout ? out_str : err_str;
+      log_str_append_message (str, slot->log_level, slot->time,
+                              slot->domain, slot->message,
+                              stream == stdout ? stdout_can_color : stderr_can_color);
+
+      g_atomic_int_set (&slot->seq, (gint)(pos + LOG_RING_SIZE));
+      ring->dequeue_pos = pos + 1;
+      written = TRUE;
+    }
+
+  if (err_str->len)
+    {
+      fwrite (err_str->str, 1, err_str->len, stderr);
+      fflush (stderr);
+      g_string_truncate (err_str, 0);
+    }
+
+  if (out_str->len)
+    {
+      fwrite (out_str->str, 1, out_str->len, stdout);
+      fflush (stdout);
+      g_string_truncate (out_str, 0);
+    }
+
+  return written;
+}
+
+static gpointer
+log_writer_thread (gpointer user_data)
+{
+  g_autoptr(GString) out_str = NULL;
+  g_autoptr(GString) err_str = NULL;
+  LogRing *ring = user_data;
+  guint dropped = 0;
+
+  out_str = g_string_sized_new (LOG_SLOT_MESSAGE_SIZE * 4);
+  err_str = g_string_sized_new (LOG_SLOT_MESSAGE_SIZE);
+
+  while (!g_atomic_int_get (&ring->stop))
+    {
+      if (!log_ring_drain (ring, out_str, err_str))
+        {
+          g_mutex_lock (&ring->mutex);
+          g_atomic_int_set (&ring->writer_waiting, TRUE);
+          g_cond_wait_until (&ring->cond, &ring->mutex,
+                             g_get_monotonic_time () + LOG_WRITER_TIMEOUT);
+          g_atomic_int_set (&ring->writer_waiting, FALSE);
+          g_mutex_unlock (&ring->mutex);
+        }
+
+      if (dropped != (guint)g_atomic_int_get (&ring->dropped))
+        {
+          guint new_dropped = g_atomic_int_get (&ring->dropped);
+
+          fprintf (stderr, "Log buffer full, dropped %u messages\n", new_dropped - dropped);
+          dropped = new_dropped;
+        }
+    }
+
+  log_ring_drain (ring, out_str, err_str);
+
+  return NULL;
+}
+
 static GLogWriterOutput
 mkt_log_handler (GLogLevelFlags   log_level,
                  const GLogField *fields,
@@ -217,20 +418,74 @@ mkt_log_handler (GLogLevelFlags   log_level,
   if (!log_message)
     log_message = "(NULL) message";
 
-  if (any_domain)
-    return mkt_log_write (log_level, log_domain, log_message,
-                             fields, n_fields, user_data);
+  if (!any_domain && !strstr (log_domain, domain))
+    return G_LOG_WRITER_HANDLED;
 
-  if (!log_domain || strstr (log_domain, domain))
-    return mkt_log_write (log_level, log_domain, log_message,
-                             fields, n_fields, user_data);
+  /* Errors may abort right after, so write them right away */
+  if (g_atomic_pointer_get (&log_ring) &&
+      !(log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)))
+    {
+      GLogWriterOutput output = G_LOG_WRITER_HANDLED;
+      LogRing *ring;
 
-  return G_LOG_WRITER_HANDLED;
+      /* Load it once, as mkt_log_finalize() may take it meanwhile */
+      g_atomic_int_inc (&log_ring_users);
+      ring = g_atomic_pointer_get (&log_ring);
+
+      if (ring)
+        output = mkt_log_write_async (ring, log_level, log_domain, log_message);
+
+      g_atomic_int_dec_and_test (&log_ring_users);
+
+      if (ring)
+        return output;
+    }
+
+  return mkt_log_write (log_level, log_domain, log_message,
+                        fields, n_fields, user_data);
+}
+
+static void
+log_update_flags (void)
+{
+  int flags = 0;
+
+  /* Keep in sync with the checks in mkt_log_handler() */
+  if (verbosity >= 3 || (any_domain && domain))
+    flags |= MKT_LOG_FLAG_DEBUG;
+
+  if (verbosity >= 4)
+    flags |= MKT_LOG_FLAG_TRACE;
+
+  g_atomic_int_set (&mkt_log_flags, flags);
 }
 
 static void
 mkt_log_finalize (void)
 {
+  LogRing *ring = g_atomic_pointer_get (&log_ring);
+
+  /* Other threads may still log, those that see no ring write synchronously */
+  if (ring &&
+      g_atomic_pointer_compare_and_exchange (&log_ring, ring, NULL))
+    {
+      /* Wait for the threads that got the ring before, so that it's not freed under them */
+      while (g_atomic_int_get (&log_ring_users))
+        g_thread_yield ();
+
+      g_atomic_int_set (&ring->stop, TRUE);
+      g_cond_signal (&ring->cond);
+      g_thread_join (ring->thread);
+
+      if (ring->dropped)
+        fprintf (stderr, "Dropped %u log messages in total\n", ring->dropped);
+
+      g_mutex_clear (&ring->mutex);
+      g_cond_clear (&ring->cond);
+      g_free (ring->slots);
+      g_free (ring);
+    }
+
   g_clear_pointer (&domain, g_free);
 }
 
@@ -246,6 +501,12 @@ mkt_log_init (void)
       if (!domain || g_str_equal (domain, "all"))
         any_domain = TRUE;
 
+      /* Cache these, as checking requires syscalls */
+      stdout_can_color = g_log_writer_supports_color (fileno (stdout));
+      stderr_can_color = g_log_writer_supports_color (fileno (stderr));
+      pid = getpid ();
+      log_update_flags ();
+
       g_log_set_writer_func (mkt_log_handler, NULL, NULL);
       g_once_init_leave (&initialized, 1);
       atexit (mkt_log_finalize);
@@ -256,6 +517,7 @@ void
 mkt_log_increase_verbosity (void)
 {
   verbosity++;
+  log_update_flags ();
 }
 
 int
@@ -263,3 +525,55 @@ mkt_log_get_verbosity (void)
 {
   return verbosity;
 }
+
+/**
+ * mkt_log_enable_async:
+ *
+ * Write logs from a background thread.  Logging then
+ * only copies the message to a preallocated ring buffer,
+ * which never blocks on the log output.  If the buffer
+ * is full, the messages are dropped, and the number of
+ * dropped messages is logged.
+ *
+ * Errors and criticals are still written synchronously.
+ * mkt_log_init() should be called before this.
+ */
+void
+mkt_log_enable_async (void)
+{
+  LogRing *ring;
+
+  if (g_atomic_pointer_get (&log_ring))
+    return;
+
+  ring = g_new0 (LogRing, 1);
+  ring->slots = g_new0 (LogSlot, LOG_RING_SIZE);
+
+  for (guint i = 0; i < LOG_RING_SIZE; i++)
+    ring->slots[i].seq = i;
+
+  g_mutex_init (&ring->mutex);
+  g_cond_init (&ring->cond);
+  ring->thread = g_thread_new ("mkt-log", log_writer_thread, ring);
+
+  g_atomic_pointer_set (&log_ring, ring);
+}
+
+/**
+ * mkt_log_get_dropped:
+ *
+ * Get the number of log messages dropped as the
+ * ring buffer was full, see mkt_log_enable_async().
+ *
+ * Returns: The number of messages dropped
+ */
+guint
+mkt_log_get_dropped (void)
+{
+  LogRing *ring = g_atomic_pointer_get (&log_ring);
+
+  if (!ring)
+    return 0;
+
+  return g_atomic_int_get (&ring->dropped);
+}
@@ -24,27 +24,72 @@
 
 #pragma once
 
+#ifdef MKT_ENABLE_USDT
+# include <sys/sdt.h>
+#endif
+
 #ifndef MKT_LOG_LEVEL_TRACE
 # define MKT_LOG_LEVEL_TRACE ((GLogLevelFlags)(1 << G_LOG_LEVEL_USER_SHIFT))
 #endif
 
+#define MKT_LOG_FLAG_DEBUG (1 << 0)
+#define MKT_LOG_FLAG_TRACE (1 << 1)
+
+/*
+ * Check the flags before evaluating the arguments, so that
+ * disabled log points cost only a load and a branch.  With
+ * MKT_DISABLE_TRACING, they are compiled out, but still type
+ * checked.
+ */
+#ifdef MKT_DISABLE_TRACING
+# define MKT_LOG_ENABLED(flag) 0
+#else
+# define MKT_LOG_ENABLED(flag) G_UNLIKELY (mkt_log_flags & (flag))
+#endif
+
 /* XXX: Should we use the semi-private g_log_structured_standard() API? */
-#define MKT_TRACE_MSG(fmt, ...)                         \
-  g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,  \
-                    "MESSAGE", "%s():%d: " fmt,         \
-                    G_STRFUNC, __LINE__, ##__VA_ARGS__)
-#define MKT_TRACE(fmt, ...)                             \
-  g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,  \
-                    "MESSAGE",  fmt, ##__VA_ARGS__)
-#define MKT_DEBUG_MSG(fmt, ...)                         \
-  g_log_structured (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,    \
-                    "MESSAGE", "%s():%d: " fmt,         \
-                    G_STRFUNC, __LINE__, ##__VA_ARGS__)
-#define MKT_TODO(_msg)                                  \
-  g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,  \
-                    "MESSAGE", "TODO: %s():%d: %s",     \
-                    G_STRFUNC, __LINE__, _msg)
-
-void mkt_log_init               (void);
-void mkt_log_increase_verbosity (void);
-int  mkt_log_get_verbosity      (void);
+#define MKT_TRACE_MSG(fmt, ...)                              \
+  G_STMT_START {                                             \
+    if (MKT_LOG_ENABLED (MKT_LOG_FLAG_TRACE))                \
+      g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,   \
+                        "MESSAGE", "%s():%d: " fmt,          \
+                        G_STRFUNC, __LINE__, ##__VA_ARGS__); \
+  } G_STMT_END
+#define MKT_TRACE(fmt, ...)                                  \
+  G_STMT_START {                                             \
+    if (MKT_LOG_ENABLED (MKT_LOG_FLAG_TRACE))                \
+      g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,   \
+                        "MESSAGE",  fmt, ##__VA_ARGS__);     \
+  } G_STMT_END
+#define MKT_DEBUG_MSG(fmt, ...)                              \
+  G_STMT_START {                                             \
+    if (MKT_LOG_ENABLED (MKT_LOG_FLAG_DEBUG))                \
+      g_log_structured (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,     \
+                        "MESSAGE", "%s():%d: " fmt,          \
+                        G_STRFUNC, __LINE__, ##__VA_ARGS__); \
+  } G_STMT_END
+#define MKT_TODO(_msg)                                       \
+  G_STMT_START {                                             \
+    if (MKT_LOG_ENABLED (MKT_LOG_FLAG_TRACE))                \
+      g_log_structured (G_LOG_DOMAIN, MKT_LOG_LEVEL_TRACE,   \
+                        "MESSAGE", "TODO: %s():%d: %s",      \
+                        G_STRFUNC, __LINE__, _msg);          \
+  } G_STMT_END
+
+/*
+ * Static probes for tracing with tools like bpftrace or perf,
+ * eg: bpftrace -e 'usdt:./multi-keyterm:multi_keyterm:key_fed { ... }'
+ */
+#ifdef MKT_ENABLE_USDT
+# define MKT_PROBE(name, ...) STAP_PROBEV (multi_keyterm, name, ##__VA_ARGS__)
+#else
+# define MKT_PROBE(name, ...) G_STMT_START { } G_STMT_END
+#endif
+
+extern int mkt_log_flags;
+
+void  mkt_log_init               (void);
+void  mkt_log_enable_async       (void);
+guint mkt_log_get_dropped        (void);
+void  mkt_log_increase_verbosity (void);
+int   mkt_log_get_verbosity      (void);
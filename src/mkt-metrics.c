@@ -0,0 +1,525 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-metrics.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-metrics"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-metrics.h"
+#include "mkt-utils.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-metrics
+ * @title: MktMetrics
+ * @short_description: Export per-slot counters to a file
+ * @include: "mkt-metrics.h"
+ *
+ * Write the counters of the keyboards of each slot, and a
+ * few of the application, to a file in the Prometheus text
+ * format, which can be read by the textfile collector of
+ * node_exporter.  The file is written to a temporary file
+ * first and renamed over, so that a partial file is never
+ * read.
+ *
+ * The main thread only copies the counters to a snapshot
+ * every interval, which doesn't allocate.  The snapshot is
+ * formatted to a preallocated buffer and written out from a
+ * thread of its own, so a slow disk never blocks input.
+ *
+ * The lag of the main loop is measured with a timeout that
+ * should fire every %LOOP_LAG_INTERVAL ms.  Any delay past
+ * that is time the main loop was busy with something else.
+ */
+
+#define LOOP_LAG_INTERVAL   200 /* ms */
+#define METRICS_BUFFER_SIZE (64 * 1024)
+
+struct _MktMetrics
+{
+  MktController      *controller;
+  char               *path;
+  char               *tmp_path;
+
+  /* Used only by the main thread */
+  guint               snapshot_id;
+  guint               lag_id;
+  gint64              lag_time;
+  gint64              lag_max;
+  guint64             lag_sum;
+
+  GThread            *thread;
+  GMutex              mutex;
+  GCond               cond;
+  /* Protected by mutex */
+  MktMetricsSnapshot  pending;
+  gboolean            has_pending;
+  gboolean            stop;
+
+  /* Used only by the writer thread */
+  MktMetricsSnapshot  snapshot;
+  int                 last_errno;
+  char                buffer[METRICS_BUFFER_SIZE];
+};
+
+typedef struct
+{
+  char     *buffer;
+  gsize     size;
+  gsize     len;
+  gboolean  overflow;
+} MetricsBuffer;
+
+static const struct {
+  const char *name;
+  const char *help;
+  gsize       offset;
+} slot_counters[] = {
+  {
+    "multi_keyterm_key_events_total",
+    "Key events from the keyboards of the slot",
+    G_STRUCT_OFFSET (MktKeyboardStats, events),
+  },
+  {
+    "multi_keyterm_key_repeats_total",
+    "Key repeats generated for the keyboards of the slot",
+    G_STRUCT_OFFSET (MktKeyboardStats, repeats),
+  },
+  {
+    "multi_keyterm_key_dropped_total",
+    "Key events not handled, eg: as the window had no focus",
+    G_STRUCT_OFFSET (MktKeyboardStats, dropped),
+  },
+  {
+    "multi_keyterm_key_rate_limited_total",
+    "Key presses dropped as they were over the rate limit",
+    G_STRUCT_OFFSET (MktKeyboardStats, limited),
+  },
+  {
+    "multi_keyterm_stuck_key_releases_total",
+    "Keys released as they were held down for too long",
+    G_STRUCT_OFFSET (MktKeyboardStats, stuck_releases),
+  },
+  {
+    "multi_keyterm_pty_written_bytes_total",
+    "Bytes written to the shell",
+    G_STRUCT_OFFSET (MktKeyboardStats, bytes_written),
+  },
+  {
+    "multi_keyterm_pty_read_bytes_total",
+    "Bytes read from the shell, only counted when run by the session server",
+    G_STRUCT_OFFSET (MktKeyboardStats, bytes_read),
+  },
+  {
+    "multi_keyterm_shell_restarts_total",
+    "Exits of the shell, after which it's started again on request",
+    G_STRUCT_OFFSET (MktKeyboardStats, shell_exits),
+  },
+  {
+    "multi_keyterm_led_writes_total",
+    "Updates of the keyboard LEDs",
+    G_STRUCT_OFFSET (MktKeyboardStats, led_writes),
+  },
+};
+
+static void G_GNUC_PRINTF (2, 3)
+metrics_append (MetricsBuffer *out,
+                const char    *format,
+                ...)
+{
+  va_list args;
+  int len;
+
+  if (out->overflow)
+    return;
+
+  /* vsnprintf() doesn't allocate, unlike g_vsnprintf() may */
+  va_start (args, format);
+  len = vsnprintf (out->buffer + out->len, out->size - out->len, format, args);
+  va_end (args);
+
+  if (len < 0 || (gsize)len >= out->size - out->len)
+    {
+      out->overflow = TRUE;
+      return;
+    }
+
+  out->len += len;
+}
+
+static void
+metrics_add_stats (MktKeyboardStats       *total,
+                   const MktKeyboardStats *stats)
+{
+  total->events += stats->events;
+  total->repeats += stats->repeats;
+  total->dropped += stats->dropped;
+  total->limited += stats->limited;
+  total->stuck_releases += stats->stuck_releases;
+  total->bytes_written += stats->bytes_written;
+  total->bytes_read += stats->bytes_read;
+  total->shell_exits += stats->shell_exits;
+  total->led_writes += stats->led_writes;
+  total->latency_sum += stats->latency_sum;
+
+  for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS; i++)
+    total->latency[i] += stats->latency[i];
+}
+
+static void
+metrics_write (MktMetrics *self)
+{
+  gsize len, written = 0;
+  int fd;
+
+  len = mkt_metrics_format (&self->snapshot, self->buffer, sizeof self->buffer);
+
+  if (!len)
+    {
+      if (self->last_errno != ENOBUFS)
+        g_warning ("Metrics don't fit in %d bytes, not written", METRICS_BUFFER_SIZE);
+
+      self->last_errno = ENOBUFS;
+      return;
+    }
+
+  fd = open (self->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  if (fd == -1)
+    goto error;
+
+  while (written < len)
+    {
+      gssize n;
+
+      n = write (fd, self->buffer + written, len - written);
+
+      if (n == -1 && errno == EINTR)
+        continue;
+
+      if (n == -1)
+        {
+          int saved_errno = errno;
+
+          close (fd);
+          unlink (self->tmp_path);
+          errno = saved_errno;
+          goto error;
+        }
+
+      written += n;
+    }
+
+  if (close (fd) == -1 ||
+      rename (self->tmp_path, self->path) == -1)
+    {
+      int saved_errno = errno;
+
+      unlink (self->tmp_path);
+      errno = saved_errno;
+      goto error;
+    }
+
+  self->last_errno = 0;
+  return;
+
+ error:
+  /* Warn only once for the same error, as it would be repeated every interval */
+  if (self->last_errno != errno)
+    g_warning ("Failed to write metrics to %s: %s", self->path, g_strerror (errno));
+
+  self->last_errno = errno;
+}
+
+static gpointer
+metrics_writer_thread (gpointer user_data)
+{
+  MktMetrics *self = user_data;
+
+  g_mutex_lock (&self->mutex);
+
+  while (TRUE)
+    {
+      while (!self->has_pending && !self->stop)
+        g_cond_wait (&self->cond, &self->mutex);
+
+      if (self->stop)
+        break;
+
+      self->snapshot = self->pending;
+      self->has_pending = FALSE;
+      g_mutex_unlock (&self->mutex);
+
+      metrics_write (self);
+
+      g_mutex_lock (&self->mutex);
+    }
+
+  g_mutex_unlock (&self->mutex);
+
+  return NULL;
+}
+
+static gboolean
+metrics_lag_cb (gpointer user_data)
+{
+  MktMetrics *self = user_data;
+  gint64 now, lag;
+
+  g_assert (MKT_IS_MAIN_THREAD ());
+
+  now = g_get_monotonic_time ();
+  lag = MAX (now - self->lag_time - LOOP_LAG_INTERVAL * 1000, 0);
+  self->lag_time = now;
+  self->lag_max = MAX (self->lag_max, lag);
+  self->lag_sum += lag;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+metrics_snapshot_cb (gpointer user_data)
+{
+  MktMetrics *self = user_data;
+  GListModel *keyboard_list;
+  guint n_items;
+
+  g_assert (MKT_IS_MAIN_THREAD ());
+
+  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
+  n_items = g_list_model_get_n_items (keyboard_list);
+
+  g_mutex_lock (&self->mutex);
+
+  memset (&self->pending, 0, sizeof self->pending);
+  self->pending.hotplug_events = mkt_controller_get_hotplug_events (self->controller);
+  self->pending.loop_lag_max = self->lag_max;
+  self->pending.loop_lag_sum = self->lag_sum;
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+      guint slot;
+
+      keyboard = g_list_model_get_item (keyboard_list, i);
+      slot = mkt_keyboard_get_index (keyboard) - XKB_KEY_0;
+
+      if (slot >= MKT_METRICS_SLOTS)
+        slot = 0;
+
+      metrics_add_stats (&self->pending.slots[slot], mkt_keyboard_get_stats (keyboard));
+      self->pending.n_keyboards[slot]++;
+    }
+
+  self->has_pending = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+
+  self->lag_max = 0;
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * mkt_metrics_new:
+ * @controller: A #MktController
+ * @path: The path of the file to write
+ * @interval: The time between writes in seconds
+ *
+ * Create a new #MktMetrics that writes the counters of
+ * the keyboards of @controller to @path every @interval
+ * seconds, until freed.  The temporary file is written
+ * next to @path with a “.tmp” suffix, which is ignored by
+ * the textfile collector.
+ *
+ * Returns: (transfer full): A #MktMetrics
+ */
+MktMetrics *
+mkt_metrics_new (MktController *controller,
+                 const char    *path,
+                 guint          interval)
+{
+  MktMetrics *self;
+
+  g_return_val_if_fail (MKT_IS_CONTROLLER (controller), NULL);
+  g_return_val_if_fail (path && *path, NULL);
+  g_return_val_if_fail (interval, NULL);
+  g_return_val_if_fail (MKT_IS_MAIN_THREAD (), NULL);
+
+  self = g_new0 (MktMetrics, 1);
+  self->controller = g_object_ref (controller);
+  self->path = g_strdup (path);
+  self->tmp_path = g_strconcat (path, ".tmp", NULL);
+
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->thread = g_thread_new ("mkt-metrics", metrics_writer_thread, self);
+
+  self->lag_time = g_get_monotonic_time ();
+  self->lag_id = g_timeout_add (LOOP_LAG_INTERVAL, metrics_lag_cb, self);
+  self->snapshot_id = g_timeout_add_seconds (interval, metrics_snapshot_cb, self);
+
+  /* Have the file ready without waiting for an interval */
+  metrics_snapshot_cb (self);
+
+  MKT_DEBUG_MSG ("Writing metrics to %s every %u seconds", path, interval);
+
+  return self;
+}
+
+void
+mkt_metrics_free (MktMetrics *self)
+{
+  if (!self)
+    return;
+
+  g_clear_handle_id (&self->snapshot_id, g_source_remove);
+  g_clear_handle_id (&self->lag_id, g_source_remove);
+
+  g_mutex_lock (&self->mutex);
+  self->stop = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+
+  g_thread_join (self->thread);
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+
+  g_clear_object (&self->controller);
+  g_free (self->path);
+  g_free (self->tmp_path);
+  g_free (self);
+}
+
+/**
+ * mkt_metrics_format:
+ * @snapshot: A #MktMetricsSnapshot
+ * @buffer: The buffer to write to
+ * @size: The size of @buffer
+ *
+ * Format @snapshot in the Prometheus text format to @buffer.
+ * Only slots with keyboards are written.  This doesn't
+ * allocate, so it can be run from any thread.
+ *
+ * Returns: The length written, excluding the terminating
+ * NUL byte, or 0 if @buffer is too small.
+ */
+gsize
+mkt_metrics_format (const MktMetricsSnapshot *snapshot,
+                    char                     *buffer,
+                    gsize                     size)
+{
+  MetricsBuffer out = { buffer, size, 0, FALSE };
+  const char *name;
+
+  g_return_val_if_fail (snapshot, 0);
+  g_return_val_if_fail (buffer, 0);
+
+  if (!size)
+    return 0;
+
+  name = "multi_keyterm_keyboards";
+  metrics_append (&out, "# HELP %s Keyboards assigned to the slot\n", name);
+  metrics_append (&out, "# TYPE %s gauge\n", name);
+
+  for (guint slot = 0; slot < MKT_METRICS_SLOTS; slot++)
+    if (snapshot->n_keyboards[slot])
+      metrics_append (&out, "%s{slot=\"%u\"} %u\n", name, slot,
+                      snapshot->n_keyboards[slot]);
+
+  for (guint i = 0; i < G_N_ELEMENTS (slot_counters); i++)
+    {
+      name = slot_counters[i].name;
+      metrics_append (&out, "# HELP %s %s\n", name, slot_counters[i].help);
+      metrics_append (&out, "# TYPE %s counter\n", name);
+
+      for (guint slot = 0; slot < MKT_METRICS_SLOTS; slot++)
+        if (snapshot->n_keyboards[slot])
+          metrics_append (&out, "%s{slot=\"%u\"} %" G_GUINT64_FORMAT "\n", name, slot,
+                          G_STRUCT_MEMBER (guint64, &snapshot->slots[slot],
+                                           slot_counters[i].offset));
+    }
+
+  name = "multi_keyterm_input_latency_seconds";
+  metrics_append (&out, "# HELP %s Time from a key event to its write to the shell\n", name);
+  metrics_append (&out, "# TYPE %s histogram\n", name);
+
+  for (guint slot = 0; slot < MKT_METRICS_SLOTS; slot++)
+    {
+      const MktKeyboardStats *stats = &snapshot->slots[slot];
+      guint64 count = 0;
+
+      if (!snapshot->n_keyboards[slot])
+        continue;
+
+      /* The last bucket has no upper bound */
+      for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS - 1; i++)
+        {
+          count += stats->latency[i];
+          metrics_append (&out, "%s_bucket{slot=\"%u\",le=\"%g\"} %" G_GUINT64_FORMAT "\n",
+                          name, slot, (double)(1 << i) / G_USEC_PER_SEC, count);
+        }
+
+      count += stats->latency[MKT_KEYBOARD_LATENCY_BUCKETS - 1];
+      metrics_append (&out, "%s_bucket{slot=\"%u\",le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+                      name, slot, count);
+      metrics_append (&out, "%s_sum{slot=\"%u\"} %g\n", name, slot,
+                      (double)stats->latency_sum / G_USEC_PER_SEC);
+      metrics_append (&out, "%s_count{slot=\"%u\"} %" G_GUINT64_FORMAT "\n",
+                      name, slot, count);
+    }
+
+  name = "multi_keyterm_device_hotplug_events_total";
+  metrics_append (&out, "# HELP %s Input devices added and removed\n", name);
+  metrics_append (&out, "# TYPE %s counter\n", name);
+  metrics_append (&out, "%s %" G_GUINT64_FORMAT "\n", name, snapshot->hotplug_events);
+
+  name = "multi_keyterm_main_loop_lag_seconds";
+  metrics_append (&out, "# HELP %s The longest delay of the main loop since the last write\n", name);
+  metrics_append (&out, "# TYPE %s gauge\n", name);
+  metrics_append (&out, "%s %g\n", name, (double)snapshot->loop_lag_max / G_USEC_PER_SEC);
+
+  name = "multi_keyterm_main_loop_lag_seconds_total";
+  metrics_append (&out, "# HELP %s The total delay of the main loop\n", name);
+  metrics_append (&out, "# TYPE %s counter\n", name);
+  metrics_append (&out, "%s %g\n", name, (double)snapshot->loop_lag_sum / G_USEC_PER_SEC);
+
+  if (out.overflow)
+    {
+      buffer[0] = '\0';
+      return 0;
+    }
+
+  return out.len;
+}
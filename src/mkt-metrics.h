@@ -0,0 +1,57 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-metrics.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "mkt-controller.h"
+#include "mkt-keyboard.h"
+
+G_BEGIN_DECLS
+
+/* Slots 1 to 9, and 0 for keyboards without a slot */
+#define MKT_METRICS_SLOTS 10
+
+typedef struct _MktMetricsSnapshot {
+  MktKeyboardStats slots[MKT_METRICS_SLOTS];
+  guint            n_keyboards[MKT_METRICS_SLOTS];
+  guint64          hotplug_events;
+  gint64           loop_lag_max; /* µs, since the last snapshot */
+  guint64          loop_lag_sum; /* µs */
+} MktMetricsSnapshot;
+
+typedef struct _MktMetrics MktMetrics;
+
+MktMetrics *mkt_metrics_new    (MktController            *controller,
+                                const char               *path,
+                                guint                     interval);
+void        mkt_metrics_free   (MktMetrics               *self);
+gsize       mkt_metrics_format (const MktMetricsSnapshot *snapshot,
+                                char                     *buffer,
+                                gsize                     size);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktMetrics, mkt_metrics_free)
+
+G_END_DECLS
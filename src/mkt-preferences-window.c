@@ -43,6 +43,11 @@ struct _MktPreferencesWindow
   GtkWidget            *expand_to_fit_row;
   GtkWidget            *horizontal_split_row;
   GtkWidget            *min_height_row;
+  GtkWidget            *use_all_monitors_row;
+  GtkWidget            *performance_hud_row;
+  GtkWidget            *keep_sessions_row;
+  GtkWidget            *predictive_echo_row;
+  GtkWidget            *freeze_idle_row;
 
   GtkWidget            *font_chooser_dialog;
 
@@ -97,6 +102,21 @@ preferences_window_set_settings (MktPreferencesWindow *self,
   g_object_bind_property (self->settings, "minimum-terminal-height",
                           self->min_height_row, "value",
                           G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
+  g_object_bind_property (self->settings, "use-all-monitors",
+                          self->use_all_monitors_row, "active",
+                          G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
+  g_object_bind_property (self->settings, "show-performance-hud",
+                          self->performance_hud_row, "active",
+                          G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
+  g_object_bind_property (self->settings, "keep-sessions",
+                          self->keep_sessions_row, "active",
+                          G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
+  g_object_bind_property (self->settings, "predictive-echo",
+                          self->predictive_echo_row, "active",
+                          G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
+  g_object_bind_property (self->settings, "freeze-idle-shells",
+                          self->freeze_idle_row, "active",
+                          G_BINDING_BIDIRECTIONAL | G_BINDING_SYNC_CREATE);
 
   settings_font_changed_cb (self, self->settings);
 }
@@ -177,6 +197,11 @@ mkt_preferences_window_class_init (MktPreferencesWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, expand_to_fit_row);
   gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, horizontal_split_row);
   gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, min_height_row);
+  gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, use_all_monitors_row);
+  gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, performance_hud_row);
+  gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, keep_sessions_row);
+  gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, predictive_echo_row);
+  gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, freeze_idle_row);
 
   gtk_widget_class_bind_template_child (widget_class, MktPreferencesWindow, font_chooser_dialog);
 
@@ -0,0 +1,469 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-router.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-router"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-router.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-router
+ * @title: MktRouter
+ * @short_description: Route keyboard input without terminals
+ * @include: "mkt-router.h"
+ *
+ * In headless mode, there are no terminals to show.  Instead,
+ * the bytes each claimed keyboard would have written to its
+ * terminal are sent to a target set in the “headless-routes”
+ * setting.  The target can be a TTY, like a VT running a login
+ * or a PTY of a tmux session, where the input is injected with
+ * TIOCSTI as if typed on it, or a UNIX stream socket, eg:
+ *
+ * |[
+ * socat UNIX-LISTEN:/run/kbd1.sock,fork EXEC:"tmux attach -t kbd1",pty,setsid,ctty
+ * ]|
+ *
+ * Routes are looked up when a keyboard is claimed.  Keys
+ * that can't be delivered are counted as dropped.  A target
+ * that fails is reopened from a timer, with the delay doubled
+ * on each failure, and not on each key.
+ */
+
+#define UNIX_PREFIX "unix:"
+#define RETRY_DELAY_MIN 250   /* ms */
+#define RETRY_DELAY_MAX 30000 /* ms */
+
+typedef struct
+{
+  MktRouter   *router;
+  MktKeyboard *keyboard;
+  char        *target;
+  int          fd;
+  gboolean     is_tty;
+  /* Warn only once until the target works again */
+  gboolean     failed;
+  guint        retry_id;
+  guint        retry_delay;
+} Route;
+
+struct _MktRouter
+{
+  GObject        parent_instance;
+
+  MktController *controller;
+  MktSettings   *settings;
+  /* MktKeyboard to Route map */
+  GHashTable    *routes;
+  guint          retry_delay_min;
+  guint          retry_delay_max;
+};
+
+G_DEFINE_TYPE (MktRouter, mkt_router, G_TYPE_OBJECT)
+
+static void
+route_close (Route *route)
+{
+  if (route->fd != -1)
+    close (route->fd);
+
+  route->fd = -1;
+}
+
+static void
+route_free (gpointer data)
+{
+  Route *route = data;
+
+  mkt_keyboard_unset_key_func (route->keyboard, route);
+  g_clear_handle_id (&route->retry_id, g_source_remove);
+  route_close (route);
+  g_object_unref (route->keyboard);
+  g_free (route->target);
+  g_free (route);
+}
+
+static gboolean route_open (Route *route);
+
+static gboolean
+route_retry_cb (gpointer user_data)
+{
+  Route *route = user_data;
+
+  route->retry_id = 0;
+  /* This schedules the next try if it fails again */
+  route_open (route);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+route_set_failed (Route      *route,
+                  const char *message)
+{
+  route_close (route);
+
+  if (!route->failed)
+    g_warning ("Failed to route keyboard %u to %s: %s",
+               mkt_keyboard_get_index (route->keyboard) - XKB_KEY_0,
+               route->target, message);
+  route->failed = TRUE;
+
+  if (route->retry_id)
+    return;
+
+  if (route->retry_delay)
+    route->retry_delay = MIN (route->retry_delay * 2, route->router->retry_delay_max);
+  else
+    route->retry_delay = route->router->retry_delay_min;
+
+  route->retry_id = g_timeout_add (route->retry_delay, route_retry_cb, route);
+}
+
+static gboolean
+route_open (Route *route)
+{
+  const char *path;
+  int fd;
+
+  if (route->fd != -1)
+    return TRUE;
+
+  route->is_tty = !g_str_has_prefix (route->target, UNIX_PREFIX);
+
+  if (route->is_tty)
+    {
+      fd = open (route->target, O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    }
+  else
+    {
+      struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+      path = route->target + strlen (UNIX_PREFIX);
+
+      if (strlen (path) >= sizeof addr.sun_path)
+        {
+          route_set_failed (route, "Socket path too long");
+          return FALSE;
+        }
+
+      strcpy (addr.sun_path, path);
+      fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+      if (fd != -1 &&
+          connect (fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+        {
+          int saved_errno = errno;
+
+          close (fd);
+          fd = -1;
+          errno = saved_errno;
+        }
+    }
+
+  if (fd == -1)
+    {
+      route_set_failed (route, g_strerror (errno));
+      return FALSE;
+    }
+
+  if (route->failed)
+    g_message ("Routing keyboard %u to %s",
+               mkt_keyboard_get_index (route->keyboard) - XKB_KEY_0,
+               route->target);
+  route->fd = fd;
+  route->failed = FALSE;
+  route->retry_delay = 0;
+
+  return TRUE;
+}
+
+static void
+route_write (Route      *route,
+             const char *buffer,
+             gsize       len)
+{
+  /* A failed target is reopened from a timer, not for every key */
+  if (route->fd == -1)
+    {
+      mkt_keyboard_count_dropped (route->keyboard);
+      return;
+    }
+
+  if (route->is_tty)
+    {
+      for (gsize i = 0; i < len; i++)
+        if (ioctl (route->fd, TIOCSTI, &buffer[i]) == -1)
+          {
+            route_set_failed (route, g_strerror (errno));
+            if (i)
+              mkt_keyboard_add_written (route->keyboard, i);
+            mkt_keyboard_count_dropped (route->keyboard);
+            return;
+          }
+    }
+  else
+    {
+      gssize written;
+
+      /* Don't let a stuck reader block every other keyboard */
+      written = send (route->fd, buffer, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+      if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          mkt_keyboard_count_dropped (route->keyboard);
+          return;
+        }
+
+      if (written == -1)
+        {
+          route_set_failed (route, g_strerror (errno));
+          mkt_keyboard_count_dropped (route->keyboard);
+          return;
+        }
+
+      /* The socket buffer is full, the rest of the batch is lost */
+      if ((gsize)written < len)
+        {
+          mkt_keyboard_add_written (route->keyboard, written);
+          mkt_keyboard_count_dropped (route->keyboard);
+          return;
+        }
+    }
+
+  mkt_keyboard_add_written (route->keyboard, len);
+}
+
+static void
+route_keys_cb (MktKeyboard          *keyboard,
+               const MktKeyboardKey *keys,
+               guint                 n_keys,
+               gpointer              user_data)
+{
+  char buffer[MKT_KEYBOARD_KEY_MAX_LEN * MKT_KEYBOARD_KEY_BATCH];
+  Route *route = user_data;
+  gsize len = 0;
+
+  for (guint i = 0; i < n_keys; i++)
+    if (keys[i].pressed)
+      len += mkt_keyboard_key_encode (&keys[i], buffer + len);
+
+  if (len)
+    route_write (route, buffer, len);
+}
+
+static void
+router_add_keyboard (MktRouter   *self,
+                     MktKeyboard *keyboard)
+{
+  g_autofree char *target = NULL;
+  Route *route;
+  guint slot;
+
+  g_assert (MKT_IS_ROUTER (self));
+  g_assert (MKT_IS_KEYBOARD (keyboard));
+
+  slot = mkt_keyboard_get_index (keyboard) - XKB_KEY_0;
+  target = mkt_settings_get_headless_route (self->settings,
+                                            mkt_keyboard_get_id (keyboard),
+                                            slot);
+
+  if (!target || !*target)
+    {
+      g_warning ("No route set for keyboard %u (%s), its input is discarded",
+                 slot, mkt_keyboard_get_id (keyboard) ?: "no id");
+      return;
+    }
+
+  route = g_new0 (Route, 1);
+  route->router = self;
+  route->keyboard = g_object_ref (keyboard);
+  route->target = g_steal_pointer (&target);
+  route->fd = -1;
+  g_hash_table_insert (self->routes, keyboard, route);
+
+  mkt_keyboard_set_key_func (keyboard, route_keys_cb, route);
+
+  /* Open early so that a bad route is reported right away */
+  route_open (route);
+  MKT_DEBUG_MSG ("Routing keyboard %u to %s", slot, route->target);
+}
+
+static void
+router_keyboards_changed_cb (MktRouter *self)
+{
+  g_autoptr(GHashTable) keyboards = NULL;
+  GListModel *keyboard_list;
+  GHashTableIter iter;
+  gpointer keyboard;
+  guint n_items;
+
+  g_assert (MKT_IS_ROUTER (self));
+
+  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
+  n_items = g_list_model_get_n_items (keyboard_list);
+  keyboards = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                     g_object_unref, NULL);
+
+  for (guint i = 0; i < n_items; i++)
+    g_hash_table_add (keyboards, g_list_model_get_item (keyboard_list, i));
+
+  /* Drop routes of removed keyboards */
+  g_hash_table_iter_init (&iter, self->routes);
+  while (g_hash_table_iter_next (&iter, &keyboard, NULL))
+    if (!g_hash_table_contains (keyboards, keyboard))
+      g_hash_table_iter_remove (&iter);
+
+  g_hash_table_iter_init (&iter, keyboards);
+  while (g_hash_table_iter_next (&iter, &keyboard, NULL))
+    if (!g_hash_table_contains (self->routes, keyboard))
+      router_add_keyboard (self, keyboard);
+}
+
+static void
+mkt_router_finalize (GObject *object)
+{
+  MktRouter *self = (MktRouter *)object;
+
+  g_clear_pointer (&self->routes, g_hash_table_unref);
+  g_clear_object (&self->controller);
+  g_clear_object (&self->settings);
+
+  G_OBJECT_CLASS (mkt_router_parent_class)->finalize (object);
+}
+
+static void
+mkt_router_class_init (MktRouterClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = mkt_router_finalize;
+}
+
+static void
+mkt_router_init (MktRouter *self)
+{
+  self->routes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL, route_free);
+  self->retry_delay_min = RETRY_DELAY_MIN;
+  self->retry_delay_max = RETRY_DELAY_MAX;
+}
+
+/**
+ * mkt_router_new:
+ * @controller: A #MktController
+ * @settings: A #MktSettings
+ *
+ * Create a new router that sends the input of each
+ * keyboard claimed by @controller to the target set
+ * for it in @settings.
+ *
+ * Returns: (transfer full): A #MktRouter
+ */
+MktRouter *
+mkt_router_new (MktController *controller,
+                MktSettings   *settings)
+{
+  MktRouter *self;
+
+  g_return_val_if_fail (MKT_IS_CONTROLLER (controller), NULL);
+  g_return_val_if_fail (MKT_IS_SETTINGS (settings), NULL);
+
+  self = g_object_new (MKT_TYPE_ROUTER, NULL);
+  self->controller = g_object_ref (controller);
+  self->settings = g_object_ref (settings);
+
+  g_signal_connect_object (mkt_controller_get_keyboard_list (controller),
+                           "items-changed",
+                           G_CALLBACK (router_keyboards_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  router_keyboards_changed_cb (self);
+
+  return self;
+}
+
+/**
+ * mkt_router_set_retry_delay:
+ * @self: A #MktRouter
+ * @min_delay: The delay after the first failure, in milliseconds
+ * @max_delay: The longest delay, in milliseconds
+ *
+ * Set how long to wait before reopening a target that
+ * failed.  The delay starts at @min_delay and is doubled
+ * on each failure, up to @max_delay.  The default is
+ * 250ms up to 30s.  Routes already waiting keep their
+ * current delay until the next failure.
+ */
+void
+mkt_router_set_retry_delay (MktRouter *self,
+                            guint      min_delay,
+                            guint      max_delay)
+{
+  g_return_if_fail (MKT_IS_ROUTER (self));
+  g_return_if_fail (min_delay > 0);
+  g_return_if_fail (min_delay <= max_delay);
+
+  self->retry_delay_min = min_delay;
+  self->retry_delay_max = max_delay;
+}
+
+/**
+ * mkt_router_get_retry_delay:
+ * @self: A #MktRouter
+ * @keyboard: A #MktKeyboard
+ *
+ * Get the delay before the target of @keyboard is
+ * reopened.
+ *
+ * Returns: The delay in milliseconds, or 0 if the
+ * target works or @keyboard has no route.
+ */
+guint
+mkt_router_get_retry_delay (MktRouter   *self,
+                            MktKeyboard *keyboard)
+{
+  Route *route;
+
+  g_return_val_if_fail (MKT_IS_ROUTER (self), 0);
+  g_return_val_if_fail (MKT_IS_KEYBOARD (keyboard), 0);
+
+  route = g_hash_table_lookup (self->routes, keyboard);
+
+  if (!route)
+    return 0;
+
+  return route->retry_delay;
+}
@@ -0,0 +1,46 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-router.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "mkt-controller.h"
+#include "mkt-settings.h"
+
+G_BEGIN_DECLS
+
+#define MKT_TYPE_ROUTER (mkt_router_get_type ())
+
+G_DECLARE_FINAL_TYPE (MktRouter, mkt_router, MKT, ROUTER, GObject)
+
+MktRouter *mkt_router_new             (MktController *controller,
+                                       MktSettings   *settings);
+void       mkt_router_set_retry_delay (MktRouter     *self,
+                                       guint          min_delay,
+                                       guint          max_delay);
+guint      mkt_router_get_retry_delay (MktRouter     *self,
+                                       MktKeyboard   *keyboard);
+
+G_END_DECLS
@@ -0,0 +1,681 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-session-server.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * multi-keyterm-session-server owns the PTYs and the shells of
+ * the terminals, so that they survive a crash or a restart of
+ * the UI.  Each terminal connects with a #MktSession and attaches
+ * to the shell of its slot, which is started on first attach.
+ * The recent output of each shell is kept, and replayed to the
+ * UI on attach, so that a restarted UI shows the screen as it
+ * was within a few milliseconds.
+ *
+ * The server is started by the UI when needed, and exits once
+ * it has no shells and no clients left for IDLE_TIMEOUT.
+ */
+
+#define G_LOG_DOMAIN "mkt-session-server"
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mkt-session.h"
+#include "mkt-log.h"
+
+#define IDLE_TIMEOUT 10           /* s */
+#define READ_SIZE    (16 * 1024)
+/* Output kept per shell, for replay on attach */
+#define REPLAY_SIZE  (256 * 1024)
+/* Stop reading a shell when its client is this far behind */
+#define MAX_PENDING  (256 * 1024)
+
+typedef struct _Server Server;
+typedef struct _Client Client;
+
+typedef struct
+{
+  Server     *server;
+  Client     *client;
+  GByteArray *replay;
+  /* Input not yet written to the shell */
+  GByteArray *input;
+  guint       slot;
+  int         master;
+  GPid        pid;
+  guint       master_id;
+  guint       input_id;
+  guint       child_id;
+} Shell;
+
+struct _Client
+{
+  Server     *server;
+  MktSession *session;
+  Shell      *shell;
+};
+
+struct _Server
+{
+  GMainLoop  *main_loop;
+  /* Slot number to Shell */
+  GHashTable *shells;
+  GPtrArray  *clients;
+  guint       idle_id;
+};
+
+static char *socket_path;
+
+static gboolean
+cmd_verbose_cb (const char  *option_name,
+                const char  *value,
+                gpointer     data,
+                GError     **error)
+{
+  mkt_log_increase_verbosity ();
+
+  return TRUE;
+}
+
+static GOptionEntry cmd_options[] = {
+  { "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path,
+    "Socket to listen on (default: $XDG_RUNTIME_DIR/multi-keyterm/sessions)", "PATH" },
+  { "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, cmd_verbose_cb,
+    "Show verbose logs", NULL },
+  { NULL }
+};
+
+static gboolean shell_read_cb (int          fd,
+                               GIOCondition condition,
+                               gpointer     user_data);
+
+static gboolean
+server_idle_cb (gpointer user_data)
+{
+  Server *server = user_data;
+
+  g_info ("No shells left, exiting");
+  server->idle_id = 0;
+  g_main_loop_quit (server->main_loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+server_update_idle (Server *server)
+{
+  if (g_hash_table_size (server->shells) || server->clients->len)
+    g_clear_handle_id (&server->idle_id, g_source_remove);
+  else if (!server->idle_id)
+    server->idle_id = g_timeout_add_seconds (IDLE_TIMEOUT, server_idle_cb, server);
+}
+
+static void
+shell_append_replay (Shell      *shell,
+                     const char *data,
+                     gsize       length)
+{
+  GByteArray *replay = shell->replay;
+
+  g_byte_array_append (replay, (const guint8 *)data, length);
+
+  /* Trim in batches, so that the buffer isn't moved on each read */
+  if (replay->len > REPLAY_SIZE + REPLAY_SIZE / 4)
+    {
+      gsize trim;
+      guint8 *newline;
+
+      trim = replay->len - REPLAY_SIZE;
+      /* Start the replay at a line, it's less likely to be in an escape sequence */
+      newline = memchr (replay->data + trim, '\n', REPLAY_SIZE / 16);
+
+      if (newline)
+        trim = newline - replay->data + 1;
+
+      g_byte_array_remove_range (replay, 0, trim);
+    }
+}
+
+static void
+shell_set_size (Shell                *shell,
+                const MktSessionSize *size)
+{
+  struct winsize ws = { 0 };
+
+  if (!size->rows || !size->columns)
+    return;
+
+  ws.ws_row = size->rows;
+  ws.ws_col = size->columns;
+
+  if (ioctl (shell->master, TIOCSWINSZ, &ws) == -1)
+    g_debug ("Failed to resize slot %u: %s", shell->slot, g_strerror (errno));
+}
+
+static void
+shell_resume (Shell *shell)
+{
+  if (shell->master_id || shell->master == -1)
+    return;
+
+  shell->master_id = g_unix_fd_add (shell->master, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                    shell_read_cb, shell);
+}
+
+static void
+shell_forward (Shell      *shell,
+               const char *data,
+               gsize       length)
+{
+  shell_append_replay (shell, data, length);
+
+  if (shell->client)
+    mkt_session_send (shell->client->session, MKT_SESSION_MESSAGE_OUTPUT,
+                      data, length);
+}
+
+static gboolean
+shell_read_cb (int          fd,
+               GIOCondition condition,
+               gpointer     user_data)
+{
+  Shell *shell = user_data;
+  char buffer[READ_SIZE];
+  gssize size;
+
+  size = read (fd, buffer, sizeof buffer);
+
+  if (size == -1 && (errno == EAGAIN || errno == EINTR))
+    return G_SOURCE_CONTINUE;
+
+  /* EIO once the shell and its children have closed the PTY */
+  if (size <= 0)
+    {
+      shell->master_id = 0;
+
+      return G_SOURCE_REMOVE;
+    }
+
+  shell_forward (shell, buffer, size);
+
+  /* Let the shell block on output, rather than queuing without limit */
+  if (shell->client &&
+      mkt_session_get_pending (shell->client->session) > MAX_PENDING)
+    {
+      shell->master_id = 0;
+
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+shell_write_cb (int          fd,
+                GIOCondition condition,
+                gpointer     user_data)
+{
+  Shell *shell = user_data;
+  gssize size;
+
+  while (shell->input->len)
+    {
+      size = write (fd, shell->input->data, shell->input->len);
+
+      if (size == -1 && errno == EINTR)
+        continue;
+
+      if (size == -1 && errno == EAGAIN)
+        break;
+
+      /* The shell is exiting, the child watch cleans up */
+      if (size <= 0)
+        {
+          g_byte_array_set_size (shell->input, 0);
+          break;
+        }
+
+      g_byte_array_remove_range (shell->input, 0, size);
+    }
+
+  if (shell->input->len)
+    {
+      if (!shell->input_id)
+        shell->input_id = g_unix_fd_add (fd, G_IO_OUT, shell_write_cb, shell);
+
+      return G_SOURCE_CONTINUE;
+    }
+
+  shell->input_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+shell_free (Shell *shell)
+{
+  g_clear_handle_id (&shell->master_id, g_source_remove);
+  g_clear_handle_id (&shell->input_id, g_source_remove);
+  g_clear_handle_id (&shell->child_id, g_source_remove);
+
+  if (shell->client)
+    shell->client->shell = NULL;
+
+  if (shell->master != -1)
+    close (shell->master);
+
+  g_byte_array_unref (shell->replay);
+  g_byte_array_unref (shell->input);
+  g_free (shell);
+}
+
+static void
+shell_exited_cb (GPid     pid,
+                 int      status,
+                 gpointer user_data)
+{
+  Shell *shell = user_data;
+  Server *server = shell->server;
+  char buffer[READ_SIZE];
+  gssize size;
+
+  shell->child_id = 0;
+  g_spawn_close_pid (pid);
+  MKT_DEBUG_MSG ("Shell of slot %u exited with status %d", shell->slot, status);
+
+  /* Forward the output not yet read, it's at most what the PTY buffers */
+  while ((size = read (shell->master, buffer, sizeof buffer)) > 0)
+    shell_forward (shell, buffer, size);
+
+  if (shell->client)
+    {
+      gint32 wait_status = status;
+
+      mkt_session_send (shell->client->session, MKT_SESSION_MESSAGE_EXITED,
+                        (const char *)&wait_status, sizeof wait_status);
+    }
+
+  g_hash_table_remove (server->shells, GUINT_TO_POINTER (shell->slot));
+  server_update_idle (server);
+}
+
+static Shell *
+shell_new (Server                 *server,
+           const MktSessionAttach *attach,
+           const char             *cwd,
+           char                  **argv)
+{
+  g_auto(GStrv) envp = NULL;
+  struct winsize ws = { 0 };
+  const char *home;
+  sigset_t mask;
+  Shell *shell;
+  int master;
+  GPid pid;
+
+  /* Prepare everything before fork, only async-signal-safe calls are allowed after */
+  envp = g_get_environ ();
+  envp = g_environ_setenv (envp, "TERM", "xterm-256color", TRUE);
+  envp = g_environ_setenv (envp, "COLORTERM", "truecolor", TRUE);
+  envp = g_environ_unsetenv (envp, "MKT_SESSION_SERVER");
+  home = g_get_home_dir ();
+  sigemptyset (&mask);
+
+  ws.ws_row = attach->size.rows ?: 24;
+  ws.ws_col = attach->size.columns ?: 80;
+
+  pid = forkpty (&master, NULL, NULL, &ws);
+
+  if (pid == -1)
+    {
+      g_warning ("Failed to create PTY for slot %u: %s",
+                 attach->slot, g_strerror (errno));
+      return NULL;
+    }
+
+  if (pid == 0)
+    {
+      /* Ignored signals are inherited over exec, undo ours */
+      signal (SIGHUP, SIG_DFL);
+      signal (SIGPIPE, SIG_DFL);
+      sigprocmask (SIG_SETMASK, &mask, NULL);
+
+      if (chdir (cwd) == -1 && chdir (home) == -1 && chdir ("/") == -1)
+        _exit (127);
+
+      execvpe (argv[0], argv, envp);
+      _exit (127);
+    }
+
+  fcntl (master, F_SETFD, FD_CLOEXEC);
+  g_unix_set_fd_nonblocking (master, TRUE, NULL);
+
+  shell = g_new0 (Shell, 1);
+  shell->server = server;
+  shell->slot = attach->slot;
+  shell->master = master;
+  shell->pid = pid;
+  shell->replay = g_byte_array_sized_new (REPLAY_SIZE / 4);
+  shell->input = g_byte_array_new ();
+  shell->child_id = g_child_watch_add (pid, shell_exited_cb, shell);
+  shell_resume (shell);
+
+  g_hash_table_insert (server->shells, GUINT_TO_POINTER (shell->slot), shell);
+  MKT_DEBUG_MSG ("Started %s for slot %u, pid %d", argv[0], shell->slot, (int)pid);
+
+  return shell;
+}
+
+static void
+client_free (Client *client)
+{
+  if (client->shell)
+    client->shell->client = NULL;
+
+  mkt_session_close (client->session);
+  mkt_session_unref (client->session);
+  g_free (client);
+}
+
+static void
+server_drop_client (Server *server,
+                    Client *client)
+{
+  g_ptr_array_remove_fast (server->clients, client);
+  server_update_idle (server);
+}
+
+static void
+client_attach (Client     *client,
+               const char *data,
+               gsize       length)
+{
+  g_autoptr(GPtrArray) argv = NULL;
+  MktSessionAttach attach;
+  Server *server = client->server;
+  const char *cwd, *end;
+  Shell *shell;
+
+  if (client->shell || length < sizeof attach ||
+      data[length - 1] != '\0')
+    {
+      g_warning ("Invalid attach request");
+      server_drop_client (server, client);
+      return;
+    }
+
+  memcpy (&attach, data, sizeof attach);
+  end = data + length;
+  cwd = data + sizeof attach;
+  argv = g_ptr_array_new ();
+
+  for (const char *arg = cwd + strlen (cwd) + 1; arg < end; arg += strlen (arg) + 1)
+    g_ptr_array_add (argv, (char *)arg);
+  g_ptr_array_add (argv, NULL);
+
+  shell = g_hash_table_lookup (server->shells, GUINT_TO_POINTER (attach.slot));
+
+  if (shell)
+    {
+      MKT_DEBUG_MSG ("Reattaching to slot %u, %u bytes to replay",
+                     attach.slot, shell->replay->len);
+
+      /* A restarted UI replaces the old one */
+      if (shell->client)
+        server_drop_client (server, shell->client);
+
+      shell->client = client;
+      client->shell = shell;
+
+      if (shell->replay->len)
+        mkt_session_send (client->session, MKT_SESSION_MESSAGE_OUTPUT,
+                          (const char *)shell->replay->data, shell->replay->len);
+
+      /*
+       * The replay is only the recent output, so make full
+       * screen programs redraw by changing the size, even if
+       * the new size is the same as the old one.
+       */
+      if (attach.size.rows && attach.size.columns)
+        {
+          MktSessionSize nudge = attach.size;
+
+          nudge.columns++;
+          shell_set_size (shell, &nudge);
+          shell_set_size (shell, &attach.size);
+        }
+
+      shell_resume (shell);
+
+      return;
+    }
+
+  if (!argv->pdata[0])
+    {
+      g_warning ("No command to start for slot %u", attach.slot);
+      server_drop_client (server, client);
+      return;
+    }
+
+  shell = shell_new (server, &attach, cwd, (char **)argv->pdata);
+
+  if (!shell)
+    {
+      gint32 status = 127 << 8;
+
+      mkt_session_send (client->session, MKT_SESSION_MESSAGE_EXITED,
+                        (const char *)&status, sizeof status);
+      return;
+    }
+
+  shell->client = client;
+  client->shell = shell;
+  server_update_idle (server);
+}
+
+static void
+client_message_cb (MktSession        *session,
+                   MktSessionMessage  type,
+                   const char        *data,
+                   gsize              length,
+                   gpointer           user_data)
+{
+  Client *client = user_data;
+  Shell *shell = client->shell;
+
+  switch (type)
+    {
+    case MKT_SESSION_MESSAGE_ATTACH:
+      client_attach (client, data, length);
+      break;
+
+    case MKT_SESSION_MESSAGE_INPUT:
+      if (!shell)
+        break;
+
+      g_byte_array_append (shell->input, (const guint8 *)data, length);
+      if (!shell->input_id)
+        shell_write_cb (shell->master, G_IO_OUT, shell);
+      break;
+
+    case MKT_SESSION_MESSAGE_RESIZE:
+      if (shell && length == sizeof (MktSessionSize))
+        {
+          MktSessionSize size;
+
+          memcpy (&size, data, sizeof size);
+          shell_set_size (shell, &size);
+        }
+      break;
+
+    case MKT_SESSION_MESSAGE_DRAINED:
+      if (shell)
+        shell_resume (shell);
+      break;
+
+    case MKT_SESSION_MESSAGE_CLOSED:
+      if (shell)
+        MKT_DEBUG_MSG ("Client of slot %u disconnected", shell->slot);
+      server_drop_client (client->server, client);
+      break;
+
+    case MKT_SESSION_MESSAGE_OUTPUT:
+    case MKT_SESSION_MESSAGE_EXITED:
+    default:
+      g_debug ("Ignoring message of type %u from client", type);
+    }
+}
+
+static gboolean
+server_incoming_cb (GSocketService    *service,
+                    GSocketConnection *connection,
+                    GObject           *source_object,
+                    gpointer           user_data)
+{
+  g_autoptr(GCredentials) credentials = NULL;
+  Server *server = user_data;
+  Client *client;
+  GSocket *socket;
+  uid_t uid;
+
+  socket = g_socket_connection_get_socket (connection);
+  credentials = g_socket_get_credentials (socket, NULL);
+  uid = credentials ? g_credentials_get_unix_user (credentials, NULL) : (uid_t)-1;
+
+  /* The shells run as us, so only let us in */
+  if (uid != getuid ())
+    {
+      g_warning ("Rejecting client of uid %d", (int)uid);
+      return TRUE;
+    }
+
+  client = g_new0 (Client, 1);
+  client->server = server;
+  client->session = mkt_session_new (connection, client_message_cb, client);
+  g_ptr_array_add (server->clients, client);
+  server_update_idle (server);
+
+  return TRUE;
+}
+
+static gboolean
+server_quit_cb (gpointer user_data)
+{
+  Server *server = user_data;
+
+  g_main_loop_quit (server->main_loop);
+
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GSocketService) service = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *socket_dir = NULL;
+  Server server = { 0 };
+  guint sigint_id, sigterm_id;
+
+  context = g_option_context_new ("- keep multi-keyterm shells running");
+  g_option_context_add_main_entries (context, cmd_options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  mkt_log_init ();
+
+  if (!socket_path)
+    socket_path = mkt_session_get_default_socket_path ();
+
+  /* Don't get the hangup of the terminal or session the UI was started from */
+  setsid ();
+  signal (SIGHUP, SIG_IGN);
+  signal (SIGPIPE, SIG_IGN);
+
+  socket_dir = g_path_get_dirname (socket_path);
+  g_mkdir_with_parents (socket_dir, 0700);
+  /* Remove the socket of a previous run, if any */
+  g_unlink (socket_path);
+
+  service = g_socket_service_new ();
+  address = g_unix_socket_address_new (socket_path);
+
+  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error))
+    {
+      g_printerr ("Failed to listen on %s: %s\n", socket_path, error->message);
+      return 1;
+    }
+
+  g_chmod (socket_path, 0600);
+
+  server.shells = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                         NULL, (GDestroyNotify)shell_free);
+  server.clients = g_ptr_array_new_with_free_func ((GDestroyNotify)client_free);
+  server.main_loop = g_main_loop_new (NULL, FALSE);
+
+  g_signal_connect (service, "incoming", G_CALLBACK (server_incoming_cb), &server);
+  g_socket_service_start (service);
+  g_info ("Listening on %s", socket_path);
+  server_update_idle (&server);
+
+  sigint_id = g_unix_signal_add (SIGINT, server_quit_cb, &server);
+  sigterm_id = g_unix_signal_add (SIGTERM, server_quit_cb, &server);
+  g_main_loop_run (server.main_loop);
+  g_source_remove (sigint_id);
+  g_source_remove (sigterm_id);
+
+  g_socket_service_stop (service);
+  g_unlink (socket_path);
+  g_clear_handle_id (&server.idle_id, g_source_remove);
+  g_ptr_array_unref (server.clients);
+  /* Closing the PTYs hangs up the shells */
+  g_hash_table_unref (server.shells);
+  g_main_loop_unref (server.main_loop);
+
+  return 0;
+}
@@ -0,0 +1,558 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-session.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-session"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <gio/gunixsocketaddress.h>
+#include <string.h>
+
+#include "mkt-session.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-session
+ * @title: MktSession
+ * @short_description: A connection to the session server
+ * @include: "mkt-session.h"
+ *
+ * multi-keyterm-session-server owns the PTYs and the shells
+ * run in them, so that they outlive the UI.  Each terminal
+ * has a connection to the server, over which it attaches to
+ * the shell of its slot, sends input and size changes, and
+ * receives the output.  On attach, the server replays the
+ * recent output of the shell, so that a restarted UI shows
+ * the screen as it was.
+ *
+ * The same #MktSession is used on both ends.  Messages are
+ * queued and written when the socket is writable, so that
+ * neither end blocks on the other.
+ */
+
+#define SERVER_START_TIMEOUT 2000 /* ms */
+#define READ_SIZE            (16 * 1024)
+
+struct _MktSession
+{
+  GSocketConnection *connection;
+  GSocket           *socket;
+  GByteArray        *in_buffer;
+  GByteArray        *out_buffer;
+  MktSessionFunc     func;
+  gpointer           user_data;
+  GSource           *in_source;
+  GSource           *out_source;
+  gboolean           closed;
+  gboolean           write_failed;
+};
+
+static void
+session_clear_sources (MktSession *self)
+{
+  if (self->in_source)
+    g_source_destroy (self->in_source);
+  if (self->out_source)
+    g_source_destroy (self->out_source);
+
+  g_clear_pointer (&self->in_source, g_source_unref);
+  g_clear_pointer (&self->out_source, g_source_unref);
+}
+
+static void
+session_finalize (gpointer data)
+{
+  MktSession *self = data;
+
+  session_clear_sources (self);
+
+  if (self->connection)
+    g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
+
+  g_clear_object (&self->connection);
+  g_byte_array_unref (self->in_buffer);
+  g_byte_array_unref (self->out_buffer);
+}
+
+static void
+session_closed (MktSession *self)
+{
+  if (self->closed)
+    return;
+
+  mkt_session_close (self);
+  self->func (self, MKT_SESSION_MESSAGE_CLOSED, NULL, 0, self->user_data);
+}
+
+static gboolean
+session_write_cb (GSocket      *socket,
+                  GIOCondition  condition,
+                  gpointer      user_data)
+{
+  g_autoptr(MktSession) self = mkt_session_ref (user_data);
+  g_autoptr(GError) error = NULL;
+  gssize size;
+
+  while (self->out_buffer->len)
+    {
+      size = g_socket_send_with_blocking (self->socket,
+                                          (const char *)self->out_buffer->data,
+                                          self->out_buffer->len,
+                                          FALSE, NULL, &error);
+
+      if (size == -1 &&
+          g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        break;
+
+      /*
+       * Leave it to the read side to notice the closed
+       * connection, as this may be called from a send.
+       */
+      if (size <= 0)
+        {
+          g_debug ("Failed to write to session: %s",
+                   error ? error->message : "Connection closed");
+          self->write_failed = TRUE;
+          g_byte_array_set_size (self->out_buffer, 0);
+          break;
+        }
+
+      g_byte_array_remove_range (self->out_buffer, 0, size);
+    }
+
+  if (self->out_buffer->len)
+    {
+      if (!self->out_source)
+        {
+          self->out_source = g_socket_create_source (self->socket, G_IO_OUT, NULL);
+          g_source_set_callback (self->out_source, (GSourceFunc)session_write_cb,
+                                 self, NULL);
+          g_source_attach (self->out_source, NULL);
+        }
+
+      return G_SOURCE_CONTINUE;
+    }
+
+  if (self->out_source)
+    {
+      g_source_destroy (self->out_source);
+      g_clear_pointer (&self->out_source, g_source_unref);
+      self->func (self, MKT_SESSION_MESSAGE_DRAINED, NULL, 0, self->user_data);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+session_read_cb (GSocket      *socket,
+                 GIOCondition  condition,
+                 gpointer      user_data)
+{
+  g_autoptr(MktSession) self = mkt_session_ref (user_data);
+  g_autoptr(GError) error = NULL;
+  MktSessionHeader header;
+  gsize offset = 0;
+  gssize size;
+  guint len;
+
+  len = self->in_buffer->len;
+  g_byte_array_set_size (self->in_buffer, len + READ_SIZE);
+  size = g_socket_receive_with_blocking (socket, (char *)self->in_buffer->data + len,
+                                         READ_SIZE, FALSE, NULL, &error);
+  g_byte_array_set_size (self->in_buffer, len + MAX (size, 0));
+
+  if (size == -1 &&
+      g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    return G_SOURCE_CONTINUE;
+
+  if (size <= 0)
+    {
+      if (error)
+        g_debug ("Failed to read from session: %s", error->message);
+
+      session_closed (self);
+
+      return G_SOURCE_REMOVE;
+    }
+
+  while (!self->closed &&
+         self->in_buffer->len - offset >= sizeof header)
+    {
+      memcpy (&header, self->in_buffer->data + offset, sizeof header);
+
+      if (header.length > MKT_SESSION_MAX_MESSAGE ||
+          header.type == 0 ||
+          header.type >= MKT_SESSION_MESSAGE_CLOSED)
+        {
+          g_debug ("Invalid session message of type %u, length %u",
+                   header.type, header.length);
+          session_closed (self);
+
+          return G_SOURCE_REMOVE;
+        }
+
+      if (self->in_buffer->len - offset - sizeof header < header.length)
+        break;
+
+      offset += sizeof header;
+      self->func (self, header.type, (const char *)self->in_buffer->data + offset,
+                  header.length, self->user_data);
+      offset += header.length;
+    }
+
+  if (self->closed)
+    return G_SOURCE_REMOVE;
+
+  g_byte_array_remove_range (self->in_buffer, 0, offset);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * mkt_session_get_default_socket_path:
+ *
+ * Get the socket path of the session server of the
+ * current user.
+ *
+ * Returns: (transfer full): The socket path
+ */
+char *
+mkt_session_get_default_socket_path (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (),
+                           "multi-keyterm", "sessions", NULL);
+}
+
+/**
+ * mkt_session_new:
+ * @connection: A connected #GSocketConnection
+ * @func: The function to call for each message
+ * @user_data: The data passed to @func
+ *
+ * Create a new session on @connection.  @func is
+ * called from the main context for each message
+ * received, with %MKT_SESSION_MESSAGE_DRAINED once
+ * the queued messages are written after a short
+ * write, and with %MKT_SESSION_MESSAGE_CLOSED when
+ * the connection is lost.  @func isn't called once
+ * mkt_session_close() is called.
+ *
+ * Returns: (transfer full): A #MktSession
+ */
+MktSession *
+mkt_session_new (GSocketConnection *connection,
+                 MktSessionFunc     func,
+                 gpointer           user_data)
+{
+  MktSession *self;
+
+  g_return_val_if_fail (G_IS_SOCKET_CONNECTION (connection), NULL);
+  g_return_val_if_fail (func, NULL);
+
+  self = g_rc_box_new0 (MktSession);
+  self->connection = g_object_ref (connection);
+  self->socket = g_socket_connection_get_socket (connection);
+  self->in_buffer = g_byte_array_new ();
+  self->out_buffer = g_byte_array_new ();
+  self->func = func;
+  self->user_data = user_data;
+
+  g_socket_set_blocking (self->socket, FALSE);
+
+  /* Output is what the user waits for, handle it before redraws */
+  self->in_source = g_socket_create_source (self->socket,
+                                            G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+  g_source_set_priority (self->in_source, G_PRIORITY_HIGH);
+  g_source_set_callback (self->in_source, (GSourceFunc)session_read_cb, self, NULL);
+  g_source_attach (self->in_source, NULL);
+
+  return self;
+}
+
+static gboolean
+session_spawn_server (const char  *socket_path,
+                      GError     **error)
+{
+  const char *server;
+  const char *argv[4];
+
+  /* Let the run script use the server from the build directory */
+  server = g_getenv ("MKT_SESSION_SERVER");
+
+  if (!server)
+    server = PACKAGE_LIBEXECDIR "/multi-keyterm-session-server";
+
+  argv[0] = server;
+  argv[1] = "--socket";
+  argv[2] = socket_path;
+  argv[3] = NULL;
+
+  MKT_DEBUG_MSG ("Starting session server %s", server);
+
+  /* The child is not reaped by us, so GLib double forks and it outlives us */
+  return g_spawn_async (NULL, (char **)argv, NULL, G_SPAWN_STDIN_FROM_DEV_NULL,
+                        NULL, NULL, NULL, error);
+}
+
+/**
+ * mkt_session_connect:
+ * @socket_path: (nullable): The path of the server socket
+ * @func: The function to call for each message
+ * @user_data: The data passed to @func
+ * @error: A location for a #GError
+ *
+ * Connect to the session server listening on @socket_path,
+ * or the default socket if %NULL.  If no server is running,
+ * one is started.  See mkt_session_new() for @func.
+ *
+ * Returns: (transfer full) (nullable): A #MktSession
+ */
+MktSession *
+mkt_session_connect (const char      *socket_path,
+                     MktSessionFunc   func,
+                     gpointer         user_data,
+                     GError         **error)
+{
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GSocketClient) client = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree char *default_path = NULL;
+  gint64 end;
+
+  g_return_val_if_fail (func, NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  if (!socket_path)
+    socket_path = default_path = mkt_session_get_default_socket_path ();
+
+  address = g_unix_socket_address_new (socket_path);
+  client = g_socket_client_new ();
+  connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+                                        NULL, &local_error);
+
+  if (connection)
+    return mkt_session_new (connection, func, user_data);
+
+  if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
+      !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED))
+    {
+      g_propagate_error (error, g_steal_pointer (&local_error));
+      return NULL;
+    }
+
+  if (!session_spawn_server (socket_path, error))
+    return NULL;
+
+  /* The server listens right after start, this is usually a few ms */
+  end = g_get_monotonic_time () + SERVER_START_TIMEOUT * 1000;
+
+  while (TRUE)
+    {
+      g_clear_error (&local_error);
+      connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+                                            NULL, &local_error);
+
+      if (connection)
+        return mkt_session_new (connection, func, user_data);
+
+      if (g_get_monotonic_time () > end)
+        break;
+
+      g_usleep (10 * 1000);
+    }
+
+  g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                              "Session server didn't start: ");
+
+  return NULL;
+}
+
+MktSession *
+mkt_session_ref (MktSession *self)
+{
+  g_return_val_if_fail (self, NULL);
+
+  return g_rc_box_acquire (self);
+}
+
+void
+mkt_session_unref (MktSession *self)
+{
+  g_return_if_fail (self);
+
+  g_rc_box_release_full (self, session_finalize);
+}
+
+/**
+ * mkt_session_close:
+ * @self: A #MktSession
+ *
+ * Close the connection.  Messages not yet written
+ * are lost, and the #MktSessionFunc of @self is not
+ * called anymore.
+ */
+void
+mkt_session_close (MktSession *self)
+{
+  g_return_if_fail (self);
+
+  if (self->closed)
+    return;
+
+  self->closed = TRUE;
+  session_clear_sources (self);
+  g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
+}
+
+gboolean
+mkt_session_is_closed (MktSession *self)
+{
+  g_return_val_if_fail (self, TRUE);
+
+  return self->closed;
+}
+
+/**
+ * mkt_session_get_pending:
+ * @self: A #MktSession
+ *
+ * Get the number of bytes queued to be written.
+ *
+ * Returns: The pending size in bytes
+ */
+gsize
+mkt_session_get_pending (MktSession *self)
+{
+  g_return_val_if_fail (self, 0);
+
+  return self->out_buffer->len;
+}
+
+/**
+ * mkt_session_send:
+ * @self: A #MktSession
+ * @type: The message type
+ * @data: (nullable): The payload
+ * @length: The length of @data
+ *
+ * Send a message of @type.  Messages larger than
+ * %MKT_SESSION_MAX_MESSAGE are split, which makes
+ * sense only for input and output.
+ */
+void
+mkt_session_send (MktSession        *self,
+                  MktSessionMessage  type,
+                  const char        *data,
+                  gsize              length)
+{
+  MktSessionHeader header;
+
+  g_return_if_fail (self);
+  g_return_if_fail (type && type < MKT_SESSION_MESSAGE_CLOSED);
+  g_return_if_fail (data || !length);
+
+  if (self->closed || self->write_failed)
+    return;
+
+  do
+    {
+      header.type = type;
+      header.length = MIN (length, MKT_SESSION_MAX_MESSAGE);
+      g_byte_array_append (self->out_buffer, (const guint8 *)&header, sizeof header);
+
+      if (header.length)
+        g_byte_array_append (self->out_buffer, (const guint8 *)data, header.length);
+
+      data += header.length;
+      length -= header.length;
+    }
+  while (length);
+
+  /* Try writing right away if nothing is waiting for the socket */
+  if (!self->out_source)
+    session_write_cb (self->socket, G_IO_OUT, self);
+}
+
+/**
+ * mkt_session_attach:
+ * @self: A #MktSession
+ * @slot: The terminal slot
+ * @rows: The number of rows of the terminal
+ * @columns: The number of columns of the terminal
+ * @cwd: The directory to start the shell in
+ * @argv: The command to run, if the slot has no shell yet
+ *
+ * Attach to the shell of @slot, starting @argv if the
+ * slot has none.  The server replays the recent output
+ * of the shell before the new output.
+ */
+void
+mkt_session_attach (MktSession         *self,
+                    guint               slot,
+                    guint               rows,
+                    guint               columns,
+                    const char         *cwd,
+                    const char * const *argv)
+{
+  g_autoptr(GByteArray) message = NULL;
+  MktSessionAttach attach = { 0 };
+
+  g_return_if_fail (self);
+  g_return_if_fail (cwd);
+  g_return_if_fail (argv && argv[0]);
+
+  attach.slot = slot;
+  attach.size.rows = MIN (rows, G_MAXUINT16);
+  attach.size.columns = MIN (columns, G_MAXUINT16);
+
+  message = g_byte_array_new ();
+  g_byte_array_append (message, (const guint8 *)&attach, sizeof attach);
+  g_byte_array_append (message, (const guint8 *)cwd, strlen (cwd) + 1);
+
+  for (guint i = 0; argv[i]; i++)
+    g_byte_array_append (message, (const guint8 *)argv[i], strlen (argv[i]) + 1);
+
+  g_return_if_fail (message->len <= MKT_SESSION_MAX_MESSAGE);
+
+  mkt_session_send (self, MKT_SESSION_MESSAGE_ATTACH,
+                    (const char *)message->data, message->len);
+}
+
+void
+mkt_session_resize (MktSession *self,
+                    guint       rows,
+                    guint       columns)
+{
+  MktSessionSize size;
+
+  g_return_if_fail (self);
+
+  size.rows = MIN (rows, G_MAXUINT16);
+  size.columns = MIN (columns, G_MAXUINT16);
+  mkt_session_send (self, MKT_SESSION_MESSAGE_RESIZE,
+                    (const char *)&size, sizeof size);
+}
@@ -0,0 +1,112 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-session.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Messages larger than this are a protocol error */
+#define MKT_SESSION_MAX_MESSAGE (64 * 1024)
+
+/*
+ * Each message is a MktSessionHeader followed by length
+ * bytes of payload.  Both ends are on the same host, so
+ * integers are in host byte order.
+ */
+typedef enum
+{
+  /* Client: MktSessionAttach, then the cwd and argv, each NUL terminated */
+  MKT_SESSION_MESSAGE_ATTACH = 1,
+  /* Client: Bytes to write to the shell */
+  MKT_SESSION_MESSAGE_INPUT,
+  /* Client: MktSessionSize */
+  MKT_SESSION_MESSAGE_RESIZE,
+  /* Server: Bytes read from the shell */
+  MKT_SESSION_MESSAGE_OUTPUT,
+  /* Server: gint32 wait status of the shell */
+  MKT_SESSION_MESSAGE_EXITED,
+
+  /* Not sent, only passed to MktSessionFunc */
+  MKT_SESSION_MESSAGE_CLOSED = 0x100,
+  MKT_SESSION_MESSAGE_DRAINED,
+} MktSessionMessage;
+
+typedef struct
+{
+  guint32 type;
+  guint32 length;
+} MktSessionHeader;
+
+typedef struct
+{
+  guint16 rows;
+  guint16 columns;
+} MktSessionSize;
+
+typedef struct
+{
+  guint32        slot;
+  MktSessionSize size;
+} MktSessionAttach;
+
+typedef struct _MktSession MktSession;
+
+typedef void (*MktSessionFunc) (MktSession        *session,
+                                MktSessionMessage  type,
+                                const char        *data,
+                                gsize              length,
+                                gpointer           user_data);
+
+char       *mkt_session_get_default_socket_path (void);
+MktSession *mkt_session_new         (GSocketConnection  *connection,
+                                     MktSessionFunc      func,
+                                     gpointer            user_data);
+MktSession *mkt_session_connect     (const char         *socket_path,
+                                     MktSessionFunc      func,
+                                     gpointer            user_data,
+                                     GError            **error);
+MktSession *mkt_session_ref         (MktSession         *self);
+void        mkt_session_unref       (MktSession         *self);
+void        mkt_session_close       (MktSession         *self);
+gboolean    mkt_session_is_closed   (MktSession         *self);
+gsize       mkt_session_get_pending (MktSession         *self);
+void        mkt_session_send        (MktSession         *self,
+                                     MktSessionMessage   type,
+                                     const char         *data,
+                                     gsize               length);
+void        mkt_session_attach      (MktSession         *self,
+                                     guint               slot,
+                                     guint               rows,
+                                     guint               columns,
+                                     const char         *cwd,
+                                     const char * const *argv);
+void        mkt_session_resize      (MktSession         *self,
+                                     guint               rows,
+                                     guint               columns);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktSession, mkt_session_unref)
+
+G_END_DECLS
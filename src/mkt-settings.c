@@ -38,6 +38,12 @@
  *
  * A class that handles application specific settings, and
  * to store them to disk.
+ *
+ * Font changes are coalesced: #MktSettings::font-changed is
+ * emitted once from an idle callback that runs before the next
+ * redraw, regardless of how many font related settings changed
+ * since.  This avoids re-layouting every terminal for each step
+ * when the font scale is changed from a spin button.
  */
 
 struct _MktSettings
@@ -50,11 +56,26 @@ struct _MktSettings
 
   char      *font;
   char      *keyboard_layout;
+  char     **seats;
+  MktShortcuts *shortcuts;
+
+  guint      font_changed_id;
 
   double     font_scale;
   int        min_terminal_height;
+  guint      reconnect_grace_period;
+  guint      idle_timeout;
+  guint      key_rate_limit;
+  guint      key_burst;
+  guint      stuck_key_timeout;
   bool       prefer_horizontal_split;
   bool       expand_to_fit;
+  bool       use_all_monitors;
+  bool       show_performance_hud;
+  bool       keep_sessions;
+  bool       freeze_idle_shells;
+  bool       predictive_echo;
+  bool       isolate_terminals;
   gboolean   first_run;
   gboolean   use_system_font;
 };
@@ -68,6 +89,17 @@ enum {
   PROP_FONT_SCALE,
   PROP_MINIMUM_TERMINAL_HEIGHT,
   PROP_PREFER_HORIZONTAL_TERMINAL_SPLIT,
+  PROP_USE_ALL_MONITORS,
+  PROP_SHOW_PERFORMANCE_HUD,
+  PROP_KEEP_SESSIONS,
+  PROP_RECONNECT_GRACE_PERIOD,
+  PROP_IDLE_TIMEOUT,
+  PROP_KEY_RATE_LIMIT,
+  PROP_KEY_BURST,
+  PROP_STUCK_KEY_TIMEOUT,
+  PROP_FREEZE_IDLE_SHELLS,
+  PROP_PREDICTIVE_ECHO,
+  PROP_ISOLATE_TERMINALS,
   N_PROPS
 };
 
@@ -80,6 +112,45 @@ enum {
 static GParamSpec *properties[N_PROPS];
 static guint signals[N_SIGNALS];
 
+static gboolean
+settings_emit_font_changed (gpointer user_data)
+{
+  MktSettings *self = user_data;
+
+  g_assert (MKT_IS_SETTINGS (self));
+
+  self->font_changed_id = 0;
+  g_signal_emit (self, signals[FONT_CHANGED], 0);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+settings_queue_font_changed (MktSettings *self)
+{
+  g_assert (MKT_IS_SETTINGS (self));
+
+  if (self->font_changed_id)
+    return;
+
+  /* GTK redraws at G_PRIORITY_HIGH_IDLE + 20, so this runs before that */
+  self->font_changed_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                           settings_emit_font_changed,
+                                           self, NULL);
+}
+
+static void
+settings_shortcuts_changed_cb (MktSettings *self)
+{
+  g_autoptr(GVariant) bindings = NULL;
+
+  g_assert (MKT_IS_SETTINGS (self));
+
+  bindings = g_settings_get_value (self->settings, "shortcuts");
+  g_clear_pointer (&self->shortcuts, mkt_shortcuts_free);
+  self->shortcuts = mkt_shortcuts_new (bindings);
+}
+
 static void
 settings_kbd_layout_changed_cb (MktSettings *self,
                                 char        *key)
@@ -135,6 +206,50 @@ mkt_settings_get_property (GObject    *object,
       g_value_set_boolean (value, self->prefer_horizontal_split);
       break;
 
+    case PROP_USE_ALL_MONITORS:
+      g_value_set_boolean (value, self->use_all_monitors);
+      break;
+
+    case PROP_SHOW_PERFORMANCE_HUD:
+      g_value_set_boolean (value, self->show_performance_hud);
+      break;
+
+    case PROP_KEEP_SESSIONS:
+      g_value_set_boolean (value, self->keep_sessions);
+      break;
+
+    case PROP_RECONNECT_GRACE_PERIOD:
+      g_value_set_uint (value, self->reconnect_grace_period);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      g_value_set_uint (value, self->idle_timeout);
+      break;
+
+    case PROP_KEY_RATE_LIMIT:
+      g_value_set_uint (value, self->key_rate_limit);
+      break;
+
+    case PROP_KEY_BURST:
+      g_value_set_uint (value, self->key_burst);
+      break;
+
+    case PROP_STUCK_KEY_TIMEOUT:
+      g_value_set_uint (value, self->stuck_key_timeout);
+      break;
+
+    case PROP_FREEZE_IDLE_SHELLS:
+      g_value_set_boolean (value, self->freeze_idle_shells);
+      break;
+
+    case PROP_PREDICTIVE_ECHO:
+      g_value_set_boolean (value, self->predictive_echo);
+      break;
+
+    case PROP_ISOLATE_TERMINALS:
+      g_value_set_boolean (value, self->isolate_terminals);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -155,8 +270,11 @@ mkt_settings_set_property (GObject      *object,
       break;
 
     case PROP_FONT_SCALE:
-      self->font_scale = g_value_get_double (value);
-      g_signal_emit (self, signals[FONT_CHANGED], 0);
+      if (self->font_scale != g_value_get_double (value))
+        {
+          self->font_scale = g_value_get_double (value);
+          settings_queue_font_changed (self);
+        }
       break;
 
     case PROP_MINIMUM_TERMINAL_HEIGHT:
@@ -167,6 +285,50 @@ mkt_settings_set_property (GObject      *object,
       self->prefer_horizontal_split = g_value_get_boolean (value);
       break;
 
+    case PROP_USE_ALL_MONITORS:
+      self->use_all_monitors = g_value_get_boolean (value);
+      break;
+
+    case PROP_SHOW_PERFORMANCE_HUD:
+      self->show_performance_hud = g_value_get_boolean (value);
+      break;
+
+    case PROP_KEEP_SESSIONS:
+      self->keep_sessions = g_value_get_boolean (value);
+      break;
+
+    case PROP_RECONNECT_GRACE_PERIOD:
+      self->reconnect_grace_period = g_value_get_uint (value);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      self->idle_timeout = g_value_get_uint (value);
+      break;
+
+    case PROP_KEY_RATE_LIMIT:
+      self->key_rate_limit = g_value_get_uint (value);
+      break;
+
+    case PROP_KEY_BURST:
+      self->key_burst = g_value_get_uint (value);
+      break;
+
+    case PROP_STUCK_KEY_TIMEOUT:
+      self->stuck_key_timeout = g_value_get_uint (value);
+      break;
+
+    case PROP_FREEZE_IDLE_SHELLS:
+      self->freeze_idle_shells = g_value_get_boolean (value);
+      break;
+
+    case PROP_PREDICTIVE_ECHO:
+      self->predictive_echo = g_value_get_boolean (value);
+      break;
+
+    case PROP_ISOLATE_TERMINALS:
+      self->isolate_terminals = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -179,6 +341,8 @@ mkt_settings_dispose (GObject *object)
 
   MKT_TRACE_MSG ("disposing settings");
 
+  g_clear_handle_id (&self->font_changed_id, g_source_remove);
+
   if (self->settings)
     {
       g_settings_set_string (self->settings, "version", PACKAGE_VERSION);
@@ -189,6 +353,8 @@ mkt_settings_dispose (GObject *object)
   g_clear_object (&self->desktop_settings);
   g_clear_pointer (&self->font, g_free);
   g_clear_pointer (&self->keyboard_layout, g_free);
+  g_clear_pointer (&self->seats, g_strfreev);
+  g_clear_pointer (&self->shortcuts, mkt_shortcuts_free);
 
   G_OBJECT_CLASS (mkt_settings_parent_class)->dispose (object);
 }
@@ -230,6 +396,83 @@ mkt_settings_class_init (MktSettingsClass *klass)
                           false,
                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_USE_ALL_MONITORS] =
+    g_param_spec_boolean ("use-all-monitors",
+                          "Use all monitors",
+                          "Whether to spread terminals over a window per monitor",
+                          false,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_SHOW_PERFORMANCE_HUD] =
+    g_param_spec_boolean ("show-performance-hud",
+                          "Show performance overlay",
+                          "Whether to show performance statistics over terminals and window",
+                          false,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_KEEP_SESSIONS] =
+    g_param_spec_boolean ("keep-sessions",
+                          "Keep sessions",
+                          "Whether to keep shells running in a session server",
+                          false,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_RECONNECT_GRACE_PERIOD] =
+    g_param_spec_uint ("reconnect-grace-period",
+                       "Reconnect grace period",
+                       "Time in ms a removed keyboard keeps its terminal",
+                       0, 600000, 5000,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_IDLE_TIMEOUT] =
+    g_param_spec_uint ("idle-timeout",
+                       "Idle timeout",
+                       "Time in seconds after which a terminal is idle",
+                       0, 86400, 900,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_KEY_RATE_LIMIT] =
+    g_param_spec_uint ("key-rate-limit",
+                       "Key rate limit",
+                       "Key presses per second accepted from a keyboard",
+                       0, 10000, 50,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_KEY_BURST] =
+    g_param_spec_uint ("key-burst",
+                       "Key burst",
+                       "Key presses accepted at once from a keyboard",
+                       1, 10000, 100,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_STUCK_KEY_TIMEOUT] =
+    g_param_spec_uint ("stuck-key-timeout",
+                       "Stuck key timeout",
+                       "Time in seconds after which a repeating key is released",
+                       0, 3600, 60,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FREEZE_IDLE_SHELLS] =
+    g_param_spec_boolean ("freeze-idle-shells",
+                          "Freeze idle shells",
+                          "Whether to stop the processes of idle terminals",
+                          false,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_PREDICTIVE_ECHO] =
+    g_param_spec_boolean ("predictive-echo",
+                          "Predictive echo",
+                          "Whether to show typed characters before the shell echoes them",
+                          false,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ISOLATE_TERMINALS] =
+    g_param_spec_boolean ("isolate-terminals",
+                          "Isolate terminals",
+                          "Whether to run each terminal in a cgroup of its own",
+                          true,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 
   signals [FONT_CHANGED] =
@@ -267,6 +510,47 @@ mkt_settings_init (MktSettings *self)
   g_settings_bind (self->settings, "minimum-terminal-height",
                    self, "minimum-terminal-height",
                    G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "use-all-monitors",
+                   self, "use-all-monitors",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "show-performance-hud",
+                   self, "show-performance-hud",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "keep-sessions",
+                   self, "keep-sessions",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "reconnect-grace-period",
+                   self, "reconnect-grace-period",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "idle-timeout",
+                   self, "idle-timeout",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "key-rate-limit",
+                   self, "key-rate-limit",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "key-burst",
+                   self, "key-burst",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stuck-key-timeout",
+                   self, "stuck-key-timeout",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "freeze-idle-shells",
+                   self, "freeze-idle-shells",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "predictive-echo",
+                   self, "predictive-echo",
+                   G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "isolate-terminals",
+                   self, "isolate-terminals",
+                   G_SETTINGS_BIND_DEFAULT);
+
+  g_signal_connect_object (self->settings, "changed::shortcuts",
+                           G_CALLBACK (settings_shortcuts_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  settings_shortcuts_changed_cb (self);
+
+  /* Seats are only read on start, as input devices are set up once */
+  self->seats = g_settings_get_strv (self->settings, "seats");
 
   version = g_settings_get_string (self->settings, "version");
 
@@ -396,7 +680,7 @@ mkt_settings_set_use_system_font (MktSettings *self,
         self->font = g_strdup ("Monospace 11");
     }
 
-  g_signal_emit (self, signals[FONT_CHANGED], 0);
+  settings_queue_font_changed (self);
 }
 
 const char *
@@ -424,7 +708,7 @@ mkt_settings_set_font (MktSettings *self,
   self->font = g_strdup (font);
   g_settings_set_string (self->settings, "font", font);
 
-  g_signal_emit (self, signals[FONT_CHANGED], 0);
+  settings_queue_font_changed (self);
 }
 
 bool
@@ -469,3 +753,394 @@ mkt_settings_get_kbd_layout (MktSettings *self)
 
   return "us";
 }
+
+bool
+mkt_settings_get_use_all_monitors (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->use_all_monitors;
+}
+
+bool
+mkt_settings_get_show_performance_hud (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->show_performance_hud;
+}
+
+/**
+ * mkt_settings_get_reconnect_grace_period:
+ * @self: A #MktSettings
+ *
+ * Get the time a removed keyboard keeps its terminal,
+ * waiting for the device to return.
+ *
+ * Returns: The grace period in ms, 0 if disabled
+ */
+guint
+mkt_settings_get_reconnect_grace_period (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 0);
+
+  return self->reconnect_grace_period;
+}
+
+/**
+ * mkt_settings_get_idle_timeout:
+ * @self: A #MktSettings
+ *
+ * Get the time without keys or output after which
+ * a terminal is considered idle.
+ *
+ * Returns: The timeout in seconds, 0 if disabled
+ */
+guint
+mkt_settings_get_idle_timeout (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 0);
+
+  return self->idle_timeout;
+}
+
+/**
+ * mkt_settings_get_key_rate_limit:
+ * @self: A #MktSettings
+ * @burst: (out) (optional): Return location for the burst
+ *
+ * Get the number of key presses per second accepted
+ * from each keyboard, and the number of presses that
+ * are accepted at once.
+ *
+ * Returns: The rate, 0 if there is no limit
+ */
+guint
+mkt_settings_get_key_rate_limit (MktSettings *self,
+                                 guint       *burst)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 0);
+
+  if (burst)
+    *burst = self->key_burst;
+
+  return self->key_rate_limit;
+}
+
+guint
+mkt_settings_get_stuck_key_timeout (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 0);
+
+  return self->stuck_key_timeout;
+}
+
+bool
+mkt_settings_get_freeze_idle_shells (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->freeze_idle_shells;
+}
+
+bool
+mkt_settings_get_predictive_echo (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->predictive_echo;
+}
+
+bool
+mkt_settings_get_isolate_terminals (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->isolate_terminals;
+}
+
+guint
+mkt_settings_get_ui_cpu_weight (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 100);
+
+  return g_settings_get_uint (self->settings, "ui-cpu-weight");
+}
+
+/**
+ * mkt_settings_get_metrics_file:
+ * @self: A #MktSettings
+ *
+ * Get the path to which metrics should be written,
+ * see #MktMetrics.
+ *
+ * Returns: (transfer full) (nullable): The path, or %NULL
+ * if metrics should not be written.
+ */
+char *
+mkt_settings_get_metrics_file (MktSettings *self)
+{
+  g_autofree char *path = NULL;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), NULL);
+
+  path = g_settings_get_string (self->settings, "metrics-file");
+
+  if (!path || !*path)
+    return NULL;
+
+  return g_steal_pointer (&path);
+}
+
+guint
+mkt_settings_get_metrics_interval (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), 15);
+
+  return g_settings_get_uint (self->settings, "metrics-interval");
+}
+
+bool
+mkt_settings_get_keep_sessions (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), false);
+
+  return self->keep_sessions;
+}
+
+/**
+ * mkt_settings_get_shortcuts:
+ * @self: A #MktSettings
+ *
+ * Get the compiled keyboard shortcuts.  The shortcuts are
+ * replaced when changed, so this should not be kept.
+ *
+ * Returns: (transfer none): A #MktShortcuts
+ */
+MktShortcuts *
+mkt_settings_get_shortcuts (MktSettings *self)
+{
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), NULL);
+
+  return self->shortcuts;
+}
+
+/**
+ * mkt_settings_get_seats:
+ * @self: A #MktSettings
+ *
+ * Get the list of udev seats from which keyboards
+ * should be handled.  If none is set, "seat0" is
+ * returned.
+ *
+ * Returns: (transfer none): A %NULL terminated array
+ */
+const char * const *
+mkt_settings_get_seats (MktSettings *self)
+{
+  static const char * const default_seats[] = { "seat0", NULL };
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), default_seats);
+
+  if (self->seats && self->seats[0])
+    return (const char * const *)self->seats;
+
+  return default_seats;
+}
+
+/**
+ * mkt_settings_get_keyboard_profile:
+ * @self: A #MktSettings
+ * @id: The stable id of the keyboard
+ *
+ * Get the saved profile of the keyboard with @id,
+ * see mkt_keyboard_get_id().
+ *
+ * Returns: (transfer full) (nullable): The profile or %NULL if
+ * none saved.  Free with mkt_keyboard_profile_free().
+ */
+MktKeyboardProfile *
+mkt_settings_get_keyboard_profile (MktSettings *self,
+                                   const char  *id)
+{
+  g_autoptr(GVariant) profiles = NULL;
+  MktKeyboardProfile *profile;
+  const char *layout, *command;
+  guint slot;
+  double zoom;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), NULL);
+
+  if (!id || !*id)
+    return NULL;
+
+  profiles = g_settings_get_value (self->settings, "keyboard-profiles");
+
+  if (!g_variant_lookup (profiles, id, "(u&sd&s)", &slot, &layout, &zoom, &command))
+    return NULL;
+
+  profile = g_new0 (MktKeyboardProfile, 1);
+  profile->slot = CLAMP (slot, 1, 9);
+  profile->zoom = CLAMP (zoom, 0.25, 4.0);
+
+  if (*layout)
+    profile->layout = g_strdup (layout);
+
+  if (*command)
+    profile->command = g_strdup (command);
+
+  return profile;
+}
+
+/**
+ * mkt_settings_set_keyboard_profile:
+ * @self: A #MktSettings
+ * @id: The stable id of the keyboard
+ * @profile: (nullable): A #MktKeyboardProfile
+ *
+ * Save @profile for the keyboard with @id, replacing
+ * the existing one, if any.  Set @profile to %NULL to
+ * remove the saved profile.  Nothing is written if the
+ * saved profile is the same.
+ *
+ * Returns: %TRUE if the saved profile changed
+ */
+gboolean
+mkt_settings_set_keyboard_profile (MktSettings              *self,
+                                   const char               *id,
+                                   const MktKeyboardProfile *profile)
+{
+  g_autoptr(GVariant) profiles = NULL;
+  g_autoptr(GVariant) new_value = NULL;
+  GVariantBuilder builder;
+  GVariantIter iter;
+  GVariant *value;
+  const char *key;
+  gboolean changed;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), FALSE);
+  g_return_val_if_fail (id && *id, FALSE);
+  g_return_val_if_fail (!profile || (profile->slot >= 1 && profile->slot <= 9), FALSE);
+
+  if (profile)
+    new_value = g_variant_ref_sink (g_variant_new ("(usds)",
+                                                   profile->slot,
+                                                   profile->layout ?: "",
+                                                   profile->zoom,
+                                                   profile->command ?: ""));
+
+  profiles = g_settings_get_value (self->settings, "keyboard-profiles");
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(usds)}"));
+  g_variant_iter_init (&iter, profiles);
+  /* Removing a profile that doesn't exist changes nothing either */
+  changed = new_value != NULL;
+
+  while (g_variant_iter_next (&iter, "{&s@(usds)}", &key, &value))
+    {
+      if (!g_str_equal (key, id))
+        g_variant_builder_add (&builder, "{s@(usds)}", key, value);
+      else
+        changed = !new_value || !g_variant_equal (value, new_value);
+
+      g_variant_unref (value);
+    }
+
+  if (!changed)
+    {
+      g_variant_builder_clear (&builder);
+      return FALSE;
+    }
+
+  if (new_value)
+    g_variant_builder_add (&builder, "{s@(usds)}", id, new_value);
+
+  g_settings_set_value (self->settings, "keyboard-profiles",
+                        g_variant_builder_end (&builder));
+
+  return TRUE;
+}
+
+/**
+ * mkt_settings_get_headless_route:
+ * @self: A #MktSettings
+ * @id: (nullable): The keyboard id
+ * @slot: The keyboard slot, from 1 to 9
+ *
+ * Get the target to which the input of the keyboard with
+ * @id in @slot is routed in headless mode.  A route for
+ * @id takes precedence over the one for @slot.
+ *
+ * Returns: (transfer full) (nullable): The target or %NULL
+ * if there is no route for the keyboard.
+ */
+char *
+mkt_settings_get_headless_route (MktSettings *self,
+                                 const char  *id,
+                                 guint        slot)
+{
+  g_autoptr(GVariant) routes = NULL;
+  char slot_str[4];
+  char *target = NULL;
+
+  g_return_val_if_fail (MKT_IS_SETTINGS (self), NULL);
+
+  routes = g_settings_get_value (self->settings, "headless-routes");
+
+  if (id && *id &&
+      g_variant_lookup (routes, id, "s", &target))
+    return target;
+
+  g_snprintf (slot_str, sizeof slot_str, "%u", slot);
+
+  if (g_variant_lookup (routes, slot_str, "s", &target))
+    return target;
+
+  return NULL;
+}
+
+/**
+ * mkt_settings_get_slot_limits:
+ * @self: A #MktSettings
+ * @slot: The keyboard slot, from 1 to 9
+ * @limits: (out): The limits
+ *
+ * Get the resource limits of the processes of the terminal
+ * in @slot.  The limits for @slot take precedence over the
+ * ones for every slot.
+ */
+void
+mkt_settings_get_slot_limits (MktSettings   *self,
+                              guint          slot,
+                              MktSlotLimits *limits)
+{
+  g_autoptr(GVariant) slot_limits = NULL;
+  char slot_str[4];
+
+  g_return_if_fail (MKT_IS_SETTINGS (self));
+  g_return_if_fail (limits);
+
+  limits->cpu_weight = 100;
+  limits->memory_high = 0;
+  limits->pids_max = 0;
+
+  slot_limits = g_settings_get_value (self->settings, "slot-limits");
+  g_snprintf (slot_str, sizeof slot_str, "%u", slot);
+
+  if (!g_variant_lookup (slot_limits, slot_str, "(utu)", &limits->cpu_weight,
+                         &limits->memory_high, &limits->pids_max))
+    g_variant_lookup (slot_limits, "*", "(utu)", &limits->cpu_weight,
+                      &limits->memory_high, &limits->pids_max);
+
+  limits->cpu_weight = CLAMP (limits->cpu_weight, 1, 10000);
+}
+
+void
+mkt_keyboard_profile_free (MktKeyboardProfile *profile)
+{
+  if (!profile)
+    return;
+
+  g_free (profile->layout);
+  g_free (profile->command);
+  g_free (profile);
+}
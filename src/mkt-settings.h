@@ -26,8 +26,23 @@
 #include <stdbool.h>
 #include <gtk/gtk.h>
 
+#include "mkt-shortcuts.h"
+
 G_BEGIN_DECLS
 
+typedef struct _MktKeyboardProfile {
+  guint   slot;     /* 1 to 9 */
+  char   *layout;   /* %NULL to follow the system layout */
+  double  zoom;
+  char   *command;  /* %NULL for the default shell */
+} MktKeyboardProfile;
+
+typedef struct _MktSlotLimits {
+  guint   cpu_weight;  /* 1 to 10000 */
+  guint64 memory_high; /* bytes, 0 for no limit */
+  guint   pids_max;    /* 0 for no limit */
+} MktSlotLimits;
+
 #define MKT_TYPE_SETTINGS (mkt_settings_get_type ())
 
 G_DECLARE_FINAL_TYPE (MktSettings, mkt_settings, MKT, SETTINGS, GObject)
@@ -47,5 +62,36 @@ double       mkt_settings_get_font_scale       (MktSettings *self);
 int          mkt_settings_get_min_terminal_height (MktSettings *self);
 bool         mkt_settings_get_prefer_horizontal_split (MktSettings *self);
 const char  *mkt_settings_get_kbd_layout       (MktSettings *self);
+bool         mkt_settings_get_use_all_monitors (MktSettings *self);
+bool         mkt_settings_get_show_performance_hud (MktSettings *self);
+bool         mkt_settings_get_keep_sessions    (MktSettings *self);
+guint        mkt_settings_get_reconnect_grace_period (MktSettings *self);
+guint        mkt_settings_get_idle_timeout     (MktSettings *self);
+guint        mkt_settings_get_key_rate_limit   (MktSettings *self,
+                                                guint       *burst);
+guint        mkt_settings_get_stuck_key_timeout (MktSettings *self);
+bool         mkt_settings_get_freeze_idle_shells (MktSettings *self);
+bool         mkt_settings_get_predictive_echo  (MktSettings *self);
+bool         mkt_settings_get_isolate_terminals (MktSettings *self);
+guint        mkt_settings_get_ui_cpu_weight    (MktSettings *self);
+char        *mkt_settings_get_metrics_file     (MktSettings *self);
+guint        mkt_settings_get_metrics_interval (MktSettings *self);
+void         mkt_settings_get_slot_limits      (MktSettings   *self,
+                                                guint          slot,
+                                                MktSlotLimits *limits);
+MktShortcuts *mkt_settings_get_shortcuts       (MktSettings *self);
+const char * const *mkt_settings_get_seats     (MktSettings *self);
+MktKeyboardProfile *mkt_settings_get_keyboard_profile (MktSettings *self,
+                                                       const char  *id);
+gboolean     mkt_settings_set_keyboard_profile (MktSettings              *self,
+                                                const char               *id,
+                                                const MktKeyboardProfile *profile);
+char        *mkt_settings_get_headless_route   (MktSettings *self,
+                                                const char  *id,
+                                                guint        slot);
+
+void         mkt_keyboard_profile_free         (MktKeyboardProfile *profile);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktKeyboardProfile, mkt_keyboard_profile_free)
 
 G_END_DECLS
@@ -0,0 +1,207 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-shortcuts.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-shortcuts"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "mkt-shortcuts.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-shortcuts
+ * @title: MktShortcuts
+ * @short_description: Map key presses to terminal actions
+ * @include: "mkt-shortcuts.h"
+ *
+ * The bindings are compiled into a hash table keyed by the
+ * modifiers and the lowercase keysym of the key, so that a
+ * key press is matched with a single lookup.  Unbound keys
+ * return %MKT_SHORTCUT_NONE and are written to the terminal
+ * as usual.
+ *
+ * Shift is part of the binding for letters, but not for
+ * other keys, as eg: “plus” may need Shift to be typed
+ * depending on the layout.  Meta is treated as Alt, as
+ * both are often set for the same key.
+ */
+
+#define SHORTCUT_MODS (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_ALT_MASK | GDK_SUPER_MASK)
+
+struct _MktShortcuts
+{
+  /* (modifiers << 32 | keysym) to MktShortcutAction */
+  GHashTable *table;
+};
+
+static const struct {
+  const char        *name;
+  MktShortcutAction  action;
+} shortcut_actions[] = {
+  { "zoom-in", MKT_SHORTCUT_ZOOM_IN },
+  { "zoom-out", MKT_SHORTCUT_ZOOM_OUT },
+  { "zoom-reset", MKT_SHORTCUT_ZOOM_RESET },
+  { "copy", MKT_SHORTCUT_COPY },
+  { "paste", MKT_SHORTCUT_PASTE },
+  { "scroll-page-up", MKT_SHORTCUT_SCROLL_PAGE_UP },
+  { "scroll-page-down", MKT_SHORTCUT_SCROLL_PAGE_DOWN },
+  { "reset", MKT_SHORTCUT_RESET },
+  { "clear-scrollback", MKT_SHORTCUT_CLEAR_SCROLLBACK },
+};
+
+static inline guint64
+shortcut_key (guint           keyval,
+              GdkModifierType modifier)
+{
+  if (modifier & GDK_META_MASK)
+    modifier |= GDK_ALT_MASK;
+
+  return (guint64)(modifier & SHORTCUT_MODS) << 32 | gdk_keyval_to_lower (keyval);
+}
+
+static void
+shortcuts_add (MktShortcuts      *self,
+               guint              keyval,
+               GdkModifierType    modifier,
+               MktShortcutAction  action)
+{
+  MktShortcutAction old_action;
+  guint64 *key;
+
+  key = g_new (guint64, 1);
+  *key = shortcut_key (keyval, modifier);
+  old_action = GPOINTER_TO_UINT (g_hash_table_lookup (self->table, key));
+
+  if (old_action && old_action != action)
+    g_warning ("Key %s is bound to more than one action, the last one is used",
+               gdk_keyval_name (keyval));
+
+  g_hash_table_insert (self->table, key, GUINT_TO_POINTER (action));
+}
+
+/**
+ * mkt_shortcuts_new:
+ * @bindings: An `a{sas}` #GVariant
+ *
+ * Compile @bindings, which maps action names to lists of
+ * accelerators in the format of gtk_accelerator_parse(),
+ * eg: “<Control>plus”.  Unknown actions and invalid
+ * accelerators are skipped with a warning.
+ *
+ * Returns: (transfer full): A #MktShortcuts
+ */
+MktShortcuts *
+mkt_shortcuts_new (GVariant *bindings)
+{
+  MktShortcuts *self;
+  GVariantIter iter;
+  const char *name;
+  GVariantIter *accels;
+
+  g_return_val_if_fail (bindings, NULL);
+  g_return_val_if_fail (g_variant_is_of_type (bindings, G_VARIANT_TYPE ("a{sas}")), NULL);
+
+  self = g_new0 (MktShortcuts, 1);
+  self->table = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+
+  g_variant_iter_init (&iter, bindings);
+
+  while (g_variant_iter_next (&iter, "{&sas}", &name, &accels))
+    {
+      MktShortcutAction action = MKT_SHORTCUT_NONE;
+      const char *accel;
+
+      for (guint i = 0; i < G_N_ELEMENTS (shortcut_actions); i++)
+        if (g_str_equal (name, shortcut_actions[i].name))
+          action = shortcut_actions[i].action;
+
+      if (action == MKT_SHORTCUT_NONE)
+        g_warning ("Unknown shortcut action '%s'", name);
+
+      while (action && g_variant_iter_next (accels, "&s", &accel))
+        {
+          GdkModifierType modifier;
+          guint keyval;
+
+          if (!gtk_accelerator_parse (accel, &keyval, &modifier) || !keyval)
+            {
+              g_warning ("Invalid accelerator '%s' for '%s'", accel, name);
+              continue;
+            }
+
+          shortcuts_add (self, keyval, modifier, action);
+
+          /* Shift is only significant for letters */
+          if (!(modifier & GDK_SHIFT_MASK) &&
+              gdk_keyval_to_lower (keyval) == gdk_keyval_to_upper (keyval))
+            shortcuts_add (self, keyval, modifier | GDK_SHIFT_MASK, action);
+        }
+
+      g_variant_iter_free (accels);
+    }
+
+  MKT_DEBUG_MSG ("Compiled %u key bindings", g_hash_table_size (self->table));
+
+  return self;
+}
+
+void
+mkt_shortcuts_free (MktShortcuts *self)
+{
+  if (!self)
+    return;
+
+  g_hash_table_unref (self->table);
+  g_free (self);
+}
+
+/**
+ * mkt_shortcuts_lookup:
+ * @self: A #MktShortcuts
+ * @keyval: The keysym of the pressed key
+ * @modifier: The active modifiers
+ *
+ * Find the action bound to @keyval with @modifier.
+ * This doesn't allocate.
+ *
+ * Returns: The action, or %MKT_SHORTCUT_NONE if unbound
+ */
+MktShortcutAction
+mkt_shortcuts_lookup (MktShortcuts    *self,
+                      guint            keyval,
+                      GdkModifierType  modifier)
+{
+  guint64 key;
+
+  g_return_val_if_fail (self, MKT_SHORTCUT_NONE);
+
+  if (!g_hash_table_size (self->table))
+    return MKT_SHORTCUT_NONE;
+
+  key = shortcut_key (keyval, modifier);
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (self->table, &key));
+}
@@ -0,0 +1,55 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-shortcuts.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MKT_SHORTCUT_NONE,
+  MKT_SHORTCUT_ZOOM_IN,
+  MKT_SHORTCUT_ZOOM_OUT,
+  MKT_SHORTCUT_ZOOM_RESET,
+  MKT_SHORTCUT_COPY,
+  MKT_SHORTCUT_PASTE,
+  MKT_SHORTCUT_SCROLL_PAGE_UP,
+  MKT_SHORTCUT_SCROLL_PAGE_DOWN,
+  MKT_SHORTCUT_RESET,
+  MKT_SHORTCUT_CLEAR_SCROLLBACK,
+} MktShortcutAction;
+
+typedef struct _MktShortcuts MktShortcuts;
+
+MktShortcuts      *mkt_shortcuts_new    (GVariant        *bindings);
+void               mkt_shortcuts_free   (MktShortcuts    *self);
+MktShortcutAction  mkt_shortcuts_lookup (MktShortcuts    *self,
+                                         guint            keyval,
+                                         GdkModifierType  modifier);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MktShortcuts, mkt_shortcuts_free)
+
+G_END_DECLS
@@ -0,0 +1,285 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-terminal-grid.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mkt-terminal-grid"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "mkt-grid-layout.h"
+#include "mkt-terminal-grid.h"
+#include "mkt-log.h"
+
+/**
+ * SECTION: mkt-terminal-grid
+ * @title: MktTerminalGrid
+ * @short_description: A container to tile terminals
+ * @include: "mkt-terminal-grid.h"
+ *
+ * A container that creates a widget for each item in a
+ * #GListModel and tiles them using #MktGridLayout.  Only
+ * the widgets for the changed items are created or
+ * destroyed when the model changes.  A widget can be
+ * moved to another grid, see mkt_terminal_grid_reuse_widget().
+ */
+
+struct _MktTerminalGrid
+{
+  GtkWidget                  parent_instance;
+
+  GListModel                *model;
+  MktTerminalGridCreateFunc  create_func;
+  gpointer                   create_data;
+  GDestroyNotify             create_data_free;
+  /* Item to widget map, see mkt_terminal_grid_reuse_widget() */
+  GHashTable                *reused_widgets;
+};
+
+G_DEFINE_TYPE (MktTerminalGrid, mkt_terminal_grid, GTK_TYPE_WIDGET)
+
+static void
+terminal_grid_items_changed_cb (MktTerminalGrid *self,
+                                guint            position,
+                                guint            removed,
+                                guint            added,
+                                GListModel      *model)
+{
+  GtkWidget *child, *prev;
+
+  g_assert (MKT_IS_TERMINAL_GRID (self));
+  g_assert (G_IS_LIST_MODEL (model));
+
+  child = gtk_widget_get_first_child (GTK_WIDGET (self));
+
+  for (guint i = 0; i < position && child; i++)
+    child = gtk_widget_get_next_sibling (child);
+
+  for (guint i = 0; i < removed && child; i++)
+    {
+      GtkWidget *next;
+
+      next = gtk_widget_get_next_sibling (child);
+      gtk_widget_unparent (child);
+      child = next;
+    }
+
+  if (child)
+    prev = gtk_widget_get_prev_sibling (child);
+  else
+    prev = gtk_widget_get_last_child (GTK_WIDGET (self));
+
+  for (guint i = 0; i < added; i++)
+    {
+      g_autoptr(GObject) item = NULL;
+      GtkWidget *widget;
+
+      item = g_list_model_get_item (model, position + i);
+      widget = g_hash_table_lookup (self->reused_widgets, item);
+
+      if (widget)
+        {
+          gtk_widget_insert_after (widget, GTK_WIDGET (self), prev);
+          g_hash_table_remove (self->reused_widgets, item);
+        }
+      else
+        {
+          widget = self->create_func (item, self->create_data);
+          gtk_widget_insert_after (widget, GTK_WIDGET (self), prev);
+        }
+
+      prev = widget;
+    }
+}
+
+static void
+terminal_grid_remove_all (MktTerminalGrid *self)
+{
+  GtkWidget *child;
+
+  g_assert (MKT_IS_TERMINAL_GRID (self));
+
+  while ((child = gtk_widget_get_first_child (GTK_WIDGET (self))))
+    gtk_widget_unparent (child);
+}
+
+static void
+terminal_grid_unbind_model (MktTerminalGrid *self)
+{
+  g_assert (MKT_IS_TERMINAL_GRID (self));
+
+  if (self->model)
+    g_signal_handlers_disconnect_by_func (self->model,
+                                          terminal_grid_items_changed_cb,
+                                          self);
+
+  if (self->create_data_free)
+    self->create_data_free (self->create_data);
+
+  g_clear_object (&self->model);
+  self->create_func = NULL;
+  self->create_data = NULL;
+  self->create_data_free = NULL;
+}
+
+static void
+mkt_terminal_grid_dispose (GObject *object)
+{
+  MktTerminalGrid *self = (MktTerminalGrid *)object;
+
+  terminal_grid_unbind_model (self);
+  terminal_grid_remove_all (self);
+  g_clear_pointer (&self->reused_widgets, g_hash_table_unref);
+
+  G_OBJECT_CLASS (mkt_terminal_grid_parent_class)->dispose (object);
+}
+
+static void
+mkt_terminal_grid_class_init (MktTerminalGridClass *klass)
+{
+  GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+  object_class->dispose = mkt_terminal_grid_dispose;
+
+  gtk_widget_class_set_layout_manager_type (widget_class, MKT_TYPE_GRID_LAYOUT);
+  gtk_widget_class_set_css_name (widget_class, "terminalgrid");
+}
+
+static void
+mkt_terminal_grid_init (MktTerminalGrid *self)
+{
+  gtk_widget_set_overflow (GTK_WIDGET (self), GTK_OVERFLOW_HIDDEN);
+  self->reused_widgets = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                g_object_unref, g_object_unref);
+}
+
+GtkWidget *
+mkt_terminal_grid_new (void)
+{
+  return g_object_new (MKT_TYPE_TERMINAL_GRID, NULL);
+}
+
+/**
+ * mkt_terminal_grid_bind_model:
+ * @self: A #MktTerminalGrid
+ * @model: (nullable): A #GListModel
+ * @create_func: (nullable): A function to create widgets for items
+ * @user_data: user data passed to @create_func
+ * @user_data_free_func: function for freeing @user_data
+ *
+ * Bind @model to @self, similar to gtk_flow_box_bind_model().
+ * Any previously bound model is unbound, and all the
+ * existing children are removed.
+ */
+void
+mkt_terminal_grid_bind_model (MktTerminalGrid           *self,
+                              GListModel                *model,
+                              MktTerminalGridCreateFunc  create_func,
+                              gpointer                   user_data,
+                              GDestroyNotify             user_data_free_func)
+{
+  g_return_if_fail (MKT_IS_TERMINAL_GRID (self));
+  g_return_if_fail (!model || G_IS_LIST_MODEL (model));
+  g_return_if_fail (!model || create_func);
+
+  terminal_grid_unbind_model (self);
+  terminal_grid_remove_all (self);
+
+  if (!model)
+    return;
+
+  self->model = g_object_ref (model);
+  self->create_func = create_func;
+  self->create_data = user_data;
+  self->create_data_free = user_data_free_func;
+
+  g_signal_connect_object (model, "items-changed",
+                           G_CALLBACK (terminal_grid_items_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  terminal_grid_items_changed_cb (self, 0, 0, g_list_model_get_n_items (model), model);
+}
+
+/**
+ * mkt_terminal_grid_get_widget:
+ * @self: A #MktTerminalGrid
+ * @item: An item of the bound model
+ *
+ * Get the widget created for @item.
+ *
+ * Returns: (transfer none) (nullable): The widget, or %NULL
+ * if @item is not in the model.
+ */
+GtkWidget *
+mkt_terminal_grid_get_widget (MktTerminalGrid *self,
+                              gpointer         item)
+{
+  GtkWidget *child;
+  guint n_items;
+
+  g_return_val_if_fail (MKT_IS_TERMINAL_GRID (self), NULL);
+
+  if (!self->model)
+    return NULL;
+
+  n_items = g_list_model_get_n_items (self->model);
+  child = gtk_widget_get_first_child (GTK_WIDGET (self));
+
+  for (guint i = 0; i < n_items && child; i++)
+    {
+      g_autoptr(GObject) model_item = NULL;
+
+      model_item = g_list_model_get_item (self->model, i);
+
+      if (model_item == item)
+        return child;
+
+      child = gtk_widget_get_next_sibling (child);
+    }
+
+  return NULL;
+}
+
+/**
+ * mkt_terminal_grid_reuse_widget:
+ * @self: A #MktTerminalGrid
+ * @item: An item not yet in the bound model
+ * @widget: A #GtkWidget without parent
+ *
+ * Use @widget for @item once it's added to the model,
+ * instead of creating a new one.  This moves a widget
+ * from another grid, keeping its state.
+ */
+void
+mkt_terminal_grid_reuse_widget (MktTerminalGrid *self,
+                                gpointer         item,
+                                GtkWidget       *widget)
+{
+  g_return_if_fail (MKT_IS_TERMINAL_GRID (self));
+  g_return_if_fail (G_IS_OBJECT (item));
+  g_return_if_fail (GTK_IS_WIDGET (widget));
+  g_return_if_fail (!gtk_widget_get_parent (widget));
+
+  g_hash_table_insert (self->reused_widgets, g_object_ref (item), g_object_ref (widget));
+}
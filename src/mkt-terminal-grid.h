@@ -0,0 +1,50 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* mkt-terminal-grid.h
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define MKT_TYPE_TERMINAL_GRID (mkt_terminal_grid_get_type ())
+
+G_DECLARE_FINAL_TYPE (MktTerminalGrid, mkt_terminal_grid, MKT, TERMINAL_GRID, GtkWidget)
+
+typedef GtkWidget *(*MktTerminalGridCreateFunc) (gpointer item,
+                                                 gpointer user_data);
+
+GtkWidget *mkt_terminal_grid_new          (void);
+void       mkt_terminal_grid_bind_model   (MktTerminalGrid           *self,
+                                           GListModel                *model,
+                                           MktTerminalGridCreateFunc  create_func,
+                                           gpointer                   user_data,
+                                           GDestroyNotify             user_data_free_func);
+GtkWidget *mkt_terminal_grid_get_widget   (MktTerminalGrid           *self,
+                                           gpointer                   item);
+void       mkt_terminal_grid_reuse_widget (MktTerminalGrid           *self,
+                                           gpointer                   item,
+                                           GtkWidget                 *widget);
+
+G_END_DECLS
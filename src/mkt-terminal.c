@@ -28,104 +28,773 @@
 # include "version.h"
 #endif
 
-#include <ctype.h>
+#include <errno.h>
 #include <pwd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <unistd.h>
 #include <vte/vte.h>
 #include <glib/gi18n.h>
 
+#include "mkt-alloc.h"
+#include "mkt-cgroup.h"
 #include "mkt-controller.h"
-#include "mkt-utils.h"
+#include "mkt-session.h"
 #include "mkt-terminal.h"
+#include "mkt-utils.h"
 #include "mkt-log.h"
 
+/*
+ * Resources given back by a terminal without keys or output,
+ * each stage after one more idle-timeout.
+ */
+typedef enum
+{
+  IDLE_STAGE_ACTIVE,
+  /* Scrollback trimmed, blinking stopped */
+  IDLE_STAGE_TRIMMED,
+  /* Processes reniced, and stopped if set */
+  IDLE_STAGE_PARKED,
+} IdleStage;
+
+typedef struct
+{
+  GPid pid;
+  int  nice;
+} ParkedProcess;
+
+/* A typed character expected to be echoed at a cell */
+typedef struct
+{
+  gunichar c;
+  glong    row;
+  glong    column;
+  gint64   time;
+} Prediction;
+
 struct _MktTerminal
 {
-  GtkFlowBoxChild  parent_instance;
+  AdwBin           parent_instance;
 
   GtkWidget       *main_stack;
   GtkWidget       *empty_view;
   GtkWidget       *empty_subtitle;
   GtkWidget       *terminal;
+  GtkWidget       *hud_label;
+  GtkWidget       *disconnected_label;
+  GtkWidget       *echo_area;
 
   MktController   *controller;
   MktSettings     *settings;
   MktKeyboard       *keyboard;
+  /* Set if the shell is run by the session server */
+  MktSession      *session;
+  guint            session_rows;
+  guint            session_columns;
+  /* The shell run by VTE, 0 if not known */
+  GPid             shell_pid;
+  MktCgroupLeaf   *cgroup;
+  char           **command;
   guint            position;
 
+  /* Performance overlay, updated every HUD_INTERVAL */
+  MktKeyboardStats hud_stats;
+  gint64           hud_time;
+  guint            hud_contents_changed;
+  guint            hud_id;
+
+  gint64           last_activity;
+  guint            idle_id;
+  IdleStage        idle_stage;
+  glong            scrollback_lines;
+  VteCursorBlinkMode cursor_blink_mode;
+  VteTextBlinkMode text_blink_mode;
+  GArray          *parked;
+
+  /* Predictive echo, see terminal_predict_key() */
+  GArray          *predictions;
+  gint64           echo_srtt;
+  gboolean         echo_confirmed;
+  guint            prediction_timeout_id;
+
   double           default_scale;
+  /* Per keyboard zoom, on top of the font scale from settings */
+  double           zoom;
+  guint            zoom_save_id;
   gboolean         has_shell;
 };
 
-G_DEFINE_TYPE (MktTerminal, mkt_terminal, GTK_TYPE_FLOW_BOX_CHILD)
+G_DEFINE_TYPE (MktTerminal, mkt_terminal, ADW_TYPE_BIN)
 
+#define HUD_INTERVAL 1000 /* ms */
+#define IDLE_SCROLLBACK 100 /* lines */
+#define IDLE_NICE       10
+/* Echoes slower than this on average get predicted */
+#define PREDICTION_SRTT_TRIGGER 30000   /* µs */
+#define PREDICTION_TIMEOUT      1000    /* ms */
+/* Default padding of VteTerminal, which isn't exposed */
+#define VTE_PADDING             1
+/* Zoom changes are saved once the keys are left alone for this long */
+#define ZOOM_SAVE_DELAY         1000    /* ms */
+
+static void terminal_child_exited_cb (MktTerminal *self);
 
 static void
-keyboard_key_pressed_cb (MktTerminal  *self,
-                       MktKeyboardKey *key)
+terminal_update_font_scale (MktTerminal *self)
 {
-  char buffer[6];
   double scale;
 
   g_assert (MKT_IS_TERMINAL (self));
 
-  scale = vte_terminal_get_font_scale (VTE_TERMINAL (self->terminal));
+  scale = mkt_settings_get_font_scale (self->settings);
+  vte_terminal_set_font_scale (VTE_TERMINAL (self->terminal),
+                               self->default_scale * scale * self->zoom);
+}
+
+static void
+terminal_save_zoom (MktTerminal *self)
+{
+  g_autoptr(MktKeyboardProfile) profile = NULL;
+  const char *id;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  g_clear_handle_id (&self->zoom_save_id, g_source_remove);
+
+  /* Remember the zoom level if the keyboard has a saved profile */
+  id = mkt_keyboard_get_id (self->keyboard);
+  profile = mkt_settings_get_keyboard_profile (self->settings, id);
+
+  if (!profile)
+    return;
+
+  profile->zoom = self->zoom;
+
+  if (mkt_settings_set_keyboard_profile (self->settings, id, profile))
+    mkt_settings_save (self->settings);
+}
+
+static gboolean
+terminal_save_zoom_cb (gpointer user_data)
+{
+  MktTerminal *self = user_data;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->zoom_save_id = 0;
+  terminal_save_zoom (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+terminal_set_zoom (MktTerminal *self,
+                   double       zoom)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->zoom = CLAMP (zoom, 0.25, 4.0);
+  terminal_update_font_scale (self);
+
+  /* Don't rewrite the profiles on every key press while zooming */
+  g_clear_handle_id (&self->zoom_save_id, g_source_remove);
+  self->zoom_save_id = g_timeout_add (ZOOM_SAVE_DELAY, terminal_save_zoom_cb, self);
+}
+
+static void
+terminal_write (MktTerminal *self,
+                const char  *buffer,
+                gsize        len)
+{
+  vte_terminal_feed_child (VTE_TERMINAL (self->terminal), buffer, len);
+  mkt_keyboard_add_written (self->keyboard, len);
+}
+
+static void
+terminal_park_processes (MktTerminal *self)
+{
+  g_autoptr(GArray) pids = NULL;
+  gboolean freeze;
 
-  if (((key->keyval == GDK_KEY_plus ||
-        key->keyval == GDK_KEY_equal) &&
-       key->modifier & GDK_CONTROL_MASK) ||
-      (key->keyval == GDK_KEY_KP_Add &&
-       key->modifier == GDK_CONTROL_MASK))
+  g_assert (MKT_IS_TERMINAL (self));
+  g_assert (!self->parked);
+
+  if (!self->shell_pid)
+    return;
+
+  freeze = mkt_settings_get_freeze_idle_shells (self->settings);
+  pids = mkt_utils_get_session_pids (self->shell_pid);
+  self->parked = g_array_new (FALSE, FALSE, sizeof (ParkedProcess));
+
+  /*
+   * The shell comes first, so that it's stopped before it
+   * can notice its jobs being stopped and take the terminal.
+   */
+  for (guint i = 0; i < pids->len; i++)
+    {
+      ParkedProcess process = { 0 };
+
+      process.pid = g_array_index (pids, GPid, i);
+      errno = 0;
+      process.nice = getpriority (PRIO_PROCESS, process.pid);
+
+      if (errno)
+        continue;
+
+      /* Only root can raise the priority back */
+      if (geteuid () == 0 && process.nice < IDLE_NICE)
+        setpriority (PRIO_PROCESS, process.pid, IDLE_NICE);
+
+      if (freeze)
+        kill (process.pid, SIGSTOP);
+
+      g_array_append_val (self->parked, process);
+    }
+
+  MKT_DEBUG_MSG ("Parked %u processes of terminal %p%s", self->parked->len,
+                 self, freeze ? ", frozen" : "");
+}
+
+static void
+terminal_unpark_processes (MktTerminal *self)
+{
+  g_autoptr(GArray) parked = NULL;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  parked = g_steal_pointer (&self->parked);
+
+  if (!parked)
+    return;
+
+  /* Continue the shell last, so that it finds its jobs running */
+  for (guint i = parked->len; i > 0; i--)
     {
-      vte_terminal_set_font_scale (VTE_TERMINAL (self->terminal), scale + 0.05);
+      ParkedProcess *process = &g_array_index (parked, ParkedProcess, i - 1);
+
+      kill (process->pid, SIGCONT);
+
+      if (geteuid () == 0 && process->nice < IDLE_NICE)
+        setpriority (PRIO_PROCESS, process->pid, process->nice);
     }
-  else if ((key->keyval == GDK_KEY_minus ||
-            key->keyval == GDK_KEY_KP_Subtract) &&
-           key->modifier == GDK_CONTROL_MASK)
+}
+
+static void
+terminal_set_idle_stage (MktTerminal *self,
+                         IdleStage    stage)
+{
+  VteTerminal *terminal;
+  gint64 last_activity;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  if (self->idle_stage == stage)
+    return;
+
+  terminal = VTE_TERMINAL (self->terminal);
+  /* Trimming the scrollback changes the contents, which isn't activity */
+  last_activity = self->last_activity;
+
+  if (stage == IDLE_STAGE_ACTIVE)
     {
-      vte_terminal_set_font_scale (VTE_TERMINAL (self->terminal), scale - 0.05);
+      terminal_unpark_processes (self);
+      vte_terminal_set_scrollback_lines (terminal, self->scrollback_lines);
+      vte_terminal_set_cursor_blink_mode (terminal, self->cursor_blink_mode);
+      vte_terminal_set_text_blink_mode (terminal, self->text_blink_mode);
     }
-  else if (((key->keyval == GDK_KEY_0 ||
-             key->keyval == GDK_KEY_KP_0) &&
-            key->modifier == GDK_CONTROL_MASK))
+
+  if (stage >= IDLE_STAGE_TRIMMED && self->idle_stage < IDLE_STAGE_TRIMMED)
     {
-      double scale;
+      self->scrollback_lines = vte_terminal_get_scrollback_lines (terminal);
+      self->cursor_blink_mode = vte_terminal_get_cursor_blink_mode (terminal);
+      self->text_blink_mode = vte_terminal_get_text_blink_mode (terminal);
 
-      scale = mkt_settings_get_font_scale (self->settings);
+      if (self->scrollback_lines < 0 || self->scrollback_lines > IDLE_SCROLLBACK)
+        vte_terminal_set_scrollback_lines (terminal, IDLE_SCROLLBACK);
 
-      vte_terminal_set_font_scale (VTE_TERMINAL (self->terminal), self->default_scale * scale);
+      /* Blinking redraws the terminal forever, even if nothing changes */
+      vte_terminal_set_cursor_blink_mode (terminal, VTE_CURSOR_BLINK_OFF);
+      vte_terminal_set_text_blink_mode (terminal, VTE_TEXT_BLINK_NEVER);
     }
-  else if (key->modifier == GDK_CONTROL_MASK &&
-           toupper (key->keyval) >= 'A' && toupper (key->keyval) <= 'Z')
+
+  if (stage == IDLE_STAGE_PARKED)
+    terminal_park_processes (self);
+
+  MKT_DEBUG_MSG ("Terminal %p idle stage changed from %d to %d",
+                 self, self->idle_stage, stage);
+  self->idle_stage = stage;
+  self->last_activity = last_activity;
+}
+
+static void terminal_schedule_idle (MktTerminal *self);
+
+static gboolean
+terminal_idle_cb (gpointer user_data)
+{
+  MktTerminal *self = user_data;
+  gint64 idle_time, timeout;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->idle_id = 0;
+  timeout = mkt_settings_get_idle_timeout (self->settings) * G_USEC_PER_SEC;
+  idle_time = g_get_monotonic_time () - self->last_activity;
+
+  if (timeout && self->idle_stage < IDLE_STAGE_PARKED &&
+      idle_time >= timeout * (self->idle_stage + 1))
+    terminal_set_idle_stage (self, self->idle_stage + 1);
+
+  terminal_schedule_idle (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+terminal_schedule_idle (MktTerminal *self)
+{
+  gint64 timeout, deadline, remaining;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  g_clear_handle_id (&self->idle_id, g_source_remove);
+  timeout = mkt_settings_get_idle_timeout (self->settings) * G_USEC_PER_SEC;
+
+  if (!timeout || !self->has_shell || self->idle_stage == IDLE_STAGE_PARKED)
+    return;
+
+  /*
+   * Activity only updates the time, the timeout is checked
+   * against it when run, and set again for the remaining time.
+   */
+  deadline = self->last_activity + timeout * (self->idle_stage + 1);
+  remaining = MAX (deadline - g_get_monotonic_time (), 0);
+  self->idle_id = g_timeout_add_seconds (remaining / G_USEC_PER_SEC + 1,
+                                         terminal_idle_cb, self);
+}
+
+static void
+terminal_touch (MktTerminal *self)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  if (G_UNLIKELY (self->idle_stage != IDLE_STAGE_ACTIVE))
+    {
+      terminal_set_idle_stage (self, IDLE_STAGE_ACTIVE);
+      self->last_activity = g_get_monotonic_time ();
+      terminal_schedule_idle (self);
+      return;
+    }
+
+  self->last_activity = g_get_monotonic_time ();
+}
+
+static void
+terminal_idle_timeout_changed_cb (MktTerminal *self)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  terminal_touch (self);
+  terminal_schedule_idle (self);
+}
+
+static void
+terminal_reset_predictions (MktTerminal *self)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  g_clear_handle_id (&self->prediction_timeout_id, g_source_remove);
+
+  /* Nothing is shown until a prediction after the reset is right */
+  self->echo_confirmed = FALSE;
+
+  if (!self->predictions->len)
+    return;
+
+  g_array_set_size (self->predictions, 0);
+  gtk_widget_queue_draw (self->echo_area);
+}
+
+static gunichar
+terminal_get_cell (MktTerminal *self,
+                   glong        row,
+                   glong        column)
+{
+  g_autofree char *text = NULL;
+  const char *end, *cell;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  text = vte_terminal_get_text_range (VTE_TERMINAL (self->terminal),
+                                      row, 0, row, column + 1,
+                                      NULL, NULL, NULL);
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  if (!text)
+    return 0;
+
+  /* Trailing blanks of a row are trimmed */
+  end = text + strlen (text);
+  cell = text;
+
+  for (glong i = 0; i < column && cell < end; i++)
+    cell = g_utf8_next_char (cell);
+
+  if (cell >= end || *cell == '\n')
+    return ' ';
+
+  return g_utf8_get_char (cell);
+}
+
+/*
+ * Check the predictions against the screen.  A prediction is
+ * right if its cell has the typed character, and wrong if the
+ * cursor has moved past its cell without it, or it took too long.
+ */
+static void
+terminal_check_predictions (MktTerminal *self)
+{
+  glong row, column;
+  guint confirmed = 0;
+  gint64 now;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  if (!self->predictions->len)
+    return;
+
+  now = g_get_monotonic_time ();
+  vte_terminal_get_cursor_position (VTE_TERMINAL (self->terminal), &column, &row);
+
+  for (guint i = 0; i < self->predictions->len; i++)
     {
-      buffer[0] = toupper (key->keyval) - 'A' + 1;
-      buffer[1] = '\0';
-      vte_terminal_feed_child (VTE_TERMINAL (self->terminal), buffer, -1);
+      Prediction *prediction = &g_array_index (self->predictions, Prediction, i);
+
+      if (terminal_get_cell (self, prediction->row, prediction->column) == prediction->c)
+        {
+          gint64 rtt = now - prediction->time;
+
+          self->echo_srtt = self->echo_srtt ? (self->echo_srtt * 7 + rtt) / 8 : rtt;
+          confirmed = i + 1;
+          continue;
+        }
+
+      if (row > prediction->row ||
+          (row == prediction->row && column > prediction->column) ||
+          now - prediction->time > PREDICTION_TIMEOUT * 1000)
+        {
+          MKT_DEBUG_MSG ("Terminal %p echo didn't match prediction", self);
+          terminal_reset_predictions (self);
+          return;
+        }
+
+      break;
     }
-  else if (key->keyval >= GDK_KEY_Left &&
-           key->keyval <= GDK_KEY_Down)
+
+  if (!confirmed)
+    return;
+
+  self->echo_confirmed = TRUE;
+  g_array_remove_range (self->predictions, 0, confirmed);
+  gtk_widget_queue_draw (self->echo_area);
+
+  if (!self->predictions->len)
+    g_clear_handle_id (&self->prediction_timeout_id, g_source_remove);
+}
+
+static gboolean
+terminal_prediction_timeout_cb (gpointer user_data)
+{
+  MktTerminal *self = user_data;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->prediction_timeout_id = 0;
+  terminal_check_predictions (self);
+
+  if (self->predictions->len)
+    terminal_reset_predictions (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Predictive echo, like mosh does: a printable key is expected
+ * to be echoed at the cursor, and is drawn there right away if
+ * the shell has been slow to echo.  The predictions are checked
+ * against the screen as output arrives, and are only drawn once
+ * one has been right since the last reset, which happens on any
+ * other key and on a wrong prediction.  So full screen programs
+ * and prompts that don't echo don't get stray characters.
+ */
+static void
+terminal_predict_key (MktTerminal          *self,
+                      const MktKeyboardKey *key,
+                      gsize                 len)
+{
+  Prediction prediction = { 0 };
+  VtePty *pty;
+  gunichar c;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  c = gdk_keyval_to_unicode (key->keyval);
+
+  if (!len || !g_unichar_isprint (c) ||
+      key->modifier & (GDK_CONTROL_MASK | GDK_ALT_MASK | GDK_SUPER_MASK))
     {
-      buffer[0] = '\033';
-      buffer[1] = '[';
-      if (key->keyval == GDK_KEY_Up)
-        buffer[2] = 'A';
-      else if (key->keyval == GDK_KEY_Down)
-        buffer[2] = 'B';
-      else if (key->keyval == GDK_KEY_Right)
-        buffer[2] = 'C';
-      else
-        buffer[2] = 'D';
+      /* Keys that write nothing, like Shift, don't change anything */
+      if (len)
+        terminal_reset_predictions (self);
+      return;
+    }
+
+  pty = vte_terminal_get_pty (VTE_TERMINAL (self->terminal));
 
-      buffer[3] = '\0';
-      vte_terminal_feed_child (VTE_TERMINAL (self->terminal), buffer, -1);
+  /* Never show a password typed at a prompt that doesn't echo */
+  if (pty)
+    {
+      struct termios termios;
+
+      if (tcgetattr (vte_pty_get_fd (pty), &termios) == 0 &&
+          !(termios.c_lflag & ECHO) && termios.c_lflag & ICANON)
+        {
+          terminal_reset_predictions (self);
+          return;
+        }
     }
+
+  if (self->predictions->len)
+    {
+      Prediction *last;
+
+      last = &g_array_index (self->predictions, Prediction, self->predictions->len - 1);
+      prediction.row = last->row;
+      prediction.column = last->column + 1;
+    }
+  else
+    {
+      vte_terminal_get_cursor_position (VTE_TERMINAL (self->terminal),
+                                        &prediction.column, &prediction.row);
+    }
+
+  /* Line wraps aren't predicted */
+  if (prediction.column >= vte_terminal_get_column_count (VTE_TERMINAL (self->terminal)))
+    return;
+
+  prediction.c = c;
+  prediction.time = g_get_monotonic_time ();
+  g_array_append_val (self->predictions, prediction);
+
+  if (!self->prediction_timeout_id)
+    self->prediction_timeout_id = g_timeout_add (PREDICTION_TIMEOUT,
+                                                 terminal_prediction_timeout_cb,
+                                                 self);
+
+  if (self->echo_confirmed && self->echo_srtt >= PREDICTION_SRTT_TRIGGER)
+    gtk_widget_queue_draw (self->echo_area);
+}
+
+static void
+terminal_draw_predictions (GtkDrawingArea *area,
+                           cairo_t        *cr,
+                           int             width,
+                           int             height,
+                           gpointer        user_data)
+{
+  MktTerminal *self = user_data;
+  g_autoptr(PangoFontDescription) font_desc = NULL;
+  VteTerminal *terminal;
+  graphene_rect_t bounds;
+  GdkRGBA background, foreground;
+  double top_row, size;
+  glong char_width, char_height;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  if (!self->predictions->len || !self->echo_confirmed ||
+      self->echo_srtt < PREDICTION_SRTT_TRIGGER ||
+      !gtk_widget_compute_bounds (self->terminal, GTK_WIDGET (area), &bounds))
+    return;
+
+  terminal = VTE_TERMINAL (self->terminal);
+  char_width = vte_terminal_get_char_width (terminal);
+  char_height = vte_terminal_get_char_height (terminal);
+  top_row = gtk_adjustment_get_value (gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (terminal)));
+
+  font_desc = pango_font_description_copy (vte_terminal_get_font (terminal));
+  size = pango_font_description_get_size (font_desc) * vte_terminal_get_font_scale (terminal);
+
+  if (pango_font_description_get_size_is_absolute (font_desc))
+    pango_font_description_set_absolute_size (font_desc, size);
   else
+    pango_font_description_set_size (font_desc, size);
+
+  vte_terminal_get_color_background_for_draw (terminal, &background);
+  gtk_widget_get_color (GTK_WIDGET (area), &foreground);
+
+  for (guint i = 0; i < self->predictions->len; i++)
+    {
+      Prediction *prediction = &g_array_index (self->predictions, Prediction, i);
+      g_autoptr(PangoLayout) layout = NULL;
+      char text[7] = { 0 };
+      double x, y;
+
+      x = bounds.origin.x + VTE_PADDING + prediction->column * char_width;
+      y = bounds.origin.y + VTE_PADDING + (prediction->row - top_row) * char_height;
+
+      gdk_cairo_set_source_rgba (cr, &background);
+      cairo_rectangle (cr, x, y, char_width, char_height);
+      cairo_fill (cr);
+
+      g_unichar_to_utf8 (prediction->c, text);
+      layout = gtk_widget_create_pango_layout (GTK_WIDGET (area), text);
+      pango_layout_set_font_description (layout, font_desc);
+
+      /* Underline, to tell it from the real echo */
+      gdk_cairo_set_source_rgba (cr, &foreground);
+      cairo_move_to (cr, x, y);
+      pango_cairo_show_layout (cr, layout);
+      cairo_rectangle (cr, x, y + char_height - 1, char_width, 1);
+      cairo_fill (cr);
+    }
+}
+
+static void
+terminal_scroll_pages (MktTerminal *self,
+                       double       pages)
+{
+  GtkAdjustment *adjustment;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self->terminal));
+  gtk_adjustment_set_value (adjustment,
+                            gtk_adjustment_get_value (adjustment) +
+                            pages * gtk_adjustment_get_page_size (adjustment));
+}
+
+static void
+terminal_activate_shortcut (MktTerminal       *self,
+                            MktShortcutAction  action)
+{
+  VteTerminal *terminal;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  terminal = VTE_TERMINAL (self->terminal);
+  MKT_DEBUG_MSG ("Terminal %p shortcut action: %d", self, action);
+
+  switch (action)
+    {
+    case MKT_SHORTCUT_ZOOM_IN:
+      terminal_set_zoom (self, self->zoom + 0.05);
+      break;
+
+    case MKT_SHORTCUT_ZOOM_OUT:
+      terminal_set_zoom (self, self->zoom - 0.05);
+      break;
+
+    case MKT_SHORTCUT_ZOOM_RESET:
+      terminal_set_zoom (self, 1.0);
+      break;
+
+    case MKT_SHORTCUT_COPY:
+      vte_terminal_copy_clipboard_format (terminal, VTE_FORMAT_TEXT);
+      break;
+
+    case MKT_SHORTCUT_PASTE:
+      vte_terminal_paste_clipboard (terminal);
+      break;
+
+    case MKT_SHORTCUT_SCROLL_PAGE_UP:
+      terminal_scroll_pages (self, -1.0);
+      break;
+
+    case MKT_SHORTCUT_SCROLL_PAGE_DOWN:
+      terminal_scroll_pages (self, 1.0);
+      break;
+
+    case MKT_SHORTCUT_RESET:
+      vte_terminal_reset (terminal, TRUE, FALSE);
+      break;
+
+    case MKT_SHORTCUT_CLEAR_SCROLLBACK:
+      {
+        glong lines;
+
+        /* VTE has no API for this, but dropping the lines does it */
+        lines = vte_terminal_get_scrollback_lines (terminal);
+        vte_terminal_set_scrollback_lines (terminal, 0);
+        vte_terminal_set_scrollback_lines (terminal, lines);
+      }
+      break;
+
+    case MKT_SHORTCUT_NONE:
+    default:
+      g_return_if_reached ();
+    }
+}
+
+static void
+keyboard_keys_cb (MktKeyboard          *keyboard,
+                  const MktKeyboardKey *keys,
+                  guint                 n_keys,
+                  gpointer              user_data)
+{
+  MktTerminal *self = user_data;
+  char buffer[MKT_KEYBOARD_KEY_MAX_LEN * MKT_KEYBOARD_KEY_BATCH];
+  MktShortcuts *shortcuts;
+  gsize len = 0;
+  gboolean predict;
+  MKT_ALLOC_SCOPE (MKT_ALLOC_SCOPE_TERMINAL);
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  predict = mkt_settings_get_predictive_echo (self->settings);
+  shortcuts = mkt_settings_get_shortcuts (self->settings);
+
+  /* Any key, even a release, wakes an idle terminal */
+  terminal_touch (self);
+
+  for (guint i = 0; i < n_keys; i++)
     {
-      guint len;
+      const MktKeyboardKey *key = &keys[i];
+      MktShortcutAction action;
+
+      if (!key->pressed)
+        continue;
+
+      MKT_PROBE (terminal_key, self, key->keyval, key->modifier);
+
+      action = mkt_shortcuts_lookup (shortcuts, key->keyval, key->modifier);
+
+      if (action != MKT_SHORTCUT_NONE)
+        {
+          /* Write the keys before, so that eg: a paste comes after them */
+          if (len)
+            terminal_write (self, buffer, len);
+          len = 0;
 
-      len = g_unichar_to_utf8 (gdk_keyval_to_unicode (key->keyval), buffer);
-      buffer[len] = '\0';
-      vte_terminal_feed_child (VTE_TERMINAL (self->terminal), buffer, -1);
+          terminal_activate_shortcut (self, action);
+        }
+      else
+        {
+          gsize key_len;
+
+          key_len = mkt_keyboard_key_encode (key, buffer + len);
+          len += key_len;
+
+          if (predict)
+            terminal_predict_key (self, key, key_len);
+        }
     }
+
+  /* Write the whole batch at once */
+  if (len)
+    terminal_write (self, buffer, len);
 }
 
 static void
@@ -140,6 +809,124 @@ child_ready_cb (VteTerminal *terminal,
     g_warning ("error: %s", error->message);
 
   self->has_shell = !error;
+  self->shell_pid = error ? 0 : pid;
+
+  if (self->cgroup && self->shell_pid)
+    mkt_cgroup_leaf_attach (self->cgroup, self->shell_pid);
+
+  terminal_touch (self);
+  terminal_schedule_idle (self);
+}
+
+static void
+terminal_session_cb (MktSession        *session,
+                     MktSessionMessage  type,
+                     const char        *data,
+                     gsize              length,
+                     gpointer           user_data)
+{
+  MktTerminal *self = user_data;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  switch (type)
+    {
+    case MKT_SESSION_MESSAGE_OUTPUT:
+      mkt_keyboard_add_read (self->keyboard, length);
+      vte_terminal_feed (VTE_TERMINAL (self->terminal), data, length);
+      break;
+
+    case MKT_SESSION_MESSAGE_CLOSED:
+      g_warning ("Lost connection to session server");
+      G_GNUC_FALLTHROUGH;
+
+    case MKT_SESSION_MESSAGE_EXITED:
+      mkt_session_close (session);
+      g_clear_pointer (&self->session, mkt_session_unref);
+      terminal_child_exited_cb (self);
+      break;
+
+    case MKT_SESSION_MESSAGE_ATTACH:
+    case MKT_SESSION_MESSAGE_INPUT:
+    case MKT_SESSION_MESSAGE_RESIZE:
+    case MKT_SESSION_MESSAGE_DRAINED:
+    default:
+      break;
+    }
+}
+
+static gboolean
+terminal_attach_session (MktTerminal        *self,
+                         const char         *cwd,
+                         const char * const *argv)
+{
+  g_autofree char *current_dir = NULL;
+  g_autoptr(GError) error = NULL;
+  VteTerminal *terminal;
+  guint slot;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->session = mkt_session_connect (NULL, terminal_session_cb, self, &error);
+
+  if (!self->session)
+    {
+      g_warning ("Failed to connect to session server: %s", error->message);
+      return FALSE;
+    }
+
+  if (!cwd)
+    cwd = current_dir = g_get_current_dir ();
+
+  terminal = VTE_TERMINAL (self->terminal);
+  slot = mkt_keyboard_get_index (self->keyboard) - GDK_KEY_0;
+  self->session_rows = vte_terminal_get_row_count (terminal);
+  self->session_columns = vte_terminal_get_column_count (terminal);
+
+  /* The server replays the recent output of a running shell */
+  vte_terminal_reset (terminal, TRUE, TRUE);
+  mkt_session_attach (self->session, slot,
+                      self->session_rows, self->session_columns,
+                      cwd, argv);
+  self->has_shell = TRUE;
+  terminal_touch (self);
+  terminal_schedule_idle (self);
+
+  MKT_DEBUG_MSG ("Attached terminal %u to session server", slot);
+
+  return TRUE;
+}
+
+static void
+terminal_spawn (MktTerminal *self,
+                const char  *cwd,
+                char       **argv)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  if (mkt_settings_get_keep_sessions (self->settings) &&
+      terminal_attach_session (self, cwd, (const char * const *)argv))
+    return;
+
+  g_clear_pointer (&self->cgroup, mkt_cgroup_leaf_free);
+
+  if (mkt_settings_get_isolate_terminals (self->settings))
+    {
+      MktSlotLimits limits;
+      guint slot;
+
+      slot = mkt_keyboard_get_index (self->keyboard) - GDK_KEY_0;
+      mkt_settings_get_slot_limits (self->settings, slot, &limits);
+      self->cgroup = mkt_cgroup_leaf_new (mkt_cgroup_get_default (), slot, &limits);
+    }
+
+  vte_terminal_spawn_async (VTE_TERMINAL (self->terminal),
+                            VTE_PTY_DEFAULT,
+                            cwd, argv, NULL, G_SPAWN_SEARCH_PATH,
+                            self->cgroup ? mkt_cgroup_leaf_child_setup : NULL,
+                            self->cgroup, NULL, -1,
+                            NULL,
+                            child_ready_cb, g_object_ref (self));
 }
 
 static void
@@ -155,6 +942,12 @@ terminal_start_bash (MktTerminal *self)
   if (self->has_shell)
     return;
 
+  if (self->command)
+    {
+      terminal_spawn (self, NULL, self->command);
+      return;
+    }
+
   shell = vte_get_user_shell ();
 
   if (!shell)
@@ -202,12 +995,7 @@ terminal_start_bash (MktTerminal *self)
   if (!cwd)
     cwd = g_strdup_printf ("/home/%s", g_getenv ("USER"));
 
-  vte_terminal_spawn_async (VTE_TERMINAL (self->terminal),
-                            VTE_PTY_DEFAULT,
-                            cwd, argv, NULL, G_SPAWN_SEARCH_PATH,
-                            NULL, NULL, NULL, -1,
-                            NULL,
-                            child_ready_cb, g_object_ref (self));
+  terminal_spawn (self, cwd, argv);
 }
 
 static void
@@ -235,7 +1023,6 @@ terminal_font_changed_cb (MktTerminal *self,
 {
   PangoFontDescription *font_desc = NULL;
   const char *font = NULL;
-  double scale;
 
   g_assert (MKT_IS_TERMINAL (self));
   g_assert (MKT_IS_SETTINGS (settings));
@@ -247,9 +1034,94 @@ terminal_font_changed_cb (MktTerminal *self,
     font_desc = pango_font_description_from_string (font);
 
   vte_terminal_set_font (VTE_TERMINAL (self->terminal), font_desc);
+  terminal_update_font_scale (self);
+}
 
-  scale = mkt_settings_get_font_scale (self->settings);
-  vte_terminal_set_font_scale (VTE_TERMINAL (self->terminal), self->default_scale * scale);
+static gboolean
+terminal_update_hud (gpointer user_data)
+{
+  MktTerminal *self = user_data;
+  g_autofree char *label = NULL;
+  const MktKeyboardStats *stats;
+  MktKeyboardStats recent = { 0 };
+  double interval;
+  gint64 now;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  now = g_get_monotonic_time ();
+  interval = MAX (now - self->hud_time, 1) / (double)G_USEC_PER_SEC;
+  stats = mkt_keyboard_get_stats (self->keyboard);
+
+  /* Show the latency of the events since the last update only */
+  for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS; i++)
+    recent.latency[i] = stats->latency[i] - self->hud_stats.latency[i];
+
+  /*
+   * VTE doesn't tell the number of bytes read from the PTY,
+   * so the screen updates are shown as the output rate.
+   */
+  label = mkt_utils_format_terminal_hud (mkt_keyboard_stats_get_latency_percentile (&recent, 0.5),
+                                         mkt_keyboard_stats_get_latency_percentile (&recent, 0.99),
+                                         (stats->bytes_written - self->hud_stats.bytes_written) / interval,
+                                         self->hud_contents_changed / interval,
+                                         (stats->repeats - self->hud_stats.repeats) / interval,
+                                         stats->dropped, stats->limited);
+  gtk_label_set_text (GTK_LABEL (self->hud_label), label);
+
+  self->hud_stats = *stats;
+  self->hud_time = now;
+  self->hud_contents_changed = 0;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+terminal_commit_cb (MktTerminal *self,
+                    const char  *text,
+                    guint        size)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  /* Without a PTY, VTE only emits what it would have written to it */
+  if (self->session)
+    mkt_session_send (self->session, MKT_SESSION_MESSAGE_INPUT, text, size);
+}
+
+static void
+terminal_contents_changed_cb (MktTerminal *self)
+{
+  g_assert (MKT_IS_TERMINAL (self));
+
+  self->hud_contents_changed++;
+  terminal_touch (self);
+  terminal_check_predictions (self);
+}
+
+static void
+terminal_show_hud_changed_cb (MktTerminal *self)
+{
+  gboolean show;
+
+  g_assert (MKT_IS_TERMINAL (self));
+
+  show = mkt_settings_get_show_performance_hud (self->settings);
+  gtk_widget_set_visible (self->hud_label, show);
+
+  if (!show)
+    {
+      g_clear_handle_id (&self->hud_id, g_source_remove);
+      return;
+    }
+
+  if (self->hud_id)
+    return;
+
+  self->hud_stats = *mkt_keyboard_get_stats (self->keyboard);
+  self->hud_time = g_get_monotonic_time ();
+  self->hud_contents_changed = 0;
+  self->hud_id = g_timeout_add (HUD_INTERVAL, terminal_update_hud, self);
+  terminal_update_hud (self);
 }
 
 static void
@@ -271,6 +1143,11 @@ terminal_child_exited_cb (MktTerminal *self)
     return;
 
   self->has_shell = FALSE;
+  self->shell_pid = 0;
+  mkt_keyboard_count_shell_exit (self->keyboard);
+  g_clear_pointer (&self->cgroup, mkt_cgroup_leaf_free);
+  terminal_set_idle_stage (self, IDLE_STAGE_ACTIVE);
+  g_clear_handle_id (&self->idle_id, g_source_remove);
   vte_terminal_reset (VTE_TERMINAL (self->terminal), TRUE, TRUE);
   mkt_keyboard_set_enabled (self->keyboard, FALSE);
 
@@ -283,21 +1160,68 @@ terminal_child_exited_cb (MktTerminal *self)
   else
     {
       g_autofree char *label = NULL;
-      guint index = 0;
+      guint index;
 
-      mkt_utils_get_item_position (keyboard_list, self->keyboard, &index);
-      label = g_strdup_printf ("Press “%d” to start the terminal", index + 1);
+      index = mkt_keyboard_get_index (self->keyboard) - GDK_KEY_0;
+      label = g_strdup_printf ("Press “%u” to start the terminal", index);
       gtk_label_set_text (GTK_LABEL (self->empty_subtitle), label);
     }
 }
 
+static void
+mkt_terminal_size_allocate (GtkWidget *widget,
+                            int        width,
+                            int        height,
+                            int        baseline)
+{
+  MktTerminal *self = (MktTerminal *)widget;
+  VteTerminal *terminal;
+  guint rows, columns;
+
+  GTK_WIDGET_CLASS (mkt_terminal_parent_class)->size_allocate (widget, width, height, baseline);
+
+  if (!self->session)
+    return;
+
+  /* VTE resizes the PTY itself, which the session server owns here */
+  terminal = VTE_TERMINAL (self->terminal);
+  rows = vte_terminal_get_row_count (terminal);
+  columns = vte_terminal_get_column_count (terminal);
+
+  if (rows == self->session_rows && columns == self->session_columns)
+    return;
+
+  self->session_rows = rows;
+  self->session_columns = columns;
+  mkt_session_resize (self->session, rows, columns);
+}
+
 static void
 mkt_terminal_finalize (GObject *object)
 {
   MktTerminal *self = (MktTerminal *)object;
 
+  /* The shell is left running in the server, for the next terminal of the slot */
+  if (self->session)
+    mkt_session_close (self->session);
+
+  g_clear_pointer (&self->session, mkt_session_unref);
+  g_clear_handle_id (&self->hud_id, g_source_remove);
+  g_clear_handle_id (&self->idle_id, g_source_remove);
+  g_clear_handle_id (&self->prediction_timeout_id, g_source_remove);
+  g_clear_pointer (&self->predictions, g_array_unref);
+
+  /* Save a zoom change still waiting for the timeout */
+  if (self->zoom_save_id)
+    terminal_save_zoom (self);
+
+  /* Don't leave the processes stopped */
+  terminal_unpark_processes (self);
+  g_clear_pointer (&self->cgroup, mkt_cgroup_leaf_free);
+  mkt_keyboard_unset_key_func (self->keyboard, self);
   g_clear_object (&self->keyboard);
   g_clear_object (&self->settings);
+  g_clear_pointer (&self->command, g_strfreev);
   g_clear_object (&self->controller);
 
   G_OBJECT_CLASS (mkt_terminal_parent_class)->finalize (object);
@@ -311,6 +1235,8 @@ mkt_terminal_class_init (MktTerminalClass *klass)
 
   object_class->finalize = mkt_terminal_finalize;
 
+  widget_class->size_allocate = mkt_terminal_size_allocate;
+
   gtk_widget_class_set_template_from_resource (widget_class,
                                                "/org/sadiqpk/multi-keyterm/"
                                                "ui/mkt-terminal.ui");
@@ -319,6 +1245,9 @@ mkt_terminal_class_init (MktTerminalClass *klass)
   gtk_widget_class_bind_template_child (widget_class, MktTerminal, empty_view);
   gtk_widget_class_bind_template_child (widget_class, MktTerminal, empty_subtitle);
   gtk_widget_class_bind_template_child (widget_class, MktTerminal, terminal);
+  gtk_widget_class_bind_template_child (widget_class, MktTerminal, hud_label);
+  gtk_widget_class_bind_template_child (widget_class, MktTerminal, disconnected_label);
+  gtk_widget_class_bind_template_child (widget_class, MktTerminal, echo_area);
 
   gtk_widget_class_bind_template_callback (widget_class, mkt_terminal_close);
 }
@@ -330,7 +1259,20 @@ mkt_terminal_init (MktTerminal *self)
   g_signal_connect_object (self->terminal, "child-exited",
                            G_CALLBACK (terminal_child_exited_cb),
                            self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->terminal, "commit",
+                           G_CALLBACK (terminal_commit_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->terminal, "contents-changed",
+                           G_CALLBACK (terminal_contents_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->terminal, "cursor-moved",
+                           G_CALLBACK (terminal_check_predictions),
+                           self, G_CONNECT_SWAPPED);
+  self->predictions = g_array_new (FALSE, FALSE, sizeof (Prediction));
+  gtk_drawing_area_set_draw_func (GTK_DRAWING_AREA (self->echo_area),
+                                  terminal_draw_predictions, self, NULL);
   self->default_scale = vte_terminal_get_font_scale (VTE_TERMINAL (self->terminal));
+  self->zoom = 1.0;
 }
 
 GtkWidget *
@@ -338,6 +1280,7 @@ mkt_terminal_new (MktController *controller,
                   MktSettings   *settings,
                   MktKeyboard     *keyboard)
 {
+  g_autoptr(MktKeyboardProfile) profile = NULL;
   MktTerminal *self;
 
   g_assert (MKT_IS_CONTROLLER (controller));
@@ -349,16 +1292,38 @@ mkt_terminal_new (MktController *controller,
   self->settings = g_object_ref (settings);
   self->keyboard = g_object_ref (keyboard);
 
-  g_signal_connect_object (keyboard, "key-pressed",
-                           G_CALLBACK (keyboard_key_pressed_cb),
-                           self, G_CONNECT_SWAPPED);
+  /* Restore the zoom level and command, which has to be set before the shell starts */
+  profile = mkt_settings_get_keyboard_profile (settings, mkt_keyboard_get_id (keyboard));
+
+  if (profile)
+    {
+      g_auto(GStrv) argv = NULL;
+
+      self->zoom = profile->zoom;
+
+      if (profile->command &&
+          g_shell_parse_argv (profile->command, NULL, &argv, NULL))
+        self->command = g_steal_pointer (&argv);
+    }
+
+  mkt_keyboard_set_key_func (keyboard, keyboard_keys_cb, self);
+  g_object_bind_property (keyboard, "connected",
+                          self->disconnected_label, "visible",
+                          G_BINDING_SYNC_CREATE | G_BINDING_INVERT_BOOLEAN);
   g_signal_connect_object (keyboard, "notify::enabled",
                            G_CALLBACK (keyboard_enable_changed_cb),
                            self, G_CONNECT_SWAPPED);
   g_signal_connect_object (self->settings, "font-changed",
                            G_CALLBACK (terminal_font_changed_cb),
                            self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::show-performance-hud",
+                           G_CALLBACK (terminal_show_hud_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::idle-timeout",
+                           G_CALLBACK (terminal_idle_timeout_changed_cb),
+                           self, G_CONNECT_SWAPPED);
   terminal_font_changed_cb (self, settings);
+  terminal_show_hud_changed_cb (self);
   keyboard_enable_changed_cb (self);
 
   return GTK_WIDGET (self);
@@ -371,3 +1336,24 @@ mkt_terminal_get_keyboard (MktTerminal *self)
 
   return self->keyboard;
 }
+
+/**
+ * mkt_terminal_set_command:
+ * @self: A #MktTerminal
+ * @argv: (nullable): The command to run
+ *
+ * Set the command to run when the terminal is started,
+ * instead of the user shell.  Set %NULL to use the
+ * default shell.  This has no effect if the command
+ * is already running.
+ */
+void
+mkt_terminal_set_command (MktTerminal        *self,
+                          const char * const *argv)
+{
+  g_return_if_fail (MKT_IS_TERMINAL (self));
+  g_return_if_fail (!argv || argv[0]);
+
+  g_strfreev (self->command);
+  self->command = g_strdupv ((char **)argv);
+}
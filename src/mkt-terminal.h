@@ -24,7 +24,7 @@
 
 #pragma once
 
-#include <gtk/gtk.h>
+#include <adwaita.h>
 
 #include "mkt-keyboard.h"
 #include "mkt-settings.h"
@@ -34,11 +34,13 @@ G_BEGIN_DECLS
 
 #define MKT_TYPE_TERMINAL (mkt_terminal_get_type ())
 
-G_DECLARE_FINAL_TYPE (MktTerminal, mkt_terminal, MKT, TERMINAL, GtkFlowBoxChild)
+G_DECLARE_FINAL_TYPE (MktTerminal, mkt_terminal, MKT, TERMINAL, AdwBin)
 
 GtkWidget   *mkt_terminal_new          (MktController *controller,
                                         MktSettings   *settings,
                                         MktKeyboard   *keyboard);
 MktKeyboard *mkt_terminal_get_keyboard (MktTerminal   *self);
+void         mkt_terminal_set_command  (MktTerminal        *self,
+                                        const char * const *argv);
 
 G_END_DECLS
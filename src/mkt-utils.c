@@ -28,6 +28,12 @@
 # include "config.h"
 #endif
 
+#include <libinput.h>
+#include <libudev.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "mkt-utils.h"
 
 /**
@@ -92,3 +98,173 @@ mkt_utils_get_item_position (GListModel *list,
 
   return FALSE;
 }
+
+/**
+ * mkt_utils_get_device_id:
+ * @libinput_device: A libinput device
+ *
+ * Get a stable identifier for @libinput_device, so that
+ * the same keyboard can be recognized when plugged again.
+ *
+ * Returns: (transfer full) (nullable): The device id
+ */
+char *
+mkt_utils_get_device_id (gpointer libinput_device)
+{
+  struct udev_device *udev_device;
+  const char *id = NULL;
+  char *device_id = NULL;
+
+  g_return_val_if_fail (libinput_device, NULL);
+
+  udev_device = libinput_device_get_udev_device (libinput_device);
+
+  if (!udev_device)
+    return NULL;
+
+  /*
+   * ID_PATH is the physical port the keyboard is connected to,
+   * which is stable across reboots and differs even if identical
+   * keyboards are used.  Use the serial if that's not available.
+   */
+  id = udev_device_get_property_value (udev_device, "ID_PATH");
+  if (!id)
+    id = udev_device_get_property_value (udev_device, "ID_SERIAL");
+
+  if (id)
+    device_id = g_strdup (id);
+
+  udev_device_unref (udev_device);
+
+  return device_id;
+}
+
+/**
+ * mkt_utils_get_session_pids:
+ * @session: The session id, which is the pid of the session leader
+ *
+ * Get the processes in the session @session, like the
+ * processes started from a shell that leads the session.
+ * The session leader is always the first, if it's alive.
+ *
+ * Returns: (transfer full) (element-type GPid): The pids
+ */
+GArray *
+mkt_utils_get_session_pids (GPid session)
+{
+  g_autoptr(GDir) dir = NULL;
+  GArray *pids;
+  const char *name;
+
+  g_return_val_if_fail (session > 0, NULL);
+
+  pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+  dir = g_dir_open ("/proc", 0, NULL);
+
+  if (!dir)
+    return pids;
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      g_autofree char *path = NULL;
+      g_autofree char *content = NULL;
+      const char *fields;
+      long sid = 0;
+      GPid pid;
+
+      if (!g_ascii_isdigit (*name))
+        continue;
+
+      path = g_build_filename ("/proc", name, "stat", NULL);
+
+      /* The process may have exited since the directory was read */
+      if (!g_file_get_contents (path, &content, NULL, NULL))
+        continue;
+
+      /* The command name may have spaces and parens, skip to the last paren */
+      fields = strrchr (content, ')');
+
+      if (!fields ||
+          sscanf (fields + 1, " %*c %*d %*d %ld", &sid) != 1 ||
+          sid != session)
+        continue;
+
+      pid = atoi (name);
+
+      if (pid == session)
+        g_array_prepend_val (pids, pid);
+      else
+        g_array_append_val (pids, pid);
+    }
+
+  return pids;
+}
+
+static char *
+utils_format_latency (guint64 latency)
+{
+  if (!latency)
+    return g_strdup ("–");
+
+  if (latency < 1000)
+    return g_strdup_printf ("≤%" G_GUINT64_FORMAT "µs", latency);
+
+  return g_strdup_printf ("≤%.1fms", latency / 1000.0);
+}
+
+/**
+ * mkt_utils_format_terminal_hud:
+ * @latency_p50: The median input latency in µs, or 0 if unknown
+ * @latency_p99: The 99th percentile of the input latency in µs
+ * @bytes_rate: The bytes written to the PTY per second
+ * @output_rate: The screen updates per second
+ * @repeat_rate: The key repeats per second
+ * @dropped: The keys dropped since the keyboard was added
+ * @limited: The key presses over the rate limit since then
+ *
+ * Get the text of the performance overlay of a terminal.
+ *
+ * Returns: (transfer full): The overlay text
+ */
+char *
+mkt_utils_format_terminal_hud (guint64 latency_p50,
+                               guint64 latency_p99,
+                               double  bytes_rate,
+                               double  output_rate,
+                               double  repeat_rate,
+                               guint64 dropped,
+                               guint64 limited)
+{
+  g_autofree char *p50 = NULL;
+  g_autofree char *p99 = NULL;
+
+  p50 = utils_format_latency (latency_p50);
+  p99 = utils_format_latency (latency_p99);
+
+  return g_strdup_printf ("latency  p50 %s  p99 %s\n"
+                          "pty in   %.0f B/s\n"
+                          "output   %.0f updates/s\n"
+                          "repeat   %.0f/s  dropped %" G_GUINT64_FORMAT "  limited %" G_GUINT64_FORMAT,
+                          p50, p99, bytes_rate, output_rate, repeat_rate,
+                          dropped, limited);
+}
+
+/**
+ * mkt_utils_format_window_hud:
+ * @frame_rate: The frames drawn per second
+ * @frame_avg: The average time to draw a frame in ms
+ * @frame_max: The longest time to draw a frame in ms
+ *
+ * Get the text of the performance overlay of a window.
+ *
+ * Returns: (transfer full): The overlay text
+ */
+char *
+mkt_utils_format_window_hud (double frame_rate,
+                             double frame_avg,
+                             double frame_max)
+{
+  return g_strdup_printf ("frames  %.0f/s\n"
+                          "frame   avg %.2fms  max %.2fms",
+                          frame_rate, frame_avg, frame_max);
+}
@@ -35,5 +35,17 @@ GThread    *mkt_utils_get_main_thread         (void);
 gboolean    mkt_utils_get_item_position       (GListModel *list,
                                                gpointer    item,
                                                guint      *position);
+char       *mkt_utils_get_device_id           (gpointer    libinput_device);
+GArray     *mkt_utils_get_session_pids        (GPid        session);
+char       *mkt_utils_format_terminal_hud     (guint64     latency_p50,
+                                               guint64     latency_p99,
+                                               double      bytes_rate,
+                                               double      output_rate,
+                                               double      repeat_rate,
+                                               guint64     dropped,
+                                               guint64     limited);
+char       *mkt_utils_format_window_hud       (double      frame_rate,
+                                               double      frame_avg,
+                                               double      frame_max);
 
 G_END_DECLS
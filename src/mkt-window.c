@@ -34,9 +34,12 @@
 
 #include "mkt-keyboard.h"
 #include "mkt-controller.h"
+#include "mkt-grid-layout.h"
 #include "mkt-terminal.h"
+#include "mkt-terminal-grid.h"
 #include "mkt-preferences-window.h"
 #include "mkt-settings.h"
+#include "mkt-utils.h"
 #include "mkt-window.h"
 #include "mkt-log.h"
 
@@ -47,6 +50,7 @@ struct _MktWindow
   GtkWidget            *menu_button;
   GtkWidget            *focus_revealer;
   GtkWidget            *button_revealer;
+  GtkWidget            *hud_label;
 
   GtkWidget            *main_stack;
   GtkWidget            *status_page;
@@ -54,11 +58,23 @@ struct _MktWindow
 
   MktSettings          *settings;
   MktController        *controller;
+  GListModel           *keyboard_list;
   GtkEventController   *key_controller;
+
+  /* Performance overlay, updated every HUD_INTERVAL */
+  GdkFrameClock        *frame_clock;
+  gint64                frame_start;
+  gint64                frame_total;
+  gint64                frame_max;
+  guint                 frame_count;
+  gint64                hud_time;
+  guint                 hud_id;
 };
 
 G_DEFINE_TYPE (MktWindow, mkt_window, ADW_TYPE_APPLICATION_WINDOW)
 
+#define HUD_INTERVAL 1000 /* ms */
+
 static gboolean
 window_key_event_cb (MktWindow *self)
 {
@@ -88,66 +104,65 @@ controller_failed_cb (MktWindow *self)
                                    "to “input” user group");
 }
 
-GtkWidget *
+static GtkWidget *
 terminal_new (MktKeyboard *keyboard,
               MktWindow   *self)
 {
   return mkt_terminal_new (self->controller, self->settings, keyboard);
 }
 
+/*
+ * This only updates the layout parameters.  The grid size is
+ * computed by the layout manager on allocation, so changes
+ * in size or terminal count are applied at most once per frame.
+ */
 static void
 window_update_terminal_style (MktWindow *self)
 {
-  GListModel *keyboard_list;
-  guint n_items, children_count = 2;
-  bool h_split;
+  g_autoptr(PangoFontDescription) font_desc = NULL;
+  PangoFontMetrics *metrics;
+  MktGridLayout *layout;
+  int single_column_height = 0;
+  double scale;
 
-  g_assert (MKT_IS_WINDOW(self));
+  g_assert (MKT_IS_WINDOW (self));
 
-  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
-  n_items = g_list_model_get_n_items (keyboard_list);
-  h_split = mkt_settings_get_prefer_horizontal_split (self->settings);
+  layout = MKT_GRID_LAYOUT (gtk_widget_get_layout_manager (self->terminal_grid));
 
-  if (n_items <= 1)
-    {
-      children_count = 1;
-    }
-  else if (h_split)
-    {
-      int term_height, height;
-
-      height = gtk_widget_get_height (self->terminal_grid);
-      term_height = mkt_settings_get_min_terminal_height (self->settings);
+  /* Cells are sized in characters of the terminal font */
+  font_desc = pango_font_description_from_string (mkt_settings_get_font (self->settings));
+  metrics = pango_context_get_metrics (gtk_widget_get_pango_context (self->terminal_grid),
+                                       font_desc, NULL);
+  scale = mkt_settings_get_font_scale (self->settings) / PANGO_SCALE;
+  mkt_grid_layout_set_char_size (layout,
+                                 MAX (1, pango_font_metrics_get_approximate_digit_width (metrics) * scale),
+                                 MAX (1, pango_font_metrics_get_height (metrics) * scale));
+  pango_font_metrics_unref (metrics);
 
-      if (term_height * n_items <= height)
-        children_count = 1;
-    }
+  if (mkt_settings_get_prefer_horizontal_split (self->settings))
+    single_column_height = mkt_settings_get_min_terminal_height (self->settings);
 
-  g_object_set (self->terminal_grid,
-                "min-children-per-line", children_count,
-                "max-children-per-line", children_count,
-                NULL);
+  mkt_grid_layout_set_single_column_height (layout, single_column_height);
+  mkt_grid_layout_set_expand_last_row (layout,
+                                       mkt_settings_expand_terminal_to_fit (self->settings));
 }
 
 
 static void
 keyboard_list_changed_cb (MktWindow *self)
 {
-  GListModel *keyboard_list;
   GtkWidget *child;
   guint n_items;
 
   g_assert (MKT_IS_WINDOW (self));
 
-  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
-  n_items = g_list_model_get_n_items (keyboard_list);
+  n_items = g_list_model_get_n_items (self->keyboard_list);
 
   if (n_items >= 1)
     child = self->terminal_grid;
   else
     child = self->status_page;
 
-  window_update_terminal_style (self);
   gtk_stack_set_visible_child (GTK_STACK (self->main_stack), child);
 }
 
@@ -174,6 +189,28 @@ mkt_window_show_preferences (MktWindow *self)
   gtk_window_present (GTK_WINDOW (preferences));
 }
 
+/*
+ * GtkApplication builds the help overlay for every window
+ * if it's at gtk/help-overlay.ui, so it's elsewhere and
+ * built only when asked for.
+ */
+static void
+window_show_help_overlay_cb (GtkWidget  *widget,
+                             const char *action_name,
+                             GVariant   *parameter)
+{
+  MktWindow *self = (MktWindow *)widget;
+  g_autoptr(GtkBuilder) builder = NULL;
+  GtkWindow *help_overlay;
+
+  g_assert (MKT_IS_WINDOW (self));
+
+  builder = gtk_builder_new_from_resource ("/org/sadiqpk/multi-keyterm/ui/help-overlay.ui");
+  help_overlay = GTK_WINDOW (gtk_builder_get_object (builder, "help_overlay"));
+  gtk_window_set_transient_for (help_overlay, GTK_WINDOW (self));
+  gtk_window_present (help_overlay);
+}
+
 static void
 mkt_window_show_about (MktWindow *self)
 {
@@ -211,28 +248,145 @@ window_fullscreen_changed_cb (MktWindow *self)
 static void
 window_focus_changed_cb (MktWindow *self)
 {
-  gboolean has_focus;
+  GtkApplication *application;
+  GList *windows;
+  gboolean has_focus = FALSE;
 
   g_assert (MKT_IS_WINDOW (self));
 
-  has_focus = gtk_window_is_active (GTK_WINDOW (self));
+  application = gtk_window_get_application (GTK_WINDOW (self));
+
+  if (!application)
+    return;
+
+  windows = gtk_application_get_windows (application);
+
+  /*
+   * With a window per monitor, the focus is lost only if
+   * none of our windows is active.  Focus moving from one
+   * window to another shouldn't drop any key press.
+   */
+  for (GList *node = windows; node; node = node->next)
+    if (MKT_IS_WINDOW (node->data) && gtk_window_is_active (node->data))
+      has_focus = TRUE;
 
   mkt_controller_ignore_keypress (self->controller, !has_focus);
-  gtk_revealer_set_reveal_child (GTK_REVEALER (self->focus_revealer), !has_focus);
+
+  for (GList *node = windows; node; node = node->next)
+    {
+      MktWindow *window = node->data;
+
+      if (MKT_IS_WINDOW (window))
+        gtk_revealer_set_reveal_child (GTK_REVEALER (window->focus_revealer), !has_focus);
+    }
 }
 
 static void
-mkt_window_map (GtkWidget *widget)
+frame_clock_update_cb (MktWindow *self)
 {
-  GdkSurface *surface;
+  self->frame_start = g_get_monotonic_time ();
+}
 
-  GTK_WIDGET_CLASS (mkt_window_parent_class)->map (widget);
+static void
+frame_clock_after_paint_cb (MktWindow *self)
+{
+  gint64 duration;
 
-  surface = gtk_native_get_surface (GTK_NATIVE (widget));
-  g_signal_connect_object (surface,
-                           "notify::height",
-                           G_CALLBACK (window_update_terminal_style),
-                           widget, G_CONNECT_SWAPPED);
+  if (!self->frame_start)
+    return;
+
+  duration = g_get_monotonic_time () - self->frame_start;
+  self->frame_total += duration;
+  self->frame_max = MAX (self->frame_max, duration);
+  self->frame_count++;
+  self->frame_start = 0;
+}
+
+static gboolean
+window_update_hud (gpointer user_data)
+{
+  MktWindow *self = user_data;
+  g_autofree char *label = NULL;
+  double interval;
+  gint64 now;
+
+  g_assert (MKT_IS_WINDOW (self));
+
+  now = g_get_monotonic_time ();
+  interval = MAX (now - self->hud_time, 1) / (double)G_USEC_PER_SEC;
+
+  /* Only the frames actually drawn are counted, an idle window shows 0 */
+  label = mkt_utils_format_window_hud (self->frame_count / interval,
+                                       self->frame_count ? self->frame_total / 1000.0 / self->frame_count : 0.0,
+                                       self->frame_max / 1000.0);
+  gtk_label_set_text (GTK_LABEL (self->hud_label), label);
+
+  self->frame_total = 0;
+  self->frame_max = 0;
+  self->frame_count = 0;
+  self->hud_time = now;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+window_show_hud_changed_cb (MktWindow *self)
+{
+  gboolean show;
+
+  g_assert (MKT_IS_WINDOW (self));
+
+  show = self->settings && mkt_settings_get_show_performance_hud (self->settings);
+  gtk_widget_set_visible (self->hud_label, show);
+
+  if (!show || !self->frame_clock)
+    {
+      g_clear_handle_id (&self->hud_id, g_source_remove);
+
+      if (self->frame_clock)
+        g_signal_handlers_disconnect_by_data (self->frame_clock, self);
+      return;
+    }
+
+  if (self->hud_id)
+    return;
+
+  g_signal_connect_object (self->frame_clock, "update",
+                           G_CALLBACK (frame_clock_update_cb),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->frame_clock, "after-paint",
+                           G_CALLBACK (frame_clock_after_paint_cb),
+                           self, G_CONNECT_SWAPPED);
+
+  self->frame_start = 0;
+  self->hud_time = g_get_monotonic_time ();
+  self->hud_id = g_timeout_add (HUD_INTERVAL, window_update_hud, self);
+  window_update_hud (self);
+}
+
+static void
+mkt_window_realize (GtkWidget *widget)
+{
+  MktWindow *self = (MktWindow *)widget;
+
+  GTK_WIDGET_CLASS (mkt_window_parent_class)->realize (widget);
+
+  self->frame_clock = gtk_widget_get_frame_clock (widget);
+  window_show_hud_changed_cb (self);
+}
+
+static void
+mkt_window_unrealize (GtkWidget *widget)
+{
+  MktWindow *self = (MktWindow *)widget;
+
+  g_clear_handle_id (&self->hud_id, g_source_remove);
+
+  if (self->frame_clock)
+    g_signal_handlers_disconnect_by_data (self->frame_clock, self);
+  self->frame_clock = NULL;
+
+  GTK_WIDGET_CLASS (mkt_window_parent_class)->unrealize (widget);
 }
 
 static void
@@ -242,6 +396,7 @@ mkt_window_finalize (GObject *object)
 
   g_clear_object (&self->settings);
   g_clear_object (&self->controller);
+  g_clear_object (&self->keyboard_list);
 
   G_OBJECT_CLASS (mkt_window_parent_class)->finalize (object);
 }
@@ -254,7 +409,10 @@ mkt_window_class_init (MktWindowClass *klass)
 
   object_class->finalize = mkt_window_finalize;
 
-  widget_class->map = mkt_window_map;
+  widget_class->realize = mkt_window_realize;
+  widget_class->unrealize = mkt_window_unrealize;
+
+  g_type_ensure (MKT_TYPE_TERMINAL_GRID);
 
   gtk_widget_class_set_template_from_resource (widget_class,
                                                "/org/sadiqpk/multi-keyterm/"
@@ -263,6 +421,7 @@ mkt_window_class_init (MktWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, MktWindow, menu_button);
   gtk_widget_class_bind_template_child (widget_class, MktWindow, focus_revealer);
   gtk_widget_class_bind_template_child (widget_class, MktWindow, button_revealer);
+  gtk_widget_class_bind_template_child (widget_class, MktWindow, hud_label);
 
   gtk_widget_class_bind_template_child (widget_class, MktWindow, main_stack);
   gtk_widget_class_bind_template_child (widget_class, MktWindow, status_page);
@@ -273,19 +432,18 @@ mkt_window_class_init (MktWindowClass *klass)
   gtk_widget_class_bind_template_callback (widget_class, mkt_window_fullscreen_clicked_cb);
   gtk_widget_class_bind_template_callback (widget_class, mkt_window_show_preferences);
   gtk_widget_class_bind_template_callback (widget_class, mkt_window_show_about);
+
+  gtk_widget_class_install_action (widget_class, "win.show-help-overlay", NULL,
+                                   window_show_help_overlay_cb);
 }
 
 static void
 mkt_window_init (MktWindow *self)
 {
   GtkEventController *event_controller;
-  AdwStyleManager *style_manager;
 
   gtk_widget_init_template (GTK_WIDGET (self));
 
-  style_manager = adw_style_manager_get_default ();
-  adw_style_manager_set_color_scheme (style_manager, ADW_COLOR_SCHEME_FORCE_DARK);
-
   event_controller = gtk_event_controller_key_new ();
   gtk_widget_add_controller (GTK_WIDGET (self), event_controller);
   gtk_event_controller_set_propagation_phase (event_controller, GTK_PHASE_CAPTURE);
@@ -302,33 +460,49 @@ mkt_window_init (MktWindow *self)
                            G_CONNECT_SWAPPED);
 }
 
+/**
+ * mkt_window_new:
+ * @application: A #GtkApplication
+ * @settings: A #MktSettings
+ * @controller: A #MktController
+ * @keyboard_list: A #GListModel of #MktKeyboard
+ *
+ * Create a new window showing a terminal for each
+ * keyboard in @keyboard_list.  Several windows can
+ * share the same @controller, each showing a subset
+ * of its keyboards.
+ *
+ * Returns: (transfer floating): A #MktWindow
+ */
 GtkWidget *
 mkt_window_new (GtkApplication *application,
-                MktSettings    *settings)
+                MktSettings    *settings,
+                MktController  *controller,
+                GListModel     *keyboard_list)
 {
-  GListModel *keyboard_list;
   MktWindow *self;
 
   g_assert (GTK_IS_APPLICATION (application));
   g_assert (MKT_IS_SETTINGS (settings));
+  g_assert (MKT_IS_CONTROLLER (controller));
+  g_assert (G_IS_LIST_MODEL (keyboard_list));
 
   self = g_object_new (MKT_TYPE_WINDOW,
                        "application", application,
                        NULL);
   self->settings = g_object_ref (settings);
-  gtk_window_maximize (GTK_WINDOW (self));
+  self->controller = g_object_ref (controller);
+  self->keyboard_list = g_object_ref (keyboard_list);
 
-  self->controller = mkt_controller_new (settings);
   g_signal_connect_object (self->controller, "notify::failed",
                            G_CALLBACK (controller_failed_cb),
                            self, G_CONNECT_SWAPPED);
   controller_failed_cb (self);
 
-  keyboard_list = mkt_controller_get_keyboard_list (self->controller);
-  gtk_flow_box_bind_model (GTK_FLOW_BOX (self->terminal_grid),
-                           keyboard_list,
-                           (GtkFlowBoxCreateWidgetFunc)terminal_new,
-                           g_object_ref (self), g_object_unref);
+  mkt_terminal_grid_bind_model (MKT_TERMINAL_GRID (self->terminal_grid),
+                                keyboard_list,
+                                (MktTerminalGridCreateFunc)terminal_new,
+                                self, NULL);
   g_signal_connect_object (keyboard_list, "items-changed",
                            G_CALLBACK (keyboard_list_changed_cb),
                            self, G_CONNECT_SWAPPED);
@@ -342,11 +516,62 @@ mkt_window_new (GtkApplication *application,
                            "notify::minimum-terminal-height",
                            G_CALLBACK (window_update_terminal_style),
                            self, G_CONNECT_SWAPPED);
-  g_signal_connect_object (keyboard_list,
-                           "items-changed",
+  g_signal_connect_object (self->settings,
+                           "notify::expand-to-fit",
+                           G_CALLBACK (window_update_terminal_style),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "font-changed",
+                           G_CALLBACK (window_update_terminal_style),
+                           self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings, "notify::font-scale",
                            G_CALLBACK (window_update_terminal_style),
                            self, G_CONNECT_SWAPPED);
   window_update_terminal_style (self);
 
+  g_signal_connect_object (self->settings, "notify::show-performance-hud",
+                           G_CALLBACK (window_show_hud_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  window_show_hud_changed_cb (self);
+
   return GTK_WIDGET (self);
 }
+
+/**
+ * mkt_window_get_terminal:
+ * @self: A #MktWindow
+ * @keyboard: A #MktKeyboard
+ *
+ * Get the terminal of @keyboard shown in @self.
+ *
+ * Returns: (transfer none) (nullable): The #MktTerminal
+ */
+GtkWidget *
+mkt_window_get_terminal (MktWindow   *self,
+                         MktKeyboard *keyboard)
+{
+  g_return_val_if_fail (MKT_IS_WINDOW (self), NULL);
+  g_return_val_if_fail (MKT_IS_KEYBOARD (keyboard), NULL);
+
+  return mkt_terminal_grid_get_widget (MKT_TERMINAL_GRID (self->terminal_grid), keyboard);
+}
+
+/**
+ * mkt_window_reuse_terminal:
+ * @self: A #MktWindow
+ * @terminal: A #MktTerminal removed from another window
+ *
+ * Show @terminal once its keyboard is added to the
+ * keyboard list of @self, instead of creating a new
+ * terminal, so that its shell and scrollback are kept.
+ */
+void
+mkt_window_reuse_terminal (MktWindow *self,
+                           GtkWidget *terminal)
+{
+  g_return_if_fail (MKT_IS_WINDOW (self));
+  g_return_if_fail (MKT_IS_TERMINAL (terminal));
+
+  mkt_terminal_grid_reuse_widget (MKT_TERMINAL_GRID (self->terminal_grid),
+                                  mkt_terminal_get_keyboard (MKT_TERMINAL (terminal)),
+                                  terminal);
+}
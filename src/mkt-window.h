@@ -26,6 +26,7 @@
 
 #include <adwaita.h>
 
+#include "mkt-controller.h"
 #include "mkt-settings.h"
 
 G_BEGIN_DECLS
@@ -34,7 +35,13 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (MktWindow, mkt_window, MKT, WINDOW, AdwApplicationWindow)
 
-GtkWidget *mkt_window_new (GtkApplication *application,
-                           MktSettings    *settings);
+GtkWidget *mkt_window_new            (GtkApplication *application,
+                                      MktSettings    *settings,
+                                      MktController  *controller,
+                                      GListModel     *keyboard_list);
+GtkWidget *mkt_window_get_terminal   (MktWindow      *self,
+                                      MktKeyboard    *keyboard);
+void       mkt_window_reuse_terminal (MktWindow      *self,
+                                      GtkWidget      *terminal);
 
 G_END_DECLS
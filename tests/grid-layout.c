@@ -0,0 +1,133 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* grid-layout.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <gtk/gtk.h>
+
+#include "mkt-grid-layout.h"
+
+static void
+test_grid_layout_compute (void)
+{
+  guint rows, columns;
+
+  mkt_grid_layout_compute (0, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 0);
+  g_assert_cmpuint (columns, ==, 0);
+
+  mkt_grid_layout_compute (1, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 1);
+  g_assert_cmpuint (columns, ==, 1);
+
+  /* Side by side on a wide screen */
+  mkt_grid_layout_compute (2, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 1);
+  g_assert_cmpuint (columns, ==, 2);
+
+  /* But stacked on a tall one */
+  mkt_grid_layout_compute (2, 1080, 1920, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 2);
+  g_assert_cmpuint (columns, ==, 1);
+
+  mkt_grid_layout_compute (4, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 2);
+  g_assert_cmpuint (columns, ==, 2);
+
+  mkt_grid_layout_compute (9, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 3);
+  g_assert_cmpuint (columns, ==, 3);
+
+  mkt_grid_layout_compute (16, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 4);
+  g_assert_cmpuint (columns, ==, 4);
+
+  /* Never leave a full row empty */
+  for (guint n = 1; n <= 32; n++)
+    {
+      mkt_grid_layout_compute (n, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+      g_assert_cmpuint (rows * columns, >=, n);
+      g_assert_cmpuint ((rows - 1) * columns, <, n);
+    }
+}
+
+static void
+test_grid_layout_single_column (void)
+{
+  guint rows, columns;
+
+  mkt_grid_layout_compute (3, 1920, 1080, 240, 120, 1.6, 300, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 3);
+  g_assert_cmpuint (columns, ==, 1);
+
+  /* Doesn't fit, so fallback to the default tiling */
+  mkt_grid_layout_compute (4, 1920, 1080, 240, 120, 1.6, 300, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 2);
+  g_assert_cmpuint (columns, ==, 2);
+}
+
+static void
+test_grid_layout_min_cell_size (void)
+{
+  guint rows, columns;
+
+  /* 4×4 gives cells of 240×135, which is below the minimum height */
+  mkt_grid_layout_compute (16, 960, 540, 100, 200, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, <=, 2);
+  g_assert_cmpuint (rows * columns, >=, 16);
+}
+
+static void
+test_grid_layout_aspect_ratio (void)
+{
+  guint rows, columns;
+
+  /* Side by side cells of 960×1080 fit a wide terminal best */
+  mkt_grid_layout_compute (2, 1920, 1080, 240, 120, 1.6, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 1);
+  g_assert_cmpuint (columns, ==, 2);
+
+  /* But stacked cells of 1920×540 fit a terminal with a wider font better */
+  mkt_grid_layout_compute (2, 1920, 1080, 240, 120, 4.0, 0, &rows, &columns);
+  g_assert_cmpuint (rows, ==, 2);
+  g_assert_cmpuint (columns, ==, 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/grid-layout/compute", test_grid_layout_compute);
+  g_test_add_func ("/grid-layout/single_column", test_grid_layout_single_column);
+  g_test_add_func ("/grid-layout/min_cell_size", test_grid_layout_min_cell_size);
+  g_test_add_func ("/grid-layout/aspect_ratio", test_grid_layout_aspect_ratio);
+
+  return g_test_run ();
+}
@@ -0,0 +1,313 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* idle-terminals.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Idle terminal scalability benchmark.
+ *
+ * Grows the keyboard list of a MktWindow one virtual keyboard
+ * at a time and, at each step, records the resident memory and
+ * open file descriptors of the process along with the frame
+ * interval and layout time of the window.  Each step is printed
+ * as a JSON object in a line of its own, and a summary with the
+ * average cost per terminal is printed last.  Like the output
+ * benchmark, this requires a display, which can be a headless
+ * compositor.
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <stdio.h>
+#include <unistd.h>
+#include <adwaita.h>
+
+#include "mkt-controller.h"
+#include "mkt-keyboard.h"
+#include "mkt-settings.h"
+#include "mkt-window.h"
+#include "mkt-log.h"
+
+#define SETTLE_TIME  500  /* ms */
+#define MEASURE_TIME 1000 /* ms */
+
+typedef struct
+{
+  GArray  *frame_times;
+  GArray  *layout_times;
+  gint64   last_frame;
+  gint64   update_end;
+} FrameStats;
+
+static int max_terminals = 32;
+
+static GOptionEntry bench_options[] = {
+  { "max-terminals", 'n', 0, G_OPTION_ARG_INT, &max_terminals,
+    "Maximum number of terminals to open (default: 32)", "N" },
+  { NULL }
+};
+
+static gsize
+get_rss (void)
+{
+  g_autofree char *content = NULL;
+  gulong size = 0, resident = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &content, NULL, NULL))
+    return 0;
+
+  if (sscanf (content, "%lu %lu", &size, &resident) != 2)
+    return 0;
+
+  return (gsize)resident * sysconf (_SC_PAGESIZE);
+}
+
+static guint
+get_fd_count (void)
+{
+  g_autoptr(GDir) dir = NULL;
+  guint count = 0;
+
+  dir = g_dir_open ("/proc/self/fd", 0, NULL);
+
+  if (!dir)
+    return 0;
+
+  while (g_dir_read_name (dir))
+    count++;
+
+  /* Don't count the fd used to read the directory itself */
+  return count ? count - 1 : 0;
+}
+
+static void
+run_main_loop_for (guint timeout)
+{
+  gint64 end;
+
+  end = g_get_monotonic_time () + timeout * 1000;
+
+  while (g_get_monotonic_time () < end)
+    {
+      while (g_main_context_pending (NULL))
+        g_main_context_iteration (NULL, FALSE);
+
+      g_usleep (1000);
+    }
+}
+
+static double
+get_mean_ms (GArray *array)
+{
+  double mean = 0.0;
+
+  for (guint i = 0; i < array->len; i++)
+    mean += g_array_index (array, gint64, i) / 1000.0 / array->len;
+
+  return mean;
+}
+
+static double
+get_max_ms (GArray *array)
+{
+  gint64 max = 0;
+
+  for (guint i = 0; i < array->len; i++)
+    max = MAX (max, g_array_index (array, gint64, i));
+
+  return max / 1000.0;
+}
+
+static void
+frame_clock_update_cb (GdkFrameClock *frame_clock,
+                       FrameStats    *stats)
+{
+  stats->update_end = g_get_monotonic_time ();
+}
+
+static void
+frame_clock_layout_cb (GdkFrameClock *frame_clock,
+                       FrameStats    *stats)
+{
+  gint64 layout_time;
+
+  /*
+   * We are connected after GTK, so this is run after GTK
+   * has allocated every widget.  The time since the end
+   * of the update phase is the time spent on layout.
+   */
+  if (!stats->update_end)
+    return;
+
+  layout_time = g_get_monotonic_time () - stats->update_end;
+  g_array_append_val (stats->layout_times, layout_time);
+  stats->update_end = 0;
+}
+
+static gboolean
+bench_tick_cb (GtkWidget     *widget,
+               GdkFrameClock *frame_clock,
+               gpointer       user_data)
+{
+  FrameStats *stats = user_data;
+  gint64 frame_time;
+
+  frame_time = gdk_frame_clock_get_frame_time (frame_clock);
+
+  if (stats->last_frame)
+    {
+      gint64 delta = frame_time - stats->last_frame;
+
+      g_array_append_val (stats->frame_times, delta);
+    }
+
+  stats->last_frame = frame_time;
+
+  /* Force a full relayout on every frame */
+  gtk_widget_queue_resize (widget);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+bench_activate_cb (GApplication *application,
+                   MktSettings  *settings)
+{
+  g_autoptr(MktController) controller = NULL;
+  g_autoptr(GPtrArray) keyboards = NULL;
+  GdkFrameClock *frame_clock;
+  GtkWidget *window;
+  FrameStats stats = { 0 };
+  gsize base_rss;
+  guint base_fds;
+
+  g_application_hold (application);
+
+  controller = mkt_controller_new (settings);
+  window = mkt_window_new (GTK_APPLICATION (application), settings, controller,
+                           mkt_controller_get_keyboard_list (controller));
+  gtk_window_maximize (GTK_WINDOW (window));
+  gtk_window_present (GTK_WINDOW (window));
+
+  while (!gtk_widget_get_mapped (window))
+    g_main_context_iteration (NULL, TRUE);
+
+  frame_clock = gtk_widget_get_frame_clock (window);
+  keyboards = g_ptr_array_new_with_free_func (g_object_unref);
+  stats.frame_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  stats.layout_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  g_signal_connect (frame_clock, "update",
+                    G_CALLBACK (frame_clock_update_cb), &stats);
+  g_signal_connect (frame_clock, "layout",
+                    G_CALLBACK (frame_clock_layout_cb), &stats);
+
+  run_main_loop_for (SETTLE_TIME);
+  base_rss = get_rss ();
+  base_fds = get_fd_count ();
+
+  for (int i = 1; i <= max_terminals; i++)
+    {
+      MktKeyboard *keyboard;
+      guint tick_id;
+
+      keyboard = mkt_keyboard_new_virtual ();
+      g_ptr_array_add (keyboards, keyboard);
+      mkt_controller_add_keyboard (controller, keyboard);
+      mkt_keyboard_set_enabled (keyboard, TRUE);
+
+      /* Let the shell start and the window settle */
+      run_main_loop_for (SETTLE_TIME);
+
+      g_array_set_size (stats.frame_times, 0);
+      g_array_set_size (stats.layout_times, 0);
+      stats.last_frame = 0;
+      stats.update_end = 0;
+
+      tick_id = gtk_widget_add_tick_callback (window, bench_tick_cb, &stats, NULL);
+      run_main_loop_for (MEASURE_TIME);
+      gtk_widget_remove_tick_callback (window, tick_id);
+
+      g_print ("{\"benchmark\": \"idle-terminals\", \"terminals\": %d, "
+               "\"rss_bytes\": %" G_GSIZE_FORMAT ", \"fd_count\": %u, \"frames\": %u, "
+               "\"frame_time_mean_ms\": %.2f, \"frame_time_max_ms\": %.2f, "
+               "\"layout_time_mean_ms\": %.3f, \"layout_time_max_ms\": %.3f}\n",
+               i, get_rss (), get_fd_count (), stats.frame_times->len,
+               get_mean_ms (stats.frame_times), get_max_ms (stats.frame_times),
+               get_mean_ms (stats.layout_times), get_max_ms (stats.layout_times));
+    }
+
+  if (max_terminals > 0)
+    g_print ("{\"benchmark\": \"idle-terminals-summary\", \"terminals\": %d, "
+             "\"base_rss_bytes\": %" G_GSIZE_FORMAT ", \"base_fd_count\": %u, "
+             "\"rss_bytes_per_terminal\": %.0f, \"fds_per_terminal\": %.2f}\n",
+             max_terminals, base_rss, base_fds,
+             ((double)get_rss () - base_rss) / max_terminals,
+             ((double)get_fd_count () - base_fds) / max_terminals);
+
+  g_signal_handlers_disconnect_by_data (frame_clock, &stats);
+  g_array_unref (stats.frame_times);
+  g_array_unref (stats.layout_times);
+
+  gtk_window_destroy (GTK_WINDOW (window));
+  g_application_release (application);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(AdwApplication) application = NULL;
+  g_autoptr(MktSettings) settings = NULL;
+  g_autoptr(GError) error = NULL;
+
+  context = g_option_context_new ("- benchmark idle terminal cost");
+  g_option_context_add_main_entries (context, bench_options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  mkt_log_init ();
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  if (!gtk_init_check ())
+    {
+      g_printerr ("No display found, skipping benchmark\n");
+      return 77;
+    }
+
+  settings = mkt_settings_new ();
+  application = adw_application_new ("org.sadiqpk.multi-keyterm.IdleBenchmark",
+                                     G_APPLICATION_NON_UNIQUE);
+  g_signal_connect (application, "activate",
+                    G_CALLBACK (bench_activate_cb), settings);
+
+  return g_application_run (G_APPLICATION (application), 0, NULL);
+}
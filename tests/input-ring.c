@@ -0,0 +1,215 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* input-ring.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <gio/gio.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "mkt-input-ring.h"
+#include "mkt-log.h"
+
+#define N_SLOTS  16
+#define N_EVENTS 100000
+
+static MktInputRing *
+create_consumer (MktInputRing *producer)
+{
+  g_autoptr(GError) error = NULL;
+  MktInputRing *consumer;
+
+  consumer = mkt_input_ring_new_from_fds (dup (mkt_input_ring_get_memfd (producer)),
+                                          dup (mkt_input_ring_get_eventfd (producer)),
+                                          &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (consumer);
+
+  return consumer;
+}
+
+static gboolean
+eventfd_is_readable (MktInputRing *ring)
+{
+  struct pollfd pfd = { .fd = mkt_input_ring_get_eventfd (ring), .events = POLLIN };
+
+  return poll (&pfd, 1, 0) == 1;
+}
+
+static void
+test_input_ring_push_pop (void)
+{
+  g_autoptr(MktInputRing) producer = NULL;
+  g_autoptr(MktInputRing) consumer = NULL;
+  g_autoptr(GError) error = NULL;
+  MktInputEvent event = { 0 };
+
+  producer = mkt_input_ring_new (N_SLOTS, &error);
+  g_assert_no_error (error);
+  consumer = create_consumer (producer);
+
+  g_assert_false (mkt_input_ring_pop (consumer, &event));
+  g_assert_cmpuint (mkt_input_ring_get_n_free (producer), ==, N_SLOTS);
+
+  event.type = MKT_INPUT_EVENT_KEY;
+
+  for (guint i = 0; i < N_SLOTS; i++)
+    {
+      event.key = i;
+      g_assert_true (mkt_input_ring_push (producer, &event));
+    }
+
+  /* Full */
+  g_assert_cmpuint (mkt_input_ring_get_n_free (producer), ==, 0);
+  g_assert_false (mkt_input_ring_push (producer, &event));
+  mkt_input_ring_add_dropped (producer);
+  g_assert_cmpuint (mkt_input_ring_get_dropped (consumer), ==, 1);
+
+  for (guint i = 0; i < N_SLOTS; i++)
+    {
+      g_assert_true (mkt_input_ring_pop (consumer, &event));
+      g_assert_cmpuint (event.type, ==, MKT_INPUT_EVENT_KEY);
+      g_assert_cmpuint (event.key, ==, i);
+    }
+
+  g_assert_false (mkt_input_ring_pop (consumer, &event));
+  g_assert_cmpuint (mkt_input_ring_get_n_free (producer), ==, N_SLOTS);
+}
+
+static void
+test_input_ring_wakeup (void)
+{
+  g_autoptr(MktInputRing) producer = NULL;
+  g_autoptr(MktInputRing) consumer = NULL;
+  g_autoptr(GError) error = NULL;
+  MktInputEvent event = { 0 };
+
+  producer = mkt_input_ring_new (N_SLOTS, &error);
+  g_assert_no_error (error);
+  consumer = create_consumer (producer);
+
+  /* The consumer isn't waiting, so no wake up is needed */
+  g_assert_true (mkt_input_ring_push (producer, &event));
+  g_assert_false (eventfd_is_readable (consumer));
+
+  /* Events pending, so the consumer shall not wait */
+  g_assert_false (mkt_input_ring_prepare_wait (consumer));
+  g_assert_true (mkt_input_ring_pop (consumer, &event));
+  g_assert_true (mkt_input_ring_prepare_wait (consumer));
+  g_assert_false (eventfd_is_readable (consumer));
+
+  /* Only the first event after waiting wakes up */
+  g_assert_true (mkt_input_ring_push (producer, &event));
+  g_assert_true (eventfd_is_readable (consumer));
+  g_assert_true (mkt_input_ring_push (producer, &event));
+
+  g_assert_true (mkt_input_ring_pop (consumer, &event));
+  g_assert_true (mkt_input_ring_pop (consumer, &event));
+  g_assert_true (mkt_input_ring_prepare_wait (consumer));
+  g_assert_false (eventfd_is_readable (consumer));
+}
+
+static gpointer
+producer_thread (gpointer user_data)
+{
+  MktInputRing *producer = user_data;
+  MktInputEvent event = { 0 };
+
+  for (guint i = 0; i < N_EVENTS; i++)
+    {
+      event.key = i;
+
+      while (!mkt_input_ring_push (producer, &event))
+        g_thread_yield ();
+    }
+
+  return NULL;
+}
+
+static void
+test_input_ring_thread (void)
+{
+  g_autoptr(MktInputRing) producer = NULL;
+  g_autoptr(MktInputRing) consumer = NULL;
+  g_autoptr(GError) error = NULL;
+  MktInputEvent event;
+  GThread *thread;
+  guint n_events = 0;
+
+  producer = mkt_input_ring_new (N_SLOTS, &error);
+  g_assert_no_error (error);
+  consumer = create_consumer (producer);
+  thread = g_thread_new ("producer", producer_thread, producer);
+
+  while (n_events < N_EVENTS)
+    {
+      while (mkt_input_ring_pop (consumer, &event))
+        g_assert_cmpuint (event.key, ==, n_events++);
+
+      /* Never sleep forever, so that a lost wake up fails the test */
+      if (n_events < N_EVENTS && mkt_input_ring_prepare_wait (consumer))
+        {
+          struct pollfd pfd = { .fd = mkt_input_ring_get_eventfd (consumer), .events = POLLIN };
+
+          g_assert_cmpint (poll (&pfd, 1, 5000), ==, 1);
+        }
+    }
+
+  g_thread_join (thread);
+  g_assert_false (mkt_input_ring_pop (consumer, &event));
+}
+
+static void
+test_input_ring_invalid (void)
+{
+  g_autoptr(MktInputRing) ring = NULL;
+  g_autoptr(GError) error = NULL;
+  int fds[2];
+
+  /* A pipe is not a sealed memfd */
+  g_assert_cmpint (pipe (fds), ==, 0);
+  ring = mkt_input_ring_new_from_fds (fds[0], fds[1], &error);
+  g_assert_null (ring);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  mkt_log_init ();
+
+  g_test_add_func ("/input-ring/push_pop", test_input_ring_push_pop);
+  g_test_add_func ("/input-ring/wakeup", test_input_ring_wakeup);
+  g_test_add_func ("/input-ring/thread", test_input_ring_thread);
+  g_test_add_func ("/input-ring/invalid", test_input_ring_invalid);
+
+  return g_test_run ();
+}
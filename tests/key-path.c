@@ -0,0 +1,314 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* key-path.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Key path allocation test.
+ *
+ * Acts as the input broker of a MktController, and replays a
+ * long typing session through the shared input ring, so that
+ * each key goes through the controller, the keyboard and the
+ * terminal like a real one.  After a warm up, no allocation
+ * should be done in any of them, nor anywhere else in the main
+ * thread.  The terminal runs a command that doesn't echo, as
+ * drawing the output is not part of the key path, see the
+ * terminal-output benchmark for that.  Allocations of other
+ * threads are only reported.  This is built only with
+ * alloc_accounting enabled, and requires a display, which can
+ * be a headless compositor.
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "mkt-alloc.h"
+#include "mkt-controller.h"
+#include "mkt-input-ring.h"
+#include "mkt-keyboard.h"
+#include "mkt-settings.h"
+#include "mkt-terminal.h"
+#include "mkt-utils.h"
+#include "mkt-log.h"
+
+#define RING_SLOTS    256
+#define DEVICE        1
+#define SETTLE_TIME   500   /* ms */
+#define N_WARMUP_RUNS 50
+#define N_RUNS        2000
+
+/* From linux/input-event-codes.h */
+#define KEY_BACKSPACE 14
+#define KEY_W         17
+#define KEY_E         18
+#define KEY_R         19
+#define KEY_O         24
+#define KEY_ENTER     28
+#define KEY_D         32
+#define KEY_H         35
+#define KEY_L         38
+#define KEY_LEFTSHIFT 42
+#define KEY_SPACE     57
+
+/* "Hello world!", with a typo fixed, and Enter */
+static const guint32 typing_keys[] = {
+  KEY_H, KEY_E, KEY_L, KEY_L, KEY_O, KEY_SPACE,
+  KEY_W, KEY_O, KEY_R, KEY_R, KEY_BACKSPACE, KEY_L, KEY_D,
+  KEY_ENTER,
+};
+
+typedef struct
+{
+  GSocketListener *listener;
+  MktInputRing    *ring;
+} Broker;
+
+static gboolean have_display;
+
+static gpointer
+broker_accept_thread (gpointer user_data)
+{
+  Broker *broker = user_data;
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GError) error = NULL;
+
+  connection = g_socket_listener_accept (broker->listener, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  g_unix_connection_send_fd (G_UNIX_CONNECTION (connection),
+                             mkt_input_ring_get_memfd (broker->ring), NULL, &error);
+  g_assert_no_error (error);
+  g_unix_connection_send_fd (G_UNIX_CONNECTION (connection),
+                             mkt_input_ring_get_eventfd (broker->ring), NULL, &error);
+  g_assert_no_error (error);
+
+  /* Keep it open, the controller sends LED updates over it */
+  return g_steal_pointer (&connection);
+}
+
+static void
+run_main_loop_for (guint timeout)
+{
+  gint64 end;
+
+  end = g_get_monotonic_time () + timeout * 1000;
+
+  while (g_get_monotonic_time () < end)
+    {
+      while (g_main_context_pending (NULL))
+        g_main_context_iteration (NULL, FALSE);
+
+      g_usleep (1000);
+    }
+}
+
+static void
+push_event (MktInputRing *ring,
+            guint32       type,
+            guint32       key,
+            gboolean      pressed)
+{
+  MktInputEvent event = { 0 };
+
+  event.type = type;
+  event.device = DEVICE;
+  event.key = key;
+  event.pressed = pressed;
+  event.time = g_get_monotonic_time ();
+
+  if (type == MKT_INPUT_EVENT_DEVICE_ADDED)
+    g_strlcpy (event.id, "key-path-test", sizeof event.id);
+
+  /* Let the controller drain the ring when full */
+  while (!mkt_input_ring_push (ring, &event))
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+wait_for_ring (MktInputRing *ring)
+{
+  while (mkt_input_ring_get_n_free (ring) < RING_SLOTS)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+type_keys (MktInputRing *ring,
+           guint         n_runs)
+{
+  for (guint run = 0; run < n_runs; run++)
+    {
+      push_event (ring, MKT_INPUT_EVENT_KEY, KEY_LEFTSHIFT, TRUE);
+      push_event (ring, MKT_INPUT_EVENT_KEY, typing_keys[0], TRUE);
+      push_event (ring, MKT_INPUT_EVENT_KEY, typing_keys[0], FALSE);
+      push_event (ring, MKT_INPUT_EVENT_KEY, KEY_LEFTSHIFT, FALSE);
+
+      for (guint i = 1; i < G_N_ELEMENTS (typing_keys); i++)
+        {
+          push_event (ring, MKT_INPUT_EVENT_KEY, typing_keys[i], TRUE);
+          push_event (ring, MKT_INPUT_EVENT_KEY, typing_keys[i], FALSE);
+        }
+    }
+
+  wait_for_ring (ring);
+}
+
+static void
+test_key_path_allocations (void)
+{
+  g_autoptr(MktController) controller = NULL;
+  g_autoptr(MktSettings) settings = NULL;
+  g_autoptr(GSocketListener) listener = NULL;
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(MktInputRing) ring = NULL;
+  g_autoptr(GSettings) gsettings = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *socket_path = NULL;
+  g_autofree char *dir = NULL;
+  MktAllocCounter before[MKT_ALLOC_N_SCOPES], after[MKT_ALLOC_N_SCOPES];
+  MktAllocCounter thread_before, thread_after;
+  const MktKeyboardStats *stats;
+  MktKeyboardProfile profile = { 0 };
+  Broker broker = { 0 };
+  MktKeyboard *keyboard;
+  GtkWidget *terminal;
+  GThread *thread;
+  guint64 events, n_keys;
+
+  if (!have_display)
+    {
+      g_test_skip ("No display found");
+      return;
+    }
+
+  gsettings = g_settings_new ("org.sadiqpk.multi-keyterm");
+  /* Replayed keys are way faster than humans type */
+  g_settings_set_uint (gsettings, "key-rate-limit", 0);
+  g_settings_set_boolean (gsettings, "isolate-terminals", FALSE);
+
+  settings = mkt_settings_new ();
+  profile.slot = 1;
+  profile.zoom = 1.0;
+  /* Only the keys are measured, so nothing is written back */
+  profile.command = (char *)"sh -c 'stty -echo; exec cat > /dev/null'";
+  mkt_settings_set_keyboard_profile (settings, "key-path-test", &profile);
+
+  ring = mkt_input_ring_new (RING_SLOTS, &error);
+  g_assert_no_error (error);
+
+  dir = g_dir_make_tmp ("mkt-key-path-XXXXXX", &error);
+  g_assert_no_error (error);
+  socket_path = g_build_filename (dir, "broker", NULL);
+  address = g_unix_socket_address_new (socket_path);
+  listener = g_socket_listener_new ();
+  g_socket_listener_add_address (listener, address,
+                                 G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                 NULL, NULL, &error);
+  g_assert_no_error (error);
+  broker.listener = listener;
+  broker.ring = ring;
+
+  /* The controller blocks until the ring is received */
+  thread = g_thread_new ("broker", broker_accept_thread, &broker);
+  controller = mkt_controller_new_for_broker (settings, socket_path);
+  connection = g_thread_join (thread);
+  g_assert_true (mkt_controller_get_ready (controller));
+  g_assert_null (mkt_controller_get_error (controller));
+
+  /* The keyboard is restored to slot 1 from its profile */
+  push_event (ring, MKT_INPUT_EVENT_DEVICE_ADDED, 0, FALSE);
+  wait_for_ring (ring);
+  keyboard = mkt_controller_get_keyboard_for_slot (controller, 1);
+  g_assert_nonnull (keyboard);
+  g_assert_true (mkt_keyboard_get_enabled (keyboard));
+
+  terminal = g_object_ref_sink (mkt_terminal_new (controller, settings, keyboard));
+  run_main_loop_for (SETTLE_TIME);
+
+  /* Let buffers and caches grow to their steady state size */
+  type_keys (ring, N_WARMUP_RUNS);
+  run_main_loop_for (SETTLE_TIME);
+
+  stats = mkt_keyboard_get_stats (keyboard);
+  events = stats->events;
+  n_keys = (G_N_ELEMENTS (typing_keys) + 1) * 2 * N_RUNS;
+
+  mkt_alloc_get_thread_counter (&thread_before);
+  mkt_alloc_get_counters (before);
+  type_keys (ring, N_RUNS);
+  mkt_alloc_get_counters (after);
+  mkt_alloc_get_thread_counter (&thread_after);
+
+  /* Every key went all the way through */
+  g_assert_cmpuint (stats->events - events, ==, n_keys);
+
+  /* Not checked, other threads like the GDBus worker are not on the key path */
+  g_test_message ("%" G_GUINT64_FORMAT " key events, %" G_GUINT64_FORMAT
+                  " allocations in other threads",
+                  n_keys,
+                  after[MKT_ALLOC_SCOPE_NONE].allocs - before[MKT_ALLOC_SCOPE_NONE].allocs -
+                  (thread_after.allocs - thread_before.allocs));
+
+  /* Anything else the main thread did is part of the key path too, eg: the main loop */
+  g_test_message ("Main thread outside of the scopes: %" G_GUINT64_FORMAT " allocations, %"
+                  G_GUINT64_FORMAT " bytes",
+                  thread_after.allocs - thread_before.allocs,
+                  thread_after.bytes - thread_before.bytes);
+  g_assert_cmpuint (thread_after.allocs - thread_before.allocs, ==, 0);
+
+  for (guint i = MKT_ALLOC_SCOPE_NONE + 1; i < MKT_ALLOC_N_SCOPES; i++)
+    {
+      g_test_message ("Scope %u: %" G_GUINT64_FORMAT " allocations, %" G_GUINT64_FORMAT " bytes",
+                      i, after[i].allocs - before[i].allocs, after[i].bytes - before[i].bytes);
+      g_assert_cmpuint (after[i].allocs - before[i].allocs, ==, 0);
+    }
+
+  g_object_unref (terminal);
+  g_clear_object (&controller);
+  g_socket_listener_close (listener);
+  g_unlink (socket_path);
+  g_rmdir (dir);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  mkt_log_init ();
+  mkt_utils_get_main_thread ();
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+  have_display = gtk_init_check ();
+
+  g_test_add_func ("/key-path/allocations", test_key_path_allocations);
+
+  return g_test_run ();
+}
@@ -0,0 +1,386 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* keyboard.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <glib.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-keyboard.h"
+#include "mkt-log.h"
+
+/* From linux/input-event-codes.h */
+#define KEY_A         30
+#define KEY_LEFTSHIFT 42
+
+static void
+test_keyboard_stats (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  const MktKeyboardStats *stats;
+  guint64 events, n_latency = 0;
+
+  keyboard = mkt_keyboard_new_virtual ();
+  stats = mkt_keyboard_get_stats (keyboard);
+  g_assert_nonnull (stats);
+  /* Setting Num Lock on creation feeds keys too */
+  events = stats->events;
+
+  mkt_keyboard_set_event_time (keyboard, g_get_monotonic_time () - 1000);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  mkt_keyboard_add_written (keyboard, 1);
+  /* Only the first write of an event is used for latency */
+  mkt_keyboard_add_written (keyboard, 3);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  mkt_keyboard_count_dropped (keyboard);
+  mkt_keyboard_add_read (keyboard, 5);
+  mkt_keyboard_count_shell_exit (keyboard);
+
+  g_assert_cmpuint (stats->events, ==, events + 2);
+  g_assert_cmpuint (stats->dropped, ==, 1);
+  g_assert_cmpuint (stats->bytes_written, ==, 4);
+  g_assert_cmpuint (stats->bytes_read, ==, 5);
+  g_assert_cmpuint (stats->shell_exits, ==, 1);
+  g_assert_cmpuint (stats->latency_sum, >=, 1000);
+
+  for (guint i = 0; i < MKT_KEYBOARD_LATENCY_BUCKETS; i++)
+    n_latency += stats->latency[i];
+
+  g_assert_cmpuint (n_latency, ==, 1);
+  /* At least 1000µs has passed since the event */
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (stats, 0.5), >=, 1024);
+}
+
+static void
+key_func_cb (MktKeyboard          *keyboard,
+             const MktKeyboardKey *keys,
+             guint                 n_keys,
+             gpointer              user_data)
+{
+  GArray *batches = user_data;
+
+  for (guint i = 0; i < n_keys; i++)
+    g_assert_cmpuint (keys[i].keyval, ==, GDK_KEY_a);
+
+  g_array_append_val (batches, n_keys);
+  /* Keep the pressed state of the last key */
+  g_array_append_val (batches, keys[n_keys - 1].pressed);
+}
+
+static void
+test_keyboard_key_func (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  g_autoptr(GArray) batches = NULL;
+  int other;
+
+  keyboard = mkt_keyboard_new_virtual ();
+  batches = g_array_new (FALSE, FALSE, sizeof (guint));
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  mkt_keyboard_set_key_func (keyboard, key_func_cb, batches);
+
+  /* Each key is passed right away */
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (batches->len, ==, 4);
+  g_assert_cmpuint (g_array_index (batches, guint, 0), ==, 1);
+  g_assert_true (g_array_index (batches, guint, 1));
+  g_assert_cmpuint (g_array_index (batches, guint, 2), ==, 1);
+  g_assert_false (g_array_index (batches, guint, 3));
+  g_array_set_size (batches, 0);
+
+  /* Keys are held back until thawed */
+  mkt_keyboard_freeze_keys (keyboard);
+  for (guint i = 0; i < 3; i++)
+    {
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+    }
+  g_assert_cmpuint (batches->len, ==, 0);
+  mkt_keyboard_thaw_keys (keyboard);
+  g_assert_cmpuint (batches->len, ==, 2);
+  g_assert_cmpuint (g_array_index (batches, guint, 0), ==, 6);
+  g_array_set_size (batches, 0);
+
+  /* A full batch is passed even if frozen */
+  mkt_keyboard_freeze_keys (keyboard);
+  for (guint i = 0; i < MKT_KEYBOARD_KEY_BATCH / 2 + 1; i++)
+    {
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+    }
+  g_assert_cmpuint (batches->len, ==, 2);
+  g_assert_cmpuint (g_array_index (batches, guint, 0), ==, MKT_KEYBOARD_KEY_BATCH);
+  mkt_keyboard_thaw_keys (keyboard);
+  g_assert_cmpuint (batches->len, ==, 4);
+  g_assert_cmpuint (g_array_index (batches, guint, 2), ==, 2);
+  g_array_set_size (batches, 0);
+
+  /* Only the consumer that set the function can unset it */
+  mkt_keyboard_unset_key_func (keyboard, &other);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  g_assert_cmpuint (batches->len, ==, 2);
+  mkt_keyboard_unset_key_func (keyboard, batches);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (batches->len, ==, 2);
+}
+
+static void
+count_keys_cb (MktKeyboard          *keyboard,
+               const MktKeyboardKey *keys,
+               guint                 n_keys,
+               gpointer              user_data)
+{
+  guint *n_pressed = user_data;
+
+  for (guint i = 0; i < n_keys; i++)
+    if (keys[i].pressed)
+      (*n_pressed)++;
+}
+
+static void
+test_keyboard_rate_limit (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  const MktKeyboardStats *stats;
+  guint n_pressed = 0;
+  guint64 events;
+
+  keyboard = mkt_keyboard_new_virtual ();
+  stats = mkt_keyboard_get_stats (keyboard);
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  mkt_keyboard_set_key_func (keyboard, count_keys_cb, &n_pressed);
+  mkt_keyboard_set_rate_limit (keyboard, 1, 2);
+  events = stats->events;
+
+  /* Only the burst is accepted at once */
+  for (guint i = 0; i < 4; i++)
+    {
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+    }
+
+  g_assert_cmpuint (n_pressed, ==, 2);
+  g_assert_cmpuint (stats->limited, ==, 2);
+  /* The releases of dropped presses are dropped too */
+  g_assert_cmpuint (stats->events, ==, events + 4);
+
+  mkt_keyboard_set_rate_limit (keyboard, 0, 0);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (n_pressed, ==, 3);
+  g_assert_cmpuint (stats->events, ==, events + 6);
+}
+
+static void
+test_keyboard_stuck_key (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  const MktKeyboardStats *stats;
+  guint n_pressed = 0;
+  guint64 events;
+  gint64 end;
+
+  keyboard = mkt_keyboard_new_virtual ();
+  stats = mkt_keyboard_get_stats (keyboard);
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  mkt_keyboard_set_key_func (keyboard, count_keys_cb, &n_pressed);
+  mkt_keyboard_set_stuck_timeout (keyboard, 1);
+
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  end = g_get_monotonic_time () + 3 * G_USEC_PER_SEC;
+
+  while (!stats->stuck_releases && g_get_monotonic_time () < end)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (stats->stuck_releases, ==, 1);
+  g_assert_cmpuint (stats->repeats, >, 0);
+
+  /* The key no longer repeats, and the late release is dropped */
+  n_pressed = 0;
+  events = stats->events;
+  g_usleep (100 * 1000);
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (n_pressed, ==, 0);
+  g_assert_cmpuint (stats->events, ==, events);
+}
+
+static void
+last_key_cb (MktKeyboard          *keyboard,
+             const MktKeyboardKey *keys,
+             guint                 n_keys,
+             gpointer              user_data)
+{
+  MktKeyboardKey *last_key = user_data;
+
+  *last_key = keys[n_keys - 1];
+}
+
+static void
+test_keyboard_stuck_modifier (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  const MktKeyboardStats *stats;
+  MktKeyboardKey last_key = { 0 };
+  guint64 events;
+  gint64 end;
+
+  keyboard = mkt_keyboard_new_virtual ();
+  stats = mkt_keyboard_get_stats (keyboard);
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  mkt_keyboard_set_key_func (keyboard, last_key_cb, &last_key);
+  mkt_keyboard_set_stuck_timeout (keyboard, 1);
+
+  /* Modifiers don't repeat, they are released all the same */
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_LEFTSHIFT);
+  end = g_get_monotonic_time () + 3 * G_USEC_PER_SEC;
+
+  while (!stats->stuck_releases && g_get_monotonic_time () < end)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (stats->stuck_releases, ==, 1);
+  g_assert_cmpuint (stats->repeats, ==, 0);
+
+  /* Keys typed after are no longer shifted */
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  g_assert_cmpuint (last_key.keyval, ==, GDK_KEY_a);
+  g_assert_false (last_key.modifier & GDK_SHIFT_MASK);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+
+  /* And the late release is dropped */
+  events = stats->events;
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_LEFTSHIFT);
+  g_assert_cmpuint (stats->events, ==, events);
+}
+
+static void
+connected_notify_cb (MktKeyboard *keyboard,
+                     GParamSpec  *pspec,
+                     guint       *count)
+{
+  (*count)++;
+}
+
+static void
+test_keyboard_connected (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  guint count = 0;
+
+  keyboard = mkt_keyboard_new_remote ("pci-0000:00:14.0-usb-0:1:1.0");
+  g_signal_connect (keyboard, "notify::connected",
+                    G_CALLBACK (connected_notify_cb), &count);
+  g_assert_true (mkt_keyboard_get_connected (keyboard));
+
+  mkt_keyboard_set_connected (keyboard, FALSE);
+  g_assert_false (mkt_keyboard_get_connected (keyboard));
+  g_assert_cmpuint (count, ==, 1);
+
+  /* Setting the same value doesn't notify */
+  mkt_keyboard_set_connected (keyboard, FALSE);
+  g_assert_cmpuint (count, ==, 1);
+
+  /* The id is kept without a device, so the device can be matched on return */
+  mkt_keyboard_set_device (keyboard, NULL);
+  g_assert_cmpstr (mkt_keyboard_get_id (keyboard), ==, "pci-0000:00:14.0-usb-0:1:1.0");
+
+  mkt_keyboard_set_connected (keyboard, TRUE);
+  g_assert_true (mkt_keyboard_get_connected (keyboard));
+  g_assert_cmpuint (count, ==, 2);
+}
+
+static void
+test_keyboard_latency_percentile (void)
+{
+  MktKeyboardStats stats = { 0 };
+
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.5), ==, 0);
+
+  /* 90 events within 16µs, 9 within 256µs and 1 within 4096µs */
+  stats.latency[4] = 90;
+  stats.latency[8] = 9;
+  stats.latency[12] = 1;
+
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.0), ==, 16);
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.5), ==, 16);
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.9), ==, 16);
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.95), ==, 256);
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 0.99), ==, 256);
+  g_assert_cmpuint (mkt_keyboard_stats_get_latency_percentile (&stats, 1.0), ==, 4096);
+}
+
+static void
+test_keyboard_key_encode (void)
+{
+  char buffer[MKT_KEYBOARD_KEY_MAX_LEN];
+  MktKeyboardKey key = { 0 };
+
+  key.keyval = GDK_KEY_a;
+  g_assert_cmpuint (mkt_keyboard_key_encode (&key, buffer), ==, 1);
+  g_assert_cmpstr (buffer, ==, "a");
+
+  key.modifier = GDK_CONTROL_MASK;
+  g_assert_cmpuint (mkt_keyboard_key_encode (&key, buffer), ==, 1);
+  g_assert_cmpstr (buffer, ==, "\001");
+
+  key.keyval = GDK_KEY_Up;
+  key.modifier = 0;
+  g_assert_cmpuint (mkt_keyboard_key_encode (&key, buffer), ==, 3);
+  g_assert_cmpstr (buffer, ==, "\033[A");
+
+  key.keyval = GDK_KEY_eacute;
+  g_assert_cmpuint (mkt_keyboard_key_encode (&key, buffer), ==, 2);
+  g_assert_cmpstr (buffer, ==, "é");
+
+  /* Keys without text aren't written */
+  key.keyval = GDK_KEY_F1;
+  g_assert_cmpuint (mkt_keyboard_key_encode (&key, buffer), ==, 0);
+  g_assert_cmpstr (buffer, ==, "");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  mkt_log_init ();
+
+  g_test_add_func ("/keyboard/stats", test_keyboard_stats);
+  g_test_add_func ("/keyboard/key_func", test_keyboard_key_func);
+  g_test_add_func ("/keyboard/rate_limit", test_keyboard_rate_limit);
+  g_test_add_func ("/keyboard/stuck_key", test_keyboard_stuck_key);
+  g_test_add_func ("/keyboard/stuck_modifier", test_keyboard_stuck_modifier);
+  g_test_add_func ("/keyboard/connected", test_keyboard_connected);
+  g_test_add_func ("/keyboard/latency_percentile", test_keyboard_latency_percentile);
+  g_test_add_func ("/keyboard/key_encode", test_keyboard_key_encode);
+
+  return g_test_run ();
+}
@@ -0,0 +1,90 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* log.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "mkt-test-log"
+
+#include <glib.h>
+
+#include "mkt-log.h"
+
+static guint n_evaluated;
+
+static const char *
+get_message (void)
+{
+  n_evaluated++;
+
+  return "message";
+}
+
+static void
+test_log_flags (void)
+{
+  /* Disabled log points shall not evaluate their arguments */
+  g_assert_cmpint (mkt_log_get_verbosity (), ==, 0);
+  MKT_TRACE_MSG ("%s", get_message ());
+  MKT_TRACE ("%s", get_message ());
+  MKT_DEBUG_MSG ("%s", get_message ());
+  g_assert_cmpuint (n_evaluated, ==, 0);
+
+  mkt_log_increase_verbosity ();
+  mkt_log_increase_verbosity ();
+  mkt_log_increase_verbosity ();
+
+#ifndef MKT_DISABLE_TRACING
+  MKT_DEBUG_MSG ("%s", get_message ());
+  g_assert_cmpuint (n_evaluated, ==, 1);
+  MKT_TRACE_MSG ("%s", get_message ());
+  g_assert_cmpuint (n_evaluated, ==, 1);
+
+  mkt_log_increase_verbosity ();
+  MKT_TRACE_MSG ("%s", get_message ());
+  MKT_TRACE ("%s", get_message ());
+  g_assert_cmpuint (n_evaluated, ==, 3);
+#else
+  mkt_log_increase_verbosity ();
+  MKT_DEBUG_MSG ("%s", get_message ());
+  MKT_TRACE_MSG ("%s", get_message ());
+  g_assert_cmpuint (n_evaluated, ==, 0);
+#endif
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_unsetenv ("G_MESSAGES_DEBUG");
+  mkt_log_init ();
+
+  g_test_add_func ("/log/flags", test_log_flags);
+
+  return g_test_run ();
+}
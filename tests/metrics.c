@@ -0,0 +1,100 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* metrics.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <string.h>
+#include <glib.h>
+
+#include "mkt-metrics.h"
+
+static void
+test_metrics_format (void)
+{
+  MktMetricsSnapshot snapshot = { 0 };
+  char buffer[16 * 1024];
+  gsize len;
+
+  snapshot.n_keyboards[2] = 1;
+  snapshot.slots[2].events = 42;
+  snapshot.slots[2].bytes_written = 7;
+  snapshot.slots[2].latency[3] = 2;
+  snapshot.slots[2].latency[5] = 1;
+  snapshot.slots[2].latency[MKT_KEYBOARD_LATENCY_BUCKETS - 1] = 1;
+  snapshot.slots[2].latency_sum = 500000;
+  /* Slots without keyboards are not written */
+  snapshot.slots[4].events = 3;
+  snapshot.hotplug_events = 5;
+  snapshot.loop_lag_max = 1500;
+
+  len = mkt_metrics_format (&snapshot, buffer, sizeof buffer);
+  g_assert_cmpuint (len, >, 0);
+  g_assert_cmpuint (len, ==, strlen (buffer));
+  g_assert_true (g_str_has_suffix (buffer, "\n"));
+
+  g_assert_nonnull (strstr (buffer, "# TYPE multi_keyterm_key_events_total counter\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_keyboards{slot=\"2\"} 1\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_key_events_total{slot=\"2\"} 42\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_pty_written_bytes_total{slot=\"2\"} 7\n"));
+  g_assert_null (strstr (buffer, "slot=\"4\""));
+
+  /* Buckets are cumulative */
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_input_latency_seconds_bucket{slot=\"2\",le=\"8e-06\"} 2\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_input_latency_seconds_bucket{slot=\"2\",le=\"3.2e-05\"} 3\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_input_latency_seconds_bucket{slot=\"2\",le=\"+Inf\"} 4\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_input_latency_seconds_sum{slot=\"2\"} 0.5\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_input_latency_seconds_count{slot=\"2\"} 4\n"));
+
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_device_hotplug_events_total 5\n"));
+  g_assert_nonnull (strstr (buffer, "multi_keyterm_main_loop_lag_seconds 0.0015\n"));
+}
+
+static void
+test_metrics_format_overflow (void)
+{
+  MktMetricsSnapshot snapshot = { 0 };
+  char buffer[64];
+
+  for (guint i = 0; i < MKT_METRICS_SLOTS; i++)
+    snapshot.n_keyboards[i] = 1;
+
+  g_assert_cmpuint (mkt_metrics_format (&snapshot, buffer, sizeof buffer), ==, 0);
+  g_assert_cmpstr (buffer, ==, "");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/metrics/format", test_metrics_format);
+  g_test_add_func ("/metrics/format_overflow", test_metrics_format_overflow);
+
+  return g_test_run ();
+}
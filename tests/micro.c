@@ -0,0 +1,369 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* micro.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Microbenchmarks for the functions on the key path.
+ *
+ * Each benchmark is run with a doubling number of iterations
+ * until a run takes at least MIN_RUN_TIME, and the result is
+ * printed as a JSON object in a line of its own, so that the
+ * numbers can be compared across releases.  This requires
+ * neither input hardware nor a display.
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "mkt-micro"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-keyboard.h"
+#include "mkt-utils.h"
+#include "mkt-log.h"
+
+#define MIN_RUN_TIME   (200 * 1000) /* µs */
+#define MAX_ITERATIONS (G_GUINT64_CONSTANT (1) << 32)
+
+/* From linux/input-event-codes.h */
+#define KEY_ENTER     28
+#define KEY_LEFTCTRL  29
+#define KEY_A         30
+#define KEY_LEFTSHIFT 42
+#define KEY_LEFTALT   56
+#define KEY_UP        103
+
+typedef void (*BenchFunc) (gpointer data,
+                           guint64  n_iterations);
+
+typedef struct
+{
+  MktKeyboard *keyboard;
+  guint        key;
+} FeedKeyData;
+
+typedef struct
+{
+  GListModel *list;
+  gpointer    item;
+} LookupData;
+
+static volatile guint64 sink;
+
+static void
+bench_run (const char *name,
+           BenchFunc   func,
+           gpointer    data)
+{
+  guint64 n_iterations = 1;
+  gint64 elapsed;
+
+  while (TRUE)
+    {
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      func (data, n_iterations);
+      elapsed = g_get_monotonic_time () - start;
+
+      if (elapsed >= MIN_RUN_TIME || n_iterations >= MAX_ITERATIONS)
+        break;
+
+      n_iterations *= 2;
+    }
+
+  g_print ("{\"benchmark\": \"micro\", \"name\": \"%s\", "
+           "\"iterations\": %" G_GUINT64_FORMAT ", \"ns_per_op\": %.2f}\n",
+           name, n_iterations, elapsed * 1000.0 / n_iterations);
+}
+
+/* Each iteration is a press and a release */
+static void
+bench_feed_key (gpointer data,
+                guint64  n_iterations)
+{
+  FeedKeyData *feed = data;
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    {
+      mkt_keyboard_feed_key (feed->keyboard, XKB_KEY_DOWN, feed->key);
+      mkt_keyboard_feed_key (feed->keyboard, XKB_KEY_UP, feed->key);
+    }
+}
+
+/* Each iteration is a batch of 8 presses and releases */
+static void
+bench_feed_key_batched (gpointer data,
+                        guint64  n_iterations)
+{
+  FeedKeyData *feed = data;
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    {
+      mkt_keyboard_freeze_keys (feed->keyboard);
+
+      for (guint j = 0; j < MKT_KEYBOARD_KEY_BATCH / 2; j++)
+        {
+          mkt_keyboard_feed_key (feed->keyboard, XKB_KEY_DOWN, feed->key);
+          mkt_keyboard_feed_key (feed->keyboard, XKB_KEY_UP, feed->key);
+        }
+
+      mkt_keyboard_thaw_keys (feed->keyboard);
+    }
+}
+
+/* Stands in for the terminal, so that key delivery is measured */
+static void
+bench_keys_cb (MktKeyboard          *keyboard,
+               const MktKeyboardKey *keys,
+               guint                 n_keys,
+               gpointer              user_data)
+{
+  char buffer[MKT_KEYBOARD_KEY_MAX_LEN];
+
+  for (guint i = 0; i < n_keys; i++)
+    if (keys[i].pressed)
+      sink += mkt_keyboard_key_encode (&keys[i], buffer);
+}
+
+static void
+bench_get_modifiers (gpointer data,
+                     guint64  n_iterations)
+{
+  MktKeyboard *keyboard = data;
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    sink += mkt_keyboard_get_modifiers (keyboard);
+}
+
+static void
+bench_key_encode (gpointer data,
+                  guint64  n_iterations)
+{
+  const MktKeyboardKey *key = data;
+  char buffer[MKT_KEYBOARD_KEY_MAX_LEN];
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    sink += mkt_keyboard_key_encode (key, buffer);
+}
+
+static void
+bench_log (gpointer data,
+           guint64  n_iterations)
+{
+  GLogLevelFlags log_level = GPOINTER_TO_INT (data);
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    g_log_structured (G_LOG_DOMAIN, log_level,
+                      "MESSAGE", "Key event %" G_GUINT64_FORMAT, i);
+}
+
+static void
+bench_list_store_find (gpointer data,
+                       guint64  n_iterations)
+{
+  LookupData *lookup = data;
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    sink += g_list_store_find (G_LIST_STORE (lookup->list), lookup->item, NULL);
+}
+
+static void
+bench_get_item_position (gpointer data,
+                         guint64  n_iterations)
+{
+  LookupData *lookup = data;
+
+  for (guint64 i = 0; i < n_iterations; i++)
+    sink += mkt_utils_get_item_position (lookup->list, lookup->item, NULL);
+}
+
+static void
+run_keyboard_benchmarks (void)
+{
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  FeedKeyData feed;
+  struct {
+    const char *name;
+    guint       keys[2];
+  } modifiers[] = {
+    { "none", { 0 } },
+    { "ctrl", { KEY_LEFTCTRL } },
+    { "shift", { KEY_LEFTSHIFT } },
+    { "alt", { KEY_LEFTALT } },
+    { "ctrl-shift", { KEY_LEFTCTRL, KEY_LEFTSHIFT } },
+  };
+  struct {
+    const char *name;
+    guint       key;
+  } keys[] = {
+    { "letter", KEY_A },
+    { "enter", KEY_ENTER },
+    { "arrow", KEY_UP },
+  };
+
+  keyboard = mkt_keyboard_new_virtual ();
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  mkt_keyboard_set_key_func (keyboard, bench_keys_cb, NULL);
+  feed.keyboard = keyboard;
+
+  for (guint i = 0; i < G_N_ELEMENTS (keys); i++)
+    {
+      g_autofree char *name = NULL;
+
+      name = g_strdup_printf ("feed-key/%s", keys[i].name);
+      feed.key = keys[i].key;
+      bench_run (name, bench_feed_key, &feed);
+    }
+
+  /* Hold the modifiers down while feeding a letter key */
+  feed.key = KEY_A;
+  bench_run ("feed-key/batched", bench_feed_key_batched, &feed);
+
+  for (guint i = 0; i < G_N_ELEMENTS (modifiers); i++)
+    {
+      g_autofree char *feed_name = NULL;
+      g_autofree char *modifiers_name = NULL;
+
+      for (guint j = 0; j < G_N_ELEMENTS (modifiers[i].keys) && modifiers[i].keys[j]; j++)
+        mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, modifiers[i].keys[j]);
+
+      feed_name = g_strdup_printf ("feed-key/modifier-%s", modifiers[i].name);
+      bench_run (feed_name, bench_feed_key, &feed);
+      modifiers_name = g_strdup_printf ("get-modifiers/%s", modifiers[i].name);
+      bench_run (modifiers_name, bench_get_modifiers, keyboard);
+
+      for (guint j = 0; j < G_N_ELEMENTS (modifiers[i].keys) && modifiers[i].keys[j]; j++)
+        mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, modifiers[i].keys[j]);
+    }
+}
+
+static void
+run_key_encode_benchmarks (void)
+{
+  struct {
+    const char     *name;
+    MktKeyboardKey  key;
+  } keys[] = {
+    { "key-encode/letter", { 0, 0, GDK_KEY_a } },
+    { "key-encode/ctrl-letter", { GDK_CONTROL_MASK, 0, GDK_KEY_c } },
+    { "key-encode/arrow", { 0, 0, GDK_KEY_Up } },
+    { "key-encode/unicode", { 0, 0, GDK_KEY_eacute } },
+    { "key-encode/no-text", { 0, 0, GDK_KEY_F1 } },
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (keys); i++)
+    bench_run (keys[i].name, bench_key_encode, &keys[i].key);
+}
+
+static void
+run_log_benchmarks (void)
+{
+  int stdout_fd, null_fd;
+
+  /* The log handler writes to stdout, which has our results */
+  fflush (stdout);
+  stdout_fd = dup (STDOUT_FILENO);
+  null_fd = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+  g_assert_cmpint (stdout_fd, >=, 0);
+  g_assert_cmpint (null_fd, >=, 0);
+
+  for (int verbosity = 0; verbosity <= 4; verbosity++)
+    {
+      g_autofree char *debug_name = NULL;
+      g_autofree char *message_name = NULL;
+
+      debug_name = g_strdup_printf ("log-handler/debug-v%d", verbosity);
+      message_name = g_strdup_printf ("log-handler/message-v%d", verbosity);
+
+      dup2 (null_fd, STDOUT_FILENO);
+      bench_run (debug_name, bench_log, GINT_TO_POINTER (G_LOG_LEVEL_DEBUG));
+      bench_run (message_name, bench_log, GINT_TO_POINTER (G_LOG_LEVEL_MESSAGE));
+      fflush (stdout);
+      dup2 (stdout_fd, STDOUT_FILENO);
+
+      mkt_log_increase_verbosity ();
+    }
+
+  close (null_fd);
+  close (stdout_fd);
+}
+
+static void
+run_lookup_benchmarks (void)
+{
+  guint sizes[] = { 9, 100, 1000, 100000 };
+
+  for (guint i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      g_autoptr(GListStore) store = NULL;
+      g_autofree char *find_name = NULL;
+      g_autofree char *position_name = NULL;
+      LookupData lookup;
+
+      store = g_list_store_new (G_TYPE_OBJECT);
+
+      for (guint j = 0; j < sizes[i]; j++)
+        {
+          g_autoptr(GObject) object = NULL;
+
+          object = g_object_new (G_TYPE_OBJECT, NULL);
+          g_list_store_append (store, object);
+        }
+
+      /* Look up the last item, the worst case */
+      lookup.list = G_LIST_MODEL (store);
+      lookup.item = g_list_model_get_item (lookup.list, sizes[i] - 1);
+      g_object_unref (lookup.item);
+
+      /* As done for each key event in handle_keyboard_event() */
+      find_name = g_strdup_printf ("keyboard-lookup/n%u", sizes[i]);
+      bench_run (find_name, bench_list_store_find, &lookup);
+      position_name = g_strdup_printf ("get-item-position/n%u", sizes[i]);
+      bench_run (position_name, bench_get_item_position, &lookup);
+    }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  /* Use the same log domain filtering for every run */
+  g_unsetenv ("G_MESSAGES_DEBUG");
+  mkt_log_init ();
+
+  run_keyboard_benchmarks ();
+  run_key_encode_benchmarks ();
+  run_lookup_benchmarks ();
+  /* This changes the verbosity, so keep it last */
+  run_log_benchmarks ();
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* router.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "mkt-router.h"
+#include "mkt-log.h"
+
+/* From linux/input-event-codes.h */
+#define KEY_A 30
+
+static void
+wait_for_retry_delay (MktRouter   *router,
+                      MktKeyboard *keyboard,
+                      guint        delay)
+{
+  gint64 deadline;
+
+  deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  while (mkt_router_get_retry_delay (router, keyboard) != delay)
+    {
+      g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+      g_main_context_iteration (NULL, FALSE);
+      g_usleep (1000);
+    }
+}
+
+static int
+listen_unix (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd;
+
+  g_assert_cmpuint (strlen (path), <, sizeof addr.sun_path);
+  strcpy (addr.sun_path, path);
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  g_assert_cmpint (fd, !=, -1);
+  g_assert_cmpint (bind (fd, (struct sockaddr *)&addr, sizeof addr), ==, 0);
+  g_assert_cmpint (listen (fd, 1), ==, 0);
+
+  return fd;
+}
+
+static void
+test_router_retry (void)
+{
+  g_autoptr(MktController) controller = NULL;
+  g_autoptr(MktKeyboard) keyboard = NULL;
+  g_autoptr(MktSettings) settings = NULL;
+  g_autoptr(MktRouter) router = NULL;
+  g_autoptr(GSettings) gsettings = NULL;
+  g_autofree char *broker_path = NULL;
+  g_autofree char *tmpdir = NULL;
+  g_autofree char *target = NULL;
+  g_autofree char *path = NULL;
+  const MktKeyboardStats *stats;
+  guint64 dropped, written;
+  gint64 wait_until;
+  int listen_fd, peer_fd;
+  gsize received = 0;
+  char buffer[4096];
+  gssize len;
+
+  tmpdir = g_dir_make_tmp ("router-XXXXXX", NULL);
+  g_assert_nonnull (tmpdir);
+  path = g_build_filename (tmpdir, "kbd1.sock", NULL);
+  target = g_strconcat ("unix:", path, NULL);
+
+  gsettings = g_settings_new ("org.sadiqpk.multi-keyterm");
+  g_settings_set_value (gsettings, "headless-routes",
+                        g_variant_new_parsed ("{'1': %s}", target));
+
+  /* No broker listens there, so no input device is opened */
+  broker_path = g_build_filename (tmpdir, "broker.sock", NULL);
+  settings = mkt_settings_new ();
+  controller = mkt_controller_new_for_broker (settings, broker_path);
+  router = mkt_router_new (controller, settings);
+  mkt_router_set_retry_delay (router, 10, 40);
+
+  keyboard = mkt_keyboard_new_virtual ();
+  mkt_keyboard_set_enabled (keyboard, TRUE);
+  /* Fill the socket as fast as keys can be fed */
+  mkt_keyboard_set_rate_limit (keyboard, 0, 0);
+  stats = mkt_keyboard_get_stats (keyboard);
+  mkt_controller_add_keyboard (controller, keyboard);
+  g_assert_cmpuint (mkt_keyboard_get_index (keyboard), ==, XKB_KEY_1);
+
+  /* Nothing listens yet, the target is retried with the delay doubled each time */
+  g_assert_cmpuint (mkt_router_get_retry_delay (router, keyboard), ==, 10);
+  wait_for_retry_delay (router, keyboard, 20);
+  wait_for_retry_delay (router, keyboard, 40);
+
+  /* And no more than the maximum */
+  wait_until = g_get_monotonic_time () + 200 * 1000;
+  while (g_get_monotonic_time () < wait_until)
+    {
+      g_main_context_iteration (NULL, FALSE);
+      g_usleep (1000);
+      g_assert_cmpuint (mkt_router_get_retry_delay (router, keyboard), ==, 40);
+    }
+
+  /* Keys are dropped meanwhile, without trying the target */
+  dropped = stats->dropped;
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (stats->dropped, ==, dropped + 1);
+  g_assert_cmpuint (mkt_router_get_retry_delay (router, keyboard), ==, 40);
+
+  /* Once the target is there, it's reopened and the delay reset */
+  listen_fd = listen_unix (path);
+  wait_for_retry_delay (router, keyboard, 0);
+  peer_fd = accept (listen_fd, NULL, NULL);
+  g_assert_cmpint (peer_fd, !=, -1);
+
+  /*
+   * Nobody reads, so the socket fills up.  A batch it doesn't
+   * take, in part or in whole, is dropped and only the bytes it
+   * took are counted as written.  A full socket isn't a failure.
+   */
+  dropped = stats->dropped;
+  written = stats->bytes_written;
+
+  for (guint i = 0; stats->dropped == dropped && i < 1000000; i++)
+    {
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+      mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+    }
+
+  g_assert_cmpuint (stats->dropped, >, dropped);
+  g_assert_cmpuint (mkt_router_get_retry_delay (router, keyboard), ==, 0);
+
+  while ((len = recv (peer_fd, buffer, sizeof buffer, MSG_DONTWAIT)) > 0)
+    received += len;
+
+  g_assert_cmpint (len, ==, -1);
+  g_assert_cmpint (errno, ==, EAGAIN);
+  g_assert_cmpuint (received, ==, stats->bytes_written - written);
+  g_assert_cmpuint (received, >, 0);
+
+  /* A target that goes away fails again from the shortest delay */
+  close (peer_fd);
+  close (listen_fd);
+  g_assert_cmpint (unlink (path), ==, 0);
+  dropped = stats->dropped;
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_DOWN, KEY_A);
+  mkt_keyboard_feed_key (keyboard, XKB_KEY_UP, KEY_A);
+  g_assert_cmpuint (stats->dropped, ==, dropped + 1);
+  g_assert_cmpuint (mkt_router_get_retry_delay (router, keyboard), ==, 10);
+
+  g_clear_object (&router);
+  g_settings_reset (gsettings, "headless-routes");
+  g_assert_cmpint (g_rmdir (tmpdir), ==, 0);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  mkt_log_init ();
+
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  g_test_add_func ("/router/retry", test_router_retry);
+
+  return g_test_run ();
+}
@@ -0,0 +1,221 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* session.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mkt-session.h"
+#include "mkt-log.h"
+
+typedef struct
+{
+  GArray     *types;
+  GByteArray *data;
+  gboolean    closed;
+} Received;
+
+static void
+received_cb (MktSession        *session,
+             MktSessionMessage  type,
+             const char        *data,
+             gsize              length,
+             gpointer           user_data)
+{
+  Received *received = user_data;
+
+  if (type == MKT_SESSION_MESSAGE_DRAINED)
+    return;
+
+  if (type == MKT_SESSION_MESSAGE_CLOSED)
+    received->closed = TRUE;
+
+  g_array_append_val (received->types, type);
+  g_byte_array_append (received->data, (const guint8 *)data, length);
+}
+
+static MktSession *
+create_session (int       fd,
+                Received *received)
+{
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GSocket) socket = NULL;
+  g_autoptr(GError) error = NULL;
+
+  socket = g_socket_new_from_fd (fd, &error);
+  g_assert_no_error (error);
+  connection = g_socket_connection_factory_create_connection (socket);
+
+  return mkt_session_new (connection, received_cb, received);
+}
+
+static void
+received_init (Received *received)
+{
+  received->types = g_array_new (FALSE, FALSE, sizeof (MktSessionMessage));
+  received->data = g_byte_array_new ();
+  received->closed = FALSE;
+}
+
+static void
+received_clear (Received *received)
+{
+  g_array_unref (received->types);
+  g_byte_array_unref (received->data);
+}
+
+static void
+test_session_messages (void)
+{
+  g_autoptr(MktSession) client = NULL;
+  g_autoptr(MktSession) server = NULL;
+  g_autofree char *output = NULL;
+  const char *argv[] = { "sh", "-c", "true", NULL };
+  Received from_client, from_server;
+  MktSessionAttach attach;
+  MktSessionSize size;
+  const char *data;
+  gsize output_len;
+  int fds[2];
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), ==, 0);
+
+  received_init (&from_client);
+  received_init (&from_server);
+  client = create_session (fds[0], &from_server);
+  server = create_session (fds[1], &from_client);
+
+  mkt_session_attach (client, 3, 24, 80, "/tmp", argv);
+  mkt_session_send (client, MKT_SESSION_MESSAGE_INPUT, "ls\r", 3);
+  mkt_session_resize (client, 50, 132);
+
+  /* Larger than a message, and the socket buffer */
+  output_len = MKT_SESSION_MAX_MESSAGE * 4 + 7;
+  output = g_malloc (output_len);
+  for (gsize i = 0; i < output_len; i++)
+    output[i] = 'a' + i % 26;
+  mkt_session_send (server, MKT_SESSION_MESSAGE_OUTPUT, output, output_len);
+
+  while (from_client.types->len < 3 ||
+         from_server.data->len < output_len)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (mkt_session_get_pending (server), ==, 0);
+
+  /* The attach message has the slot, size, cwd and the command */
+  g_assert_cmpint (g_array_index (from_client.types, MktSessionMessage, 0), ==,
+                   MKT_SESSION_MESSAGE_ATTACH);
+  data = (const char *)from_client.data->data;
+  memcpy (&attach, data, sizeof attach);
+  g_assert_cmpint (attach.slot, ==, 3);
+  g_assert_cmpint (attach.size.rows, ==, 24);
+  g_assert_cmpint (attach.size.columns, ==, 80);
+  data += sizeof attach;
+  g_assert_cmpstr (data, ==, "/tmp");
+  data += strlen (data) + 1;
+  for (guint i = 0; argv[i]; i++)
+    {
+      g_assert_cmpstr (data, ==, argv[i]);
+      data += strlen (data) + 1;
+    }
+
+  g_assert_cmpint (g_array_index (from_client.types, MktSessionMessage, 1), ==,
+                   MKT_SESSION_MESSAGE_INPUT);
+  g_assert_true (memcmp (data, "ls\r", 3) == 0);
+  data += 3;
+
+  g_assert_cmpint (g_array_index (from_client.types, MktSessionMessage, 2), ==,
+                   MKT_SESSION_MESSAGE_RESIZE);
+  memcpy (&size, data, sizeof size);
+  g_assert_cmpint (size.rows, ==, 50);
+  g_assert_cmpint (size.columns, ==, 132);
+
+  /* Large output is split, but arrives in order */
+  g_assert_cmpint (from_server.types->len, ==, 5);
+  for (guint i = 0; i < from_server.types->len; i++)
+    g_assert_cmpint (g_array_index (from_server.types, MktSessionMessage, i), ==,
+                     MKT_SESSION_MESSAGE_OUTPUT);
+  g_assert_cmpmem (from_server.data->data, from_server.data->len, output, output_len);
+
+  /* Closing one end is seen by the other */
+  mkt_session_close (client);
+  g_assert_true (mkt_session_is_closed (client));
+
+  while (!from_client.closed)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (mkt_session_is_closed (server));
+  g_assert_false (from_server.closed);
+
+  received_clear (&from_client);
+  received_clear (&from_server);
+}
+
+static void
+test_session_invalid (void)
+{
+  g_autoptr(MktSession) server = NULL;
+  MktSessionHeader header = { 0 };
+  Received received;
+  int fds[2];
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), ==, 0);
+
+  received_init (&received);
+  server = create_session (fds[1], &received);
+
+  /* A message too large to be valid closes the connection */
+  header.type = MKT_SESSION_MESSAGE_INPUT;
+  header.length = MKT_SESSION_MAX_MESSAGE + 1;
+  g_assert_cmpint (write (fds[0], &header, sizeof header), ==, sizeof header);
+
+  while (!received.closed)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (received.types->len, ==, 1);
+
+  close (fds[0]);
+  received_clear (&received);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  mkt_log_init ();
+
+  g_test_add_func ("/session/messages", test_session_messages);
+  g_test_add_func ("/session/invalid", test_session_invalid);
+
+  return g_test_run ();
+}
@@ -69,6 +69,145 @@ test_settings_first_run (void)
   g_object_unref (settings);
 }
 
+static void
+font_changed_cb (MktSettings *settings,
+                 guint       *count)
+{
+  (*count)++;
+}
+
+static void
+test_settings_font_changed (void)
+{
+  MktSettings *settings;
+  guint count = 0;
+
+  settings = mkt_settings_new ();
+  g_signal_connect (settings, "font-changed",
+                    G_CALLBACK (font_changed_cb), &count);
+
+  /* Several changes in a row shall emit the signal only once */
+  for (guint i = 0; i < 20; i++)
+    g_object_set (settings, "font-scale", 1.0 + 0.05 * (i + 1), NULL);
+
+  mkt_settings_set_use_system_font (settings, FALSE);
+  mkt_settings_set_font (settings, "Monospace 13");
+  g_assert_cmpuint (count, ==, 0);
+
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+
+  g_assert_cmpuint (count, ==, 1);
+  g_assert_cmpfloat_with_epsilon (mkt_settings_get_font_scale (settings), 2.0, 0.001);
+  g_assert_cmpstr (mkt_settings_get_font (settings), ==, "Monospace 13");
+
+  /* Setting the same value shouldn't emit again */
+  g_object_set (settings, "font-scale", 2.0, NULL);
+  mkt_settings_set_font (settings, "Monospace 13");
+
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+
+  g_assert_cmpuint (count, ==, 1);
+
+  /* Pending emission shall be dropped on finalize */
+  g_object_set (settings, "font-scale", 1.0, NULL);
+  g_object_unref (settings);
+
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+
+  g_assert_cmpuint (count, ==, 1);
+}
+
+static void
+test_settings_keyboard_profile (void)
+{
+  g_autoptr(MktKeyboardProfile) profile = NULL;
+  MktKeyboardProfile new_profile = { 0 };
+  MktSettings *settings;
+
+  settings = mkt_settings_new ();
+  g_assert_null (mkt_settings_get_keyboard_profile (settings, NULL));
+  g_assert_null (mkt_settings_get_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0"));
+
+  new_profile.slot = 3;
+  new_profile.zoom = 1.5;
+  g_assert_true (mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0", &new_profile));
+  /* Saving the same profile again writes nothing */
+  g_assert_false (mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0", &new_profile));
+
+  new_profile.slot = 4;
+  new_profile.layout = "de";
+  new_profile.command = "htop -d 10";
+  mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:2:1.0", &new_profile);
+
+  profile = mkt_settings_get_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0");
+  g_assert_nonnull (profile);
+  g_assert_cmpuint (profile->slot, ==, 3);
+  g_assert_cmpfloat_with_epsilon (profile->zoom, 1.5, 0.001);
+  g_assert_null (profile->layout);
+  g_assert_null (profile->command);
+  g_clear_pointer (&profile, mkt_keyboard_profile_free);
+
+  /* Profiles shall be saved to disk */
+  mkt_settings_save (settings);
+  g_object_unref (settings);
+  settings = mkt_settings_new ();
+
+  profile = mkt_settings_get_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:2:1.0");
+  g_assert_nonnull (profile);
+  g_assert_cmpuint (profile->slot, ==, 4);
+  g_assert_cmpstr (profile->layout, ==, "de");
+  g_assert_cmpstr (profile->command, ==, "htop -d 10");
+  g_clear_pointer (&profile, mkt_keyboard_profile_free);
+
+  /* Replace one, and remove the other */
+  new_profile.slot = 5;
+  g_assert_true (mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:2:1.0", &new_profile));
+  g_assert_true (mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0", NULL));
+  g_assert_false (mkt_settings_set_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0", NULL));
+
+  profile = mkt_settings_get_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:2:1.0");
+  g_assert_cmpuint (profile->slot, ==, 5);
+  g_assert_null (mkt_settings_get_keyboard_profile (settings, "pci-0000:00:14.0-usb-0:1:1.0"));
+
+  g_object_unref (settings);
+}
+
+static void
+test_settings_slot_limits (void)
+{
+  g_autoptr(GSettings) gsettings = NULL;
+  MktSlotLimits limits;
+  MktSettings *settings;
+
+  settings = mkt_settings_new ();
+  mkt_settings_get_slot_limits (settings, 1, &limits);
+  g_assert_cmpuint (limits.cpu_weight, ==, 100);
+  g_assert_cmpuint (limits.memory_high, ==, 0);
+  g_assert_cmpuint (limits.pids_max, ==, 0);
+
+  gsettings = g_settings_new ("org.sadiqpk.multi-keyterm");
+  g_settings_set_value (gsettings, "slot-limits",
+                        g_variant_new_parsed ("{'*': (@u 50, @t 1073741824, @u 512),"
+                                              " '2': (@u 0, @t 0, @u 0)}"));
+
+  mkt_settings_get_slot_limits (settings, 1, &limits);
+  g_assert_cmpuint (limits.cpu_weight, ==, 50);
+  g_assert_cmpuint (limits.memory_high, ==, 1073741824);
+  g_assert_cmpuint (limits.pids_max, ==, 512);
+
+  /* A slot of its own takes precedence, and the weight is clamped */
+  mkt_settings_get_slot_limits (settings, 2, &limits);
+  g_assert_cmpuint (limits.cpu_weight, ==, 1);
+  g_assert_cmpuint (limits.memory_high, ==, 0);
+  g_assert_cmpuint (limits.pids_max, ==, 0);
+
+  g_settings_reset (gsettings, "slot-limits");
+  g_object_unref (settings);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -86,6 +225,9 @@ main (int   argc,
   g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
 
   g_test_add_func ("/settings/first_run", test_settings_first_run);
+  g_test_add_func ("/settings/font_changed", test_settings_font_changed);
+  g_test_add_func ("/settings/keyboard_profile", test_settings_keyboard_profile);
+  g_test_add_func ("/settings/slot_limits", test_settings_slot_limits);
 
   return g_test_run ();
 }
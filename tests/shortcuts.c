@@ -0,0 +1,85 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* shortcuts.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <glib.h>
+
+#include "mkt-shortcuts.h"
+
+static void
+test_shortcuts_lookup (void)
+{
+  g_autoptr(MktShortcuts) shortcuts = NULL;
+  GVariant *bindings;
+
+  bindings = g_variant_new_parsed ("{'zoom-in': ['<Control>plus', '<Control>KP_Add'],"
+                                   " 'copy': ['<Control><Shift>c'],"
+                                   " 'paste': ['<Alt>v'],"
+                                   " 'reset': @as []}");
+  shortcuts = mkt_shortcuts_new (g_variant_ref_sink (bindings));
+  g_variant_unref (bindings);
+
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_plus, GDK_CONTROL_MASK),
+                   ==, MKT_SHORTCUT_ZOOM_IN);
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_KP_Add, GDK_CONTROL_MASK),
+                   ==, MKT_SHORTCUT_ZOOM_IN);
+  /* Shift may be needed to type “plus” */
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_plus,
+                                         GDK_CONTROL_MASK | GDK_SHIFT_MASK),
+                   ==, MKT_SHORTCUT_ZOOM_IN);
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_plus, 0),
+                   ==, MKT_SHORTCUT_NONE);
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_plus,
+                                         GDK_CONTROL_MASK | GDK_ALT_MASK),
+                   ==, MKT_SHORTCUT_NONE);
+
+  /* Letters are matched regardless of case, but Shift is significant */
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_C,
+                                         GDK_CONTROL_MASK | GDK_SHIFT_MASK),
+                   ==, MKT_SHORTCUT_COPY);
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_c, GDK_CONTROL_MASK),
+                   ==, MKT_SHORTCUT_NONE);
+
+  /* Meta is the same as Alt */
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_v, GDK_META_MASK),
+                   ==, MKT_SHORTCUT_PASTE);
+  g_assert_cmpint (mkt_shortcuts_lookup (shortcuts, GDK_KEY_v, 0),
+                   ==, MKT_SHORTCUT_NONE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/shortcuts/lookup", test_shortcuts_lookup);
+
+  return g_test_run ();
+}
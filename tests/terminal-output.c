@@ -0,0 +1,423 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* terminal-output.c
+ *
+ * Copyright 2023 Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author(s):
+ *   Mohammed Sadiq <sadiq@sadiqpk.org>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Terminal output throughput benchmark.
+ *
+ * Opens N terminals driven by virtual keyboards, runs the same
+ * output workload in each and prints one JSON object per line
+ * for each (workload, N) pair.  No input hardware is required,
+ * but a display is.  On a plain box, run it in a headless
+ * compositor, eg:
+ *
+ *   weston --backend=headless-backend.so --socket=mkt-bench &
+ *   WAYLAND_DISPLAY=mkt-bench meson test --benchmark terminal-output
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "mkt-controller.h"
+#include "mkt-keyboard.h"
+#include "mkt-settings.h"
+#include "mkt-terminal.h"
+#include "mkt-terminal-grid.h"
+#include "mkt-log.h"
+
+#define RUN_TIMEOUT 120 /* seconds */
+
+typedef struct
+{
+  const char *name;
+  char       *command;
+} Workload;
+
+typedef struct
+{
+  MktController *controller;
+  MktSettings   *settings;
+  char         **command;
+} BenchTerminalData;
+
+typedef struct
+{
+  GMainLoop *loop;
+  GArray    *frame_times;
+  GArray    *durations;
+  gint64     start_time;
+  gint64     frame_start;
+  guint      n_running;
+  gboolean   timed_out;
+} BenchRun;
+
+static char *terminal_list = NULL;
+static char *workload_name = NULL;
+static int workload_size = 4 * 1024 * 1024;
+
+static GOptionEntry bench_options[] = {
+  { "terminals", 'n', 0, G_OPTION_ARG_STRING, &terminal_list,
+    "Comma separated list of terminal counts (default: 1,2,4,8,16)", "LIST" },
+  { "workload", 'w', 0, G_OPTION_ARG_STRING, &workload_name,
+    "Run only the given workload (cat, yes or compiler-log)", "NAME" },
+  { "size", 's', 0, G_OPTION_ARG_INT, &workload_size,
+    "Bytes written by each terminal", "BYTES" },
+  { NULL }
+};
+
+static char *
+create_workload_file (const char *dir,
+                      const char *name,
+                      gboolean    colored)
+{
+  g_autoptr(GString) content = NULL;
+  g_autoptr(GError) error = NULL;
+  char *path;
+  guint line = 0;
+
+  content = g_string_sized_new (workload_size + 256);
+
+  while (content->len < (gsize)workload_size)
+    {
+      line++;
+
+      if (colored)
+        g_string_append_printf (content,
+                                "\033[01m\033[Ksrc/mkt-file-%u.c:%u:%u:\033[m\033[K "
+                                "\033[01;35m\033[Kwarning: \033[m\033[Kunused variable "
+                                "‘\033[01m\033[Kvalue_%u\033[m\033[K’ "
+                                "[\033[01;35m\033[K-Wunused-variable\033[m\033[K]\n",
+                                line % 97, line, line % 80, line);
+      else
+        g_string_append_printf (content,
+                                "%08u The quick brown fox jumps over the lazy dog\n",
+                                line);
+    }
+
+  g_string_truncate (content, workload_size);
+  path = g_build_filename (dir, name, NULL);
+
+  if (!g_file_set_contents (path, content->str, content->len, &error))
+    g_error ("Failed to create workload file: %s", error->message);
+
+  return path;
+}
+
+static int
+compare_int64 (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+frame_clock_before_paint_cb (GdkFrameClock *frame_clock,
+                             BenchRun      *run)
+{
+  run->frame_start = g_get_monotonic_time ();
+}
+
+static void
+frame_clock_after_paint_cb (GdkFrameClock *frame_clock,
+                            BenchRun      *run)
+{
+  gint64 frame_time;
+
+  /*
+   * Every frame is bracketed by these, so this is the time
+   * spent on the update, layout and paint phases of it
+   */
+  if (!run->frame_start)
+    return;
+
+  frame_time = g_get_monotonic_time () - run->frame_start;
+  g_array_append_val (run->frame_times, frame_time);
+  run->frame_start = 0;
+}
+
+static void
+bench_keyboard_enabled_cb (MktKeyboard *keyboard,
+                           GParamSpec  *pspec,
+                           BenchRun    *run)
+{
+  gint64 duration;
+
+  if (mkt_keyboard_get_enabled (keyboard))
+    return;
+
+  duration = g_get_monotonic_time () - run->start_time;
+  g_array_append_val (run->durations, duration);
+
+  if (--run->n_running == 0)
+    g_main_loop_quit (run->loop);
+}
+
+static GtkWidget *
+bench_terminal_new (MktKeyboard       *keyboard,
+                    BenchTerminalData *data)
+{
+  GtkWidget *terminal;
+
+  terminal = mkt_terminal_new (data->controller, data->settings, keyboard);
+  mkt_terminal_set_command (MKT_TERMINAL (terminal), (const char * const *)data->command);
+
+  return terminal;
+}
+
+static double
+get_cpu_time (const struct rusage *start,
+              const struct rusage *end)
+{
+  return (end->ru_utime.tv_sec - start->ru_utime.tv_sec) +
+         (end->ru_stime.tv_sec - start->ru_stime.tv_sec) +
+         ((end->ru_utime.tv_usec - start->ru_utime.tv_usec) +
+          (end->ru_stime.tv_usec - start->ru_stime.tv_usec)) / (double)G_USEC_PER_SEC;
+}
+
+static gboolean
+bench_timeout_cb (gpointer user_data)
+{
+  BenchRun *run = user_data;
+
+  run->timed_out = TRUE;
+  g_main_loop_quit (run->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+run_workload (MktController  *controller,
+              MktSettings    *settings,
+              const Workload *workload,
+              guint           n_terminals)
+{
+  g_autoptr(GListStore) keyboards = NULL;
+  struct rusage usage_start, usage_end;
+  struct rusage thread_start, thread_end;
+  GdkFrameClock *frame_clock;
+  GtkWidget *window, *grid;
+  BenchRun run = { 0 };
+  const char *argv[] = { "/bin/sh", "-c", workload->command, NULL };
+  BenchTerminalData data = { controller, settings, (char **)argv };
+  double cpu_time, main_cpu_time, wall_time, bytes_per_sec = 0.0, min_bytes_per_sec = 0.0;
+  double frame_mean = 0.0, frame_p95 = 0.0, frame_max = 0.0;
+  guint timeout_id;
+
+  run.loop = g_main_loop_new (NULL, FALSE);
+  run.frame_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  run.durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+  keyboards = g_list_store_new (MKT_TYPE_KEYBOARD);
+
+  window = gtk_window_new ();
+  grid = mkt_terminal_grid_new ();
+  gtk_window_set_child (GTK_WINDOW (window), grid);
+  gtk_window_set_default_size (GTK_WINDOW (window), 1920, 1080);
+  mkt_terminal_grid_bind_model (MKT_TERMINAL_GRID (grid), G_LIST_MODEL (keyboards),
+                                (MktTerminalGridCreateFunc)bench_terminal_new,
+                                &data, NULL);
+
+  for (guint i = 0; i < n_terminals; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = mkt_keyboard_new_virtual ();
+      g_signal_connect (keyboard, "notify::enabled",
+                        G_CALLBACK (bench_keyboard_enabled_cb), &run);
+      g_list_store_append (keyboards, keyboard);
+    }
+
+  gtk_window_present (GTK_WINDOW (window));
+
+  while (!gtk_widget_get_mapped (window))
+    g_main_context_iteration (NULL, TRUE);
+
+  frame_clock = gtk_widget_get_frame_clock (window);
+  g_signal_connect (frame_clock, "before-paint",
+                    G_CALLBACK (frame_clock_before_paint_cb), &run);
+  g_signal_connect (frame_clock, "after-paint",
+                    G_CALLBACK (frame_clock_after_paint_cb), &run);
+  timeout_id = g_timeout_add_seconds (RUN_TIMEOUT, bench_timeout_cb, &run);
+
+  /* The main loop runs in this thread, GTK and GLib may use others */
+  getrusage (RUSAGE_THREAD, &thread_start);
+  getrusage (RUSAGE_SELF, &usage_start);
+  run.start_time = g_get_monotonic_time ();
+  run.n_running = n_terminals;
+
+  for (guint i = 0; i < n_terminals; i++)
+    {
+      g_autoptr(MktKeyboard) keyboard = NULL;
+
+      keyboard = g_list_model_get_item (G_LIST_MODEL (keyboards), i);
+      mkt_keyboard_set_enabled (keyboard, TRUE);
+    }
+
+  g_main_loop_run (run.loop);
+
+  wall_time = (g_get_monotonic_time () - run.start_time) / (double)G_USEC_PER_SEC;
+  getrusage (RUSAGE_SELF, &usage_end);
+  getrusage (RUSAGE_THREAD, &thread_end);
+
+  if (!run.timed_out)
+    g_source_remove (timeout_id);
+  g_signal_handlers_disconnect_by_data (frame_clock, &run);
+
+  cpu_time = get_cpu_time (&usage_start, &usage_end);
+  main_cpu_time = get_cpu_time (&thread_start, &thread_end);
+
+  for (guint i = 0; i < run.durations->len; i++)
+    {
+      double rate;
+
+      rate = workload_size / (g_array_index (run.durations, gint64, i) / (double)G_USEC_PER_SEC);
+      bytes_per_sec += rate / run.durations->len;
+
+      if (i == 0 || rate < min_bytes_per_sec)
+        min_bytes_per_sec = rate;
+    }
+
+  if (run.frame_times->len)
+    {
+      g_array_sort (run.frame_times, compare_int64);
+
+      for (guint i = 0; i < run.frame_times->len; i++)
+        frame_mean += g_array_index (run.frame_times, gint64, i) / 1000.0 / run.frame_times->len;
+
+      frame_p95 = g_array_index (run.frame_times, gint64, run.frame_times->len * 95 / 100) / 1000.0;
+      frame_max = g_array_index (run.frame_times, gint64, run.frame_times->len - 1) / 1000.0;
+    }
+
+  g_print ("{\"benchmark\": \"terminal-output\", \"workload\": \"%s\", \"terminals\": %u, "
+           "\"bytes_per_terminal\": %d, \"completed\": %u, \"timed_out\": %s, "
+           "\"wall_time_s\": %.3f, \"bytes_per_sec_per_terminal\": %.0f, "
+           "\"min_bytes_per_sec_per_terminal\": %.0f, \"frames\": %u, "
+           "\"frame_time_mean_ms\": %.2f, \"frame_time_p95_ms\": %.2f, "
+           "\"frame_time_max_ms\": %.2f, \"main_loop_cpu_percent\": %.1f, "
+           "\"process_cpu_percent\": %.1f}\n",
+           workload->name, n_terminals, workload_size, run.durations->len,
+           run.timed_out ? "true" : "false", wall_time, bytes_per_sec,
+           min_bytes_per_sec, run.frame_times->len, frame_mean, frame_p95,
+           frame_max, wall_time > 0 ? main_cpu_time * 100.0 / wall_time : 0.0,
+           wall_time > 0 ? cpu_time * 100.0 / wall_time : 0.0);
+
+  gtk_window_destroy (GTK_WINDOW (window));
+
+  /* Let the terminals get destroyed before the next run */
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, FALSE);
+
+  g_array_unref (run.frame_times);
+  g_array_unref (run.durations);
+  g_main_loop_unref (run.loop);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(MktController) controller = NULL;
+  g_autoptr(MktSettings) settings = NULL;
+  g_autoptr(GError) error = NULL;
+  g_auto(GStrv) counts = NULL;
+  g_autofree char *tmp_dir = NULL;
+  g_autofree char *text_file = NULL;
+  g_autofree char *log_file = NULL;
+  Workload workloads[3];
+
+  context = g_option_context_new ("- benchmark terminal output throughput");
+  g_option_context_add_main_entries (context, bench_options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (workload_size <= 0)
+    {
+      g_printerr ("Invalid workload size: %d\n", workload_size);
+      return 1;
+    }
+
+  mkt_log_init ();
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  if (!gtk_init_check ())
+    {
+      g_printerr ("No display found, skipping benchmark\n");
+      return 77;
+    }
+
+  tmp_dir = g_dir_make_tmp ("mkt-bench-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  text_file = create_workload_file (tmp_dir, "text.log", FALSE);
+  log_file = create_workload_file (tmp_dir, "compiler.log", TRUE);
+
+  workloads[0].name = "cat";
+  workloads[0].command = g_strdup_printf ("cat '%s'", text_file);
+  workloads[1].name = "yes";
+  workloads[1].command = g_strdup_printf ("yes | head -c %d", workload_size);
+  workloads[2].name = "compiler-log";
+  workloads[2].command = g_strdup_printf ("cat '%s'", log_file);
+
+  settings = mkt_settings_new ();
+  controller = mkt_controller_new (settings);
+  counts = g_strsplit (terminal_list ?: "1,2,4,8,16", ",", -1);
+
+  for (guint i = 0; i < G_N_ELEMENTS (workloads); i++)
+    {
+      if (workload_name && g_strcmp0 (workload_name, workloads[i].name) != 0)
+        continue;
+
+      for (guint j = 0; counts[j]; j++)
+        {
+          guint64 n_terminals;
+
+          if (!g_ascii_string_to_unsigned (counts[j], 10, 1, 64, &n_terminals, &error))
+            g_error ("Invalid terminal count '%s': %s", counts[j], error->message);
+
+          run_workload (controller, settings, &workloads[i], n_terminals);
+        }
+    }
+
+  for (guint i = 0; i < G_N_ELEMENTS (workloads); i++)
+    g_free (workloads[i].command);
+
+  g_unlink (text_file);
+  g_unlink (log_file);
+  g_rmdir (tmp_dir);
+
+  return 0;
+}
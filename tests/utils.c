@@ -28,6 +28,7 @@
 #undef G_DISABLE_CAST_CHECKS
 #undef G_LOG_DOMAIN
 
+#include <unistd.h>
 #include <glib.h>
 
 #include "mkt-utils.h"
@@ -59,6 +60,55 @@ test_utils_main_thread (void)
   g_thread_join (thread);
 }
 
+static void
+test_utils_session_pids (void)
+{
+  g_autoptr(GArray) pids = NULL;
+  gboolean found = FALSE;
+  GPid session;
+
+  session = getsid (0);
+  pids = mkt_utils_get_session_pids (session);
+
+  for (guint i = 0; i < pids->len; i++)
+    if (g_array_index (pids, GPid, i) == getpid ())
+      found = TRUE;
+
+  g_assert_true (found);
+
+  /* The session leader comes first */
+  if (getsid (session) == session)
+    g_assert_cmpint (g_array_index (pids, GPid, 0), ==, session);
+}
+
+static void
+test_utils_hud (void)
+{
+  g_autofree char *label = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  label = mkt_utils_format_terminal_hud (250, 12500, 1024, 60, 30.4, 2, 1);
+  lines = g_strsplit (label, "\n", -1);
+  g_assert_cmpuint (g_strv_length (lines), ==, 4);
+  g_assert_cmpstr (lines[0], ==, "latency  p50 ≤250µs  p99 ≤12.5ms");
+  g_assert_cmpstr (lines[1], ==, "pty in   1024 B/s");
+  g_assert_cmpstr (lines[2], ==, "output   60 updates/s");
+  g_assert_cmpstr (lines[3], ==, "repeat   30/s  dropped 2  limited 1");
+  g_clear_pointer (&label, g_free);
+  g_clear_pointer (&lines, g_strfreev);
+
+  /* No key was typed */
+  label = mkt_utils_format_terminal_hud (0, 0, 0, 0, 0, 0, 0);
+  g_assert_true (g_str_has_prefix (label, "latency  p50 –  p99 –\n"));
+  g_clear_pointer (&label, g_free);
+
+  label = mkt_utils_format_window_hud (59.6, 4.126, 16);
+  lines = g_strsplit (label, "\n", -1);
+  g_assert_cmpuint (g_strv_length (lines), ==, 2);
+  g_assert_cmpstr (lines[0], ==, "frames  60/s");
+  g_assert_cmpstr (lines[1], ==, "frame   avg 4.13ms  max 16.00ms");
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -66,6 +116,8 @@ main (int   argc,
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/utils/main_thread", test_utils_main_thread);
+  g_test_add_func ("/utils/session_pids", test_utils_session_pids);
+  g_test_add_func ("/utils/hud", test_utils_hud);
 
   return g_test_run ();
 }